@@ -0,0 +1,1109 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+// Loads the whole plugin into a fake Orthanc core (configuration, memory buffers, key-value stores,
+// queues, DICOM instances) and drives the storage callbacks with synthetic DICOM instances, exactly
+// as Orthanc does when ingesting/retrieving/deleting in parallel.  This covers the PathGenerator,
+// the CustomData, the I/O engine, the FoldersIndexer and the DelayedFilesDeleter without a running
+// Orthanc, e.g. to compare releases.  Run it on the file system of the storage area.  The number of
+// heap allocations per operation is reported as well, for the log level of the plugins that the fake
+// core reports ("default" unless --log-level is given, the logs are only printed with --verbose).
+// Usage: AdvancedStorageBenchmark [-n instances-per-thread] [-s size1,size2,...] [-t threads1,threads2,...]
+//                                 [--naming-scheme scheme] [--fsync] [--sync-mode mode] [--io-engine engine]
+//                                 [--write-cache-policy policy] [--delayed-deletion] [--indexer files]
+//                                 [--log-level level] [--verbose] directory
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/atomic.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+extern "C"
+{
+  int32_t OrthancPluginInitialize(OrthancPluginContext* context);
+  void OrthancPluginFinalize();
+}
+
+
+static const char* const DEFAULT_NAMING_SCHEME = "{split(StudyDate)}/{PatientID} - {PatientName}/{StudyInstanceUID} - {StudyDescription}/"
+  "{SeriesInstanceUID} - {pad4(SeriesNumber)}/{pad6(InstanceNumber)} - {SOPInstanceUID} - {UUID}{.ext}";
+
+static const char* const QUEUE_DELAYED_DELETION = "advst-delayed-deletion";
+static const char* const UID_ROOT = "1.2.826.0.1.3680043.8.498.1";
+
+
+// All the heap allocations of the process (the plugin is linked into the benchmark)
+static boost::atomic<uint64_t> allocations_(0);
+
+void* operator new(size_t size)
+{
+  allocations_.fetch_add(1, boost::memory_order_relaxed);
+
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == NULL)
+  {
+    throw std::bad_alloc();
+  }
+
+  return p;
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+  free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+  free(p);
+}
+
+
+namespace
+{
+  // What the fake core hands over to the plugin as an OrthancPluginDicomInstance
+  struct SyntheticInstance
+  {
+    std::string  dicom_;
+    Json::Value  simplifiedTags_;
+    size_t       sopInstanceUidOffsets_[2];  // in the meta header and in the dataset
+    size_t       instanceNumberOffset_;
+  };
+
+
+  class FakeOrthancCore : public boost::noncopyable
+  {
+  private:
+    struct QueueContent
+    {
+      std::deque<std::pair<uint64_t, std::string> >  available_;
+      std::map<uint64_t, std::string>                 reserved_;  // released only by an acknowledgement
+    };
+
+    struct Iterator
+    {
+      std::vector<std::pair<std::string, std::string> >  items_;
+      size_t                                              next_;
+      size_t                                              current_;
+    };
+
+    typedef std::map<std::string, std::string>  KeyValueStore;
+
+    boost::mutex                          mutex_;
+    std::string                           configuration_;
+    std::string                           logLevel_;
+    bool                                  verbose_;
+    std::map<std::string, KeyValueStore>  stores_;
+    std::map<std::string, QueueContent>   queues_;
+    uint64_t                              nextValueId_;
+    unsigned int                          adoptedInstances_;
+    unsigned int                          completedIterations_;
+    std::set<int>                         unsupportedServices_;
+
+  public:
+    OrthancPluginStorageCreate2      create_;
+    OrthancPluginStorageReadRange2   readRange_;
+    OrthancPluginStorageRemove2      remove_;
+    OrthancPluginOnChangeCallback    onChange_;
+
+    FakeOrthancCore(const Json::Value& configuration,
+                    const std::string& logLevel,
+                    bool verbose) :
+      logLevel_(logLevel),
+      verbose_(verbose),
+      nextValueId_(1),
+      adoptedInstances_(0),
+      completedIterations_(0),
+      create_(NULL),
+      readRange_(NULL),
+      remove_(NULL),
+      onChange_(NULL)
+    {
+      OrthancPlugins::WriteFastJson(configuration_, configuration);
+    }
+
+    unsigned int GetAdoptedInstances()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return adoptedInstances_;
+    }
+
+    // Each scan of the FoldersIndexer ends by browsing its key-value store
+    unsigned int GetCompletedIterations()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return completedIterations_;
+    }
+
+    uint64_t GetQueueSize(const std::string& queueId)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      const QueueContent& queue = queues_[queueId];
+      return queue.available_.size() + queue.reserved_.size();
+    }
+
+    std::set<int> GetUnsupportedServices()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return unsupportedServices_;
+    }
+
+    OrthancPluginErrorCode Invoke(_OrthancPluginService service,
+                                  const void* params);
+  };
+}
+
+
+static OrthancPluginErrorCode CopyToBuffer(OrthancPluginMemoryBuffer* target,
+                                           const void* data,
+                                           size_t size)
+{
+  target->size = static_cast<uint32_t>(size);
+  target->data = (size == 0 ? NULL : malloc(size));
+
+  if (size != 0 && target->data == NULL)
+  {
+    return OrthancPluginErrorCode_NotEnoughMemory;
+  }
+
+  if (size != 0)
+  {
+    memcpy(target->data, data, size);
+  }
+
+  return OrthancPluginErrorCode_Success;
+}
+
+
+static OrthancPluginErrorCode CopyToBuffer(OrthancPluginMemoryBuffer* target,
+                                           const std::string& value)
+{
+  return CopyToBuffer(target, value.data(), value.size());
+}
+
+
+OrthancPluginErrorCode FakeOrthancCore::Invoke(_OrthancPluginService service,
+                                               const void* params)
+{
+  switch (service)
+  {
+    case _OrthancPluginService_LogInfo:
+    case _OrthancPluginService_LogWarning:
+    case _OrthancPluginService_LogError:
+      if (verbose_ || service == _OrthancPluginService_LogError)
+      {
+        fprintf(stderr, "%s\n", reinterpret_cast<const char*>(params));
+      }
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_LogMessage:
+    {
+      const _OrthancPluginLogMessage& p = *reinterpret_cast<const _OrthancPluginLogMessage*>(params);
+      if (verbose_ || p.level == OrthancPluginLogLevel_Error)
+      {
+        fprintf(stderr, "%s\n", p.message);
+      }
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_GetConfiguration:
+    {
+      const _OrthancPluginRetrieveDynamicString& p = *reinterpret_cast<const _OrthancPluginRetrieveDynamicString*>(params);
+      *p.result = strdup(configuration_.c_str());
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_CreateMemoryBuffer:
+    {
+      const _OrthancPluginCreateMemoryBuffer& p = *reinterpret_cast<const _OrthancPluginCreateMemoryBuffer*>(params);
+      p.target->size = p.size;
+      p.target->data = (p.size == 0 ? NULL : malloc(p.size));
+      return (p.size != 0 && p.target->data == NULL ? OrthancPluginErrorCode_NotEnoughMemory : OrthancPluginErrorCode_Success);
+    }
+
+    case _OrthancPluginService_CreateMemoryBuffer64:
+    {
+      const _OrthancPluginCreateMemoryBuffer64& p = *reinterpret_cast<const _OrthancPluginCreateMemoryBuffer64*>(params);
+      p.target->size = p.size;
+      p.target->data = (p.size == 0 ? NULL : malloc(p.size));
+      return (p.size != 0 && p.target->data == NULL ? OrthancPluginErrorCode_NotEnoughMemory : OrthancPluginErrorCode_Success);
+    }
+
+    case _OrthancPluginService_SetCurrentThreadName:
+    case _OrthancPluginService_RegisterRestCallback:
+    case _OrthancPluginService_RegisterRestCallbackNoLock:
+    case _OrthancPluginService_RestApiDelete:
+    case _OrthancPluginService_RestApiDeleteAfterPlugins:
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_RegisterStorageArea3:
+    {
+      const _OrthancPluginRegisterStorageArea3& p = *reinterpret_cast<const _OrthancPluginRegisterStorageArea3*>(params);
+      create_ = p.create;
+      readRange_ = p.readRange;
+      remove_ = p.remove;
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_RegisterOnChangeCallback:
+      onChange_ = reinterpret_cast<const _OrthancPluginOnChangeCallback*>(params)->callback;
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_RestApiGet:
+    case _OrthancPluginService_RestApiGetAfterPlugins:
+    {
+      const _OrthancPluginRestApiGet& p = *reinterpret_cast<const _OrthancPluginRestApiGet*>(params);
+      if (std::string(p.uri) == "/system")
+      {
+        Json::Value system;
+        system["Capabilities"]["HasKeyValueStores"] = true;
+        system["Capabilities"]["HasQueues"] = true;
+
+        std::string s;
+        OrthancPlugins::WriteFastJson(s, system);
+        return CopyToBuffer(p.target, s);
+      }
+      else if (std::string(p.uri) == "/tools/log-level-plugins")
+      {
+        return CopyToBuffer(p.target, logLevel_);
+      }
+      else
+      {
+        return OrthancPluginErrorCode_UnknownResource;
+      }
+    }
+
+    case _OrthancPluginService_GetInstanceSize:
+    {
+      const _OrthancPluginAccessDicomInstance& p = *reinterpret_cast<const _OrthancPluginAccessDicomInstance*>(params);
+      *p.resultInt64 = reinterpret_cast<const SyntheticInstance*>(p.instance)->dicom_.size();
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_GetInstanceData:
+    {
+      const _OrthancPluginAccessDicomInstance& p = *reinterpret_cast<const _OrthancPluginAccessDicomInstance*>(params);
+      *p.resultString = reinterpret_cast<const SyntheticInstance*>(p.instance)->dicom_.data();
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_GetInstanceSimplifiedJson:
+    {
+      const _OrthancPluginAccessDicomInstance& p = *reinterpret_cast<const _OrthancPluginAccessDicomInstance*>(params);
+
+      std::string s;
+      OrthancPlugins::WriteFastJson(s, reinterpret_cast<const SyntheticInstance*>(p.instance)->simplifiedTags_);
+      *p.resultStringToFree = strdup(s.c_str());
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_AdoptDicomInstance:
+    {
+      // The fake core does not parse the file: every file is considered as a new DICOM instance
+      const _OrthancPluginAdoptDicomInstance& p = *reinterpret_cast<const _OrthancPluginAdoptDicomInstance*>(params);
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        adoptedInstances_++;
+      }
+
+      *p.storeStatus = OrthancPluginStoreStatus_Success;
+
+      OrthancPluginErrorCode code = CopyToBuffer(p.instanceId, Orthanc::Toolbox::GenerateUuid());
+      if (code == OrthancPluginErrorCode_Success)
+      {
+        code = CopyToBuffer(p.attachmentUuid, Orthanc::Toolbox::GenerateUuid());
+      }
+
+      return code;
+    }
+
+    case _OrthancPluginService_StoreKeyValue:
+    {
+      const _OrthancPluginStoreKeyValue& p = *reinterpret_cast<const _OrthancPluginStoreKeyValue*>(params);
+      boost::mutex::scoped_lock lock(mutex_);
+      stores_[p.storeId][p.key].assign(reinterpret_cast<const char*>(p.value), p.valueSize);
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_DeleteKeyValue:
+    {
+      const _OrthancPluginDeleteKeyValue& p = *reinterpret_cast<const _OrthancPluginDeleteKeyValue*>(params);
+      boost::mutex::scoped_lock lock(mutex_);
+      stores_[p.storeId].erase(p.key);
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_GetKeyValue:
+    {
+      const _OrthancPluginGetKeyValue& p = *reinterpret_cast<const _OrthancPluginGetKeyValue*>(params);
+      boost::mutex::scoped_lock lock(mutex_);
+
+      const KeyValueStore& store = stores_[p.storeId];
+      KeyValueStore::const_iterator found = store.find(p.key);
+
+      if (found == store.end())
+      {
+        *p.found = false;
+        return OrthancPluginErrorCode_Success;
+      }
+      else
+      {
+        *p.found = true;
+        return CopyToBuffer(p.target, found->second);
+      }
+    }
+
+    case _OrthancPluginService_CreateKeysValuesIterator:
+    {
+      const _OrthancPluginCreateKeysValuesIterator& p = *reinterpret_cast<const _OrthancPluginCreateKeysValuesIterator*>(params);
+
+      Iterator* iterator = new Iterator;
+      iterator->next_ = 0;
+      iterator->current_ = 0;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        const KeyValueStore& store = stores_[p.storeId];
+        iterator->items_.assign(store.begin(), store.end());
+      }
+
+      *p.target = reinterpret_cast<OrthancPluginKeysValuesIterator*>(iterator);
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_FreeKeysValuesIterator:
+    {
+      delete reinterpret_cast<Iterator*>(reinterpret_cast<const _OrthancPluginFreeKeysValuesIterator*>(params)->iterator);
+
+      boost::mutex::scoped_lock lock(mutex_);
+      completedIterations_++;
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_KeysValuesIteratorNext:
+    {
+      const _OrthancPluginKeysValuesIteratorNext& p = *reinterpret_cast<const _OrthancPluginKeysValuesIteratorNext*>(params);
+      Iterator& iterator = *reinterpret_cast<Iterator*>(p.iterator);
+
+      // "done" is set if the iterator points to a new item
+      if (iterator.next_ < iterator.items_.size())
+      {
+        iterator.current_ = iterator.next_++;
+        *p.done = true;
+      }
+      else
+      {
+        *p.done = false;
+      }
+
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_KeysValuesIteratorGetKey:
+    {
+      const _OrthancPluginKeysValuesIteratorGetKey& p = *reinterpret_cast<const _OrthancPluginKeysValuesIteratorGetKey*>(params);
+      const Iterator& iterator = *reinterpret_cast<const Iterator*>(p.iterator);
+      *p.target = iterator.items_[iterator.current_].first.c_str();
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_KeysValuesIteratorGetValue:
+    {
+      const _OrthancPluginKeysValuesIteratorGetValue& p = *reinterpret_cast<const _OrthancPluginKeysValuesIteratorGetValue*>(params);
+      const Iterator& iterator = *reinterpret_cast<const Iterator*>(p.iterator);
+      return CopyToBuffer(p.target, iterator.items_[iterator.current_].second);
+    }
+
+    case _OrthancPluginService_EnqueueValue:
+    {
+      const _OrthancPluginEnqueueValue& p = *reinterpret_cast<const _OrthancPluginEnqueueValue*>(params);
+      boost::mutex::scoped_lock lock(mutex_);
+      queues_[p.queueId].available_.push_back(std::make_pair(nextValueId_++, std::string(reinterpret_cast<const char*>(p.value), p.valueSize)));
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_GetQueueSize:
+    {
+      const _OrthancPluginGetQueueSize& p = *reinterpret_cast<const _OrthancPluginGetQueueSize*>(params);
+      boost::mutex::scoped_lock lock(mutex_);
+      const QueueContent& queue = queues_[p.queueId];
+      *p.size = queue.available_.size() + queue.reserved_.size();
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_DequeueValue:
+    case _OrthancPluginService_ReserveQueueValue:
+    {
+      const bool reserve = (service == _OrthancPluginService_ReserveQueueValue);
+
+      uint8_t* found;
+      OrthancPluginMemoryBuffer* target;
+      const char* queueId;
+      OrthancPluginQueueOrigin origin;
+      uint64_t* valueId = NULL;
+
+      if (reserve)
+      {
+        const _OrthancPluginReserveQueueValue& p = *reinterpret_cast<const _OrthancPluginReserveQueueValue*>(params);
+        found = p.found;
+        target = p.target;
+        queueId = p.queueId;
+        origin = p.origin;
+        valueId = p.valueId;
+      }
+      else
+      {
+        const _OrthancPluginDequeueValue& p = *reinterpret_cast<const _OrthancPluginDequeueValue*>(params);
+        found = p.found;
+        target = p.target;
+        queueId = p.queueId;
+        origin = p.origin;
+      }
+
+      boost::mutex::scoped_lock lock(mutex_);
+      QueueContent& queue = queues_[queueId];
+
+      if (queue.available_.empty())
+      {
+        *found = false;
+        return OrthancPluginErrorCode_Success;
+      }
+
+      std::pair<uint64_t, std::string> value;
+      if (origin == OrthancPluginQueueOrigin_Front)
+      {
+        value = queue.available_.front();
+        queue.available_.pop_front();
+      }
+      else
+      {
+        value = queue.available_.back();
+        queue.available_.pop_back();
+      }
+
+      if (reserve)
+      {
+        queue.reserved_[value.first] = value.second;
+        *valueId = value.first;
+      }
+
+      *found = true;
+      return CopyToBuffer(target, value.second);
+    }
+
+    case _OrthancPluginService_AcknowledgeQueueValue:
+    {
+      const _OrthancPluginAcknowledgeQueueValue& p = *reinterpret_cast<const _OrthancPluginAcknowledgeQueueValue*>(params);
+      boost::mutex::scoped_lock lock(mutex_);
+      queues_[p.queueId].reserved_.erase(p.valueId);
+      return OrthancPluginErrorCode_Success;
+    }
+
+    default:
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      unsupportedServices_.insert(static_cast<int>(service));
+      return OrthancPluginErrorCode_NotImplemented;
+    }
+  }
+}
+
+
+static OrthancPluginErrorCode InvokeService(OrthancPluginContext* context,
+                                            _OrthancPluginService service,
+                                            const void* params)
+{
+  return reinterpret_cast<FakeOrthancCore*>(context->pluginsManager)->Invoke(service, params);
+}
+
+
+static void AppendUInt16(std::string& target, uint16_t value)
+{
+  target.push_back(static_cast<char>(value & 0xff));
+  target.push_back(static_cast<char>(value >> 8));
+}
+
+
+static void AppendUInt32(std::string& target, uint32_t value)
+{
+  AppendUInt16(target, static_cast<uint16_t>(value & 0xffff));
+  AppendUInt16(target, static_cast<uint16_t>(value >> 16));
+}
+
+
+// Appends an element in explicit VR little endian and returns the offset of its value
+static size_t AppendElement(std::string& target,
+                            uint16_t group,
+                            uint16_t element,
+                            const char* vr,
+                            const std::string& value)
+{
+  std::string padded = value;
+  if (padded.size() % 2 == 1)
+  {
+    padded.push_back(strcmp(vr, "UI") == 0 || strcmp(vr, "OB") == 0 ? '\0' : ' ');
+  }
+
+  AppendUInt16(target, group);
+  AppendUInt16(target, element);
+  target.append(vr, 2);
+
+  if (strcmp(vr, "OB") == 0)
+  {
+    AppendUInt16(target, 0);
+    AppendUInt32(target, static_cast<uint32_t>(padded.size()));
+  }
+  else
+  {
+    AppendUInt16(target, static_cast<uint16_t>(padded.size()));
+  }
+
+  const size_t offset = target.size();
+  target.append(padded);
+  return offset;
+}
+
+
+static std::string FormatSopInstanceUid(unsigned int series, unsigned int index)
+{
+  // fixed-length UIDs so that they can be patched in place
+  char buffer[64];
+  sprintf(buffer, "%s.%04u.%08u", UID_ROOT, 1000 + series, 10000000 + index);
+  return buffer;
+}
+
+
+static std::string FormatInstanceNumber(unsigned int index)
+{
+  char buffer[16];
+  sprintf(buffer, "%08u", index + 1);
+  return buffer;
+}
+
+
+// A CT-like Part 10 file of (about) the requested size, one study/series per series number
+static void CreateSyntheticInstance(SyntheticInstance& target,
+                                    unsigned int series,
+                                    size_t size)
+{
+  const std::string sopClassUid = "1.2.840.10008.5.1.4.1.1.2";
+  const std::string sopInstanceUid = FormatSopInstanceUid(series, 0);
+  const std::string seriesNumber = boost::lexical_cast<std::string>(series + 1);
+
+  Json::Value& tags = target.simplifiedTags_;
+  tags = Json::objectValue;
+  tags["StudyDate"] = "20260101";
+  tags["Modality"] = "CT";
+  tags["StudyDescription"] = "Benchmark";
+  tags["SeriesDescription"] = "Series " + seriesNumber;
+  tags["PatientName"] = "BENCHMARK^PATIENT" + seriesNumber;
+  tags["PatientID"] = "BENCHMARK-" + seriesNumber;
+  tags["StudyInstanceUID"] = std::string(UID_ROOT) + "." + seriesNumber + ".1";
+  tags["SeriesInstanceUID"] = std::string(UID_ROOT) + "." + seriesNumber + ".2";
+  tags["SeriesNumber"] = seriesNumber;
+
+  std::string meta;
+  AppendElement(meta, 0x0002, 0x0001, "OB", std::string("\0\1", 2));
+  AppendElement(meta, 0x0002, 0x0002, "UI", sopClassUid);
+  const size_t metaSopInstanceUid = AppendElement(meta, 0x0002, 0x0003, "UI", sopInstanceUid);
+  AppendElement(meta, 0x0002, 0x0010, "UI", "1.2.840.10008.1.2.1");
+
+  std::string& dicom = target.dicom_;
+  dicom.assign(128, '\0');
+  dicom.append("DICM");
+
+  AppendUInt16(dicom, 0x0002);
+  AppendUInt16(dicom, 0x0000);
+  dicom.append("UL");
+  AppendUInt16(dicom, 4);
+  AppendUInt32(dicom, static_cast<uint32_t>(meta.size()));
+
+  target.sopInstanceUidOffsets_[0] = dicom.size() + metaSopInstanceUid;
+  dicom.append(meta);
+
+  AppendElement(dicom, 0x0008, 0x0016, "UI", sopClassUid);
+  target.sopInstanceUidOffsets_[1] = AppendElement(dicom, 0x0008, 0x0018, "UI", sopInstanceUid);
+  AppendElement(dicom, 0x0008, 0x0020, "DA", tags["StudyDate"].asString());
+  AppendElement(dicom, 0x0008, 0x0060, "CS", tags["Modality"].asString());
+  AppendElement(dicom, 0x0008, 0x1030, "LO", tags["StudyDescription"].asString());
+  AppendElement(dicom, 0x0008, 0x103e, "LO", tags["SeriesDescription"].asString());
+  AppendElement(dicom, 0x0010, 0x0010, "PN", tags["PatientName"].asString());
+  AppendElement(dicom, 0x0010, 0x0020, "LO", tags["PatientID"].asString());
+  AppendElement(dicom, 0x0020, 0x000d, "UI", tags["StudyInstanceUID"].asString());
+  AppendElement(dicom, 0x0020, 0x000e, "UI", tags["SeriesInstanceUID"].asString());
+  AppendElement(dicom, 0x0020, 0x0011, "IS", seriesNumber);
+  target.instanceNumberOffset_ = AppendElement(dicom, 0x0020, 0x0013, "IS", FormatInstanceNumber(0));
+
+  // the pixel data fills the file up to the requested size
+  const size_t header = dicom.size() + 12;
+  std::string pixelData((size > header ? (size - header) & ~static_cast<size_t>(1) : 0), '\0');
+  for (size_t i = 0; i < pixelData.size(); i++)
+  {
+    pixelData[i] = static_cast<char>(i * 7);
+  }
+
+  AppendElement(dicom, 0x7fe0, 0x0010, "OB", pixelData);
+}
+
+
+static void SetInstanceIndex(SyntheticInstance& instance,
+                             unsigned int series,
+                             unsigned int index)
+{
+  const std::string sopInstanceUid = FormatSopInstanceUid(series, index);
+  const std::string instanceNumber = FormatInstanceNumber(index);
+
+  instance.dicom_.replace(instance.sopInstanceUidOffsets_[0], sopInstanceUid.size(), sopInstanceUid);
+  instance.dicom_.replace(instance.sopInstanceUidOffsets_[1], sopInstanceUid.size(), sopInstanceUid);
+  instance.dicom_.replace(instance.instanceNumberOffset_, instanceNumber.size(), instanceNumber);
+
+  instance.simplifiedTags_["SOPInstanceUID"] = sopInstanceUid;
+  instance.simplifiedTags_["InstanceNumber"] = instanceNumber;
+}
+
+
+namespace
+{
+  enum Operation
+  {
+    Operation_Create,
+    Operation_Read,
+    Operation_Remove
+  };
+
+  struct Attachment
+  {
+    std::string  uuid_;
+    std::string  customData_;
+  };
+
+  struct Thread
+  {
+    SyntheticInstance        instance_;
+    std::vector<Attachment>  attachments_;
+    std::vector<double>      latenciesUs_;
+    unsigned int             errors_;
+  };
+}
+
+
+static double GetElapsedSeconds(const boost::posix_time::ptime& start)
+{
+  return static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000000.0;
+}
+
+
+static void Worker(FakeOrthancCore* core,
+                   Operation operation,
+                   unsigned int series,
+                   Thread* thread)
+{
+  std::string readBuffer(operation == Operation_Read ? thread->instance_.dicom_.size() : 0, '\0');
+
+  thread->errors_ = 0;
+
+  for (size_t i = 0; i < thread->attachments_.size(); i++)
+  {
+    Attachment& attachment = thread->attachments_[i];
+    OrthancPluginErrorCode code = OrthancPluginErrorCode_Success;
+
+    if (operation == Operation_Create)
+    {
+      SetInstanceIndex(thread->instance_, series, static_cast<unsigned int>(i));
+      attachment.uuid_ = Orthanc::Toolbox::GenerateUuid();
+    }
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    switch (operation)
+    {
+      case Operation_Create:
+      {
+        OrthancPluginMemoryBuffer customData;
+        customData.data = NULL;
+        customData.size = 0;
+
+        code = core->create_(&customData, attachment.uuid_.c_str(), thread->instance_.dicom_.data(), thread->instance_.dicom_.size(),
+                             OrthancPluginContentType_Dicom, OrthancPluginCompressionType_None,
+                             reinterpret_cast<const OrthancPluginDicomInstance*>(&thread->instance_));
+
+        attachment.customData_.assign(reinterpret_cast<const char*>(customData.data), customData.size);
+        free(customData.data);
+        break;
+      }
+
+      case Operation_Read:
+      {
+        OrthancPluginMemoryBuffer64 target;
+        target.data = readBuffer.empty() ? NULL : &readBuffer[0];
+        target.size = readBuffer.size();
+
+        code = core->readRange_(&target, attachment.uuid_.c_str(), OrthancPluginContentType_Dicom, 0,
+                                attachment.customData_.data(), static_cast<uint32_t>(attachment.customData_.size()));
+        break;
+      }
+
+      case Operation_Remove:
+        code = core->remove_(attachment.uuid_.c_str(), OrthancPluginContentType_Dicom,
+                             attachment.customData_.data(), static_cast<uint32_t>(attachment.customData_.size()));
+        break;
+    }
+
+    thread->latenciesUs_[i] = static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds());
+
+    if (code != OrthancPluginErrorCode_Success)
+    {
+      thread->errors_++;
+    }
+  }
+}
+
+
+static double GetPercentile(const std::vector<double>& sorted,
+                            unsigned int permille)
+{
+  return sorted[std::min(sorted.size() - 1, sorted.size() * permille / 1000)];
+}
+
+
+static void Run(FakeOrthancCore& core,
+                std::vector<Thread>& threads,
+                Operation operation)
+{
+  const uint64_t allocations = allocations_.load();
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  boost::thread_group group;
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    group.create_thread(boost::bind(Worker, &core, operation, static_cast<unsigned int>(i), &threads[i]));
+  }
+
+  group.join_all();
+
+  const double elapsedS = GetElapsedSeconds(start);
+  const uint64_t allocationsCount = allocations_.load() - allocations;
+
+  std::vector<double> all;
+  unsigned int errors = 0;
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    all.insert(all.end(), threads[i].latenciesUs_.begin(), threads[i].latenciesUs_.end());
+    errors += threads[i].errors_;
+  }
+
+  std::sort(all.begin(), all.end());
+
+  const double megabytes = static_cast<double>(all.size()) * static_cast<double>(threads[0].instance_.dicom_.size()) / (1024.0 * 1024.0);
+
+  static const char* const NAMES[] = { "create", "read", "remove" };
+
+  printf("  %-7s %3lu threads: %9.0f ops/s %9.1f MB/s   p50: %9.1f us   p99: %9.1f us   p999: %9.1f us   max: %9.1f us   %6.1f allocs/op",
+         NAMES[operation], static_cast<unsigned long>(threads.size()), static_cast<double>(all.size()) / elapsedS,
+         (operation == Operation_Remove ? 0.0 : megabytes / elapsedS),
+         GetPercentile(all, 500), GetPercentile(all, 990), GetPercentile(all, 999), all.back(),
+         static_cast<double>(allocationsCount) / static_cast<double>(all.size()));
+
+  if (errors > 0)
+  {
+    printf("   (%u errors)", errors);
+  }
+
+  printf("\n");
+}
+
+
+static void WaitForDelayedDeletion(FakeOrthancCore& core)
+{
+  const uint64_t count = core.GetQueueSize(QUEUE_DELAYED_DELETION);
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  while (core.GetQueueSize(QUEUE_DELAYED_DELETION) > 0)
+  {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  const double elapsedS = GetElapsedSeconds(start);
+  printf("  delayed deletion: %lu files in %.2f s (%.0f files/s)\n",
+         static_cast<unsigned long>(count), elapsedS, static_cast<double>(count) / elapsedS);
+}
+
+
+static std::vector<size_t> ParseList(const std::string& value)
+{
+  std::vector<std::string> tokens;
+  boost::algorithm::split(tokens, value, boost::algorithm::is_any_of(","));
+
+  std::vector<size_t> result;
+  for (size_t i = 0; i < tokens.size(); i++)
+  {
+    result.push_back(boost::lexical_cast<size_t>(tokens[i]));
+  }
+
+  return result;
+}
+
+
+int main(int argc, char* argv[])
+{
+  unsigned int instancesPerThread = 200;
+  std::vector<size_t> sizes(1, 512 * 1024);  // a typical CT instance
+  std::vector<size_t> threadCounts;
+  threadCounts.push_back(1);
+  threadCounts.push_back(8);
+  threadCounts.push_back(64);
+  std::string namingScheme = DEFAULT_NAMING_SCHEME;
+  bool fsync = false;
+  std::string syncMode = "PerFile";
+  std::string ioEngine = "Default";
+  std::string writeCachePolicy = "Buffered";
+  bool delayedDeletion = false;
+  unsigned int indexedFiles = 0;
+  std::string logLevel = "default";
+  bool verbose = false;
+  std::string directory;
+
+  try
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      const std::string arg(argv[i]);
+      const bool hasValue = (i + 1 < argc);
+
+      if (arg == "-n" && hasValue)
+      {
+        instancesPerThread = boost::lexical_cast<unsigned int>(argv[++i]);
+      }
+      else if (arg == "-s" && hasValue)
+      {
+        sizes = ParseList(argv[++i]);
+      }
+      else if (arg == "-t" && hasValue)
+      {
+        threadCounts = ParseList(argv[++i]);
+      }
+      else if (arg == "--naming-scheme" && hasValue)
+      {
+        namingScheme = argv[++i];
+      }
+      else if (arg == "--fsync")
+      {
+        fsync = true;
+      }
+      else if (arg == "--sync-mode" && hasValue)
+      {
+        syncMode = argv[++i];
+      }
+      else if (arg == "--io-engine" && hasValue)
+      {
+        ioEngine = argv[++i];
+      }
+      else if (arg == "--write-cache-policy" && hasValue)
+      {
+        writeCachePolicy = argv[++i];
+      }
+      else if (arg == "--delayed-deletion")
+      {
+        delayedDeletion = true;
+      }
+      else if (arg == "--indexer" && hasValue)
+      {
+        indexedFiles = boost::lexical_cast<unsigned int>(argv[++i]);
+      }
+      else if (arg == "--log-level" && hasValue)
+      {
+        logLevel = argv[++i];
+      }
+      else if (arg == "--verbose")
+      {
+        verbose = true;
+      }
+      else
+      {
+        directory = arg;
+      }
+    }
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    directory.clear();
+  }
+
+  if (directory.empty() || instancesPerThread == 0 || sizes.empty() || threadCounts.empty())
+  {
+    std::cerr << "Usage: " << argv[0] << " [-n instances-per-thread] [-s size1,size2,...] [-t threads1,threads2,...]" << std::endl
+              << "         [--naming-scheme scheme] [--fsync] [--sync-mode PerFile|GroupCommit] [--io-engine Default|IoUring]" << std::endl
+              << "         [--write-cache-policy Buffered|DontNeed|Direct] [--delayed-deletion] [--indexer files]" << std::endl
+              << "         [--log-level default|verbose|trace] [--verbose] directory" << std::endl;
+    return -1;
+  }
+
+  try
+  {
+    const boost::filesystem::path root = boost::filesystem::path(directory) / "advanced-storage-benchmark";
+    const boost::filesystem::path storage = root / "storage";
+    const boost::filesystem::path indexed = root / "indexed";
+
+    boost::filesystem::remove_all(root);
+    boost::filesystem::create_directories(storage);
+
+    Json::Value configuration;
+    configuration["StorageDirectory"] = Orthanc::SystemToolbox::PathToUtf8(storage);
+    configuration["SyncStorageArea"] = fsync;
+
+    Json::Value& advancedStorage = configuration["AdvancedStorage"];
+    advancedStorage["Enable"] = true;
+    advancedStorage["NamingScheme"] = namingScheme;
+    advancedStorage["SyncMode"] = syncMode;
+    advancedStorage["IoEngine"] = ioEngine;
+    advancedStorage["WriteCachePolicy"] = writeCachePolicy;
+
+    if (delayedDeletion)
+    {
+      advancedStorage["DelayedDeletion"]["Enable"] = true;
+    }
+
+    if (indexedFiles > 0)
+    {
+      // a single scan: the next one would only start after the interval
+      advancedStorage["Indexer"]["Enable"] = true;
+      advancedStorage["Indexer"]["Folders"].append(Orthanc::SystemToolbox::PathToUtf8(indexed));
+      advancedStorage["Indexer"]["Interval"] = 3600;
+
+      SyntheticInstance instance;
+      CreateSyntheticInstance(instance, 0, sizes[0]);
+
+      for (unsigned int i = 0; i < indexedFiles; i++)
+      {
+        SetInstanceIndex(instance, 0, i);
+
+        const boost::filesystem::path path = indexed / boost::lexical_cast<std::string>(i % 100) / (boost::lexical_cast<std::string>(i) + ".dcm");
+        boost::filesystem::create_directories(path.parent_path());
+        Orthanc::SystemToolbox::WriteFile(instance.dicom_, path, false /* callFsync */);
+      }
+    }
+
+    // the plugin threads might outlive main(): the fake core is never deleted
+    FakeOrthancCore* core = new FakeOrthancCore(configuration, logLevel, verbose);
+
+    OrthancPluginContext context;
+    memset(&context, 0, sizeof(context));
+    context.pluginsManager = core;
+    context.orthancVersion = "mainline";
+    context.Free = free;
+    context.InvokeService = InvokeService;
+
+    if (OrthancPluginInitialize(&context) != 0 ||
+        core->create_ == NULL ||
+        core->onChange_ == NULL)
+    {
+      std::cerr << "The plugin could not be initialized, use --verbose to see its logs" << std::endl;
+      return -1;
+    }
+
+    printf("Naming scheme: %s\n", namingScheme.c_str());
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    core->onChange_(OrthancPluginChangeType_OrthancStarted, OrthancPluginResourceType_None, NULL);
+
+    printf("Log level of the plugins: %s\n", logLevel.c_str());
+
+    if (indexedFiles > 0)
+    {
+      while (core->GetCompletedIterations() == 0)
+      {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+      }
+
+      const double elapsedS = GetElapsedSeconds(start);
+      printf("Indexer: %u files adopted in %.2f s (%.0f files/s)\n", core->GetAdoptedInstances(), elapsedS,
+             static_cast<double>(core->GetAdoptedInstances()) / elapsedS);
+    }
+
+    for (size_t s = 0; s < sizes.size(); s++)
+    {
+      for (size_t t = 0; t < threadCounts.size(); t++)
+      {
+        std::vector<Thread> threads(threadCounts[t]);
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+          CreateSyntheticInstance(threads[i].instance_, static_cast<unsigned int>(i), sizes[s]);
+          threads[i].attachments_.resize(instancesPerThread);
+          threads[i].latenciesUs_.resize(instancesPerThread);
+        }
+
+        printf("%lu bytes per instance%s\n", static_cast<unsigned long>(threads[0].instance_.dicom_.size()), fsync ? ", fsync" : "");
+
+        Run(*core, threads, Operation_Create);
+        Run(*core, threads, Operation_Read);
+        Run(*core, threads, Operation_Remove);
+
+        if (delayedDeletion)
+        {
+          WaitForDelayedDeletion(*core);
+        }
+      }
+    }
+
+    const std::set<int> unsupported = core->GetUnsupportedServices();
+    for (std::set<int>::const_iterator it = unsupported.begin(); it != unsupported.end(); ++it)
+    {
+      std::cerr << "Warning: the plugin has called service " << *it << " that is not provided by the fake Orthanc core" << std::endl;
+    }
+
+    OrthancPluginFinalize();
+
+    boost::filesystem::remove_all(root);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    std::cerr << "Exception: " << e.What() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
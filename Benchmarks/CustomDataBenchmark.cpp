@@ -0,0 +1,175 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+// Compares the JSON (version 1) and the binary (version 2) formats of the
+// CustomData: number of bytes stored in the Orthanc database per
+// attachment, and time to decode them (full CustomData::FromString() and
+// decoding of the fields only).
+// Usage: CustomDataBenchmark [iterations]
+
+#include "../Plugin/CustomData.h"
+#include "../Plugin/PathGenerator.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <iostream>
+#include <stdio.h>
+
+
+static std::string GenerateUuid(unsigned int i)
+{
+  char uuid[64];
+  sprintf(uuid, "%08x-47bd8c3a-ff917804-d180cdbc-%08x", i * 2654435761u, i);
+  return uuid;
+}
+
+
+static boost::filesystem::path GenerateRelativePath(unsigned int i,
+                                                    const std::string& uuid)
+{
+  // what the default example of the NamingScheme generates
+  const std::string study = "1.2.840.113619.2.55.3." + boost::lexical_cast<std::string>(i / 100);
+  const std::string series = study + ".1." + boost::lexical_cast<std::string>(i / 10);
+
+  char instance[16];
+  sprintf(instance, "%06u", i % 1000);
+
+  return (boost::filesystem::path("2024") / "03" / "12" /
+          (study + " - PATIENT-" + boost::lexical_cast<std::string>(i / 1000)) /
+          series /
+          (std::string(instance) + " - " + uuid + ".dcm"));
+}
+
+
+static void Run(OrthancPlugins::CustomDataFormat format,
+                const char* name,
+                const std::vector<std::string>& uuids,
+                const std::vector<OrthancPlugins::CustomData>& customData,
+                unsigned int iterations)
+{
+  OrthancPlugins::CustomData::SetSerializationFormat(format);
+
+  std::vector<std::string> serialized(customData.size());
+  uint64_t totalBytes = 0;
+
+  for (size_t i = 0; i < customData.size(); i++)
+  {
+    customData[i].ToString(serialized[i]);
+    totalBytes += serialized[i].size();
+
+    // sanity check: the round trip must restore the same attachment
+    OrthancPlugins::CustomData decoded = OrthancPlugins::CustomData::FromString(uuids[i], serialized[i].c_str(), serialized[i].size());
+    if (decoded.GetAbsolutePath() != customData[i].GetAbsolutePath() ||
+        decoded.IsOwner() != customData[i].IsOwner() ||
+        decoded.GetStorageId() != customData[i].GetStorageId())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, std::string("Round trip mismatch for ") + uuids[i]);
+    }
+  }
+
+  size_t checksum = 0;
+
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+  for (unsigned int i = 0; i < iterations; i++)
+  {
+    const size_t k = i % serialized.size();
+    checksum += OrthancPlugins::CustomData::FromString(uuids[k], serialized[k].c_str(), serialized[k].size()).GetStorageId().size();
+  }
+  boost::posix_time::ptime middle = boost::posix_time::microsec_clock::universal_time();
+  for (unsigned int i = 0; i < iterations; i++)
+  {
+    // decoding of the fields only, without building the CustomData
+    const size_t k = i % serialized.size();
+    OrthancPlugins::SerializedCustomData binary;
+    if (binary.Decode(serialized[k].c_str(), serialized[k].size()))
+    {
+      checksum += binary.pathSize_;
+    }
+    else
+    {
+      Json::Value v;
+      OrthancPlugins::ReadJson(v, serialized[k].c_str(), serialized[k].size());
+      checksum += v["p"].asString().size();
+    }
+  }
+  boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+
+  const double fromStringNs = static_cast<double>((middle - start).total_microseconds()) * 1000.0 / iterations;
+  const double decodeNs = static_cast<double>((end - middle).total_microseconds()) * 1000.0 / iterations;
+
+  printf("%-8s %8.1f bytes/attachment   FromString: %8.1f ns   decode: %8.1f ns   (checksum %lu)\n",
+         name, static_cast<double>(totalBytes) / customData.size(), fromStringNs, decodeNs,
+         static_cast<unsigned long>(checksum));
+}
+
+
+int main(int argc, char* argv[])
+{
+  unsigned int iterations = 1000000;
+  if (argc >= 2)
+  {
+    iterations = boost::lexical_cast<unsigned int>(argv[1]);
+  }
+
+  try
+  {
+    OrthancPlugins::PathGenerator::SetNamingScheme("{split(StudyDate)}/{StudyInstanceUID} - {PatientID}/{SeriesInstanceUID}/{pad6(InstanceNumber)} - {UUID}{.ext}", false);
+    OrthancPlugins::CustomData::SetOrthancCoreRootPath("/var/lib/orthanc/db");
+    OrthancPlugins::CustomData::SetStorageRootPath("1", "/mnt/storage-1", OrthancPlugins::WritePolicy());
+    OrthancPlugins::CustomData::SetStorageRootPath("2", "/mnt/storage-2", OrthancPlugins::WritePolicy());
+    OrthancPlugins::CustomData::SetCurrentWriteStorageId("2");
+    OrthancPlugins::CustomData::SetMaxPathLength(1024);
+
+    std::vector<std::string> uuids;
+    std::vector<OrthancPlugins::CustomData> customData;
+
+    for (unsigned int i = 0; i < 1000; i++)
+    {
+      const std::string uuid = GenerateUuid(i);
+      uuids.push_back(uuid);
+
+      if (i % 10 == 0)
+      {
+        // an adopted file
+        customData.push_back(OrthancPlugins::CustomData::CreateForAdoption("/mnt/import" / GenerateRelativePath(i, uuid), false));
+      }
+      else
+      {
+        customData.push_back(OrthancPlugins::CustomData::CreateForWriting(uuid, GenerateRelativePath(i, uuid)));
+      }
+    }
+
+    Run(OrthancPlugins::CustomDataFormat_Json, "Json", uuids, customData, iterations);
+    Run(OrthancPlugins::CustomDataFormat_Binary, "Binary", uuids, customData, iterations);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    std::cerr << "Exception: " << e.What() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,152 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+// Compares the cost of reading the tags used in the naming scheme with the DicomTagsExtractor
+// and with the simplified JSON generated by the Orthanc core, i.e. what
+// OrthancPluginGetInstanceSimplifiedJson() does on the instance that the core has already
+// parsed: a full JSON conversion of the dataset, then its simplification.  Use enhanced CT/MR
+// files (large multi-frame objects with deep functional groups sequences) to see the difference.
+// Usage: DicomTagsExtractorBenchmark [-n iterations] file1.dcm [file2.dcm ...]
+
+#include "../Plugin/DicomTagsExtractor.h"
+#include "../Plugin/PathGenerator.h"
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+#include <DicomParsing/FromDcmtkBridge.h>
+#include <DicomParsing/ParsedDicomFile.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <iostream>
+#include <stdio.h>
+
+
+static const char* const NAMING_SCHEME = "{split(StudyDate)}/{PatientID} - {PatientName}/{StudyInstanceUID} - {StudyDescription}/"
+  "{SeriesInstanceUID} - {pad4(SeriesNumber)}/{pad6(InstanceNumber)} - {SOPInstanceUID} - {UUID}{.ext}";
+
+
+// ORTHANC_MAXIMUM_TAG_LENGTH, the limit used by the Orthanc core to convert a dataset to JSON
+static const unsigned int MAXIMUM_TAG_LENGTH = 256;
+
+
+static void GetSimplifiedJson(Json::Value& target,
+                              Orthanc::ParsedDicomFile& parsed)
+{
+  Json::Value full;
+  parsed.DatasetToJson(full, Orthanc::DicomToJsonFormat_Full, Orthanc::DicomToJsonFlags_Default, MAXIMUM_TAG_LENGTH);
+  Orthanc::Toolbox::SimplifyDicomAsJson(target, full, Orthanc::DicomToJsonFormat_Human);
+}
+
+
+static double GetElapsedNanoseconds(const boost::posix_time::ptime& start, unsigned int iterations)
+{
+  return static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) * 1000.0 / iterations;
+}
+
+
+int main(int argc, char* argv[])
+{
+  unsigned int iterations = 100;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::string(argv[i]) == "-n" && i + 1 < argc)
+    {
+      iterations = boost::lexical_cast<unsigned int>(argv[++i]);
+    }
+    else
+    {
+      files.push_back(argv[i]);
+    }
+  }
+
+  if (files.empty())
+  {
+    std::cerr << "Usage: " << argv[0] << " [-n iterations] file1.dcm [file2.dcm ...]" << std::endl;
+    return -1;
+  }
+
+  try
+  {
+    Orthanc::FromDcmtkBridge::InitializeDictionary(false /* loadPrivateDictionary */);
+    OrthancPlugins::PathGenerator::SetNamingScheme(NAMING_SCHEME, false);
+
+    const char* uuid = "00f7fd8b-47bd8c3a-ff917804-d180cdbc-40cf9527";
+
+    for (size_t f = 0; f < files.size(); f++)
+    {
+      std::string dicom;
+      Orthanc::SystemToolbox::ReadFile(dicom, Orthanc::SystemToolbox::PathFromUtf8(files[f]));
+
+      // sanity check: both methods must generate the same path
+      OrthancPlugins::DicomTagsValues tags;
+      if (!OrthancPlugins::DicomTagsExtractor::ExtractTags(tags, dicom.data(), dicom.size(), OrthancPlugins::PathGenerator::GetReferencedTags()))
+      {
+        printf("%s: not supported by the DicomTagsExtractor, the plugin falls back to the simplified JSON\n", files[f].c_str());
+        continue;
+      }
+
+      // the core has already parsed the instance when the plugin requests its simplified JSON
+      Orthanc::ParsedDicomFile parsed(dicom.data(), dicom.size());
+
+      Json::Value simplifiedTags;
+      GetSimplifiedJson(simplifiedTags, parsed);
+
+      const boost::filesystem::path a = OrthancPlugins::PathGenerator::GetRelativePathFromTags(tags, uuid, OrthancPluginContentType_Dicom, false);
+      const boost::filesystem::path b = OrthancPlugins::PathGenerator::GetRelativePathFromTags(simplifiedTags, uuid, OrthancPluginContentType_Dicom, false);
+
+      if (a != b)
+      {
+        std::cerr << files[f] << ": mismatch: " << a.string() << " != " << b.string() << std::endl;
+        return -1;
+      }
+
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      for (unsigned int i = 0; i < iterations; i++)
+      {
+        Json::Value json;
+        GetSimplifiedJson(json, parsed);
+      }
+      const double jsonNs = GetElapsedNanoseconds(start, iterations);
+
+      start = boost::posix_time::microsec_clock::universal_time();
+      for (unsigned int i = 0; i < iterations; i++)
+      {
+        OrthancPlugins::DicomTagsExtractor::ExtractTags(tags, dicom.data(), dicom.size(), OrthancPlugins::PathGenerator::GetReferencedTags());
+      }
+      const double extractorNs = GetElapsedNanoseconds(start, iterations);
+
+      printf("%s (%lu bytes)\n  simplified JSON: %12.1f us/instance   extractor: %10.1f us/instance   speedup: x%.1f\n",
+             files[f].c_str(), static_cast<unsigned long>(dicom.size()), jsonNs / 1000.0, extractorNs / 1000.0, jsonNs / extractorNs);
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    std::cerr << "Exception: " << e.What() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,319 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+// Walks a synthetic tree of empty files (1M by default, split among several roots as in the
+// "Folders" of the Indexer, 100 files per folder as in a series) with an increasing number of
+// walker threads.  The tree is only generated once.  Run it on the file system to index (e.g.
+// a NAS mount) and with --drop-caches (as root) to measure the cold metadata accesses.  With
+// --skip-unchanged, the folders are recorded by the first walk (as in "SkipUnchangedFolders") and
+// the next walks only stat the folders.
+// Usage: DirectoryWalkerBenchmark [-n files] [-r roots] [-t threads,threads...] [-p max-threads-per-root] [--drop-caches] [--skip-unchanged] directory
+
+#include "../Plugin/DirectoryWalker.h"
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdio.h>
+
+#if defined(__linux__)
+#  include <unistd.h>
+#endif
+
+
+static const unsigned int FILES_PER_FOLDER = 100;
+static const unsigned int FOLDERS_PER_PARENT = 100;
+
+
+namespace
+{
+  // the modification time and the subfolders of the recorded folders
+  typedef std::map<boost::filesystem::path, std::pair<int64_t, std::vector<boost::filesystem::path> > >  FolderRecords;
+
+  class CountingVisitor : public OrthancPlugins::DirectoryWalker::IVisitor
+  {
+  private:
+    uint64_t        files_;
+    boost::mutex    mutex_;
+    FolderRecords&  records_;
+    uint64_t        skippedFolders_;
+
+  public:
+    explicit CountingVisitor(FolderRecords& records) :
+      files_(0),
+      records_(records),
+      skippedFolders_(0)
+    {
+    }
+
+    virtual bool IsCandidate(const boost::filesystem::path& /* path */) const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual void VisitFile(const OrthancPlugins::DirectoryWalker::FileEntry& /* file */) ORTHANC_OVERRIDE
+    {
+      files_++;
+    }
+
+    virtual bool LookupUnchangedFolder(std::vector<boost::filesystem::path>& subfolders,
+                                       const boost::filesystem::path& folder,
+                                       int64_t mtimeNs) ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      FolderRecords::const_iterator found = records_.find(folder);
+      if (found == records_.end() ||
+          found->second.first != mtimeNs)
+      {
+        return false;
+      }
+
+      subfolders = found->second.second;
+      skippedFolders_++;
+      return true;
+    }
+
+    virtual void VisitFolder(const boost::filesystem::path& folder,
+                             size_t /* root */,
+                             int64_t mtimeNs,
+                             const std::vector<boost::filesystem::path>& subfolders) ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      records_[folder] = std::make_pair(mtimeNs, subfolders);
+    }
+
+    uint64_t GetFilesCount() const
+    {
+      return files_;
+    }
+
+    uint64_t GetSkippedFoldersCount() const
+    {
+      return skippedFolders_;
+    }
+  };
+}
+
+
+static boost::filesystem::path GetRoot(const boost::filesystem::path& directory,
+                                       unsigned int root)
+{
+  return directory / ("root-" + boost::lexical_cast<std::string>(root));
+}
+
+
+static void GenerateTree(const boost::filesystem::path& directory,
+                         unsigned int filesCount,
+                         unsigned int rootsCount)
+{
+  const boost::filesystem::path marker = directory / ("complete-" + boost::lexical_cast<std::string>(filesCount) +
+                                                      "-" + boost::lexical_cast<std::string>(rootsCount));
+  if (boost::filesystem::exists(marker))
+  {
+    return;
+  }
+
+  std::cout << "Generating " << filesCount << " files in " << directory.string() << "..." << std::endl;
+
+  for (unsigned int i = 0; i < filesCount; i++)
+  {
+    const unsigned int folder = i / FILES_PER_FOLDER;
+    const boost::filesystem::path parent = (GetRoot(directory, folder % rootsCount) /
+                                            boost::lexical_cast<std::string>(folder / FOLDERS_PER_PARENT) /
+                                            boost::lexical_cast<std::string>(folder));
+
+    if (i % FILES_PER_FOLDER == 0)
+    {
+      boost::filesystem::create_directories(parent);
+    }
+
+    char name[32];
+    sprintf(name, "%06u.dcm", i % FILES_PER_FOLDER);
+    std::ofstream file((parent / name).string().c_str());
+  }
+
+  std::ofstream file(marker.string().c_str());
+}
+
+
+static void DropCaches()
+{
+#if defined(__linux__)
+  sync();
+
+  std::ofstream dropCaches("/proc/sys/vm/drop_caches");
+  dropCaches << "3" << std::endl;
+
+  if (!dropCaches.good())
+  {
+    std::cerr << "Cannot drop the caches (not root?), the results are for a warm cache" << std::endl;
+  }
+#else
+  std::cerr << "Cannot drop the caches on this platform, the results are for a warm cache" << std::endl;
+#endif
+}
+
+
+int main(int argc, char* argv[])
+{
+  unsigned int filesCount = 1000000;
+  unsigned int rootsCount = 4;
+  unsigned int maxThreadsPerRoot = 0;
+  std::vector<unsigned int> threadsCounts;
+  bool dropCaches = false;
+  bool skipUnchanged = false;
+  std::string directory;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg(argv[i]);
+
+    if (arg == "-n" && i + 1 < argc)
+    {
+      filesCount = boost::lexical_cast<unsigned int>(argv[++i]);
+    }
+    else if (arg == "-r" && i + 1 < argc)
+    {
+      rootsCount = boost::lexical_cast<unsigned int>(argv[++i]);
+    }
+    else if (arg == "-p" && i + 1 < argc)
+    {
+      maxThreadsPerRoot = boost::lexical_cast<unsigned int>(argv[++i]);
+    }
+    else if (arg == "-t" && i + 1 < argc)
+    {
+      std::vector<std::string> tokens;
+      const std::string value(argv[++i]);
+      boost::algorithm::split(tokens, value, boost::algorithm::is_any_of(","));
+
+      for (size_t j = 0; j < tokens.size(); j++)
+      {
+        threadsCounts.push_back(boost::lexical_cast<unsigned int>(tokens[j]));
+      }
+    }
+    else if (arg == "--drop-caches")
+    {
+      dropCaches = true;
+    }
+    else if (arg == "--skip-unchanged")
+    {
+      skipUnchanged = true;
+    }
+    else
+    {
+      directory = arg;
+    }
+  }
+
+  if (directory.empty() || filesCount == 0 || rootsCount == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [-n files] [-r roots] [-t threads,threads...] [-p max-threads-per-root] [--drop-caches] [--skip-unchanged] directory" << std::endl;
+    return -1;
+  }
+
+  if (threadsCounts.empty())
+  {
+    threadsCounts.push_back(1);
+    threadsCounts.push_back(2);
+    threadsCounts.push_back(4);
+    threadsCounts.push_back(8);
+    threadsCounts.push_back(16);
+    threadsCounts.push_back(32);
+  }
+
+  try
+  {
+    GenerateTree(directory, filesCount, rootsCount);
+
+    std::vector<boost::filesystem::path> roots;
+    for (unsigned int i = 0; i < rootsCount; i++)
+    {
+      roots.push_back(GetRoot(directory, i));
+    }
+
+    FolderRecords records;
+
+    if (skipUnchanged)
+    {
+      // the first walk records the folders
+      OrthancPlugins::DirectoryWalker walker(threadsCounts[threadsCounts.size() - 1], maxThreadsPerRoot);
+      walker.SetTrackFolders(true);
+      CountingVisitor visitor(records);
+      std::vector<bool> complete;
+      const volatile bool isRunning = true;
+      walker.Walk(complete, roots, visitor, isRunning);
+    }
+
+    for (size_t i = 0; i < threadsCounts.size(); i++)
+    {
+      if (dropCaches)
+      {
+        DropCaches();
+      }
+
+      OrthancPlugins::DirectoryWalker walker(threadsCounts[i], maxThreadsPerRoot);
+      walker.SetTrackFolders(skipUnchanged);
+      CountingVisitor visitor(records);
+      std::vector<bool> complete;
+      const volatile bool isRunning = true;
+
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      walker.Walk(complete, roots, visitor, isRunning);
+      boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+
+      const double seconds = static_cast<double>((end - start).total_microseconds()) / 1000000.0;
+
+      if (skipUnchanged)
+      {
+        printf("%3u threads: %10lu unchanged folders skipped in %8.3f s\n", threadsCounts[i],
+               static_cast<unsigned long>(visitor.GetSkippedFoldersCount()), seconds);
+      }
+      else
+      {
+        printf("%3u threads: %10lu files in %8.3f s   %12.0f files/s\n", threadsCounts[i],
+               static_cast<unsigned long>(visitor.GetFilesCount()), seconds,
+               static_cast<double>(visitor.GetFilesCount()) / seconds);
+      }
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    std::cerr << "Exception: " << e.What() << std::endl;
+    return -1;
+  }
+  catch (boost::filesystem::filesystem_error& e)
+  {
+    std::cerr << "Exception: " << e.what() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
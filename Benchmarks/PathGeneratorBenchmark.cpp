@@ -0,0 +1,320 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+// Compares the compiled naming scheme of the PathGenerator with the
+// former implementation (that re-parsed the naming scheme and ran all
+// the keywords replacements for each attachment).
+// Usage: PathGeneratorBenchmark [iterations]
+
+#include "../Plugin/PathGenerator.h"
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+#include <DicomFormat/DicomInstanceHasher.h>
+
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <iostream>
+#include <stdio.h>
+
+
+namespace Legacy
+{
+  // This is a verbatim copy of the implementation of PathGenerator::GetRelativePathFromTags() in 0.3.1
+
+  static std::string GetSplitDateDicomTagToPath(const Json::Value& tags, const char* tagName, const char* defaultValue = NULL)
+  {
+    if (tags.isMember(tagName) && tags[tagName].asString().size() == 8)
+    {
+      std::string date = tags[tagName].asString();
+      return date.substr(0, 4) + "/" + date.substr(4, 2) + "/" + date.substr(6, 2);
+    }
+    else if (defaultValue != NULL)
+    {
+      return defaultValue;
+    }
+
+    return "";
+  }
+
+  static std::string GetStringDicomTagForPath(const Json::Value& tags, const std::string& tagName, const char* defaultValue = NULL)
+  {
+    if (tags.isMember(tagName) && tags[tagName].isString() && tags[tagName].asString().size() > 0)
+    {
+      return tags[tagName].asString();
+    }
+    else if (defaultValue != NULL)
+    {
+      return defaultValue;
+    }
+
+    return "";
+  }
+
+  static std::string GetIntDicomTagForPath(const Json::Value& tags, const std::string& tagName, const char* defaultValue = NULL, size_t padding = 0)
+  {
+    if (tags.isMember(tagName))
+    {
+      std::string value;
+      if (tags[tagName].isInt())
+      {
+        value = boost::lexical_cast<std::string>(tags[tagName].asInt());
+      }
+      else if (tags[tagName].isString())
+      {
+        value = tags[tagName].asString();
+      }
+
+      if (padding > 0 && padding > value.size())
+      {
+        value = std::string(padding - value.size(), '0') + value;
+      }
+      return value;
+    }
+    else if (defaultValue != NULL)
+    {
+      return defaultValue;
+    }
+
+    return "";
+  }
+
+  static void ReplaceTagKeyword(std::string& folderName, const std::string& keyword, const Json::Value& tags, const char* defaultValue, const char* tagKey = NULL)
+  {
+    if (folderName.find(keyword) != std::string::npos)
+    {
+      std::string key = keyword.substr(1, keyword.size() -2);
+      if (tagKey != NULL)
+      {
+        key = tagKey;
+      }
+      boost::replace_all(folderName, keyword, GetStringDicomTagForPath(tags, key, defaultValue));
+    }
+  }
+
+  static void ReplaceIntTagKeyword(std::string& folderName, const std::string& keyword, const Json::Value& tags, const char* defaultValue, size_t padding, const char* tagKey = NULL)
+  {
+    if (folderName.find(keyword) != std::string::npos)
+    {
+      std::string key = keyword.substr(1, keyword.size() -2);
+      if (tagKey != NULL)
+      {
+        key = tagKey;
+      }
+      boost::replace_all(folderName, keyword, GetIntDicomTagForPath(tags, key, defaultValue, padding));
+    }
+  }
+
+  static void ReplaceOrthancID(std::string& folderName, const std::string& keyword, const std::string& id, size_t from, size_t length)
+  {
+    if (length == 0)
+    {
+      boost::replace_all(folderName, keyword, id);
+    }
+    else
+    {
+      boost::replace_all(folderName, keyword, id.substr(from, length));
+    }
+  }
+
+  static boost::filesystem::path GetRelativePathFromTags(const std::string& namingScheme, const Json::Value& tags, const char* uuid)
+  {
+    boost::filesystem::path path;
+
+    std::vector<std::string> folderNames;
+    Orthanc::Toolbox::SplitString(folderNames, namingScheme, '/');
+
+    for (std::vector<std::string>::const_iterator it = folderNames.begin(); it != folderNames.end(); ++it)
+    {
+      std::string folderName = *it;
+
+      if (folderName.find("{split(StudyDate)}") != std::string::npos)
+      {
+        boost::replace_all(folderName, "{split(StudyDate)}", GetSplitDateDicomTagToPath(tags, "StudyDate", "NO_STUDY_DATE"));
+      }
+
+      if (folderName.find("{split(PatientBirthDate)}") != std::string::npos)
+      {
+        boost::replace_all(folderName, "{split(PatientBirthDate)}", GetSplitDateDicomTagToPath(tags, "PatientBirthDate", "NO_PATIENT_BIRTH_DATE"));
+      }
+
+      ReplaceTagKeyword(folderName, "{PatientID}", tags, "NO_PATIENT_ID");
+      ReplaceTagKeyword(folderName, "{PatientBirthDate}", tags, "NO_PATIENT_BIRTH_DATE");
+      ReplaceTagKeyword(folderName, "{PatientName}", tags, "NO_PATIENT_NAME");
+      ReplaceTagKeyword(folderName, "{PatientSex}", tags, "NO_PATIENT_SEX");
+      ReplaceTagKeyword(folderName, "{StudyInstanceUID}", tags, "NO_STUDY_INSTANCE_UID");
+      ReplaceTagKeyword(folderName, "{StudyDate}", tags, "NO_STUDY_DATE");
+      ReplaceTagKeyword(folderName, "{StudyID}", tags, "NO_STUDY_ID");
+      ReplaceTagKeyword(folderName, "{StudyDescription}", tags, "NO_STUDY_DESCRIPTION");
+      ReplaceTagKeyword(folderName, "{AccessionNumber}", tags, "NO_ACCESSION_NUMBER");
+      ReplaceTagKeyword(folderName, "{SeriesInstanceUID}", tags, "NO_SERIES_INSTANCE_UID");
+      ReplaceTagKeyword(folderName, "{SeriesDate}", tags, "NO_SERIES_DATE");
+      ReplaceTagKeyword(folderName, "{SeriesDescription}", tags, "NO_SERIES_DESCRIPTION");
+      ReplaceTagKeyword(folderName, "{SOPInstanceUID}", tags, "NO_SOP_INSTANCE_UID");
+      ReplaceTagKeyword(folderName, "{InstitutionName}", tags, "NO_INSTITUTION_NAME");
+      ReplaceIntTagKeyword(folderName, "{SeriesNumber}", tags, "NO_SERIES_NUMBER", 0);
+      ReplaceIntTagKeyword(folderName, "{InstanceNumber}", tags, "NO_INSTANCE_NUMBER", 0);
+      ReplaceIntTagKeyword(folderName, "{pad4(SeriesNumber)}", tags, "NO_SERIES_NUMBER", 4, "SeriesNumber");
+      ReplaceIntTagKeyword(folderName, "{pad4(InstanceNumber)}", tags, "NO_INSTANCE_NUMBER", 4, "InstanceNumber");
+      ReplaceIntTagKeyword(folderName, "{pad6(SeriesNumber)}", tags, "NO_SERIES_NUMBER", 6, "SeriesNumber");
+      ReplaceIntTagKeyword(folderName, "{pad6(InstanceNumber)}", tags, "NO_INSTANCE_NUMBER", 6, "InstanceNumber");
+      ReplaceIntTagKeyword(folderName, "{pad8(SeriesNumber)}", tags, "NO_SERIES_NUMBER", 8, "SeriesNumber");
+      ReplaceIntTagKeyword(folderName, "{pad8(InstanceNumber)}", tags, "NO_INSTANCE_NUMBER", 8, "InstanceNumber");
+
+      Orthanc::DicomInstanceHasher hasher(tags["PatientID"].asString(), tags["StudyInstanceUID"].asString(), tags["SeriesInstanceUID"].asString(), tags["SOPInstanceUID"].asString());
+      std::string orthancPatientId = hasher.HashPatient();
+      std::string orthancStudyId = hasher.HashStudy();
+      std::string orthancSeriesId = hasher.HashSeries();
+      std::string orthancInstanceId = hasher.HashInstance();
+
+      ReplaceOrthancID(folderName, "{OrthancPatientID}", orthancPatientId, 0, 0);
+      ReplaceOrthancID(folderName, "{OrthancStudyID}", orthancStudyId, 0, 0);
+      ReplaceOrthancID(folderName, "{OrthancSeriesID}", orthancSeriesId, 0, 0);
+      ReplaceOrthancID(folderName, "{OrthancInstanceID}", orthancInstanceId, 0, 0);
+
+      ReplaceOrthancID(folderName, "{01(OrthancPatientID)}", orthancPatientId, 0, 2);
+      ReplaceOrthancID(folderName, "{01(OrthancStudyID)}", orthancStudyId, 0, 2);
+      ReplaceOrthancID(folderName, "{01(OrthancSeriesID)}", orthancSeriesId, 0, 2);
+      ReplaceOrthancID(folderName, "{01(OrthancInstanceID)}", orthancInstanceId, 0, 2);
+
+      ReplaceOrthancID(folderName, "{23(OrthancPatientID)}", orthancPatientId, 2, 2);
+      ReplaceOrthancID(folderName, "{23(OrthancStudyID)}", orthancStudyId, 2, 2);
+      ReplaceOrthancID(folderName, "{23(OrthancSeriesID)}", orthancSeriesId, 2, 2);
+      ReplaceOrthancID(folderName, "{23(OrthancInstanceID)}", orthancInstanceId, 2, 2);
+
+      if (folderName.find("{UUID}") != std::string::npos)
+      {
+        boost::replace_all(folderName, "{UUID}", uuid);
+      }
+
+      if (folderName.find("{.ext}") != std::string::npos)
+      {
+        boost::replace_all(folderName, "{.ext}", ".dcm");
+      }
+
+      path /= Orthanc::SystemToolbox::PathFromUtf8(folderName);
+    }
+
+    return path;
+  }
+}
+
+
+static void GenerateTags(Json::Value& tags, unsigned int i)
+{
+  const std::string suffix = boost::lexical_cast<std::string>(i);
+
+  tags = Json::objectValue;
+  tags["PatientID"] = "PATIENT-" + boost::lexical_cast<std::string>(i / 1000);
+  tags["PatientName"] = "DOE^JOHN";
+  tags["PatientBirthDate"] = "19700101";
+  tags["PatientSex"] = "M";
+  tags["StudyInstanceUID"] = "1.2.840.113619.2.55.3." + boost::lexical_cast<std::string>(i / 100);
+  tags["StudyDate"] = "20240312";
+  tags["StudyDescription"] = "CT THORAX";
+  tags["AccessionNumber"] = "ACC" + boost::lexical_cast<std::string>(i / 100);
+  tags["SeriesInstanceUID"] = "1.2.840.113619.2.55.3.1." + boost::lexical_cast<std::string>(i / 10);
+  tags["SeriesDescription"] = "AXIAL 1.25";
+  tags["SeriesNumber"] = boost::lexical_cast<std::string>(i % 10);
+  tags["SOPInstanceUID"] = "1.2.840.113619.2.55.3.1.1." + suffix;
+  tags["InstanceNumber"] = suffix;
+
+  if (i % 7 == 0)
+  {
+    tags.removeMember("StudyDescription");  // exercise the default values
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  unsigned int iterations = 100000;
+  if (argc >= 2)
+  {
+    iterations = boost::lexical_cast<unsigned int>(argv[1]);
+  }
+
+  static const char* SCHEMES[] = {
+    "{split(StudyDate)}/{StudyInstanceUID} - {PatientID}/{SeriesInstanceUID}/{pad6(InstanceNumber)} - {UUID}{.ext}",
+    "{PatientID} - {PatientName}/{StudyDate} - {StudyInstanceUID} - {StudyDescription}/{SeriesInstanceUID}/{UUID}{.ext}",
+    "{01(OrthancStudyID)}/{23(OrthancStudyID)}/{OrthancStudyID}/{OrthancSeriesID}/{pad4(SeriesNumber)}-{UUID}{.ext}",
+    NULL
+  };
+
+  const std::string uuid = "00f7fd8b-47bd8c3a-ff917804-d180cdbc-40cf9527";
+
+  std::vector<Json::Value> samples(1000);
+  for (size_t i = 0; i < samples.size(); i++)
+  {
+    GenerateTags(samples[i], static_cast<unsigned int>(i));
+  }
+
+  try
+  {
+    for (size_t s = 0; SCHEMES[s] != NULL; s++)
+    {
+      OrthancPlugins::PathGenerator::SetNamingScheme(SCHEMES[s], false);
+
+      // sanity check: both implementations must generate the same paths
+      for (size_t i = 0; i < samples.size(); i++)
+      {
+        boost::filesystem::path a = Legacy::GetRelativePathFromTags(SCHEMES[s], samples[i], uuid.c_str());
+        boost::filesystem::path b = OrthancPlugins::PathGenerator::GetRelativePathFromTags(samples[i], uuid.c_str(), OrthancPluginContentType_Dicom, false);
+
+        if (a != b)
+        {
+          std::cerr << "Mismatch for scheme " << SCHEMES[s] << ": " << a.string() << " != " << b.string() << std::endl;
+          return -1;
+        }
+      }
+
+      size_t checksum = 0;
+
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      for (unsigned int i = 0; i < iterations; i++)
+      {
+        checksum += Legacy::GetRelativePathFromTags(SCHEMES[s], samples[i % samples.size()], uuid.c_str()).size();
+      }
+      boost::posix_time::ptime middle = boost::posix_time::microsec_clock::universal_time();
+      for (unsigned int i = 0; i < iterations; i++)
+      {
+        checksum += OrthancPlugins::PathGenerator::GetRelativePathFromTags(samples[i % samples.size()], uuid.c_str(), OrthancPluginContentType_Dicom, false).size();
+      }
+      boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+
+      const double legacyNs = static_cast<double>((middle - start).total_microseconds()) * 1000.0 / iterations;
+      const double compiledNs = static_cast<double>((end - middle).total_microseconds()) * 1000.0 / iterations;
+
+      printf("%s\n  legacy: %10.1f ns/path   compiled: %10.1f ns/path   speedup: x%.1f   (checksum %lu)\n",
+             SCHEMES[s], legacyNs, compiledNs, legacyNs / compiledNs, static_cast<unsigned long>(checksum));
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    std::cerr << "Exception: " << e.What() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,226 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+// Compares the I/O engines of the storage callbacks (write a new file, read it back, remove it)
+// with 1, 8 and 64 concurrent callers, as Orthanc does when ingesting/retrieving in parallel.
+// Run it on the file system of the storage area, e.g. an NVMe drive.
+// Usage: StorageIoEngineBenchmark [-n files-per-caller] [-s file-size] [--fsync] directory
+
+#include "../Plugin/StorageIoEngine.h"
+
+#if ORTHANC_ENABLE_IO_URING == 1
+#  include "../Plugin/IoUringStorageIoEngine.h"
+#endif
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+
+
+namespace
+{
+  enum Operation
+  {
+    Operation_Write,
+    Operation_Read,
+    Operation_Remove
+  };
+
+  struct Parameters
+  {
+    OrthancPlugins::IStorageIoEngine*  engine_;
+    boost::filesystem::path            directory_;
+    unsigned int                       filesPerCaller_;
+    std::string                        content_;
+    bool                               fsync_;
+    OrthancPlugins::WritePolicy        policy_;
+  };
+}
+
+
+static boost::filesystem::path GetPath(const Parameters& parameters, unsigned int caller, unsigned int file)
+{
+  return parameters.directory_ / ("caller-" + boost::lexical_cast<std::string>(caller)) / ("file-" + boost::lexical_cast<std::string>(file));
+}
+
+
+static void Worker(const Parameters* parameters,
+                   Operation operation,
+                   unsigned int caller,
+                   std::vector<double>* latenciesUs)
+{
+  std::string buffer(parameters->content_.size(), '\0');
+
+  for (unsigned int i = 0; i < parameters->filesPerCaller_; i++)
+  {
+    const boost::filesystem::path path = GetPath(*parameters, caller, i);
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    switch (operation)
+    {
+      case Operation_Write:
+        parameters->engine_->WriteNewFile(path, parameters->content_.data(), parameters->content_.size(), parameters->fsync_, parameters->policy_);
+        break;
+
+      case Operation_Read:
+        parameters->engine_->ReadRange(&buffer[0], buffer.size(), path, 0, true);
+        break;
+
+      case Operation_Remove:
+        parameters->engine_->RemoveFile(path);
+        break;
+    }
+
+    (*latenciesUs)[i] = static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds());
+  }
+}
+
+
+static void Run(const Parameters& parameters,
+                Operation operation,
+                unsigned int callers)
+{
+  std::vector<std::vector<double> > latencies(callers, std::vector<double>(parameters.filesPerCaller_));
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  boost::thread_group threads;
+  for (unsigned int i = 0; i < callers; i++)
+  {
+    threads.create_thread(boost::bind(Worker, &parameters, operation, i, &latencies[i]));
+  }
+
+  threads.join_all();
+
+  const double elapsedS = static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000000.0;
+
+  std::vector<double> all;
+  for (unsigned int i = 0; i < callers; i++)
+  {
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+  }
+
+  std::sort(all.begin(), all.end());
+
+  static const char* const NAMES[] = { "write", "read", "remove" };
+
+  printf("  %-8s %3u callers: %10.0f ops/s   p50: %9.1f us   p99: %9.1f us   max: %9.1f us\n",
+         NAMES[operation], callers, static_cast<double>(all.size()) / elapsedS,
+         all[all.size() / 2], all[std::min(all.size() - 1, all.size() * 99 / 100)], all.back());
+}
+
+
+int main(int argc, char* argv[])
+{
+  unsigned int filesPerCaller = 200;
+  size_t fileSize = 512 * 1024;  // a typical CT instance
+  bool fsync = false;
+  std::string directory;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg(argv[i]);
+
+    if (arg == "-n" && i + 1 < argc)
+    {
+      filesPerCaller = boost::lexical_cast<unsigned int>(argv[++i]);
+    }
+    else if (arg == "-s" && i + 1 < argc)
+    {
+      fileSize = boost::lexical_cast<size_t>(argv[++i]);
+    }
+    else if (arg == "--fsync")
+    {
+      fsync = true;
+    }
+    else
+    {
+      directory = arg;
+    }
+  }
+
+  if (directory.empty() || filesPerCaller == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [-n files-per-caller] [-s file-size] [--fsync] directory" << std::endl;
+    return -1;
+  }
+
+  try
+  {
+    std::vector<OrthancPlugins::IStorageIoEngine*> engines;
+    engines.push_back(new OrthancPlugins::DefaultStorageIoEngine);
+
+#if ORTHANC_ENABLE_IO_URING == 1
+    try
+    {
+      engines.push_back(new OrthancPlugins::IoUringStorageIoEngine(64 /* the maximum number of callers */));
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      std::cerr << "The io_uring engine is not available: " << e.What() << std::endl;
+    }
+#else
+    std::cerr << "Built without io_uring support (ENABLE_IO_URING=OFF)" << std::endl;
+#endif
+
+    static const unsigned int CALLERS[] = { 1, 8, 64 };
+
+    for (size_t e = 0; e < engines.size(); e++)
+    {
+      Parameters parameters;
+      parameters.engine_ = engines[e];
+      parameters.directory_ = boost::filesystem::path(directory) / ("advanced-storage-benchmark-" + std::string(engines[e]->GetName()));
+      parameters.filesPerCaller_ = filesPerCaller;
+      parameters.content_.assign(fileSize, 'x');
+      parameters.fsync_ = fsync;
+
+      printf("%s engine (%lu bytes per file%s)\n", engines[e]->GetName(), static_cast<unsigned long>(fileSize), fsync ? ", fsync" : "");
+
+      for (size_t c = 0; c < sizeof(CALLERS) / sizeof(unsigned int); c++)
+      {
+        for (unsigned int i = 0; i < CALLERS[c]; i++)
+        {
+          boost::filesystem::create_directories(GetPath(parameters, i, 0).parent_path());
+        }
+
+        Run(parameters, Operation_Write, CALLERS[c]);
+        Run(parameters, Operation_Read, CALLERS[c]);
+        Run(parameters, Operation_Remove, CALLERS[c]);
+      }
+
+      boost::filesystem::remove_all(parameters.directory_);
+      delete engines[e];
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    std::cerr << "Exception: " << e.What() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
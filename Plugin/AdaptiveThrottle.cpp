@@ -0,0 +1,416 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "AdaptiveThrottle.h"
+#include "CustomData.h"
+
+#include <OrthancException.h>
+
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <stdio.h>
+
+
+namespace OrthancPlugins
+{
+  static const size_t HISTOGRAM_BUCKETS = 32;           // bucket i: latencies in [2^i, 2^(i+1)[ microseconds
+  static const double ADDITIVE_INCREASE_PER_SECOND = 10;  // operations per second, added at each window below the target
+  static const double MIN_SIGNIFICANT_DELAY_MS = 0.05;    // below, the worker is not throttled anymore
+
+  namespace
+  {
+    struct Histogram
+    {
+      uint64_t  buckets_[HISTOGRAM_BUCKETS];
+      uint64_t  count_;
+
+      // the 99th percentile, linearly interpolated within its bucket (a bucket spans a factor 2, so
+      // its upper bound alone would overestimate the latency by up to 100%)
+      double GetP99Ms() const
+      {
+        const uint64_t rank = count_ - count_ / 100;
+        uint64_t cumulated = 0;
+
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+          if (buckets_[i] > 0 &&
+              cumulated + buckets_[i] >= rank)
+          {
+            const double lower = (i == 0 ? 0.0 : static_cast<double>(static_cast<uint64_t>(1) << i));
+            const double upper = static_cast<double>(static_cast<uint64_t>(1) << (i + 1));
+            const double fraction = static_cast<double>(rank - cumulated) / static_cast<double>(buckets_[i]);
+
+            return (lower + (upper - lower) * fraction) / 1000.0;
+          }
+
+          cumulated += buckets_[i];
+        }
+
+        return static_cast<double>(static_cast<uint64_t>(1) << HISTOGRAM_BUCKETS) / 1000.0;
+      }
+    };
+
+    // The histogram of 1 window, filled without any lock.  It is cleared by the first call that
+    // enters a new window: the few calls that race with this clearing may be lost, which does not
+    // matter for a percentile.
+    struct AtomicHistogram
+    {
+      boost::atomic<uint64_t>  window_;  // seconds since the epoch
+      boost::atomic<uint64_t>  buckets_[HISTOGRAM_BUCKETS];
+    };
+
+    struct StorageLatency
+    {
+      AtomicHistogram  windows_[2];  // indexed by the parity of the window: the current one and the last one
+    };
+  }
+
+
+  static StorageLatency latencies_[ForegroundLatency::MAX_STORAGES];
+
+
+  static uint64_t GetCurrentWindow()
+  {
+    return static_cast<uint64_t>(time(NULL));
+  }
+
+
+  static size_t GetStorageSlot(size_t storageNumber)
+  {
+    return std::min(storageNumber, ForegroundLatency::MAX_STORAGES - 1);
+  }
+
+
+  static size_t GetBucket(uint64_t microseconds)
+  {
+    size_t bucket = 0;
+    while (bucket + 1 < HISTOGRAM_BUCKETS &&
+           (microseconds >> (bucket + 1)) != 0)
+    {
+      bucket++;
+    }
+
+    return bucket;
+  }
+
+
+  // Reads the histogram of the window that precedes "now".  Returns false if nothing has been
+  // recorded during this window.
+  static bool ReadLastWindow(Histogram& target,
+                             size_t slot,
+                             uint64_t now)
+  {
+    const uint64_t last = now - 1;
+    const AtomicHistogram& histogram = latencies_[slot].windows_[last & 1];
+
+    target.count_ = 0;
+
+    if (histogram.window_.load(boost::memory_order_acquire) != last)
+    {
+      return false;
+    }
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+      target.buckets_[i] = histogram.buckets_[i].load(boost::memory_order_relaxed);
+      target.count_ += target.buckets_[i];
+    }
+
+    // the histogram may have been recycled for a new window in the meantime
+    if (histogram.window_.load(boost::memory_order_acquire) != last)
+    {
+      target.count_ = 0;
+    }
+
+    return target.count_ > 0;
+  }
+
+
+  void ForegroundLatency::Record(size_t storageNumber,
+                                 uint64_t microseconds)
+  {
+    const uint64_t now = GetCurrentWindow();
+    AtomicHistogram& histogram = latencies_[GetStorageSlot(storageNumber)].windows_[now & 1];
+
+    uint64_t window = histogram.window_.load(boost::memory_order_acquire);
+    if (window != now &&
+        histogram.window_.compare_exchange_strong(window, now))
+    {
+      // this call opens the window: forget about the window 2 seconds ago
+      for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+      {
+        histogram.buckets_[i].store(0, boost::memory_order_relaxed);
+      }
+    }
+
+    histogram.buckets_[GetBucket(microseconds)].fetch_add(1, boost::memory_order_relaxed);
+  }
+
+
+  bool ForegroundLatency::GetLastWindowP99(uint64_t& window,
+                                           double& p99Ms,
+                                           size_t storageNumber)
+  {
+    window = GetCurrentWindow();
+
+    Histogram histogram;
+    if (ReadLastWindow(histogram, GetStorageSlot(storageNumber), window))
+    {
+      p99Ms = histogram.GetP99Ms();
+      return true;
+    }
+    else
+    {
+      p99Ms = 0;
+      return false;
+    }
+  }
+
+
+  bool ForegroundLatency::GetLastWindowWorstP99(uint64_t& window,
+                                                double& p99Ms)
+  {
+    window = GetCurrentWindow();
+    p99Ms = 0;
+
+    bool hasForegroundCalls = false;
+
+    for (size_t slot = 0; slot < MAX_STORAGES; slot++)
+    {
+      Histogram histogram;
+      if (ReadLastWindow(histogram, slot, window))
+      {
+        hasForegroundCalls = true;
+        p99Ms = std::max(p99Ms, histogram.GetP99Ms());
+      }
+    }
+
+    return hasForegroundCalls;
+  }
+
+
+  void ForegroundLatency::GetStatistics(Json::Value& target)
+  {
+    const uint64_t now = GetCurrentWindow();
+    const bool hasOverflow = (CustomData::GetStoragesCount() + 2 > MAX_STORAGES);
+
+    target = Json::objectValue;
+
+    for (size_t slot = 0; slot < MAX_STORAGES; slot++)
+    {
+      if (latencies_[slot].windows_[0].window_.load(boost::memory_order_relaxed) == 0 &&
+          latencies_[slot].windows_[1].window_.load(boost::memory_order_relaxed) == 0)
+      {
+        continue;  // never used
+      }
+
+      Histogram histogram;
+      const bool hasForegroundCalls = ReadLastWindow(histogram, slot, now);
+
+      Json::Value storage = Json::objectValue;
+      storage["CallsPerSecond"] = static_cast<Json::UInt64>(histogram.count_);
+      storage["P99Ms"] = (hasForegroundCalls ? histogram.GetP99Ms() : 0.0);
+
+      target[slot == MAX_STORAGES - 1 && hasOverflow ? "OtherStorages" : CustomData::GetStorageName(slot)] = storage;
+    }
+  }
+
+
+  static bool isAdaptiveMode_ = false;
+  static AdaptiveThrottle::TimeWindow defaultPolicy_;
+  static std::vector<AdaptiveThrottle::TimeWindow> windows_;
+
+
+  static const AdaptiveThrottle::TimeWindow& GetCurrentPolicy()
+  {
+    if (!windows_.empty())
+    {
+      const boost::posix_time::time_duration timeOfDay = boost::posix_time::second_clock::local_time().time_of_day();
+      const unsigned int minute = static_cast<unsigned int>(timeOfDay.hours() * 60 + timeOfDay.minutes());
+
+      for (size_t i = 0; i < windows_.size(); i++)
+      {
+        const AdaptiveThrottle::TimeWindow& window = windows_[i];
+
+        if (window.fromMinute_ <= window.toMinute_ ?
+            (minute >= window.fromMinute_ && minute < window.toMinute_) :
+            (minute >= window.fromMinute_ || minute < window.toMinute_))
+        {
+          return window;
+        }
+      }
+    }
+
+    return defaultPolicy_;
+  }
+
+
+  AdaptiveThrottle::AdaptiveThrottle(unsigned int fixedDelayMs) :
+    fixedDelayMs_(fixedDelayMs)
+  {
+    for (size_t i = 0; i <= ALL_STORAGES; i++)
+    {
+      states_[i].delayMs_ = fixedDelayMs;
+      states_[i].lastWindow_ = 0;
+    }
+  }
+
+
+  double AdaptiveThrottle::Update(size_t slot)
+  {
+    uint64_t window;
+    double p99Ms;
+    const bool hasForegroundCalls = (slot == ALL_STORAGES ?
+                                     ForegroundLatency::GetLastWindowWorstP99(window, p99Ms) :
+                                     ForegroundLatency::GetLastWindowP99(window, p99Ms, slot));
+
+    const TimeWindow& policy = GetCurrentPolicy();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    State& state = states_[slot];
+
+    if (window != state.lastWindow_)
+    {
+      // once per window
+      state.lastWindow_ = window;
+
+      if (hasForegroundCalls &&
+          p99Ms > static_cast<double>(policy.targetLatencyMs_))
+      {
+        // multiplicative decrease of the speed
+        state.delayMs_ = std::max(1.0, state.delayMs_ * 2.0);
+      }
+      else if (state.delayMs_ >= MIN_SIGNIFICANT_DELAY_MS)
+      {
+        // additive increase of the speed
+        const double operationsPerSecond = 1000.0 / state.delayMs_ + ADDITIVE_INCREASE_PER_SECOND;
+        state.delayMs_ = 1000.0 / operationsPerSecond;
+      }
+    }
+
+    state.delayMs_ = std::min(std::max(state.delayMs_, static_cast<double>(policy.minDelayMs_)),
+                              static_cast<double>(policy.maxDelayMs_));
+
+    return state.delayMs_;
+  }
+
+
+  void AdaptiveThrottle::SleepInternal(size_t slot)
+  {
+    if (!isAdaptiveMode_)
+    {
+      if (fixedDelayMs_ > 0)
+      {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(fixedDelayMs_));
+      }
+
+      return;
+    }
+
+    const double delayMs = Update(slot);
+
+    if (delayMs >= MIN_SIGNIFICANT_DELAY_MS)
+    {
+      boost::this_thread::sleep(boost::posix_time::microseconds(static_cast<int64_t>(delayMs * 1000.0)));
+    }
+  }
+
+
+  void AdaptiveThrottle::Sleep(size_t storageNumber)
+  {
+    SleepInternal(GetStorageSlot(storageNumber));
+  }
+
+
+  void AdaptiveThrottle::Sleep()
+  {
+    SleepInternal(ALL_STORAGES);
+  }
+
+
+  double AdaptiveThrottle::GetCurrentDelayMs()
+  {
+    if (isAdaptiveMode_)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      bool hasDelay = false;
+      double delayMs = 0;
+
+      for (size_t i = 0; i <= ALL_STORAGES; i++)
+      {
+        if (states_[i].lastWindow_ != 0)  // the storages the worker has not worked on yet are ignored
+        {
+          delayMs = (hasDelay ? std::max(delayMs, states_[i].delayMs_) : states_[i].delayMs_);
+          hasDelay = true;
+        }
+      }
+
+      return (hasDelay ? delayMs : fixedDelayMs_);
+    }
+    else
+    {
+      return fixedDelayMs_;
+    }
+  }
+
+
+  void AdaptiveThrottle::EnableAdaptiveMode(unsigned int targetLatencyMs,
+                                            unsigned int minDelayMs,
+                                            unsigned int maxDelayMs,
+                                            const std::vector<TimeWindow>& windows)
+  {
+    defaultPolicy_.fromMinute_ = 0;
+    defaultPolicy_.toMinute_ = 24 * 60;
+    defaultPolicy_.targetLatencyMs_ = targetLatencyMs;
+    defaultPolicy_.minDelayMs_ = minDelayMs;
+    defaultPolicy_.maxDelayMs_ = std::max(minDelayMs, maxDelayMs);
+
+    windows_ = windows;
+    isAdaptiveMode_ = true;
+  }
+
+
+  bool AdaptiveThrottle::IsAdaptiveMode()
+  {
+    return isAdaptiveMode_;
+  }
+
+
+  unsigned int AdaptiveThrottle::ParseTimeOfDay(const std::string& value)
+  {
+    unsigned int hours, minutes;
+    char c;
+
+    if (sscanf(value.c_str(), "%u:%u%c", &hours, &minutes, &c) != 2 ||
+        hours > 24 ||
+        minutes > 59 ||
+        (hours == 24 && minutes != 0))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Invalid time of day (must be \"HH:MM\"): " + value);
+    }
+
+    return hours * 60 + minutes;
+  }
+}
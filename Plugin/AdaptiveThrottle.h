@@ -0,0 +1,119 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // The latencies of the foreground storage calls (StorageCreate and StorageReadRange), per storage.
+  // The latencies are collected in log2 histograms over windows of 1 second.  The storages are
+  // identified by their number (cf. CustomData::GetStorageNumber()), and the calls are recorded
+  // without any lock, in atomic counters.
+  class ForegroundLatency
+  {
+  public:
+    // The storages beyond are all recorded in the last slot
+    static const size_t MAX_STORAGES = 32;
+
+    static void Record(size_t storageNumber,
+                       uint64_t microseconds);
+
+    // The p99 of a storage during the last complete window.  Returns false if no foreground call
+    // has been recorded on this storage during this window (i.e. the storage is idle).
+    static bool GetLastWindowP99(uint64_t& window,
+                                 double& p99Ms,
+                                 size_t storageNumber);
+
+    // The worst p99 among all the storages, for the workers that are not bound to a storage
+    static bool GetLastWindowWorstP99(uint64_t& window,
+                                      double& p99Ms);
+
+    static void GetStatistics(Json::Value& target);
+  };
+
+
+  // Controls the delay between 2 operations of a background worker (the indexer or the deleters).
+  // With the adaptive mode, the speed of the worker is increased additively as long as the p99 of
+  // the foreground latency remains below the target, and the speed is halved as soon as the p99
+  // exceeds the target (AIMD).  Otherwise, the fixed delay is used.
+  class AdaptiveThrottle : public boost::noncopyable
+  {
+  public:
+    struct TimeWindow
+    {
+      unsigned int  fromMinute_;      // minutes since midnight, local time
+      unsigned int  toMinute_;        // the window wraps around midnight if toMinute_ < fromMinute_
+      unsigned int  targetLatencyMs_;
+      unsigned int  minDelayMs_;
+      unsigned int  maxDelayMs_;
+    };
+
+    // The slot of the throttling that follows the worst p99 among all the storages
+    static const size_t ALL_STORAGES = ForegroundLatency::MAX_STORAGES;
+
+  private:
+    struct State
+    {
+      double    delayMs_;
+      uint64_t  lastWindow_;
+    };
+
+    unsigned int  fixedDelayMs_;
+
+    boost::mutex  mutex_;
+    State         states_[ALL_STORAGES + 1];  // one speed per storage, protected by mutex_
+
+    double Update(size_t slot);
+
+    void SleepInternal(size_t slot);
+
+  public:
+    explicit AdaptiveThrottle(unsigned int fixedDelayMs);
+
+    // To be called between 2 operations of the worker.  The worker only slows down if the
+    // foreground calls of the storage it is working on are slow.
+    void Sleep(size_t storageNumber);
+
+    // Same, for the operations that are not bound to a storage
+    void Sleep();
+
+    // The largest delay among the storages
+    double GetCurrentDelayMs();
+
+    // The default policy applies outside of the time windows
+    static void EnableAdaptiveMode(unsigned int targetLatencyMs,
+                                   unsigned int minDelayMs,
+                                   unsigned int maxDelayMs,
+                                   const std::vector<TimeWindow>& windows);
+
+    static bool IsAdaptiveMode();
+
+    // "HH:MM" -> minutes since midnight
+    static unsigned int ParseTimeOfDay(const std::string& value);
+  };
+}
@@ -0,0 +1,433 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "AtomicFileWriter.h"
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <algorithm>
+#include <boost/noncopyable.hpp>
+
+#if !defined(_WIN32)
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <stdio.h>
+#  include <stdlib.h>
+#  include <string.h>
+#  include <unistd.h>
+#  if defined(__linux__)
+#    include <sys/syscall.h>
+#    if !defined(RENAME_NOREPLACE)
+#      define RENAME_NOREPLACE (1 << 0)
+#    endif
+#  endif
+#endif
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+#if !defined(_WIN32)
+  namespace
+  {
+    class FileDescriptor : public boost::noncopyable
+    {
+      int fd_;
+
+    public:
+      explicit FileDescriptor(int fd) :
+        fd_(fd)
+      {
+      }
+
+      ~FileDescriptor()
+      {
+        Close();
+      }
+
+      int Get() const
+      {
+        return fd_;
+      }
+
+      void Close()
+      {
+        if (fd_ >= 0)
+        {
+          close(fd_);
+          fd_ = -1;
+        }
+      }
+    };
+  }
+
+
+  static void ThrowCannotWrite(const std::string& path)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                    "Unable to write file " + path + ": " + std::string(strerror(errno)));
+  }
+
+
+  static void WriteAll(int fd,
+                       const std::string& path,
+                       const void* content,
+                       size_t size)
+  {
+    const char* position = reinterpret_cast<const char*>(content);
+    size_t remaining = size;
+
+    while (remaining > 0)
+    {
+      ssize_t written = write(fd, position, remaining);
+      if (written < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+
+        ThrowCannotWrite(path);
+      }
+
+      position += written;
+      remaining -= static_cast<size_t>(written);
+    }
+  }
+
+
+#  if defined(O_DIRECT)
+  static const size_t DIRECT_IO_ALIGNMENT = 4096;
+  static const size_t DIRECT_IO_BUFFER_SIZE = 1024 * 1024;
+
+  static void WriteDirect(int fd,
+                          const std::string& path,
+                          const void* content,
+                          size_t size)
+  {
+    // O_DIRECT requires aligned buffers and lengths: copy the content by chunks into an
+    // aligned buffer, pad the last chunk with zeros and truncate the file to its real size
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, DIRECT_IO_BUFFER_SIZE) != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+    }
+
+    try
+    {
+      for (size_t offset = 0; offset < size; offset += DIRECT_IO_BUFFER_SIZE)
+      {
+        const size_t chunk = std::min(DIRECT_IO_BUFFER_SIZE, size - offset);
+        const size_t padded = (chunk + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+
+        memcpy(buffer, reinterpret_cast<const char*>(content) + offset, chunk);
+        memset(reinterpret_cast<char*>(buffer) + chunk, 0, padded - chunk);
+
+        WriteAll(fd, path, buffer, padded);
+      }
+
+      if (size % DIRECT_IO_ALIGNMENT != 0 &&
+          ftruncate(fd, size) != 0)
+      {
+        ThrowCannotWrite(path);
+      }
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      free(buffer);
+      throw;
+    }
+
+    free(buffer);
+  }
+#  endif
+
+
+  static void WriteContent(int fd,
+                           const std::string& path,
+                           const void* content,
+                           size_t size,
+                           bool fsync,
+                           const WritePolicy& policy,
+                           bool isDirect)
+  {
+#  if defined(__linux__)
+    if (policy.IsPreallocate() && size > 0)
+    {
+      // a single allocation of the final size limits the fragmentation (ignored if not supported by the file system)
+      fallocate(fd, 0, 0, size);
+    }
+#  endif
+
+#  if defined(O_DIRECT)
+    if (isDirect)
+    {
+      WriteDirect(fd, path, content, size);
+    }
+    else
+#  endif
+    {
+      WriteAll(fd, path, content, size);
+    }
+
+    if (fsync && ::fsync(fd) != 0)
+    {
+      ThrowCannotWrite(path);
+    }
+
+#  if defined(__linux__)
+    // also used if the file system refused O_DIRECT
+    if (policy.GetCachePolicy() != WriteCachePolicy_Buffered && !isDirect)
+    {
+      if (!fsync)
+      {
+        // only clean pages can be dropped: write them back first
+        sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+      }
+
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+#  endif
+  }
+
+
+  // Adds O_DIRECT if requested by the policy, and retries without it if the file system does not support it
+  static int OpenForWriting(bool& isDirect,
+                            const char* path,
+                            int flags,
+                            const WritePolicy& policy)
+  {
+#  if defined(O_DIRECT)
+    if (policy.GetCachePolicy() == WriteCachePolicy_Direct)
+    {
+      int fd = open(path, flags | O_DIRECT, 0666);
+      if (fd >= 0 || errno != EINVAL)
+      {
+        isDirect = (fd >= 0);
+        return fd;
+      }
+    }
+#  endif
+
+    isDirect = false;
+    return open(path, flags, 0666);
+  }
+
+
+#  if defined(O_TMPFILE)
+  enum AnonymousWriteResult
+  {
+    AnonymousWriteResult_Created,
+    AnonymousWriteResult_AlreadyExists,
+    AnonymousWriteResult_NotSupported
+  };
+
+  static AnonymousWriteResult WriteAnonymousFile(const std::string& target,
+                                                 const void* content,
+                                                 size_t size,
+                                                 bool fsync,
+                                                 const WritePolicy& policy)
+  {
+    const std::string directory = fs::path(target).parent_path().string();
+
+    bool isDirect;
+    FileDescriptor fd(OpenForWriting(isDirect, directory.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, policy));
+    if (fd.Get() < 0)
+    {
+      if (errno == ENOENT || errno == ENOTDIR || errno == EACCES || errno == ENOSPC)
+      {
+        ThrowCannotWrite(target);
+      }
+
+      return AnonymousWriteResult_NotSupported;  // EOPNOTSUPP, EISDIR (old kernels), ...
+    }
+
+    WriteContent(fd.Get(), target, content, size, fsync, policy, isDirect);
+
+    // linkat() with AT_EMPTY_PATH requires CAP_DAC_READ_SEARCH, hence the /proc path
+    char procPath[64];
+    sprintf(procPath, "/proc/self/fd/%d", fd.Get());
+
+    if (linkat(AT_FDCWD, procPath, AT_FDCWD, target.c_str(), AT_SYMLINK_FOLLOW) == 0)
+    {
+      return AnonymousWriteResult_Created;
+    }
+    else if (errno == EEXIST)
+    {
+      return AnonymousWriteResult_AlreadyExists;
+    }
+    else
+    {
+      return AnonymousWriteResult_NotSupported;  // e.g. /proc is not mounted
+    }
+  }
+#  endif
+
+
+  static bool PublishTemporaryFile(const std::string& temporary,
+                                   const std::string& target)
+  {
+#  if defined(__linux__) && defined(SYS_renameat2)
+    if (syscall(SYS_renameat2, AT_FDCWD, temporary.c_str(), AT_FDCWD, target.c_str(), RENAME_NOREPLACE) == 0)
+    {
+      return true;
+    }
+    else if (errno == EEXIST)
+    {
+      unlink(temporary.c_str());
+      return false;
+    }
+    // EINVAL: RENAME_NOREPLACE is not supported by this file system
+#  endif
+
+    if (link(temporary.c_str(), target.c_str()) == 0)
+    {
+      unlink(temporary.c_str());
+      return true;
+    }
+    else if (errno == EEXIST)
+    {
+      unlink(temporary.c_str());
+      return false;
+    }
+
+    // no hard links on this file system: the exists check is not atomic, but the file is still complete once visible
+    if (fs::exists(target))
+    {
+      unlink(temporary.c_str());
+      return false;
+    }
+
+    if (rename(temporary.c_str(), target.c_str()) != 0)
+    {
+      unlink(temporary.c_str());
+      ThrowCannotWrite(target);
+    }
+
+    return true;
+  }
+
+
+  static bool WriteTemporaryFile(const std::string& target,
+                                 const void* content,
+                                 size_t size,
+                                 bool fsync,
+                                 const WritePolicy& policy)
+  {
+    const fs::path targetPath(target);
+    const std::string temporary = (targetPath.parent_path() /
+                                   ("." + targetPath.filename().string() + "." + Orthanc::Toolbox::GenerateUuid() + ".tmp")).string();
+
+    {
+      bool isDirect;
+      FileDescriptor fd(OpenForWriting(isDirect, temporary.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, policy));
+      if (fd.Get() < 0)
+      {
+        ThrowCannotWrite(target);
+      }
+
+      try
+      {
+        WriteContent(fd.Get(), target, content, size, fsync, policy, isDirect);
+      }
+      catch (Orthanc::OrthancException&)
+      {
+        fd.Close();
+        unlink(temporary.c_str());
+        throw;
+      }
+    }
+
+    return PublishTemporaryFile(temporary, target);
+  }
+#endif
+
+
+  void AtomicFileWriter::SyncParentDirectory(const fs::path& path)
+  {
+#if !defined(_WIN32)
+    // the new directory entry must be durable as well, not only the content of the file
+    const std::string directory = path.parent_path().string();
+
+    FileDescriptor fd(open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (fd.Get() < 0 ||
+        ::fsync(fd.Get()) != 0)
+    {
+      ThrowCannotWrite(path.string());
+    }
+#endif
+  }
+
+
+  bool AtomicFileWriter::WriteNewFile(const fs::path& path,
+                                      const void* content,
+                                      size_t size,
+                                      bool fsync,
+                                      const WritePolicy& policy)
+  {
+#if defined(_WIN32)
+    if (fs::exists(path))
+    {
+      return false;
+    }
+
+    Orthanc::SystemToolbox::WriteFile(content, size, path, fsync);
+    return true;
+#else
+    const std::string target = path.string();
+
+#  if defined(O_TMPFILE)
+    switch (WriteAnonymousFile(target, content, size, fsync, policy))
+    {
+      case AnonymousWriteResult_Created:
+        if (fsync)
+        {
+          SyncParentDirectory(path);
+        }
+
+        return true;
+
+      case AnonymousWriteResult_AlreadyExists:
+        return false;
+
+      default:
+        break;  // fallback to a named temporary file
+    }
+#  endif
+
+    if (WriteTemporaryFile(target, content, size, fsync, policy))
+    {
+      if (fsync)
+      {
+        SyncParentDirectory(path);
+      }
+
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+#endif
+  }
+}
@@ -0,0 +1,51 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "WritePolicy.h"
+
+#include <boost/filesystem.hpp>
+
+
+namespace OrthancPlugins
+{
+  // Writes a new file so that it only appears at its final path once it is complete:
+  // the content is written in an anonymous file (O_TMPFILE) or in a temporary file
+  // that is then published with linkat() or renameat2(RENAME_NOREPLACE).  This gives
+  // the O_EXCL semantics without a separate exists check, and a crash never leaves a
+  // partial file at the final path.  With "fsync", the parent directory is also synced
+  // once the file is published, so that its entry survives a crash.  The WritePolicy controls the page cache usage and
+  // the pre-allocation of the file.
+  class AtomicFileWriter
+  {
+  public:
+    // Returns false (and writes nothing) if the target path already exists.
+    // Throws ErrorCode_CannotWriteFile on I/O errors (including a missing parent directory).
+    static bool WriteNewFile(const boost::filesystem::path& path,
+                             const void* content,
+                             size_t size,
+                             bool fsync,
+                             const WritePolicy& policy);
+
+    // fsync() of the directory that contains "path", once a new entry has been published in it.
+    // Throws ErrorCode_CannotWriteFile on errors.
+    static void SyncParentDirectory(const boost::filesystem::path& path);
+  };
+}
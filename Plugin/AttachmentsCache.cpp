@@ -0,0 +1,237 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "AttachmentsCache.h"
+
+#include <Compatibility.h>
+#include <Cache/LeastRecentlyUsedIndex.h>
+
+#include <boost/atomic.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <string.h>
+
+
+namespace OrthancPlugins
+{
+  static const size_t SHARDS_COUNT = 16;
+
+  namespace
+  {
+    struct Entry
+    {
+      OrthancPluginContentType  type_;
+      std::string               content_;
+    };
+
+    typedef Orthanc::LeastRecentlyUsedIndex<std::string, boost::shared_ptr<Entry> >  EntriesIndex;
+
+    struct Shard
+    {
+      boost::mutex  mutex_;
+      EntriesIndex  entries_;
+      uint64_t      size_;
+      uint64_t      hits_;
+      uint64_t      misses_;
+
+      Shard() :
+        size_(0),
+        hits_(0),
+        misses_(0)
+      {
+      }
+
+      // The mutex must be locked
+      void Remove(const std::string& uuid)
+      {
+        if (entries_.Contains(uuid))
+        {
+          size_ -= entries_.Invalidate(uuid)->content_.size();
+        }
+      }
+
+      // The mutex must be locked
+      void Shrink(uint64_t maxSize)
+      {
+        while (size_ > maxSize)
+        {
+          boost::shared_ptr<Entry> oldest;
+          entries_.RemoveOldest(oldest);
+          size_ -= oldest->content_.size();
+        }
+      }
+    };
+  }
+
+
+  static Shard shards_[SHARDS_COUNT];
+  static uint64_t maxShardSize_ = 0;  // constant once the plugin is initialized
+  static size_t maxEntrySize_ = 0;
+  static boost::atomic<uint64_t> uncacheableReads_(0);  // not counted as misses
+
+
+  static Shard& GetShard(const std::string& uuid)
+  {
+    return shards_[boost::hash<std::string>()(uuid) % SHARDS_COUNT];
+  }
+
+
+  void AttachmentsCache::SetMaxSize(uint64_t maxBytes,
+                                    size_t maxEntrySize)
+  {
+    maxShardSize_ = maxBytes / SHARDS_COUNT;
+    maxEntrySize_ = std::min(static_cast<uint64_t>(maxEntrySize), maxShardSize_);
+
+    for (size_t i = 0; i < SHARDS_COUNT; i++)
+    {
+      boost::mutex::scoped_lock lock(shards_[i].mutex_);
+      shards_[i].Shrink(maxShardSize_);
+    }
+  }
+
+
+  bool AttachmentsCache::IsEnabled()
+  {
+    return maxEntrySize_ > 0;
+  }
+
+
+  bool AttachmentsCache::IsCacheable(OrthancPluginContentType type,
+                                     uint64_t size)
+  {
+    // the DICOM files are large and are read by ranges (e.g. the frames)
+    return (type != OrthancPluginContentType_Dicom &&
+            size > 0 &&
+            size <= maxEntrySize_);
+  }
+
+
+  void AttachmentsCache::Add(const std::string& uuid,
+                             OrthancPluginContentType type,
+                             const void* content,
+                             uint64_t size)
+  {
+    if (!IsCacheable(type, size))
+    {
+      return;
+    }
+
+    boost::shared_ptr<Entry> entry(new Entry);
+    entry->type_ = type;
+    entry->content_.assign(reinterpret_cast<const char*>(content), static_cast<size_t>(size));
+
+    Shard& shard = GetShard(uuid);
+
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    shard.Remove(uuid);
+    shard.entries_.Add(uuid, entry);
+    shard.size_ += size;
+    shard.Shrink(maxShardSize_);
+  }
+
+
+  bool AttachmentsCache::ReadRange(void* target,
+                                   uint64_t size,
+                                   const std::string& uuid,
+                                   OrthancPluginContentType type,
+                                   uint64_t start)
+  {
+    if (!IsEnabled())
+    {
+      return false;
+    }
+
+    if (!IsCacheable(type, start + size))
+    {
+      // the range can not be in the cache (e.g. a DICOM file or a large attachment): no lookup
+      uncacheableReads_.fetch_add(1, boost::memory_order_relaxed);
+      return false;
+    }
+
+    Shard& shard = GetShard(uuid);
+    boost::shared_ptr<Entry> entry;
+
+    {
+      boost::mutex::scoped_lock lock(shard.mutex_);
+
+      if (!shard.entries_.Contains(uuid, entry) ||
+          entry->type_ != type ||
+          start + size > entry->content_.size())
+      {
+        shard.misses_++;
+        return false;
+      }
+
+      shard.entries_.MakeMostRecent(uuid);
+      shard.hits_++;
+    }
+
+    // the entry is kept alive by the shared pointer, even if it is evicted in the meantime
+    if (size > 0)
+    {
+      memcpy(target, entry->content_.data() + start, static_cast<size_t>(size));
+    }
+
+    return true;
+  }
+
+
+  void AttachmentsCache::Invalidate(const std::string& uuid)
+  {
+    if (!IsEnabled())
+    {
+      return;
+    }
+
+    Shard& shard = GetShard(uuid);
+
+    boost::mutex::scoped_lock lock(shard.mutex_);
+    shard.Remove(uuid);
+  }
+
+
+  void AttachmentsCache::GetStatistics(Json::Value& target)
+  {
+    uint64_t entries = 0;
+    uint64_t size = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    for (size_t i = 0; i < SHARDS_COUNT; i++)
+    {
+      boost::mutex::scoped_lock lock(shards_[i].mutex_);
+      entries += shards_[i].entries_.GetSize();
+      size += shards_[i].size_;
+      hits += shards_[i].hits_;
+      misses += shards_[i].misses_;
+    }
+
+    target = Json::objectValue;
+    target["Entries"] = static_cast<Json::UInt64>(entries);
+    target["SizeMB"] = static_cast<double>(size) / (1024.0 * 1024.0);
+    target["MaxSizeMB"] = static_cast<double>(maxShardSize_ * SHARDS_COUNT) / (1024.0 * 1024.0);
+    target["Hits"] = static_cast<Json::UInt64>(hits);
+    target["Misses"] = static_cast<Json::UInt64>(misses);
+    target["HitRatio"] = (hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses));
+    target["UncacheableReads"] = static_cast<Json::UInt64>(uncacheableReads_.load(boost::memory_order_relaxed));
+  }
+}
@@ -0,0 +1,67 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <orthanc/OrthancCPlugin.h>
+
+#include <json/value.h>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  // A size-bounded LRU cache of the content of the small attachments that Orthanc reads very
+  // often (e.g. DicomUntilPixelData for the tags, find and DICOMweb metadata), keyed by attachment
+  // uuid.  The DICOM files themselves are never cached.  It is sharded by uuid to limit the
+  // contention between the concurrent reads.  It is populated when the attachments are written
+  // and when they are read for the first time, and it must be invalidated when an attachment is
+  // removed or moved.
+  class AttachmentsCache
+  {
+  public:
+    // 0 disables the cache
+    static void SetMaxSize(uint64_t maxBytes,
+                           size_t maxEntrySize);
+
+    static bool IsEnabled();
+
+    static bool IsCacheable(OrthancPluginContentType type,
+                            uint64_t size);
+
+    // The whole content of the attachment
+    static void Add(const std::string& uuid,
+                    OrthancPluginContentType type,
+                    const void* content,
+                    uint64_t size);
+
+    // Returns false if the attachment is not in the cache (or if the range is not available).  Only
+    // the ranges that could be in the cache are counted as hits or misses.
+    static bool ReadRange(void* target,
+                          uint64_t size,
+                          const std::string& uuid,
+                          OrthancPluginContentType type,
+                          uint64_t start);
+
+    static void Invalidate(const std::string& uuid);
+
+    static void GetStatistics(Json::Value& target);
+  };
+}
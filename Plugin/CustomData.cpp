@@ -28,6 +28,11 @@
 #include "PathGenerator.h"
 #include "Helpers.h"
 
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_set.hpp>
+
 
 namespace OrthancPlugins
 {
@@ -35,22 +40,375 @@ namespace OrthancPlugins
   static const char* SERIALIZATION_KEY_IS_OWNER = "o";
   static const char* SERIALIZATION_KEY_PATH = "p";
   static const char* SERIALIZATION_KEY_STORAGE_ID = "s";
+
+  // All the bytes of the header and of the integers are printable ASCII characters: the index
+  // backends might store the CustomData in a TEXT column or handle it as a C string
+  static const uint8_t BINARY_VERSION = '2';
+  static const uint8_t BINARY_FLAGS_BASE = 'A';     // the flags are stored as 'A' + flags
+  static const uint8_t VARINT_LAST_BASE = '0';      // 5 bits per character, '0'..'O' for the last one
+  static const uint8_t VARINT_MORE_BASE = 'P';      // and 'P'..'o' if more characters follow
+  static const unsigned int VARINT_BITS = 5;
+  static const uint64_t VARINT_MASK = 0x1f;
+  static const uint8_t BINARY_FLAG_IS_OWNER = 0x01;
+  static const uint8_t BINARY_FLAG_HAS_PATH = 0x02;
+  static const uint8_t BINARY_FLAG_HAS_STORAGE_ID = 0x04;
+  static const uint8_t BINARY_FLAG_NUMERIC_STORAGE_ID = 0x08;
+  static const uint8_t BINARY_KNOWN_FLAGS = 0x0f;
   
-  static boost::filesystem::path orthancCoreRootPath_;
-  static std::map<std::string, boost::filesystem::path> storagesRootPaths_;
-  static std::string currentWriteStorageId_;
+  static const size_t NO_STORAGE = static_cast<size_t>(-1);
+
+  namespace
+  {
+    struct Storage
+    {
+      std::string              id_;
+      boost::filesystem::path  rootPath_;
+      std::string              rootPathUtf8_;
+      WritePolicy              writePolicy_;
+    };
+
+
+    // The configuration of the storages.  A table is never modified once it has been published:
+    // the setters (only called at startup) publish a modified copy, and the previous tables are
+    // kept alive until the plugin is unloaded, so that the readers never take a lock.
+    class StoragesTable
+    {
+    public:
+      boost::filesystem::path   orthancCoreRootPath_;
+      std::string               orthancCoreRootPathUtf8_;
+      WritePolicy               defaultWritePolicy_;
+      std::vector<Storage>      storages_;  // the CustomData refer to the storages by their index
+      size_t                    currentWriteStorage_;  // NO_STORAGE if the MultipleStorages are disabled
+      boost::unordered_set<boost::filesystem::path::string_type>  rootPaths_;
+
+      StoragesTable() :
+        currentWriteStorage_(NO_STORAGE)
+      {
+      }
+
+      size_t FindStorage(const std::string& storageId) const
+      {
+        for (size_t i = 0; i < storages_.size(); i++)
+        {
+          if (storages_[i].id_ == storageId)
+          {
+            return i;
+          }
+        }
+
+        return NO_STORAGE;
+      }
+
+      bool IsMultipleStoragesEnabled() const
+      {
+        return currentWriteStorage_ != NO_STORAGE;
+      }
+
+      const Storage& GetStorage(size_t index,
+                                const std::string& storageId) const
+      {
+        if (index >= storages_.size())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Advanced Storage - no storage root path found for storage  '" + storageId + "'");
+        }
+
+        return storages_[index];
+      }
+
+      const boost::filesystem::path& GetOrthancCoreRootPath() const
+      {
+        if (orthancCoreRootPath_.empty())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Advanced Storage - no Orthanc storage directory defined");
+        }
+
+        return orthancCoreRootPath_;
+      }
+
+      void IndexRootPaths()
+      {
+        rootPaths_.clear();
+        AddRootPath(orthancCoreRootPath_);
+
+        for (size_t i = 0; i < storages_.size(); i++)
+        {
+          AddRootPath(storages_[i].rootPath_);
+        }
+      }
+
+    private:
+      void AddRootPath(const boost::filesystem::path& rootPath)
+      {
+        if (!rootPath.empty())
+        {
+          rootPaths_.insert(rootPath.native());
+
+          // the parent directories of the files never end with a separator, even if the root does
+          boost::filesystem::path::string_type trimmed = rootPath.native();
+          while (trimmed.size() > 1 &&
+                 (trimmed[trimmed.size() - 1] == '/' || trimmed[trimmed.size() - 1] == boost::filesystem::path::preferred_separator))
+          {
+            trimmed.resize(trimmed.size() - 1);
+          }
+
+          rootPaths_.insert(trimmed);
+        }
+      }
+    };
+  }
+
+
+  static StoragesTable emptyTable_;
+  static boost::atomic<const StoragesTable*> table_(&emptyTable_);
+  static boost::mutex publishMutex_;
+  static std::vector<boost::shared_ptr<StoragesTable> > publishedTables_;  // protected by publishMutex_
+
+  static const StoragesTable& GetTable()
+  {
+    return *table_.load(boost::memory_order_acquire);
+  }
+
+
+  // Publishes a modified copy of the current table (the caller must lock publishMutex_)
+  static void Publish(const boost::shared_ptr<StoragesTable>& table)
+  {
+    table->IndexRootPaths();
+    publishedTables_.push_back(table);
+    table_.store(table.get(), boost::memory_order_release);
+  }
+
+
   static size_t maxPathLength_ = 256;
+  static CustomDataFormat serializationFormat_ = CustomDataFormat_Json;
 	static std::string otherAttachmentsPrefix_;
 
 
+  static void EncodeVarint(std::string& target,
+                           uint64_t value)
+  {
+    while (value > VARINT_MASK)
+    {
+      target.push_back(static_cast<char>(VARINT_MORE_BASE + (value & VARINT_MASK)));
+      value >>= VARINT_BITS;
+    }
+
+    target.push_back(static_cast<char>(VARINT_LAST_BASE + value));
+  }
+
+
+  static uint64_t DecodeVarint(const uint8_t*& position,
+                               const uint8_t* end)
+  {
+    uint64_t value = 0;
+
+    for (unsigned int shift = 0; shift < 64; shift += VARINT_BITS)
+    {
+      if (position == end)
+      {
+        break;
+      }
+
+      const uint8_t byte = *position;
+      position++;
+
+      if (byte >= VARINT_LAST_BASE &&
+          byte <= VARINT_LAST_BASE + VARINT_MASK)
+      {
+        return value | (static_cast<uint64_t>(byte - VARINT_LAST_BASE) << shift);
+      }
+      else if (byte >= VARINT_MORE_BASE &&
+               byte <= VARINT_MORE_BASE + VARINT_MASK)
+      {
+        value |= static_cast<uint64_t>(byte - VARINT_MORE_BASE) << shift;
+      }
+      else
+      {
+        break;
+      }
+    }
+
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Advanced Storage - Invalid varint in a binary CustomData");
+  }
+
+
+  static const char* DecodeBytes(size_t& size,
+                                 const uint8_t*& position,
+                                 const uint8_t* end)
+  {
+    const uint64_t length = DecodeVarint(position, end);
+
+    if (length > static_cast<uint64_t>(end - position))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Advanced Storage - Truncated binary CustomData");
+    }
+
+    const char* bytes = reinterpret_cast<const char*>(position);
+    size = static_cast<size_t>(length);
+    position += size;
+    return bytes;
+  }
+
+
+  // Only the canonical decimal representations (no sign, no leading zero) are stored as integers,
+  // so that the storage id is restored exactly
+  static bool IsNumericStorageId(uint64_t& value,
+                                 const std::string& storageId)
+  {
+    if (storageId.empty() ||
+        storageId.size() > 19 ||
+        (storageId[0] == '0' && storageId.size() > 1))
+    {
+      return false;
+    }
+
+    value = 0;
+    for (size_t i = 0; i < storageId.size(); i++)
+    {
+      if (storageId[i] < '0' || storageId[i] > '9')
+      {
+        return false;
+      }
+
+      value = value * 10 + static_cast<uint64_t>(storageId[i] - '0');
+    }
+
+    return true;
+  }
+
+
+  bool SerializedCustomData::Decode(const void* buffer,
+                                    uint64_t size)
+  {
+    const uint8_t* position = reinterpret_cast<const uint8_t*>(buffer);
+    const uint8_t* end = position + size;
+
+    // the JSON of the version 1 starts with '{'
+    if (size == 0 ||
+        position[0] != BINARY_VERSION)
+    {
+      return false;
+    }
+
+    if (size < 2 ||
+        position[1] < BINARY_FLAGS_BASE ||
+        ((position[1] - BINARY_FLAGS_BASE) & ~BINARY_KNOWN_FLAGS) != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Advanced Storage - Invalid binary CustomData");
+    }
+
+    const uint8_t flags = static_cast<uint8_t>(position[1] - BINARY_FLAGS_BASE);
+    position += 2;
+
+    isOwner_ = ((flags & BINARY_FLAG_IS_OWNER) != 0);
+    path_ = NULL;
+    pathSize_ = 0;
+    storageId_ = NULL;
+    storageIdSize_ = 0;
+
+    if (flags & BINARY_FLAG_NUMERIC_STORAGE_ID)
+    {
+      // format the integer backwards at the end of the buffer
+      uint64_t value = DecodeVarint(position, end);
+
+      char* digits = storageIdBuffer_ + sizeof(storageIdBuffer_);
+      do
+      {
+        digits--;
+        *digits = static_cast<char>('0' + value % 10);
+        value /= 10;
+      } while (value != 0);
+
+      storageId_ = digits;
+      storageIdSize_ = static_cast<size_t>(storageIdBuffer_ + sizeof(storageIdBuffer_) - digits);
+    }
+    else if (flags & BINARY_FLAG_HAS_STORAGE_ID)
+    {
+      storageId_ = DecodeBytes(storageIdSize_, position, end);
+    }
+
+    if (flags & BINARY_FLAG_HAS_PATH)
+    {
+      path_ = DecodeBytes(pathSize_, position, end);
+    }
+
+    if (position != end)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Advanced Storage - Trailing bytes in a binary CustomData");
+    }
+
+    return true;
+  }
+
+
+  void SerializedCustomData::Encode(std::string& target,
+                                    bool isOwner,
+                                    const std::string& path,
+                                    const std::string& storageId)
+  {
+    uint8_t flags = 0;
+    uint64_t numericStorageId = 0;
+
+    if (isOwner)
+    {
+      flags |= BINARY_FLAG_IS_OWNER;
+    }
+
+    if (!path.empty())
+    {
+      flags |= BINARY_FLAG_HAS_PATH;
+    }
+
+    if (!storageId.empty())
+    {
+      flags |= BINARY_FLAG_HAS_STORAGE_ID;
+
+      if (IsNumericStorageId(numericStorageId, storageId))
+      {
+        flags |= BINARY_FLAG_NUMERIC_STORAGE_ID;
+      }
+    }
+
+    target.clear();
+    target.reserve(2 + 13 + storageId.size() + 13 + path.size());
+    target.push_back(static_cast<char>(BINARY_VERSION));
+    target.push_back(static_cast<char>(BINARY_FLAGS_BASE + flags));
+
+    if (flags & BINARY_FLAG_NUMERIC_STORAGE_ID)
+    {
+      EncodeVarint(target, numericStorageId);
+    }
+    else if (flags & BINARY_FLAG_HAS_STORAGE_ID)
+    {
+      EncodeVarint(target, storageId.size());
+      target.append(storageId);
+    }
+
+    if (flags & BINARY_FLAG_HAS_PATH)
+    {
+      EncodeVarint(target, path.size());
+      target.append(path);
+    }
+  }
+
+
+  void CustomData::SetSerializationFormat(CustomDataFormat format)
+  {
+    serializationFormat_ = format;
+  }
+
   void CustomData::SetCurrentWriteStorageId(const std::string& storageId)
   {
-    if (storagesRootPaths_.find(storageId) == storagesRootPaths_.end())
+    boost::mutex::scoped_lock lock(publishMutex_);
+
+    boost::shared_ptr<StoragesTable> table(new StoragesTable(GetTable()));
+    table->currentWriteStorage_ = table->FindStorage(storageId);
+
+    if (table->currentWriteStorage_ == NO_STORAGE)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Advanced Storage - CurrentWriteStorage is not defined in Storages list " + storageId);
     }
 
-    currentWriteStorageId_ = storageId;
+    Publish(table);
   }
 
   void CustomData::SetOtherAttachmentsPrefix(const std::string& prefix)
@@ -65,80 +423,198 @@ namespace OrthancPlugins
 
   bool CustomData::IsARootPath(const boost::filesystem::path& path)
   {
-    if (path == orthancCoreRootPath_)
-    {
-      return true;
-    }
+    const StoragesTable& table = GetTable();
+    return table.rootPaths_.find(path.native()) != table.rootPaths_.end();
+  }
+
+  void CustomData::SetStorageRootPath(const std::string& storageId, const std::string& rootPath, const WritePolicy& writePolicy)
+  {
+    boost::mutex::scoped_lock lock(publishMutex_);
 
-    for (std::map<std::string, boost::filesystem::path>::const_iterator it = storagesRootPaths_.begin(); it != storagesRootPaths_.end(); ++it)
+    boost::shared_ptr<StoragesTable> table(new StoragesTable(GetTable()));
+
+    // a storage that is defined again keeps its index
+    size_t index = table->FindStorage(storageId);
+    if (index == NO_STORAGE)
     {
-      if (path == it->second)
-      {
-        return true;
-      }
+      index = table->storages_.size();
+      table->storages_.push_back(Storage());
     }
 
-    return false;
+    Storage& storage = table->storages_[index];
+    storage.id_ = storageId;
+    storage.rootPath_ = Orthanc::SystemToolbox::PathFromUtf8(rootPath);
+    storage.rootPathUtf8_ = Orthanc::SystemToolbox::PathToUtf8(storage.rootPath_);
+    storage.writePolicy_ = writePolicy;
+
+    Publish(table);
   }
 
-  void CustomData::SetStorageRootPath(const std::string& storageId, const std::string& rootPath)
+  void CustomData::SetDefaultWritePolicy(const WritePolicy& writePolicy)
   {
-    storagesRootPaths_[storageId] = Orthanc::SystemToolbox::PathFromUtf8(rootPath);
+    boost::mutex::scoped_lock lock(publishMutex_);
+
+    boost::shared_ptr<StoragesTable> table(new StoragesTable(GetTable()));
+    table->defaultWritePolicy_ = writePolicy;
+
+    Publish(table);
   }
 
   boost::filesystem::path CustomData::GetStorageRootPath(const std::string& storageId)
   {
-    if (storagesRootPaths_.find(storageId) == storagesRootPaths_.end())
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Advanced Storage - no storage root path found for storage  '" + storageId + "'");
-    }
-
-    return storagesRootPaths_[storageId];
+    const StoragesTable& table = GetTable();
+    return table.GetStorage(table.FindStorage(storageId), storageId).rootPath_;
   }
 
   bool CustomData::IsMultipleStoragesEnabled()
   {
-    return storagesRootPaths_.size() > 0 && !currentWriteStorageId_.empty();
+    return GetTable().IsMultipleStoragesEnabled();
   }
 
   void CustomData::SetOrthancCoreRootPath(const std::string& rootPath)
   {
-    orthancCoreRootPath_ = Orthanc::SystemToolbox::PathFromUtf8(rootPath);
+    boost::mutex::scoped_lock lock(publishMutex_);
+
+    boost::shared_ptr<StoragesTable> table(new StoragesTable(GetTable()));
+    table->orthancCoreRootPath_ = Orthanc::SystemToolbox::PathFromUtf8(rootPath);
+    table->orthancCoreRootPathUtf8_ = Orthanc::SystemToolbox::PathToUtf8(table->orthancCoreRootPath_);
+
+    Publish(table);
   }
 
   boost::filesystem::path CustomData::GetOrthancCoreRootPath()
   {
-    if (orthancCoreRootPath_.empty())
+    return GetTable().GetOrthancCoreRootPath();
+  }
+
+  boost::filesystem::path CustomData::GetCurrentWriteRootPath()
+  {
+    const StoragesTable& table = GetTable();
+
+    if (table.IsMultipleStoragesEnabled())
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Advanced Storage - no Orthanc storage directory defined");
+      return table.storages_[table.currentWriteStorage_].rootPath_;
     }
+    
+    return table.GetOrthancCoreRootPath();
+  }
 
-    return orthancCoreRootPath_;
+  void CustomData::GetAllRootPaths(std::vector<boost::filesystem::path>& target)
+  {
+    const StoragesTable& table = GetTable();
+
+    target.clear();
+
+    if (!table.orthancCoreRootPath_.empty())
+    {
+      target.push_back(table.orthancCoreRootPath_);
+    }
+
+    for (size_t i = 0; i < table.storages_.size(); i++)
+    {
+      target.push_back(table.storages_[i].rootPath_);
+    }
   }
 
-  boost::filesystem::path CustomData::GetCurrentWriteRootPath()
+  size_t CustomData::GetStoragesCount()
   {
-    if (IsMultipleStoragesEnabled())
+    return GetTable().storages_.size();
+  }
+
+  std::string CustomData::GetStorageName(size_t storageNumber)
+  {
+    const StoragesTable& table = GetTable();
+
+    if (storageNumber == 0)
     {
-      return GetStorageRootPath(currentWriteStorageId_);
+      return "OrthancStorage";
+    }
+    else if (storageNumber <= table.storages_.size())
+    {
+      return table.storages_[storageNumber - 1].id_;
+    }
+    else
+    {
+      return "AdoptedFiles";
+    }
+  }
+
+  static bool IsUnderRootPath(const boost::filesystem::path::string_type& path,
+                              const boost::filesystem::path& rootPath)
+  {
+    const boost::filesystem::path::string_type& root = rootPath.native();
+
+    if (root.empty() ||
+        path.size() <= root.size() ||
+        path.compare(0, root.size(), root) != 0)
+    {
+      return false;
+    }
+
+    const boost::filesystem::path::value_type last = root[root.size() - 1];
+    const boost::filesystem::path::value_type next = path[root.size()];
+
+    return (last == '/' || last == boost::filesystem::path::preferred_separator ||
+            next == '/' || next == boost::filesystem::path::preferred_separator);
+  }
+
+  size_t CustomData::FindStorageNumber(const boost::filesystem::path& absolutePath)
+  {
+    const StoragesTable& table = GetTable();
+
+    // the storages of the MultipleStorages first, since their root paths may be nested in the one of the core
+    for (size_t i = 0; i < table.storages_.size(); i++)
+    {
+      if (IsUnderRootPath(absolutePath.native(), table.storages_[i].rootPath_))
+      {
+        return i + 1;
+      }
+    }
+
+    if (IsUnderRootPath(absolutePath.native(), table.orthancCoreRootPath_))
+    {
+      return 0;
+    }
+
+    return table.storages_.size() + 1;
+  }
+
+  size_t CustomData::GetStorageNumber() const
+  {
+    if (path_.is_absolute())
+    {
+      return GetTable().storages_.size() + 1;
+    }
+    else if (storageIndex_ != NO_STORAGE)
+    {
+      return storageIndex_ + 1;
+    }
+    else
+    {
+      return 0;
     }
-    
-    return GetOrthancCoreRootPath();
   }
 
   CustomData::CustomData() :
     isOwner_(true),
+    storageIndex_(NO_STORAGE),
     hasBeenAdopted_(false)
   {
   }
 
+  void CustomData::SetStorageId(const std::string& storageId)
+  {
+    storageId_ = storageId;
+    storageIndex_ = (storageId.empty() ? NO_STORAGE : GetTable().FindStorage(storageId));
+  }
+
   CustomData CustomData::CreateForMoveStorage(const CustomData& currentCustomData, const std::string& targetStorageId)
   {
     CustomData cd;
     cd.uuid_ = currentCustomData.uuid_;
     cd.path_ = currentCustomData.path_;
     cd.isOwner_ = currentCustomData.isOwner_;
-    cd.storageId_ = targetStorageId;
+    cd.SetStorageId(targetStorageId);
 
     return cd;
   }
@@ -150,7 +626,29 @@ namespace OrthancPlugins
     CustomData cd;
     cd.uuid_ = uuid;
 
-    if (customDataSize != 0)
+    SerializedCustomData binary;
+
+    if (customDataSize != 0 &&
+        binary.Decode(customDataBuffer, customDataSize))
+    {
+      cd.isOwner_ = binary.isOwner_;
+
+      if (!cd.isOwner_ && binary.path_ == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, std::string("Advanced Storage - an adopted file has no path ! - ") + uuid);
+      }
+
+      if (binary.path_ != NULL)
+      {
+        cd.path_ = Orthanc::SystemToolbox::PathFromUtf8(std::string(binary.path_, binary.pathSize_));
+      }
+
+      if (binary.storageId_ != NULL)
+      {
+        cd.SetStorageId(std::string(binary.storageId_, binary.storageIdSize_));
+      }
+    }
+    else if (customDataSize != 0)
     {
       Json::Value v;
       OrthancPlugins::ReadJson(v, customDataBuffer, customDataSize);
@@ -168,7 +666,7 @@ namespace OrthancPlugins
         
         if (v.isMember(SERIALIZATION_KEY_STORAGE_ID))
         {
-          cd.storageId_ = v[SERIALIZATION_KEY_STORAGE_ID].asString();
+          cd.SetStorageId(v[SERIALIZATION_KEY_STORAGE_ID].asString());
         }
       }
       else
@@ -196,15 +694,38 @@ namespace OrthancPlugins
   CustomData CustomData::CreateForWriting(const std::string& uuid,
                                           const boost::filesystem::path& relativePath)
   {
+    const StoragesTable& table = GetTable();
+
     CustomData cd;
     cd.isOwner_ = true;
     cd.uuid_ = uuid;
-    cd.storageId_ = currentWriteStorageId_;
     cd.path_ = relativePath;
 
-    boost::filesystem::path rootPath = CustomData::GetCurrentWriteRootPath();
-    boost::filesystem::path absolutePath = rootPath / cd.path_;
-    std::string absolutPathUtf8Str = Orthanc::SystemToolbox::PathToUtf8(absolutePath);
+    const boost::filesystem::path* rootPath;
+    const std::string* rootPathUtf8;
+
+    if (table.IsMultipleStoragesEnabled())
+    {
+      const Storage& storage = table.storages_[table.currentWriteStorage_];
+      cd.storageId_ = storage.id_;
+      cd.storageIndex_ = table.currentWriteStorage_;
+      rootPath = &storage.rootPath_;
+      rootPathUtf8 = &storage.rootPathUtf8_;
+    }
+    else
+    {
+      rootPath = &table.GetOrthancCoreRootPath();
+      rootPathUtf8 = &table.orthancCoreRootPathUtf8_;
+    }
+
+    std::string absolutPathUtf8Str = *rootPathUtf8;
+    if (!absolutPathUtf8Str.empty() &&
+        absolutPathUtf8Str[absolutPathUtf8Str.size() - 1] != '/' &&
+        absolutPathUtf8Str[absolutPathUtf8Str.size() - 1] != boost::filesystem::path::preferred_separator)
+    {
+      absolutPathUtf8Str += static_cast<char>(boost::filesystem::path::preferred_separator);
+    }
+    absolutPathUtf8Str += Orthanc::SystemToolbox::PathToUtf8(cd.path_);
 
     // check that the final path is not 'above' the root path (this could happen if e.g., a PatientName is ../../../../toto)
     // fs::canonical() can not be used for that since the file needs to exist
@@ -221,9 +742,8 @@ namespace OrthancPlugins
         cd.path_ = PathGenerator::GetLegacyRelativePath(uuid);
       }
       
-      boost::filesystem::path absoluteLegacyPath = rootPath / cd.path_;
+      boost::filesystem::path absoluteLegacyPath = *rootPath / cd.path_;
       LOG(WARNING) << "Advanced Storage - WAS02 - Path is suspicious since it contains '..' or '=': '" << absolutPathUtf8Str << "' will be stored in '" << Orthanc::SystemToolbox::PathToUtf8(absoluteLegacyPath) << "'";
-      absolutePath = absoluteLegacyPath;
     }
     else if (absolutPathUtf8Str.size() > maxPathLength_) // check path length !!!!!, if too long, go back to legacy path and issue a warning
     {
@@ -236,31 +756,62 @@ namespace OrthancPlugins
         cd.path_ = PathGenerator::GetLegacyRelativePath(uuid);
       }
 
-      boost::filesystem::path absoluteLegacyPath = rootPath / cd.path_;
+      boost::filesystem::path absoluteLegacyPath = *rootPath / cd.path_;
       LOG(WARNING) << "Advanced Storage - WAS01 - Path is too long: '" << absolutPathUtf8Str << "' will be stored in '" << absoluteLegacyPath << "'";
-      absolutePath = absoluteLegacyPath;
     }
 
     return cd;
   }
 
-  boost::filesystem::path CustomData::GetAbsolutePath() const
+  // The root path of a relative path
+  static const boost::filesystem::path& GetRelativeRootPath(const StoragesTable& table,
+                                                            const std::string& storageId,
+                                                            size_t storageIndex)
+  {
+    if (!storageId.empty())
+    {
+      return table.GetStorage(storageIndex, storageId).rootPath_;
+    }
+    else
+    {
+      return table.GetOrthancCoreRootPath();
+    }
+  }
+
+  boost::filesystem::path CustomData::GetRootPath() const
   {
     if (path_.is_absolute())
     {
-      return path_;
+      return boost::filesystem::path();
     }
+    else
+    {
+      return GetRelativeRootPath(GetTable(), storageId_, storageIndex_);
+    }
+  }
 
-    boost::filesystem::path absolutePath;
+  const WritePolicy& CustomData::GetWritePolicy() const
+  {
+    const StoragesTable& table = GetTable();
 
-    if (!storageId_.empty())
+    if (storageIndex_ < table.storages_.size())
     {
-      absolutePath = GetStorageRootPath(storageId_);
+      return table.storages_[storageIndex_].writePolicy_;
     }
     else
     {
-      absolutePath = GetOrthancCoreRootPath();
+      return table.defaultWritePolicy_;
     }
+  }
+
+  boost::filesystem::path CustomData::GetAbsolutePath() const
+  {
+    if (path_.is_absolute())
+    {
+      return path_;
+    }
+
+    boost::filesystem::path absolutePath = GetRelativeRootPath(GetTable(), storageId_, storageIndex_);
 
     if (!path_.empty())
     {
@@ -286,17 +837,28 @@ namespace OrthancPlugins
       return;
     }
 
+    // no need to store the path if we are in the default mode
+    // unless it is a file that has been adopted
+    const bool hasPath = (!PathGenerator::IsDefaultNamingScheme() || hasBeenAdopted_);
+    const bool hasStorageId = (IsMultipleStoragesEnabled() && isOwner_ && !hasBeenAdopted_);
+
+    if (serializationFormat_ == CustomDataFormat_Binary)
+    {
+      SerializedCustomData::Encode(serialized, isOwner_,
+                                   hasPath ? Orthanc::SystemToolbox::PathToUtf8(path_) : std::string(),
+                                   hasStorageId ? storageId_ : std::string());
+      return;
+    }
+
     Json::Value v;
     v[SERIALIZATION_KEY_VERSION] = 1;
 
-    // no need to store the path if we are in the default mode
-    // unless it is a file that has been adopted
-    if (!PathGenerator::IsDefaultNamingScheme() || hasBeenAdopted_)
+    if (hasPath)
     { 
       v[SERIALIZATION_KEY_PATH] = Orthanc::SystemToolbox::PathToUtf8(path_);
     }
 
-    if (IsMultipleStoragesEnabled() && isOwner_ && !hasBeenAdopted_)
+    if (hasStorageId)
     {
       v[SERIALIZATION_KEY_STORAGE_ID] = storageId_;
     }
@@ -308,7 +870,7 @@ namespace OrthancPlugins
 
   bool CustomData::HasStorage(const std::string& storageId)
   {
-    return storagesRootPaths_.find(storageId) != storagesRootPaths_.end();
+    return GetTable().FindStorage(storageId) != NO_STORAGE;
   }
 
 }
@@ -19,23 +19,65 @@
 
 #pragma once
 
+#include "WritePolicy.h"
+
 #include <boost/filesystem.hpp>
 #include <string.h>
+#include <vector>
 
 namespace OrthancPlugins
 {
+  enum CustomDataFormat
+  {
+    CustomDataFormat_Json,    // version 1: {"v":1,"o":..,"p":..,"s":..}
+    CustomDataFormat_Binary   // version 2: see SerializedCustomData
+  };
+
+
+  // The fields of a serialized CustomData in the binary format (version 2), pointing into the
+  // serialized buffer.  Decoding does not allocate any memory.  The layout is:
+  //   - 1 byte: version ('2')
+  //   - 1 byte: 'A' + flags (owner, has path, has storage id, numeric storage id)
+  //   - if the storage id is numeric (e.g. "1", "2"...): its value as a varint
+  //     otherwise, if there is a storage id: its length as a varint followed by its bytes
+  //   - if there is a path: its length as a varint followed by its UTF-8 bytes
+  // The varints store 5 bits per character ('0'..'O' for the last one, 'P'..'o' before), so that
+  // the CustomData is valid UTF-8 text without any NUL byte if the path and storage id are.
+  struct SerializedCustomData
+  {
+    bool         isOwner_;
+    const char*  path_;
+    size_t       pathSize_;
+    const char*  storageId_;
+    size_t       storageIdSize_;
+    char         storageIdBuffer_[24];  // to format the numeric storage ids
+
+    // Returns false if the buffer is not in the binary format (i.e. it is a v1 JSON).  Throws
+    // if the buffer is in the binary format but is corrupted.
+    bool Decode(const void* buffer,
+                uint64_t size);
+
+    static void Encode(std::string& target,
+                       bool isOwner,
+                       const std::string& path,         // empty if not stored
+                       const std::string& storageId);   // empty if not stored
+  };
+
 
   class CustomData
   {
     boost::filesystem::path     path_;
     bool                        isOwner_;
     std::string                 storageId_;
+    size_t                      storageIndex_;  // index of storageId_ in the storages table
     std::string                 uuid_;
     bool                        hasBeenAdopted_; // internal, not serialized
 
   protected:
     CustomData();
 
+    void SetStorageId(const std::string& storageId);
+
   public:
 
     static CustomData FromString(const std::string& uuid,
@@ -51,11 +93,14 @@ namespace OrthancPlugins
 
     static void SetMaxPathLength(size_t maxPathLength);
 
+    // The format of the new custom data (both formats are always read)
+    static void SetSerializationFormat(CustomDataFormat format);
+
     static void SetCurrentWriteStorageId(const std::string& storageId);
 
     static void SetOtherAttachmentsPrefix(const std::string& prefix);
 
-    static void SetStorageRootPath(const std::string& storageId, const std::string& rootPath);
+    static void SetStorageRootPath(const std::string& storageId, const std::string& rootPath, const WritePolicy& writePolicy);
 
     static boost::filesystem::path GetStorageRootPath(const std::string& storageId);
 
@@ -63,16 +108,39 @@ namespace OrthancPlugins
 
     static void SetOrthancCoreRootPath(const std::string& rootPath);
 
+    // The write policy of the Orthanc core storage and of the storages that don't define one
+    static void SetDefaultWritePolicy(const WritePolicy& writePolicy);
+
     static boost::filesystem::path GetOrthancCoreRootPath();
 
     static boost::filesystem::path GetCurrentWriteRootPath();
 
+    // The Orthanc core storage and all the storages of the MultipleStorages
+    static void GetAllRootPaths(std::vector<boost::filesystem::path>& target);
+
+    // The storages are also numbered, to collect per-storage statistics without any lookup: 0 for
+    // the Orthanc core storage, i + 1 for the i-th storage of the MultipleStorages, and
+    // GetStoragesCount() + 1 for the adopted files
+    static size_t GetStoragesCount();
+
+    static std::string GetStorageName(size_t storageNumber);
+
+    // The number of the storage whose root path contains this file
+    static size_t FindStorageNumber(const boost::filesystem::path& absolutePath);
+
     void ToString(std::string& serialized) const;
 
     static bool IsARootPath(const boost::filesystem::path& path);
 
     boost::filesystem::path GetAbsolutePath() const;
 
+    // The root of the storage the file belongs to (empty for absolute paths)
+    boost::filesystem::path GetRootPath() const;
+
+    const WritePolicy& GetWritePolicy() const;
+
+    size_t GetStorageNumber() const;
+
     bool IsRelativePath() const
     {
       return !path_.is_absolute();
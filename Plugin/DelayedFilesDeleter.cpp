@@ -27,26 +27,139 @@
 #include <SystemToolbox.h>
 #include <Toolbox.h>
 
+#include "CustomData.h"
 #include "DelayedFilesDeleter.h"
+#include "FileDescriptorsCache.h"
+#include "LogsVerbosity.h"
 #include "Helpers.h"
+#include <algorithm>
 #include <stack>
 
+#if !defined(_WIN32)
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
 static bool deidentifyLogs_ = true;
 
 namespace OrthancPlugins
 {
   static const char* QUEUE_ID_DELAYED_DELETER = "advst-delayed-deletion";
+  static const size_t MAX_BATCH_SIZE = 64;               // max number of files reserved (one by one) before deleting them
+  static const uint32_t RESERVATION_TIMEOUT_SECONDS = 60;  // a file is handed to another worker if not acknowledged by then
+  static const unsigned int IDLE_POLLING_MS = 1000;      // to see the files scheduled by the other Orthanc
+
+
+  // The throttling delay is slept after each file: the whole batch must be deleted well before
+  // its first reservation expires, otherwise the same files would be deleted by another worker
+  static size_t GetBatchSize(double delayMs)
+  {
+    const double maxFiles = static_cast<double>(RESERVATION_TIMEOUT_SECONDS) * 1000.0 / (2.0 * std::max(1.0, delayMs));
+
+    if (maxFiles < 1.0)
+    {
+      return 1;
+    }
+    else if (maxFiles >= static_cast<double>(MAX_BATCH_SIZE))
+    {
+      return MAX_BATCH_SIZE;
+    }
+    else
+    {
+      return static_cast<size_t>(maxFiles);
+    }
+  }
+
+
+#if !defined(_WIN32)
+  // The directory of the last deleted file, kept open by a worker: the files of a study are usually
+  // deleted one after the other and unlinkat() does not resolve the whole path again for each file
+  class ParentDirectory : public boost::noncopyable
+  {
+    int          fd_;
+    std::string  path_;
+
+    void Close()
+    {
+      if (fd_ >= 0)
+      {
+        close(fd_);
+        fd_ = -1;
+      }
+
+      path_.clear();
+    }
+
+  public:
+    ParentDirectory() :
+      fd_(-1)
+    {
+    }
+
+    ~ParentDirectory()
+    {
+      Close();
+    }
+
+    void RemoveFile(const fs::path& path)
+    {
+      const std::string parent = path.parent_path().string();
+      const std::string filename = path.filename().string();
+
+      if (fd_ >= 0 &&
+          path_ == parent)
+      {
+        if (unlinkat(fd_, filename.c_str(), 0) == 0 ||
+            errno != ENOENT)
+        {
+          return;
+        }
+
+        // the cached directory might have been removed (and created again) since it was opened
+      }
+
+      Close();
+
+      fd_ = open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd_ >= 0)
+      {
+        path_ = parent;
+        unlinkat(fd_, filename.c_str(), 0);
+      }
+    }
+  };
+#else
+  class ParentDirectory : public boost::noncopyable
+  {
+  public:
+    void RemoveFile(const fs::path& path)
+    {
+      fs::remove(path);
+    }
+  };
+#endif
+
 
   void DelayedFilesDeleter::SetDeidentifyLogs(bool deidentifyLogs)
   {
     deidentifyLogs_ = deidentifyLogs;
   }
 
-  DelayedFilesDeleter::DelayedFilesDeleter(unsigned int throttleDelayMs) :
-    throttleDelayMs_(throttleDelayMs),
+  DelayedFilesDeleter::DelayedFilesDeleter(unsigned int throttleDelayMs,
+                                           unsigned int threadsCount) :
+    throttle_(throttleDelayMs),
+    threadsCount_(threadsCount == 0 ? 1 : threadsCount),
     isRunning_(false),
-    queueFilesToDelete_(QUEUE_ID_DELAYED_DELETER)
+    queueFilesToDelete_(QUEUE_ID_DELAYED_DELETER),
+    deletedFiles_(0),
+    lastEmptyQueue_(time(NULL))
   {
+    for (size_t i = 0; i < RATE_WINDOW_SECONDS; i++)
+    {
+      rateTimes_[i] = 0;
+      rateCounts_[i] = 0;
+    }
   }
   
   DelayedFilesDeleter::~DelayedFilesDeleter()
@@ -64,45 +177,117 @@ namespace OrthancPlugins
   void DelayedFilesDeleter::Start()
   {
     isRunning_ = true;
-    thread_ = boost::thread(DelayedFilesDeleterWorkerThread, this);
+
+    for (unsigned int i = 0; i < threadsCount_; i++)
+    {
+      threads_.create_thread(boost::bind(DelayedFilesDeleterWorkerThread, this));
+    }
   }
 
   void DelayedFilesDeleter::Stop()
   {
-    isRunning_ = false;
-    if (thread_.joinable())
     {
-      thread_.join();
+      boost::mutex::scoped_lock lock(mutex_);
+      isRunning_ = false;
+      fileScheduled_.notify_all();
     }
+
+    threads_.join_all();
+  }
+
+  void DelayedFilesDeleter::NotifyDeletedFiles(size_t count)
+  {
+    const time_t now = time(NULL);
+    const size_t slot = static_cast<size_t>(now) % RATE_WINDOW_SECONDS;
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    deletedFiles_ += count;
+
+    if (rateTimes_[slot] != now)
+    {
+      rateTimes_[slot] = now;
+      rateCounts_[slot] = 0;
+    }
+
+    rateCounts_[slot] += count;
   }
 
   void DelayedFilesDeleter::WorkerThread()
   {
+    ParentDirectory parentDirectory;
+
+    std::vector<std::string> batch;
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 10)
+    std::vector<uint64_t> valueIds;
+#endif
+
     while (isRunning_)
     {
-      std::string pathToDeleteUtf8Str;
+      batch.clear();
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 10)
+      valueIds.clear();
+#endif
+
+      const size_t batchSize = GetBatchSize(throttle_.GetCurrentDelayMs());
+
+      while (batch.size() < batchSize && isRunning_)
+      {
+        std::string pathToDeleteUtf8Str;
 
 #if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 10)
-      uint64_t valueId;      
-      while (queueFilesToDelete_.ReserveFront(pathToDeleteUtf8Str, valueId, 5) && isRunning_)
+        uint64_t valueId;
+        if (!queueFilesToDelete_.ReserveFront(pathToDeleteUtf8Str, valueId, RESERVATION_TIMEOUT_SECONDS))
+        {
+          break;
+        }
+
+        valueIds.push_back(valueId);
 #else
-      while (queueFilesToDelete_.DequeueFront(pathToDeleteUtf8Str) && isRunning_)
+        if (!queueFilesToDelete_.DequeueFront(pathToDeleteUtf8Str))
+        {
+          break;
+        }
 #endif
+
+        batch.push_back(pathToDeleteUtf8Str);
+      }
+
+      if (batch.empty())
       {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        lastEmptyQueue_ = time(NULL);
+
+        if (isRunning_)
+        {
+          // woken up as soon as a file is scheduled by this Orthanc
+          fileScheduled_.timed_wait(lock, boost::posix_time::milliseconds(IDLE_POLLING_MS));
+        }
+
+        continue;
+      }
+
+      // the reserved files are all deleted, even if the plugin is stopping
+      for (size_t i = 0; i < batch.size(); i++)
+      {
+        size_t storageNumber = 0;
+
         try
         {
-          std::string pathForLogs = pathToDeleteUtf8Str;
-          if (deidentifyLogs_) // we never know how the path was generated -> always deidentify
+          boost::filesystem::path pathToDelete = Orthanc::SystemToolbox::PathFromUtf8(batch[i]);
+          storageNumber = CustomData::FindStorageNumber(pathToDelete);
+
+          if (LogsVerbosity::IsVerbose())
           {
-            pathForLogs = "*** POTENTIAL PHI ***";
+            // we never know how the path was generated -> always deidentify
+            LOG(INFO) << "Delayed deletion of file " << PathForLogs(pathToDelete, deidentifyLogs_);
           }
 
-          LOG(INFO) << "Delayed deletion of file " << pathForLogs;
-          boost::filesystem::path pathToDelete = Orthanc::SystemToolbox::PathFromUtf8(pathToDeleteUtf8Str);
-
-          fs::remove(pathToDelete);
+          FileDescriptorsCache::Invalidate(pathToDelete);
+          parentDirectory.RemoveFile(pathToDelete);
 
-          // Remove the empty parent directories, (ignoring the error code if these directories are not empty)
+          // The parent directories are removed in the background, if they are empty
           RemoveEmptyParentDirectories(pathToDelete);
         }
         catch (...)
@@ -110,27 +295,56 @@ namespace OrthancPlugins
           // Ignore the error
         }
 #if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 10)
-        queueFilesToDelete_.Acknowledge(valueId);
+        queueFilesToDelete_.Acknowledge(valueIds[i]);
 #endif
 
-        if (throttleDelayMs_ > 0)
-        {
-          boost::this_thread::sleep(boost::posix_time::milliseconds(throttleDelayMs_));
-        }
+        // only slowed down by the foreground calls on the storage of this file
+        throttle_.Sleep(storageNumber);
       }
 
-      // sleep 1 seconds between each check when there is nothing to delete
-      boost::this_thread::sleep(boost::posix_time::milliseconds(1000));
+      NotifyDeletedFiles(batch.size());
     }
   }
 
   void DelayedFilesDeleter::ScheduleFileDeletion(const std::string& path)
   {
     queueFilesToDelete_.Enqueue(path);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    fileScheduled_.notify_one();
   }
 
   uint64_t DelayedFilesDeleter::GetPendingDeletionFilesCount()
   {
     return queueFilesToDelete_.GetSize();
   }
+
+  void DelayedFilesDeleter::GetStatistics(Json::Value& target)
+  {
+    const uint64_t pending = GetPendingDeletionFilesCount();
+    const time_t now = time(NULL);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // the rate over the last complete seconds of the window
+    uint64_t recent = 0;
+    for (size_t i = 0; i < RATE_WINDOW_SECONDS; i++)
+    {
+      if (rateTimes_[i] < now &&
+          rateTimes_[i] >= now - static_cast<time_t>(RATE_WINDOW_SECONDS))
+      {
+        recent += rateCounts_[i];
+      }
+    }
+
+    target = Json::objectValue;
+    target["Threads"] = threadsCount_;
+    target["ThrottleDelayMs"] = throttle_.GetCurrentDelayMs();
+    target["PendingFiles"] = static_cast<Json::UInt64>(pending);
+    target["DeletedFiles"] = static_cast<Json::UInt64>(deletedFiles_);
+    target["FilesPerSecond"] = static_cast<double>(recent) / static_cast<double>(RATE_WINDOW_SECONDS);
+
+    // since the queue was last seen empty: this bounds the age of the oldest pending file
+    target["BacklogAgeSeconds"] = (pending == 0 ? 0 : static_cast<Json::UInt64>(now - lastEmptyQueue_));
+  }
 }
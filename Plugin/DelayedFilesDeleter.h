@@ -23,27 +23,49 @@
 #pragma once
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "AdaptiveThrottle.h"
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
+#include <json/value.h>
 
 #include <list>
 #include <string.h>
+#include <time.h>
 
 namespace fs = boost::filesystem;
 
 namespace OrthancPlugins
 {
 
+  // A pool of workers that delete the files scheduled in the "advst-delayed-deletion" queue.
+  // Each worker reserves a few files (one ReserveFront() each) before deleting them, and the
+  // workers are woken up as soon as a file is scheduled by this Orthanc (the files scheduled by
+  // the other Orthanc sharing the same DB are picked up by polling).
   class DelayedFilesDeleter
   {
-    unsigned int              throttleDelayMs_;
+    static const size_t RATE_WINDOW_SECONDS = 60;
+
+    AdaptiveThrottle          throttle_;
+    unsigned int              threadsCount_;
     
     volatile bool             isRunning_;
-    boost::thread             thread_;
+    boost::thread_group       threads_;
     OrthancPlugins::Queue     queueFilesToDelete_;
 
+    boost::mutex              mutex_;
+    boost::condition_variable fileScheduled_;
+
+    // statistics, protected by mutex_
+    uint64_t                  deletedFiles_;
+    time_t                    lastEmptyQueue_;  // the last time a worker has found the queue empty
+    time_t                    rateTimes_[RATE_WINDOW_SECONDS];
+    uint64_t                  rateCounts_[RATE_WINDOW_SECONDS];
+
+    void NotifyDeletedFiles(size_t count);
+
   public:
-    explicit DelayedFilesDeleter(unsigned int throttleDelayMs);
+    DelayedFilesDeleter(unsigned int throttleDelayMs,
+                        unsigned int threadsCount);
 
     ~DelayedFilesDeleter();
 
@@ -57,6 +79,8 @@ namespace OrthancPlugins
 
     uint64_t GetPendingDeletionFilesCount();
 
+    void GetStatistics(Json::Value& target);
+
     static void SetDeidentifyLogs(bool deidentifyLogs);
   };
 
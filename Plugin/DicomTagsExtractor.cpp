@@ -0,0 +1,454 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "DicomTagsExtractor.h"
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <stdint.h>
+#include <string.h>
+
+
+namespace OrthancPlugins
+{
+  static const uint32_t UNDEFINED_LENGTH = 0xFFFFFFFF;
+  static const unsigned int MAX_SEQUENCE_DEPTH = 32;
+
+  static const char* const TRANSFER_SYNTAX_IMPLICIT_LITTLE_ENDIAN = "1.2.840.10008.1.2";
+  static const char* const TRANSFER_SYNTAX_EXPLICIT_BIG_ENDIAN = "1.2.840.10008.1.2.2";
+  static const char* const TRANSFER_SYNTAX_DEFLATED = "1.2.840.10008.1.2.1.99";
+
+  static const Orthanc::DicomTag TAG_TRANSFER_SYNTAX_UID(0x0002, 0x0010);
+  static const Orthanc::DicomTag TAG_SPECIFIC_CHARACTER_SET(0x0008, 0x0005);
+
+
+  namespace
+  {
+    // A bounds-checked little endian reader over the DICOM buffer
+    class Reader
+    {
+      const uint8_t*  buffer_;
+      size_t          size_;
+      size_t          position_;
+
+    public:
+      Reader(const void* buffer, size_t size) :
+        buffer_(reinterpret_cast<const uint8_t*>(buffer)),
+        size_(size),
+        position_(0)
+      {
+      }
+
+      bool IsEnd() const
+      {
+        return position_ >= size_;
+      }
+
+      bool Skip(size_t length)
+      {
+        if (length > size_ - position_)
+        {
+          return false;
+        }
+
+        position_ += length;
+        return true;
+      }
+
+      bool PeekUInt16(uint16_t& value) const
+      {
+        if (size_ - position_ < 2)
+        {
+          return false;
+        }
+
+        value = static_cast<uint16_t>(buffer_[position_] | (buffer_[position_ + 1] << 8));
+        return true;
+      }
+
+      bool ReadUInt16(uint16_t& value)
+      {
+        return PeekUInt16(value) && Skip(2);
+      }
+
+      bool ReadUInt32(uint32_t& value)
+      {
+        if (size_ - position_ < 4)
+        {
+          return false;
+        }
+
+        value = (static_cast<uint32_t>(buffer_[position_]) |
+                 (static_cast<uint32_t>(buffer_[position_ + 1]) << 8) |
+                 (static_cast<uint32_t>(buffer_[position_ + 2]) << 16) |
+                 (static_cast<uint32_t>(buffer_[position_ + 3]) << 24));
+        position_ += 4;
+        return true;
+      }
+
+      bool ReadString(std::string& value, size_t length)
+      {
+        if (length > size_ - position_)
+        {
+          return false;
+        }
+
+        // remove the trailing padding
+        size_t end = length;
+        while (end > 0 && (buffer_[position_ + end - 1] == ' ' || buffer_[position_ + end - 1] == '\0'))
+        {
+          end--;
+        }
+
+        value.assign(reinterpret_cast<const char*>(buffer_ + position_), end);
+        position_ += length;
+        return true;
+      }
+    };
+
+    struct ElementHeader
+    {
+      uint16_t  group_;
+      uint16_t  element_;
+      char      vr_[2];
+      uint32_t  length_;
+
+      bool IsUnknownVR() const
+      {
+        return vr_[0] == 'U' && vr_[1] == 'N';
+      }
+    };
+  }
+
+
+  static bool HasLongLength(const char vr[2])
+  {
+    // The VRs with a 2-bytes reserved field followed by a 32-bit length in explicit VR (PS3.5 Table 7.1-1)
+    static const char* const LONG_VRS[] = { "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV" };
+
+    for (size_t i = 0; i < sizeof(LONG_VRS) / sizeof(const char*); i++)
+    {
+      if (vr[0] == LONG_VRS[i][0] && vr[1] == LONG_VRS[i][1])
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  static bool ReadElementHeader(ElementHeader& header, Reader& reader, bool isImplicit)
+  {
+    header.vr_[0] = header.vr_[1] = ' ';
+
+    if (!reader.ReadUInt16(header.group_) ||
+        !reader.ReadUInt16(header.element_))
+    {
+      return false;
+    }
+
+    if (header.group_ == 0xFFFE || isImplicit)
+    {
+      // items and delimiters never have a VR
+      return reader.ReadUInt32(header.length_);
+    }
+
+    std::string vr;
+    if (!reader.ReadString(vr, 2) || vr.size() != 2)
+    {
+      return false;
+    }
+
+    header.vr_[0] = vr[0];
+    header.vr_[1] = vr[1];
+
+    if (HasLongLength(header.vr_))
+    {
+      return reader.Skip(2) && reader.ReadUInt32(header.length_);
+    }
+    else
+    {
+      uint16_t length;
+      if (!reader.ReadUInt16(length))
+      {
+        return false;
+      }
+
+      header.length_ = length;
+      return true;
+    }
+  }
+
+
+  static bool SkipUndefinedLength(Reader& reader, bool isImplicit, unsigned int depth);
+
+  static bool SkipItemContent(Reader& reader, bool isImplicit, unsigned int depth)
+  {
+    // elements of an item with undefined length, until the item delimitation item
+    for (;;)
+    {
+      ElementHeader header;
+      if (!ReadElementHeader(header, reader, isImplicit))
+      {
+        return false;
+      }
+
+      if (header.group_ == 0xFFFE && header.element_ == 0xE00D)
+      {
+        return true;
+      }
+      else if (header.length_ == UNDEFINED_LENGTH)
+      {
+        // the content of an UN element with undefined length is always encoded in implicit VR
+        if (!SkipUndefinedLength(reader, isImplicit || header.IsUnknownVR(), depth + 1))
+        {
+          return false;
+        }
+      }
+      else if (!reader.Skip(header.length_))
+      {
+        return false;
+      }
+    }
+  }
+
+  static bool SkipUndefinedLength(Reader& reader, bool isImplicit, unsigned int depth)
+  {
+    // sequence (or encapsulated pixel data) with undefined length: a list of items until the sequence delimitation item
+    if (depth > MAX_SEQUENCE_DEPTH)
+    {
+      return false;
+    }
+
+    for (;;)
+    {
+      uint16_t group, element;
+      uint32_t length;
+
+      if (!reader.ReadUInt16(group) ||
+          !reader.ReadUInt16(element) ||
+          !reader.ReadUInt32(length) ||
+          group != 0xFFFE)
+      {
+        return false;
+      }
+
+      if (element == 0xE0DD)
+      {
+        return true;
+      }
+      else if (element != 0xE000)
+      {
+        return false;
+      }
+      else if (length == UNDEFINED_LENGTH)
+      {
+        if (!SkipItemContent(reader, isImplicit, depth))
+        {
+          return false;
+        }
+      }
+      else if (!reader.Skip(length))
+      {
+        return false;
+      }
+    }
+  }
+
+
+  static bool ReadTransferSyntax(std::string& transferSyntax, Reader& reader)
+  {
+    // the "DICM" prefix is followed by the File Meta Information (group 0x0002), always in explicit VR little endian
+    for (;;)
+    {
+      uint16_t group;
+      if (!reader.PeekUInt16(group))
+      {
+        return false;
+      }
+
+      if (group != 0x0002)
+      {
+        return !transferSyntax.empty();
+      }
+
+      ElementHeader header;
+      if (!ReadElementHeader(header, reader, false /* explicit */) ||
+          header.length_ == UNDEFINED_LENGTH)
+      {
+        return false;
+      }
+
+      if (Orthanc::DicomTag(header.group_, header.element_) == TAG_TRANSFER_SYNTAX_UID)
+      {
+        if (!reader.ReadString(transferSyntax, header.length_))
+        {
+          return false;
+        }
+      }
+      else if (!reader.Skip(header.length_))
+      {
+        return false;
+      }
+    }
+  }
+
+
+  static bool IsPlainAscii(const std::string& value)
+  {
+    for (size_t i = 0; i < value.size(); i++)
+    {
+      // 0x1B (ESC) introduces the ISO 2022 escape sequences
+      if (static_cast<uint8_t>(value[i]) >= 0x80 || value[i] == 0x1B)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  static bool ConvertToUtf8(DicomTagsValues& values, const std::string& specificCharacterSet)
+  {
+    bool isAscii = true;
+    for (DicomTagsValues::const_iterator it = values.begin(); it != values.end() && isAscii; ++it)
+    {
+      isAscii = IsPlainAscii(it->second);
+    }
+
+    if (isAscii)
+    {
+      return true;
+    }
+
+    // Without a SpecificCharacterSet, the Orthanc core uses its "DefaultEncoding" that we don't know.
+    // With multiple values, code extensions are used.  In both cases, rely on the Orthanc core.
+    if (specificCharacterSet.empty() ||
+        specificCharacterSet.find('\\') != std::string::npos)
+    {
+      return false;
+    }
+
+    Orthanc::Encoding encoding;
+    if (!Orthanc::GetDicomEncoding(encoding, specificCharacterSet.c_str()))
+    {
+      return false;
+    }
+
+    if (encoding != Orthanc::Encoding_Utf8)
+    {
+      for (DicomTagsValues::iterator it = values.begin(); it != values.end(); ++it)
+      {
+        it->second = Orthanc::Toolbox::ConvertToUtf8(it->second, encoding, false /* no code extensions */);
+      }
+    }
+
+    return true;
+  }
+
+
+  bool DicomTagsExtractor::ExtractTags(DicomTagsValues& target,
+                                       const void* dicom,
+                                       size_t size,
+                                       const std::set<Orthanc::DicomTag>& tags)
+  {
+    target.clear();
+
+    if (tags.empty())
+    {
+      return true;
+    }
+
+    if (dicom == NULL ||
+        size < 132 ||
+        memcmp(reinterpret_cast<const uint8_t*>(dicom) + 128, "DICM", 4) != 0)
+    {
+      return false;
+    }
+
+    Reader reader(dicom, size);
+    reader.Skip(132);
+
+    std::string transferSyntax;
+    if (!ReadTransferSyntax(transferSyntax, reader))
+    {
+      return false;
+    }
+
+    if (transferSyntax == TRANSFER_SYNTAX_EXPLICIT_BIG_ENDIAN ||
+        transferSyntax == TRANSFER_SYNTAX_DEFLATED)
+    {
+      return false;
+    }
+
+    const bool isImplicit = (transferSyntax == TRANSFER_SYNTAX_IMPLICIT_LITTLE_ENDIAN);
+    const Orthanc::DicomTag& lastTag = *tags.rbegin();
+
+    std::string specificCharacterSet;
+
+    while (!reader.IsEnd())
+    {
+      ElementHeader header;
+      if (!ReadElementHeader(header, reader, isImplicit) ||
+          header.group_ == 0xFFFE)
+      {
+        return false;
+      }
+
+      const Orthanc::DicomTag tag(header.group_, header.element_);
+
+      if (lastTag < tag)
+      {
+        break;  // the elements are sorted by tag: all the requested tags have been seen
+      }
+
+      if (header.length_ == UNDEFINED_LENGTH)
+      {
+        if (!SkipUndefinedLength(reader, isImplicit || header.IsUnknownVR(), 0))
+        {
+          return false;
+        }
+      }
+      else if (tag == TAG_SPECIFIC_CHARACTER_SET)
+      {
+        if (!reader.ReadString(specificCharacterSet, header.length_))
+        {
+          return false;
+        }
+      }
+      else if (tags.find(tag) != tags.end())
+      {
+        if (!reader.ReadString(target[tag], header.length_))
+        {
+          return false;
+        }
+      }
+      else if (!reader.Skip(header.length_))
+      {
+        return false;
+      }
+    }
+
+    return ConvertToUtf8(target, specificCharacterSet);
+  }
+}
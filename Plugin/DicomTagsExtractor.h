@@ -0,0 +1,47 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <DicomFormat/DicomTag.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  // UTF-8 values of a few top-level DICOM tags (trailing padding removed, like in the simplified JSON of Orthanc)
+  typedef std::map<Orthanc::DicomTag, std::string>  DicomTagsValues;
+
+  class DicomTagsExtractor
+  {
+  public:
+    // Reads the requested top-level tags directly from a DICOM file (Part 10) and stops as soon as the
+    // last requested tag has been passed: neither the rest of the dataset nor the pixel data is parsed.
+    // Returns false if the file can not be handled by this fast path (e.g. big endian or deflated transfer
+    // syntax, unusual character sets, malformed file).  The caller shall then fall back to the
+    // simplified JSON provided by the Orthanc core.
+    static bool ExtractTags(DicomTagsValues& target,
+                            const void* dicom,
+                            size_t size,
+                            const std::set<Orthanc::DicomTag>& tags);
+  };
+}
@@ -0,0 +1,145 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "DirectoriesCache.h"
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+#include <Cache/LeastRecentlyUsedIndex.h>
+
+#include <boost/thread/mutex.hpp>
+#include <map>
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+  typedef Orthanc::LeastRecentlyUsedIndex<std::string>  DirectoriesIndex;
+  typedef std::map<std::string, DirectoriesIndex*>      RootsIndexes;
+
+  static boost::mutex mutex_;
+  static RootsIndexes roots_;
+  static size_t maxDirectoriesPerRoot_ = 10000;
+
+
+  void DirectoriesCache::SetMaxSize(size_t maxDirectoriesPerRoot)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxDirectoriesPerRoot_ = maxDirectoriesPerRoot;
+  }
+
+
+  static bool IsKnownDirectory(const std::string& root, const std::string& directory)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    RootsIndexes::const_iterator found = roots_.find(root);
+    if (found != roots_.end() && found->second->Contains(directory))
+    {
+      found->second->MakeMostRecent(directory);
+      return true;
+    }
+
+    return false;
+  }
+
+
+  static void AddKnownDirectory(const std::string& root, const std::string& directory)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (maxDirectoriesPerRoot_ == 0)
+    {
+      return;
+    }
+
+    RootsIndexes::iterator found = roots_.find(root);
+    if (found == roots_.end())
+    {
+      found = roots_.insert(std::make_pair(root, new DirectoriesIndex)).first;
+    }
+
+    found->second->AddOrMakeMostRecent(directory);
+
+    while (found->second->GetSize() > maxDirectoriesPerRoot_)
+    {
+      found->second->RemoveOldest();
+    }
+  }
+
+
+  bool DirectoriesCache::CreateParentDirectory(const fs::path& rootPath,
+                                               const fs::path& filePath)
+  {
+    const fs::path parent = filePath.parent_path();
+    const std::string root = rootPath.string();
+    const std::string directory = parent.string();
+
+    if (IsKnownDirectory(root, directory))
+    {
+      return true;
+    }
+
+    if (fs::exists(parent))
+    {
+      if (!fs::is_directory(parent))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryOverFile);
+      }
+    }
+    else if (!fs::create_directories(parent) &&
+             !fs::is_directory(parent))  // it might have been created by another thread in the meantime
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_FileStorageCannotWrite);
+    }
+
+    AddKnownDirectory(root, directory);
+    return false;
+  }
+
+
+  void DirectoriesCache::Invalidate(const fs::path& directory)
+  {
+    const std::string s = directory.string();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (RootsIndexes::iterator it = roots_.begin(); it != roots_.end(); ++it)
+    {
+      if (it->second->Contains(s))
+      {
+        it->second->Invalidate(s);
+      }
+    }
+  }
+
+
+  void DirectoriesCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (RootsIndexes::iterator it = roots_.begin(); it != roots_.end(); ++it)
+    {
+      delete it->second;
+    }
+
+    roots_.clear();
+  }
+}
@@ -0,0 +1,47 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+
+namespace OrthancPlugins
+{
+  // A bounded LRU cache of the directories that are known to exist (one cache per storage root).
+  // It avoids the exists/is_directory/create_directories calls when writing the 2nd..Nth file in
+  // the same directory, which matters on network file systems.
+  class DirectoriesCache
+  {
+  public:
+    // 0 disables the cache
+    static void SetMaxSize(size_t maxDirectoriesPerRoot);
+
+    // Makes sure the parent directory of the file exists (and creates it if required).
+    // Returns true if the directory was found in the cache (no filesystem access).
+    // Throws ErrorCode_DirectoryOverFile or ErrorCode_FileStorageCannotWrite.
+    static bool CreateParentDirectory(const boost::filesystem::path& rootPath,
+                                      const boost::filesystem::path& filePath);
+
+    // Must be called when a directory is removed (or found missing)
+    static void Invalidate(const boost::filesystem::path& directory);
+
+    static void Clear();
+  };
+}
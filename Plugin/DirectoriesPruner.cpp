@@ -0,0 +1,284 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "DirectoriesPruner.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "CustomData.h"
+#include "DirectoriesCache.h"
+
+#include <boost/thread.hpp>
+
+#include <map>
+#include <set>
+#include <time.h>
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+  static const time_t GRACE_PERIOD_SECONDS = 5;
+  static const unsigned int PRUNING_INTERVAL_MS = 1000;
+  static const size_t MAX_PENDING_DIRECTORIES = 100000;  // beyond, the directories are removed immediately
+
+  namespace
+  {
+    struct PendingDirectory
+    {
+      time_t  scheduled_;     // the last time a file has been removed from the directory (local clock)
+      time_t  modification_;  // its modification time when it was last examined (clock of the filesystem)
+      bool    hasModification_;
+
+      PendingDirectory() :
+        scheduled_(0),
+        modification_(0),
+        hasModification_(false)
+      {
+      }
+    };
+  }
+
+  typedef std::map<fs::path, PendingDirectory>  PendingDirectories;
+
+  static boost::mutex mutex_;
+  static boost::condition_variable stopped_;
+  static PendingDirectories pending_;
+  static bool isRunning_ = false;
+  static boost::thread thread_;
+
+
+  // Returns false if the directory has not been removed (a storage root, not empty...)
+  static bool RemoveEmptyDirectory(const fs::path& directory)
+  {
+    if (CustomData::IsARootPath(directory))
+    {
+      return false;
+    }
+
+    boost::system::error_code ec;
+    if (fs::remove(directory, ec) && !ec)
+    {
+      DirectoriesCache::Invalidate(directory);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  static void RemoveNow(const fs::path& directory)
+  {
+    fs::path current = directory;
+
+    while (RemoveEmptyDirectory(current))
+    {
+      current = current.parent_path();
+    }
+  }
+
+
+  // The deepest directories first, so that a parent is only tried once all its children are processed
+  struct DeepestFirst
+  {
+    bool operator()(const std::pair<size_t, fs::path>& a,
+                    const std::pair<size_t, fs::path>& b) const
+    {
+      return (a.first > b.first ||
+              (a.first == b.first && a.second < b.second));
+    }
+  };
+
+
+  static size_t GetDepth(const fs::path& path)
+  {
+    size_t depth = 0;
+    for (fs::path::const_iterator it = path.begin(); it != path.end(); ++it)
+    {
+      depth++;
+    }
+
+    return depth;
+  }
+
+
+  // The directories that are not removed yet are moved back to "pending"
+  static void Prune(PendingDirectories& ready,
+                    PendingDirectories& pending)
+  {
+    std::set<std::pair<size_t, fs::path>, DeepestFirst> queue;
+
+    for (PendingDirectories::iterator it = ready.begin(); it != ready.end(); ++it)
+    {
+      boost::system::error_code ec;
+      const time_t modification = fs::last_write_time(it->first, ec);
+
+      if (ec)
+      {
+        continue;  // already removed
+      }
+
+      // A directory that has been modified during the grace period might be receiving new files.
+      // The modification times are only compared with each other, and never with the local clock,
+      // since the clock of a network filesystem may be ahead.
+      if (it->second.hasModification_ &&
+          it->second.modification_ == modification)
+      {
+        queue.insert(std::make_pair(GetDepth(it->first), it->first));
+      }
+      else
+      {
+        // first examination or modified since the last one: wait for another grace period
+        it->second.scheduled_ = time(NULL);
+        it->second.modification_ = modification;
+        it->second.hasModification_ = true;
+        pending.insert(*it);
+      }
+    }
+
+    while (!queue.empty())
+    {
+      const fs::path directory = queue.begin()->second;
+      const size_t depth = queue.begin()->first;
+      queue.erase(queue.begin());
+
+      if (RemoveEmptyDirectory(directory) &&
+          depth > 1)
+      {
+        // the parent might be empty now (possibly already in the queue, at a lower depth)
+        queue.insert(std::make_pair(depth - 1, directory.parent_path()));
+      }
+    }
+  }
+
+
+  static void Worker()
+  {
+    OrthancPluginSetCurrentThreadName(OrthancPlugins::GetGlobalContext(), "DIRS-PRUNER");
+
+    for (;;)
+    {
+      PendingDirectories ready;
+      bool isRunning;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        stopped_.timed_wait(lock, boost::posix_time::milliseconds(PRUNING_INTERVAL_MS));
+        isRunning = isRunning_;
+
+        const time_t limit = time(NULL) - GRACE_PERIOD_SECONDS;
+
+        for (PendingDirectories::iterator it = pending_.begin(); it != pending_.end(); )
+        {
+          if (!isRunning || it->second.scheduled_ <= limit)
+          {
+            ready.insert(*it);
+            pending_.erase(it++);
+          }
+          else
+          {
+            ++it;
+          }
+        }
+      }
+
+      if (!isRunning)
+      {
+        // no more grace period
+        for (PendingDirectories::iterator it = ready.begin(); it != ready.end(); ++it)
+        {
+          RemoveNow(it->first);
+        }
+
+        return;
+      }
+
+      PendingDirectories notReady;
+      Prune(ready, notReady);
+
+      if (!notReady.empty())
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        for (PendingDirectories::const_iterator it = notReady.begin(); it != notReady.end(); ++it)
+        {
+          // a file removed from the directory in the meantime has restarted its grace period
+          pending_.insert(*it);
+        }
+      }
+    }
+  }
+
+
+  void DirectoriesPruner::Start()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!isRunning_)
+    {
+      isRunning_ = true;
+      thread_ = boost::thread(Worker);
+    }
+  }
+
+
+  void DirectoriesPruner::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isRunning_ = false;
+      stopped_.notify_all();
+    }
+
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+  }
+
+
+  void DirectoriesPruner::Schedule(const fs::path& directory)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (isRunning_ &&
+          (pending_.size() < MAX_PENDING_DIRECTORIES ||
+           pending_.find(directory) != pending_.end()))
+      {
+        PendingDirectory& entry = pending_[directory];
+        entry.scheduled_ = time(NULL);
+        entry.hasModification_ = false;  // the removal of the file has modified the directory
+        return;
+      }
+    }
+
+    RemoveNow(directory);
+  }
+
+
+  size_t DirectoriesPruner::GetPendingDirectoriesCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return pending_.size();
+  }
+}
@@ -0,0 +1,47 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+
+namespace OrthancPlugins
+{
+  // Removes the directories that have become empty after the deletion of files.  Instead of trying
+  // to remove all the parent directories after each deleted file (that mostly fails since the
+  // directory still contains the other files of the series), the directories are collected (once
+  // each) and are only removed by a background thread after a grace period, from the deepest ones
+  // to the storage root.  A directory that has been modified during its grace period (e.g. a new
+  // file has been written in it) waits for another grace period.
+  class DirectoriesPruner
+  {
+  public:
+    // Without the background thread, the directories are removed immediately
+    static void Start();
+
+    // Removes the pending directories without waiting for their grace period
+    static void Stop();
+
+    // Called after a file has been removed from this directory
+    static void Schedule(const boost::filesystem::path& directory);
+
+    static size_t GetPendingDirectoriesCount();
+  };
+}
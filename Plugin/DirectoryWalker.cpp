@@ -0,0 +1,633 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "DirectoryWalker.h"
+
+#include <Logging.h>
+#include <SystemToolbox.h>
+
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+
+#if !defined(_WIN32)
+#  include <dirent.h>
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#endif
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+  static const size_t MAX_QUEUED_FILES = 4096;   // the walker threads wait if the visitor is late
+  static const unsigned int CANCEL_POLLING_MS = 100;
+
+  namespace
+  {
+    struct Folder
+    {
+      fs::path  path_;
+      size_t    root_;
+
+      Folder(const fs::path& path,
+             size_t root) :
+        path_(path),
+        root_(root)
+      {
+      }
+    };
+
+
+#if defined(_WIN32)
+    // Returns false if the folder could not be enumerated completely
+    static bool ListFolder(std::vector<fs::path>& subfolders,
+                           std::vector<DirectoryWalker::FileEntry>& files,
+                           const Folder& folder,
+                           const DirectoryWalker::IVisitor& visitor)
+    {
+      boost::system::error_code ec;
+      fs::directory_iterator current(folder.path_, ec);
+
+      if (ec)
+      {
+        LOG(WARNING) << "Indexer cannot read directory: " << Orthanc::SystemToolbox::PathToUtf8(folder.path_);
+        return false;
+      }
+
+      const fs::directory_iterator end;
+
+      while (!ec && current != end)
+      {
+        boost::system::error_code statusError;
+        const fs::file_status status = fs::status(current->path(), statusError);
+
+        if (statusError &&
+            statusError != boost::system::errc::no_such_file_or_directory)
+        {
+          // the entry exists but its type is unknown: the folder is not enumerated completely
+          ec = statusError;
+          break;
+        }
+        else if (!statusError)
+        {
+          switch (status.type())
+          {
+            case fs::regular_file:
+            case fs::reparse_file:
+              if (visitor.IsCandidate(current->path()))
+              {
+                DirectoryWalker::FileEntry entry;
+                entry.path_ = current->path();
+                entry.root_ = folder.root_;
+                files.push_back(entry);
+              }
+              break;
+
+            case fs::directory_file:
+              subfolders.push_back(current->path());
+              break;
+
+            default:
+              break;
+          }
+        }
+
+        current.increment(ec);
+      }
+
+      if (ec)
+      {
+        LOG(WARNING) << "Indexer cannot read directory completely: " << Orthanc::SystemToolbox::PathToUtf8(folder.path_);
+      }
+
+      return !ec;
+    }
+
+#else
+
+    // A single stat of the file, with only the required fields.  Returns false with errno set to
+    // ENOENT if the file has disappeared (or is not a regular file anymore).
+    static bool StatFile(DirectoryWalker::FileEntry& entry,
+                         int folderFd,
+                         const char* name)
+    {
+#  if defined(__linux__) && defined(STATX_MTIME)
+      struct statx stx;
+      if (statx(folderFd, name, AT_STATX_SYNC_AS_STAT, STATX_TYPE | STATX_MTIME | STATX_SIZE | STATX_INO, &stx) == 0)
+      {
+        if (!S_ISREG(stx.stx_mode))
+        {
+          errno = ENOENT;
+          return false;
+        }
+
+        entry.mtimeNs_ = static_cast<int64_t>(stx.stx_mtime.tv_sec) * 1000000000ll + stx.stx_mtime.tv_nsec;
+        entry.size_ = stx.stx_size;
+        entry.inode_ = stx.stx_ino;
+        entry.hasStatus_ = true;
+        return true;
+      }
+      else if (errno != ENOSYS)
+      {
+        return false;
+      }
+
+      // statx() is not available (kernel older than 4.11)
+#  endif
+
+      struct stat st;
+      if (fstatat(folderFd, name, &st, 0) != 0)
+      {
+        return false;
+      }
+      else if (!S_ISREG(st.st_mode))
+      {
+        errno = ENOENT;
+        return false;
+      }
+
+      entry.mtimeNs_ = static_cast<int64_t>(st.st_mtime) * 1000000000ll;
+      entry.size_ = st.st_size;
+      entry.inode_ = st.st_ino;
+      entry.hasStatus_ = true;
+      return true;
+    }
+
+
+    // The type of the entries is given by readdir() (d_type): only the symbolic links and the file
+    // systems that don't fill d_type require a stat.  The candidate files get a single stat.
+    // Returns false if the folder could not be enumerated completely.
+    static bool ListFolder(std::vector<fs::path>& subfolders,
+                           std::vector<DirectoryWalker::FileEntry>& files,
+                           const Folder& folder,
+                           const DirectoryWalker::IVisitor& visitor)
+    {
+      DIR* dir = opendir(folder.path_.c_str());
+      if (dir == NULL)
+      {
+        LOG(WARNING) << "Indexer cannot read directory: " << Orthanc::SystemToolbox::PathToUtf8(folder.path_);
+        return false;
+      }
+
+      const int folderFd = dirfd(dir);
+      bool success = true;
+
+      for (;;)
+      {
+        errno = 0;
+        const struct dirent* item = readdir(dir);
+
+        if (item == NULL)
+        {
+          break;
+        }
+
+        const char* name = item->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        {
+          continue;
+        }
+
+        bool isFile = (item->d_type == DT_REG);
+        bool isFolder = (item->d_type == DT_DIR);
+
+        if (item->d_type == DT_LNK ||
+            item->d_type == DT_UNKNOWN)
+        {
+          // follow the symbolic links, as boost::filesystem::status() does
+          struct stat st;
+          if (fstatat(folderFd, name, &st, 0) == 0)
+          {
+            isFile = S_ISREG(st.st_mode);
+            isFolder = S_ISDIR(st.st_mode);
+          }
+          else if (errno != ENOENT)  // ENOENT: a dangling link or a file that has disappeared
+          {
+            success = false;
+          }
+        }
+
+        if (isFolder)
+        {
+          subfolders.push_back(folder.path_ / name);
+        }
+        else if (isFile)
+        {
+          DirectoryWalker::FileEntry entry;
+          entry.path_ = folder.path_ / name;
+          entry.root_ = folder.root_;
+
+          if (visitor.IsCandidate(entry.path_))
+          {
+            if (StatFile(entry, folderFd, name))
+            {
+              files.push_back(entry);
+            }
+            else if (errno != ENOENT)  // ENOENT: the file has disappeared in the meantime
+            {
+              success = false;
+            }
+          }
+        }
+      }
+
+      if (errno != 0)
+      {
+        success = false;
+      }
+
+      closedir(dir);
+
+      if (!success)
+      {
+        LOG(WARNING) << "Indexer cannot read directory completely: " << Orthanc::SystemToolbox::PathToUtf8(folder.path_);
+      }
+
+      return success;
+    }
+#endif
+
+
+    static bool GetFolderTime(int64_t& mtimeNs,
+                              const fs::path& folder)
+    {
+#if defined(_WIN32)
+      boost::system::error_code ec;
+      const std::time_t t = fs::last_write_time(folder, ec);
+      if (ec)
+      {
+        return false;
+      }
+
+      mtimeNs = static_cast<int64_t>(t) * 1000000000ll;
+      return true;
+#else
+      struct stat st;
+      if (stat(folder.c_str(), &st) != 0)
+      {
+        return false;
+      }
+
+#  if defined(__linux__)
+      mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000ll + st.st_mtim.tv_nsec;
+#  else
+      mtimeNs = static_cast<int64_t>(st.st_mtime) * 1000000000ll;
+#  endif
+      return true;
+#endif
+    }
+
+
+    class WalkState : public boost::noncopyable
+    {
+    private:
+      DirectoryWalker::IVisitor&          visitor_;
+      unsigned int                        maxThreadsPerRoot_;
+      bool                                verbose_;
+      bool                                trackFolders_;
+
+      boost::mutex                        mutex_;
+      boost::condition_variable           folderAvailable_;
+      boost::condition_variable           fileAvailable_;
+      boost::condition_variable           fileConsumed_;
+
+      std::vector<std::deque<Folder> >    deques_;         // one per thread
+      std::vector<unsigned int>           activeThreads_;  // per root
+      std::vector<bool>                   complete_;       // per root
+      size_t                              outstanding_;    // folders queued or being enumerated
+      std::deque<DirectoryWalker::FileEntry>  files_;
+      bool                                cancelled_;
+
+      bool IsAllowed(const Folder& folder) const
+      {
+        return (maxThreadsPerRoot_ == 0 ||
+                activeThreads_[folder.root_] < maxThreadsPerRoot_);
+      }
+
+      // must be called with mutex_ locked
+      bool TakeFolder(Folder& target,
+                      size_t thread)
+      {
+        // the most recent folder of its own deque (depth-first)...
+        std::deque<Folder>& own = deques_[thread];
+        for (size_t i = own.size(); i > 0; i--)
+        {
+          if (IsAllowed(own[i - 1]))
+          {
+            target = own[i - 1];
+            own.erase(own.begin() + (i - 1));
+            return true;
+          }
+        }
+
+        // ... or the oldest folder of another deque (i.e. the closest to its root)
+        for (size_t k = 1; k < deques_.size(); k++)
+        {
+          std::deque<Folder>& other = deques_[(thread + k) % deques_.size()];
+          for (size_t i = 0; i < other.size(); i++)
+          {
+            if (IsAllowed(other[i]))
+            {
+              target = other[i];
+              other.erase(other.begin() + i);
+              return true;
+            }
+          }
+        }
+
+        return false;
+      }
+
+      void EnumerateFolder(const Folder& folder,
+                           size_t thread)
+      {
+        std::vector<fs::path> subfolders;
+        std::vector<DirectoryWalker::FileEntry> files;
+
+        int64_t mtimeNs = 0;
+        const bool hasTime = (trackFolders_ && GetFolderTime(mtimeNs, folder.path_));
+
+        bool success;
+        if (hasTime &&
+            visitor_.LookupUnchangedFolder(subfolders, folder.path_, mtimeNs))
+        {
+          success = true;
+        }
+        else
+        {
+          subfolders.clear();
+          success = ListFolder(subfolders, files, folder, visitor_);
+
+          if (success &&
+              hasTime)
+          {
+            visitor_.VisitFolder(folder.path_, folder.root_, mtimeNs, subfolders);
+          }
+        }
+
+        if (verbose_)
+        {
+          for (size_t i = 0; i < subfolders.size(); i++)
+          {
+            LOG(INFO) << "FoldersIndexer will process the folder '" << Orthanc::SystemToolbox::PathToUtf8(subfolders[i]) << "'";
+          }
+        }
+
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (!success)
+        {
+          complete_[folder.root_] = false;
+        }
+
+        for (size_t i = 0; i < subfolders.size(); i++)
+        {
+          deques_[thread].push_back(Folder(subfolders[i], folder.root_));
+        }
+
+        outstanding_ += subfolders.size();
+
+        if (!subfolders.empty())
+        {
+          folderAvailable_.notify_all();
+        }
+
+        while (!cancelled_ &&
+               !files.empty() &&
+               files_.size() >= MAX_QUEUED_FILES)
+        {
+          fileConsumed_.wait(lock);
+        }
+
+        files_.insert(files_.end(), files.begin(), files.end());
+
+        if (!files.empty())
+        {
+          fileAvailable_.notify_one();
+        }
+      }
+
+    public:
+      WalkState(DirectoryWalker::IVisitor& visitor,
+                const std::vector<fs::path>& roots,
+                unsigned int threadsCount,
+                unsigned int maxThreadsPerRoot,
+                bool verbose,
+                bool trackFolders) :
+        visitor_(visitor),
+        maxThreadsPerRoot_(maxThreadsPerRoot),
+        verbose_(verbose),
+        trackFolders_(trackFolders),
+        deques_(threadsCount),
+        activeThreads_(roots.size(), 0),
+        complete_(roots.size(), true),
+        outstanding_(roots.size()),
+        cancelled_(false)
+      {
+        // spread the roots among the threads
+        for (size_t i = 0; i < roots.size(); i++)
+        {
+          deques_[i % threadsCount].push_back(Folder(roots[i], i));
+        }
+      }
+
+      void Worker(size_t thread)
+      {
+        for (;;)
+        {
+          Folder folder(fs::path(), 0);
+
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+
+            for (;;)
+            {
+              if (cancelled_ ||
+                  outstanding_ == 0)
+              {
+                return;
+              }
+
+              if (TakeFolder(folder, thread))
+              {
+                break;
+              }
+
+              folderAvailable_.wait(lock);
+            }
+
+            activeThreads_[folder.root_]++;
+          }
+
+          try
+          {
+            EnumerateFolder(folder, thread);
+          }
+          catch (...)
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+            complete_[folder.root_] = false;
+          }
+
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+            activeThreads_[folder.root_]--;
+            outstanding_--;
+
+            // a slot of this root is free, or the walk is over
+            folderAvailable_.notify_all();
+
+            if (outstanding_ == 0)
+            {
+              fileAvailable_.notify_all();
+            }
+          }
+        }
+      }
+
+      // Returns false once the walk is over and all the files have been consumed
+      bool ConsumeFiles(std::vector<DirectoryWalker::FileEntry>& target,
+                        const volatile bool& isRunning)
+      {
+        target.clear();
+
+        boost::mutex::scoped_lock lock(mutex_);
+
+        for (;;)
+        {
+          if (!isRunning)
+          {
+            Cancel(lock);
+          }
+
+          if (cancelled_)
+          {
+            return false;
+          }
+
+          if (!files_.empty())
+          {
+            break;
+          }
+
+          if (outstanding_ == 0)
+          {
+            return false;
+          }
+
+          fileAvailable_.timed_wait(lock, boost::posix_time::milliseconds(CANCEL_POLLING_MS));
+        }
+
+        target.assign(files_.begin(), files_.end());
+        files_.clear();
+        fileConsumed_.notify_all();
+
+        return true;
+      }
+
+      void Cancel(boost::mutex::scoped_lock& /* lock */)
+      {
+        cancelled_ = true;
+        folderAvailable_.notify_all();
+        fileConsumed_.notify_all();
+      }
+
+      void Cancel()
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        Cancel(lock);
+      }
+
+      void GetComplete(std::vector<bool>& target)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        target = complete_;
+
+        if (cancelled_)
+        {
+          target.assign(target.size(), false);
+        }
+      }
+    };
+  }
+
+
+  DirectoryWalker::DirectoryWalker(unsigned int threadsCount,
+                                   unsigned int maxThreadsPerRoot) :
+    threadsCount_(std::max(1u, threadsCount)),
+    maxThreadsPerRoot_(maxThreadsPerRoot),
+    verbose_(false),
+    trackFolders_(false)
+  {
+  }
+
+
+  void DirectoryWalker::Walk(std::vector<bool>& complete,
+                             const std::vector<fs::path>& roots,
+                             IVisitor& visitor,
+                             const volatile bool& isRunning)
+  {
+    if (roots.empty())
+    {
+      complete.clear();
+      return;
+    }
+
+    WalkState state(visitor, roots, threadsCount_, maxThreadsPerRoot_, verbose_, trackFolders_);
+
+    boost::thread_group threads;
+    for (unsigned int i = 0; i < threadsCount_; i++)
+    {
+      threads.create_thread(boost::bind(&WalkState::Worker, &state, static_cast<size_t>(i)));
+    }
+
+    try
+    {
+      std::vector<FileEntry> files;
+      while (state.ConsumeFiles(files, isRunning))
+      {
+        for (size_t i = 0; i < files.size(); i++)
+        {
+          if (!isRunning)
+          {
+            state.Cancel();
+            break;
+          }
+
+          visitor.VisitFile(files[i]);
+        }
+      }
+    }
+    catch (...)
+    {
+      state.Cancel();
+      threads.join_all();
+      throw;
+    }
+
+    threads.join_all();
+    state.GetComplete(complete);
+  }
+}
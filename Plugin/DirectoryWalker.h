@@ -0,0 +1,124 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // Walks folder trees with a pool of threads.  Each thread owns a deque of folders to enumerate:
+  // it pushes the subfolders it finds at the back and pops from the back (depth-first), and the
+  // idle threads steal from the front of the other deques.  At most "maxThreadsPerRoot" threads
+  // enumerate the folders of the same root at once, so that a slow share does not take all the
+  // threads.  The files that are found are handed, one at a time, to the thread that called Walk().
+  class DirectoryWalker : public boost::noncopyable
+  {
+  public:
+    struct FileEntry
+    {
+      boost::filesystem::path  path_;
+      size_t                   root_;   // index of the root in the walked roots
+
+      // the status of the file, read by the walker thread (not available on Windows)
+      bool                     hasStatus_;
+      int64_t                  mtimeNs_;
+      uint64_t                 size_;
+      uint64_t                 inode_;
+
+      FileEntry() :
+        root_(0),
+        hasStatus_(false),
+        mtimeNs_(0),
+        size_(0),
+        inode_(0)
+      {
+      }
+    };
+
+    class IVisitor : public boost::noncopyable
+    {
+    public:
+      virtual ~IVisitor()
+      {
+      }
+
+      // Called by the walker threads to filter the files (e.g. by extension)
+      virtual bool IsCandidate(const boost::filesystem::path& path) const = 0;
+
+      // Called by the thread that calls Walk(), one file at a time
+      virtual void VisitFile(const FileEntry& file) = 0;
+
+      // Called by the walker threads before enumerating a folder (if the walker tracks the
+      // folders), with the time of its last
+      // modification.  Returns true if the folder is known not to have changed: its files are
+      // then not enumerated and only the "subfolders" are walked.
+      virtual bool LookupUnchangedFolder(std::vector<boost::filesystem::path>& /* subfolders */,
+                                         const boost::filesystem::path& /* folder */,
+                                         int64_t /* mtimeNs */)
+      {
+        return false;
+      }
+
+      // Called by the walker threads once a folder has been enumerated completely (if the walker
+      // tracks the folders)
+      virtual void VisitFolder(const boost::filesystem::path& /* folder */,
+                               size_t /* root */,
+                               int64_t /* mtimeNs */,
+                               const std::vector<boost::filesystem::path>& /* subfolders */)
+      {
+      }
+    };
+
+  private:
+    unsigned int  threadsCount_;
+    unsigned int  maxThreadsPerRoot_;
+    bool          verbose_;
+    bool          trackFolders_;
+
+  public:
+    // 0 for "maxThreadsPerRoot" means no limit
+    DirectoryWalker(unsigned int threadsCount,
+                    unsigned int maxThreadsPerRoot);
+
+    void SetVerbose(bool verbose)
+    {
+      verbose_ = verbose;
+    }
+
+    // Reads the modification time of each folder (one more stat per folder) to call the
+    // LookupUnchangedFolder() and VisitFolder() methods of the visitor
+    void SetTrackFolders(bool trackFolders)
+    {
+      trackFolders_ = trackFolders;
+    }
+
+    // Returns, for each root, whether all its folders could be enumerated.  The walk stops as soon
+    // as "isRunning" becomes false (and no root is then complete).
+    void Walk(std::vector<bool>& complete,
+              const std::vector<boost::filesystem::path>& roots,
+              IVisitor& visitor,
+              const volatile bool& isRunning);
+  };
+}
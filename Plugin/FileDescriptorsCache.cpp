@@ -0,0 +1,355 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "FileDescriptorsCache.h"
+
+#include <Compatibility.h>
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Cache/LeastRecentlyUsedIndex.h>
+
+#include <boost/thread/mutex.hpp>
+
+#if !defined(_WIN32)
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <string.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+#if !defined(_WIN32)
+  class FileDescriptorsCache::OpenedFile : public boost::noncopyable
+  {
+    int       fd_;
+    uint64_t  size_;
+    void*     mapping_;
+
+  public:
+    explicit OpenedFile(const fs::path& path) :
+      fd_(-1),
+      size_(0),
+      mapping_(NULL)
+    {
+      do
+      {
+        fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      } while (fd_ < 0 && errno == EINTR);
+
+      struct stat info;
+      if (fd_ < 0 ||
+          fstat(fd_, &info) != 0 ||
+          !S_ISREG(info.st_mode))
+      {
+        if (fd_ >= 0)
+        {
+          close(fd_);
+        }
+
+        LOG(ERROR) << "The path does not point to a regular file: " << path;
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile);
+      }
+
+      size_ = static_cast<uint64_t>(info.st_size);
+    }
+
+    ~OpenedFile()
+    {
+      if (mapping_ != NULL)
+      {
+        munmap(mapping_, static_cast<size_t>(size_));
+      }
+
+      close(fd_);
+    }
+
+    // If the mapping fails (e.g. not supported by the file system), the file is read with pread()
+    bool Map()
+    {
+      if (size_ == 0 ||
+          static_cast<uint64_t>(static_cast<size_t>(size_)) != size_)
+      {
+        return false;
+      }
+
+      void* mapping = mmap(NULL, static_cast<size_t>(size_), PROT_READ, MAP_SHARED, fd_, 0);
+      if (mapping == MAP_FAILED)
+      {
+        LOG(INFO) << "Unable to map a file in memory, it will be read with pread(): " << strerror(errno);
+        return false;
+      }
+
+      // the frames of a large instance are accessed in any order: no readahead around the page faults
+      madvise(mapping, static_cast<size_t>(size_), MADV_RANDOM);
+
+      mapping_ = mapping;
+      return true;
+    }
+
+    int GetDescriptor() const
+    {
+      return fd_;
+    }
+
+    uint64_t GetSize() const
+    {
+      return size_;
+    }
+
+    const uint8_t* GetMapping() const
+    {
+      return reinterpret_cast<const uint8_t*>(mapping_);
+    }
+  };
+
+
+  typedef Orthanc::LeastRecentlyUsedIndex<std::string, boost::shared_ptr<FileDescriptorsCache::OpenedFile> >  OpenedFilesIndex;
+  typedef Orthanc::LeastRecentlyUsedIndex<std::string>  MappedFilesIndex;
+
+  static boost::mutex mutex_;
+  static OpenedFilesIndex files_;
+  static MappedFilesIndex mappedFiles_;  // the subset of the cached files that are mapped in memory
+  static size_t maxDescriptors_ = 256;
+  static uint64_t mappingThreshold_ = 0;
+  static size_t maxMappedFiles_ = 0;
+
+
+  // The mutex must be locked
+  static void RemoveOldestFile()
+  {
+    const std::string key = files_.RemoveOldest();
+
+    if (mappedFiles_.Contains(key))
+    {
+      mappedFiles_.Invalidate(key);
+    }
+  }
+
+
+  // The mutex must be locked
+  static void RemoveOldestMappedFile()
+  {
+    const std::string key = mappedFiles_.RemoveOldest();
+
+    if (files_.Contains(key))
+    {
+      files_.Invalidate(key);
+    }
+  }
+
+
+  FileDescriptorsCache::Accessor::Accessor(const fs::path& path,
+                                          bool mappable)
+  {
+    const std::string key = path.string();
+
+    bool mapping;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (files_.Contains(key, file_))
+      {
+        files_.MakeMostRecent(key);
+
+        if (file_->GetMapping() != NULL)
+        {
+          mappedFiles_.MakeMostRecent(key);
+        }
+
+        return;
+      }
+
+      mapping = (mappable &&
+                 maxDescriptors_ > 0 &&
+                 maxMappedFiles_ > 0 &&
+                 mappingThreshold_ > 0);
+    }
+
+    // open (and map) the file outside of the lock: this is the slow path
+    file_.reset(new OpenedFile(path));
+
+    const bool isMapped = (mapping &&
+                           file_->GetSize() >= mappingThreshold_ &&
+                           file_->Map());
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (maxDescriptors_ == 0)
+    {
+      return;
+    }
+
+    // another thread might have opened the same file in the meantime: keep the most recent descriptor
+    files_.AddOrMakeMostRecent(key, file_);
+
+    if (isMapped)
+    {
+      mappedFiles_.AddOrMakeMostRecent(key);
+    }
+    else if (mappedFiles_.Contains(key))
+    {
+      mappedFiles_.Invalidate(key);
+    }
+
+    while (files_.GetSize() > maxDescriptors_)
+    {
+      RemoveOldestFile();
+    }
+
+    while (mappedFiles_.GetSize() > maxMappedFiles_)
+    {
+      RemoveOldestMappedFile();
+    }
+  }
+
+
+  int FileDescriptorsCache::Accessor::GetDescriptor() const
+  {
+    return file_->GetDescriptor();
+  }
+
+
+  uint64_t FileDescriptorsCache::Accessor::GetFileSize() const
+  {
+    return file_->GetSize();
+  }
+
+
+  const uint8_t* FileDescriptorsCache::Accessor::GetMapping() const
+  {
+    return file_->GetMapping();
+  }
+
+
+  void FileDescriptorsCache::SetMaxSize(size_t maxDescriptors)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxDescriptors_ = maxDescriptors;
+
+    while (files_.GetSize() > maxDescriptors_)
+    {
+      RemoveOldestFile();
+    }
+  }
+
+
+  void FileDescriptorsCache::SetMapping(uint64_t thresholdBytes,
+                                        size_t maxMappedFiles)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    mappingThreshold_ = thresholdBytes;
+    maxMappedFiles_ = (thresholdBytes == 0 ? 0 : maxMappedFiles);
+
+    while (mappedFiles_.GetSize() > maxMappedFiles_)
+    {
+      RemoveOldestMappedFile();
+    }
+  }
+
+
+  void FileDescriptorsCache::Invalidate(const fs::path& path)
+  {
+    const std::string key = path.string();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (files_.Contains(key))
+    {
+      // the descriptor is closed (and unmapped) once the readers that are using it are done
+      files_.Invalidate(key);
+
+      if (mappedFiles_.Contains(key))
+      {
+        mappedFiles_.Invalidate(key);
+      }
+    }
+  }
+
+
+  void FileDescriptorsCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (!files_.IsEmpty())
+    {
+      RemoveOldestFile();
+    }
+  }
+
+#else
+
+  class FileDescriptorsCache::OpenedFile
+  {
+  };
+
+
+  FileDescriptorsCache::Accessor::Accessor(const fs::path& path,
+                                          bool mappable)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+  }
+
+
+  int FileDescriptorsCache::Accessor::GetDescriptor() const
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+  }
+
+
+  uint64_t FileDescriptorsCache::Accessor::GetFileSize() const
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+  }
+
+
+  const uint8_t* FileDescriptorsCache::Accessor::GetMapping() const
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+  }
+
+
+  void FileDescriptorsCache::SetMaxSize(size_t maxDescriptors)
+  {
+  }
+
+
+  void FileDescriptorsCache::SetMapping(uint64_t thresholdBytes,
+                                        size_t maxMappedFiles)
+  {
+  }
+
+
+  void FileDescriptorsCache::Invalidate(const fs::path& path)
+  {
+  }
+
+
+  void FileDescriptorsCache::Clear()
+  {
+  }
+
+#endif
+}
@@ -0,0 +1,76 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+
+
+namespace OrthancPlugins
+{
+  // A bounded LRU cache of the read-only file descriptors of the files that have been read
+  // recently (keyed by absolute path), so that the successive range reads of the same file
+  // (e.g. the frames of a multi-frame instance) don't pay an open/close each time.
+  // The descriptors stay valid after the file is unlinked: every code that removes or moves a
+  // file of the storage must call Invalidate().  POSIX only, the cache is never used on Windows.
+  // The large files (e.g. whole-slide images) are also mapped in memory, so that the random
+  // accesses to their frames are served from the mapping.
+  class FileDescriptorsCache
+  {
+  public:
+    class OpenedFile;
+
+    // Keeps the descriptor open while it is being used, even if it is evicted in the meantime
+    class Accessor : public boost::noncopyable
+    {
+      boost::shared_ptr<OpenedFile>  file_;
+
+    public:
+      // Throws ErrorCode_InexistentFile if the path does not point to a regular file.
+      // "mappable" must be false for the files that are not owned by the plugin: they can be
+      // truncated behind our back, and accessing a truncated mapping raises SIGBUS.
+      Accessor(const boost::filesystem::path& path,
+               bool mappable);
+
+      int GetDescriptor() const;
+
+      // The size of the file when it has been opened
+      uint64_t GetFileSize() const;
+
+      // NULL if the file is not mapped in memory
+      const uint8_t* GetMapping() const;
+    };
+
+    // 0 disables the cache (the file is then closed at the end of each read)
+    static void SetMaxSize(size_t maxDescriptors);
+
+    // The files of at least "thresholdBytes" are mapped in memory, at most "maxMappedFiles" of them
+    // are kept mapped (among the cached descriptors).  0 disables the mappings.
+    static void SetMapping(uint64_t thresholdBytes,
+                           size_t maxMappedFiles);
+
+    // Must be called when a file is removed, moved or replaced
+    static void Invalidate(const boost::filesystem::path& path);
+
+    static void Clear();
+  };
+}
@@ -0,0 +1,174 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "FolderEventsQueue.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+  void FolderEventsQueue::Push(const std::vector<FolderWatcher::Event>& events)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (size_t i = 0; i < events.size(); i++)
+    {
+      if (events_.size() < maxEvents_)
+      {
+        events_.push_back(events[i]);
+        continue;
+      }
+
+      // the queue is full: the folder will be scanned again instead and its indexed files will be
+      // checked (so that the removals are not lost either)
+      switch (events[i].type_)
+      {
+        case FolderWatcher::EventType_FileWritten:
+        case FolderWatcher::EventType_FileRemoved:
+          droppedFolders_.insert(events[i].path_.parent_path());
+          break;
+
+        case FolderWatcher::EventType_NewFolder:
+        case FolderWatcher::EventType_FolderRemoved:
+          droppedFolders_.insert(events[i].path_);
+          break;
+
+        default:
+          break;
+      }
+
+      if (droppedFolders_.size() > maxFolders_)
+      {
+        droppedFolders_.clear();
+        eventsLost_ = true;
+      }
+    }
+
+    received_.notify_one();
+  }
+
+
+  void FolderEventsQueue::Worker()
+  {
+    while (isRunning_)
+    {
+      std::vector<FolderWatcher::Event> events;
+      bool complete;
+
+      try
+      {
+        complete = watcher_.WaitEvents(events, 100 /* to check isRunning_ */);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Indexer: the folders cannot be watched anymore: " << e.What();
+
+        boost::mutex::scoped_lock lock(mutex_);
+        watcherStopped_ = true;
+        received_.notify_one();
+        return;
+      }
+
+      if (!events.empty())
+      {
+        Push(events);
+      }
+
+      if (!complete)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (watcher_.GetWatchesCount() == 0)
+        {
+          watcherStopped_ = true;
+          received_.notify_one();
+          return;
+        }
+
+        eventsLost_ = true;
+        received_.notify_one();
+      }
+    }
+  }
+
+
+  FolderEventsQueue::FolderEventsQueue(FolderWatcher& watcher,
+                                       size_t maxEvents,
+                                       size_t maxFolders) :
+    watcher_(watcher),
+    maxEvents_(maxEvents),
+    maxFolders_(maxFolders),
+    eventsLost_(false),
+    watcherStopped_(false),
+    isRunning_(true)
+  {
+    thread_ = boost::thread(&FolderEventsQueue::Worker, this);
+  }
+
+
+  FolderEventsQueue::~FolderEventsQueue()
+  {
+    isRunning_ = false;
+
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+  }
+
+
+  FolderEventsQueue::Status FolderEventsQueue::WaitEvents(std::vector<FolderWatcher::Event>& events,
+                                                          std::list<fs::path>& droppedFolders,
+                                                          unsigned int timeoutMs)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (events_.empty() &&
+        droppedFolders_.empty() &&
+        !eventsLost_ &&
+        !watcherStopped_)
+    {
+      received_.timed_wait(lock, boost::posix_time::milliseconds(timeoutMs));
+    }
+
+    events.insert(events.end(), events_.begin(), events_.end());
+    events_.clear();
+
+    droppedFolders.insert(droppedFolders.end(), droppedFolders_.begin(), droppedFolders_.end());
+    droppedFolders_.clear();
+
+    if (watcherStopped_)
+    {
+      return Status_WatcherStopped;
+    }
+    else if (eventsLost_)
+    {
+      eventsLost_ = false;
+      return Status_EventsLost;
+    }
+    else
+    {
+      return Status_Success;
+    }
+  }
+}
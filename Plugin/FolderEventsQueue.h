@@ -0,0 +1,78 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "FolderWatcher.h"
+
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <list>
+#include <set>
+
+
+namespace OrthancPlugins
+{
+  // Receives the events of a FolderWatcher on its own thread into a bounded queue, so that the
+  // inotify queue does not overflow while the consumer is busy (e.g. during an hours-long scan).
+  // When the queue is full, the folders of the dropped events are recorded instead, so that the
+  // consumer only scans these folders again (and looks for their deleted files), not the whole trees.
+  class FolderEventsQueue : public boost::noncopyable
+  {
+  public:
+    enum Status
+    {
+      Status_Success,
+      Status_EventsLost,       // the kernel queue has overflowed: the trees must be scanned again
+      Status_WatcherStopped    // no folder is watched anymore
+    };
+
+  private:
+    FolderWatcher&                       watcher_;
+    size_t                               maxEvents_;
+    size_t                               maxFolders_;
+    boost::mutex                         mutex_;
+    boost::condition_variable            received_;
+    std::deque<FolderWatcher::Event>     events_;
+    std::set<boost::filesystem::path>    droppedFolders_;  // to be scanned again
+    bool                                 eventsLost_;
+    bool                                 watcherStopped_;
+    volatile bool                        isRunning_;
+    boost::thread                        thread_;
+
+    void Push(const std::vector<FolderWatcher::Event>& events);
+
+    void Worker();
+
+  public:
+    // The watcher must not be used by the caller anymore until this object is destroyed
+    FolderEventsQueue(FolderWatcher& watcher,
+                      size_t maxEvents,
+                      size_t maxFolders);
+
+    ~FolderEventsQueue();
+
+    // Waits for at most "timeoutMs" and moves the received events and the folders of the dropped
+    // events to the targets
+    Status WaitEvents(std::vector<FolderWatcher::Event>& events,
+                      std::list<boost::filesystem::path>& droppedFolders,
+                      unsigned int timeoutMs);
+  };
+}
@@ -0,0 +1,282 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "FolderWatcher.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <stack>
+
+#if defined(__linux__)
+#  include <errno.h>
+#  include <poll.h>
+#  include <string.h>
+#  include <sys/inotify.h>
+#  include <unistd.h>
+#endif
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+#if defined(__linux__)
+  static const uint32_t WATCH_MASK = (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                      IN_ONLYDIR | IN_EXCL_UNLINK);
+#endif
+
+
+  FolderWatcher::FolderWatcher() :
+    fd_(-1)
+  {
+#if defined(__linux__)
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                      std::string("Advanced Storage - Cannot create an inotify instance: ") + strerror(errno));
+    }
+#else
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented, "Advanced Storage - Folder watching is only supported on Linux");
+#endif
+  }
+
+
+  FolderWatcher::~FolderWatcher()
+  {
+#if defined(__linux__)
+    if (fd_ >= 0)
+    {
+      close(fd_);
+    }
+#endif
+  }
+
+
+  bool FolderWatcher::IsWatched(const fs::path& folder) const
+  {
+    return folders_.find(folder) != folders_.end();
+  }
+
+
+#if defined(__linux__)
+  static bool IsLinkToFolder(const fs::path& path)
+  {
+    boost::system::error_code ec1, ec2;
+    return (fs::is_symlink(fs::symlink_status(path, ec1)) && !ec1 &&
+            fs::is_directory(fs::status(path, ec2)) && !ec2);
+  }
+#endif
+
+
+  bool FolderWatcher::AddWatch(bool& isNew,
+                               const fs::path& folder)
+  {
+    isNew = false;
+
+#if defined(__linux__)
+    const int wd = inotify_add_watch(fd_, folder.c_str(), WATCH_MASK);
+    if (wd < 0)
+    {
+      if (errno == ENOSPC)
+      {
+        LOG(WARNING) << "Advanced Storage - Cannot watch more folders, increase fs.inotify.max_user_watches (" << watches_.size() << " folders are watched)";
+        return false;
+      }
+
+      return (errno == ENOENT || errno == ENOTDIR);  // the folder has disappeared in the meantime
+    }
+
+    // the watches are per inode: the same descriptor is returned for a folder that is already
+    // watched through another path (e.g. a symbolic link to one of its parents), keep the first path
+    if (watches_.find(wd) == watches_.end())
+    {
+      watches_[wd] = folder;
+      folders_[folder] = wd;
+      isNew = true;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+
+  bool FolderWatcher::AddTree(const fs::path& folder)
+  {
+    std::stack<fs::path> folders;
+    folders.push(folder);
+
+    while (!folders.empty())
+    {
+      const fs::path current = folders.top();
+      folders.pop();
+
+      bool isNew;
+      if (!AddWatch(isNew, current))
+      {
+        return false;
+      }
+
+      if (!isNew)
+      {
+        continue;  // already watched with its subfolders: this also stops the loops of symbolic links
+      }
+
+      boost::system::error_code ec;
+      for (fs::directory_iterator it(current, ec), end; !ec && it != end; it.increment(ec))
+      {
+        // follow the symbolic links, as the DirectoryWalker does when it scans the folders
+        boost::system::error_code ec2;
+        if (fs::is_directory(it->status(ec2)) && !ec2)
+        {
+          folders.push(it->path());
+        }
+      }
+    }
+
+    return true;
+  }
+
+
+  bool FolderWatcher::WaitEvents(std::vector<Event>& events,
+                                 unsigned int timeoutMs)
+  {
+#if defined(__linux__)
+    struct pollfd p;
+    p.fd = fd_;
+    p.events = POLLIN;
+    p.revents = 0;
+
+    if (poll(&p, 1, static_cast<int>(timeoutMs)) <= 0)
+    {
+      return true;  // timeout or signal
+    }
+
+    bool complete = true;
+
+    // aligned as required by inotify_event
+    char buffer[64 * 1024] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for (;;)
+    {
+      const ssize_t size = read(fd_, buffer, sizeof(buffer));
+      if (size <= 0)
+      {
+        break;  // EAGAIN: all the pending events have been read
+      }
+
+      for (const char* ptr = buffer; ptr < buffer + size; )
+      {
+        const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(ptr);
+        ptr += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW)
+        {
+          complete = false;
+          continue;
+        }
+
+        if (event->mask & IN_IGNORED)
+        {
+          // the folder has been removed
+          std::map<int, fs::path>::iterator removed = watches_.find(event->wd);
+          if (removed != watches_.end())
+          {
+            folders_.erase(removed->second);
+            watches_.erase(removed);
+          }
+          continue;
+        }
+
+        std::map<int, fs::path>::const_iterator folder = watches_.find(event->wd);
+        if (folder == watches_.end() ||
+            event->len == 0)
+        {
+          continue;
+        }
+
+        const fs::path path = folder->second / event->name;
+
+        // the symbolic links to folders are not reported with IN_ISDIR
+        const bool isFolder = ((event->mask & IN_ISDIR) ||
+                               ((event->mask & (IN_CREATE | IN_MOVED_TO)) && IsLinkToFolder(path)) ||
+                               ((event->mask & (IN_DELETE | IN_MOVED_FROM)) && IsWatched(path)));
+
+        if (isFolder)
+        {
+          if (event->mask & (IN_CREATE | IN_MOVED_TO))
+          {
+            if (!AddTree(path))
+            {
+              complete = false;
+            }
+
+            events.push_back(Event(EventType_NewFolder, path));
+          }
+          else if ((event->mask & IN_MOVED_FROM) ||
+                   ((event->mask & IN_DELETE) && !(event->mask & IN_ISDIR)))  // a link has been removed, not its target
+          {
+            // its watches remain but they now report paths outside of the tree: drop them (the paths
+            // are compared element by element, so the subfolders directly follow the folder)
+            const std::string prefix = path.string() + "/";
+
+            std::map<fs::path, int>::iterator it = folders_.lower_bound(path);
+            while (it != folders_.end() &&
+                   (it->first == path ||
+                    it->first.string().compare(0, prefix.size(), prefix) == 0))
+            {
+              inotify_rm_watch(fd_, it->second);
+              watches_.erase(it->second);
+              folders_.erase(it++);
+            }
+
+            events.push_back(Event(EventType_FolderRemoved, path));
+          }
+        }
+        else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        {
+          events.push_back(Event(EventType_FileWritten, path));
+        }
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+          events.push_back(Event(EventType_FileRemoved, path));
+        }
+      }
+    }
+
+    return complete;
+#else
+    return false;
+#endif
+  }
+
+
+  bool FolderWatcher::IsSupported()
+  {
+#if defined(__linux__)
+    return true;
+#else
+    return false;
+#endif
+  }
+}
@@ -0,0 +1,91 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <map>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // Watches folder trees for the files that are written, moved or deleted (inotify, Linux only).
+  // Each folder of the trees gets its own watch, the folders that are created or moved into the
+  // trees are watched as soon as their event is received.  The symbolic links to folders are
+  // followed, but a folder that can be reached through several paths is only reported with one.
+  class FolderWatcher : public boost::noncopyable
+  {
+  public:
+    enum EventType
+    {
+      EventType_FileWritten,    // a file has been closed after writing or moved into a tree
+      EventType_FileRemoved,    // a file has been deleted or moved out of a tree
+      EventType_NewFolder,      // a folder has been created or moved into a tree: its content must be scanned
+      EventType_FolderRemoved   // a folder has been moved out of a tree: its files are not reported one by one
+    };
+
+    struct Event
+    {
+      EventType                type_;
+      boost::filesystem::path  path_;
+
+      Event(EventType type,
+            const boost::filesystem::path& path) :
+        type_(type),
+        path_(path)
+      {
+      }
+    };
+
+  private:
+    int                                          fd_;
+    std::map<int, boost::filesystem::path>       watches_;
+    std::map<boost::filesystem::path, int>       folders_;   // reverse index of the watches
+
+    bool IsWatched(const boost::filesystem::path& folder) const;
+
+    // "isNew" is false if the folder was already watched (possibly through another path)
+    bool AddWatch(bool& isNew,
+                  const boost::filesystem::path& folder);
+
+  public:
+    FolderWatcher();
+
+    ~FolderWatcher();
+
+    // Watches the folder and all its subfolders.  Returns false if a folder could not be watched
+    // (e.g. the "fs.inotify.max_user_watches" limit has been reached).
+    bool AddTree(const boost::filesystem::path& folder);
+
+    // Waits for at most "timeoutMs" and appends the events that have been received.  Returns false
+    // if events have been lost (queue overflow): the trees must then be scanned again.
+    bool WaitEvents(std::vector<Event>& events,
+                    unsigned int timeoutMs);
+
+    size_t GetWatchesCount() const
+    {
+      return watches_.size();
+    }
+
+    static bool IsSupported();
+  };
+}
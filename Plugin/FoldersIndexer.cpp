@@ -28,8 +28,8 @@
 #include <Toolbox.h>
 
 #include "FoldersIndexer.h"
+#include "FolderEventsQueue.h"
 #include "Helpers.h"
-#include <stack>
 #include <algorithm>
 
 
@@ -41,6 +41,11 @@ namespace OrthancPlugins
   static const char* SERIALIZATION_KEY_SIZE = "s";
   static const char* SERIALIZATION_KEY_TIME = "t";
   static const char* SERIALIZATION_KEY_DELETED = "r";
+  static const char* KVS_ID_INDEXER_FOLDER = "advst-indexer-folder";
+  static const char* SERIALIZATION_KEY_SUBFOLDERS = "f";
+  static const size_t MAX_QUEUED_EVENTS = 100000;    // received while the indexer is busy, beyond their folders are recorded
+  static const size_t MAX_DROPPED_FOLDERS = 10000;   // beyond, the folders are scanned in full again
+  static const int64_t RACY_FOLDER_SECONDS = 2;  // a folder modified so recently might be modified again with the same time
 
 
   class IndexedPath
@@ -60,6 +65,14 @@ namespace OrthancPlugins
     {
     }
 
+    explicit IndexedPath(const IndexSnapshot::Record& record) :
+      time_(static_cast<std::time_t>(record.time_)),
+      size_(static_cast<uintmax_t>(record.size_)),
+      isDicom_(record.isDicom_),
+      hasBeenDeletedByOrthanc_(record.hasBeenDeletedByOrthanc_)
+    {
+    }
+
     static IndexedPath CreateFromSerializedString(const std::string& serialized)
     {
       Json::Value v;
@@ -110,9 +123,60 @@ namespace OrthancPlugins
       return hasBeenDeletedByOrthanc_;
     }
 
+    void ToRecord(IndexSnapshot::Record& record) const
+    {
+      record.time_ = static_cast<int64_t>(time_);
+      record.size_ = static_cast<uint64_t>(size_);
+      record.isDicom_ = isDicom_;
+      record.hasBeenDeletedByOrthanc_ = hasBeenDeletedByOrthanc_;
+    }
+
   };
 
 
+  static void SerializeFolder(std::string& serialized,
+                              int64_t mtimeNs,
+                              const std::vector<fs::path>& subfolders)
+  {
+    Json::Value v;
+    v[SERIALIZATION_KEY_VERSION] = 1;
+    v[SERIALIZATION_KEY_TIME] = Json::Value::Int64(mtimeNs);
+    v[SERIALIZATION_KEY_SUBFOLDERS] = Json::arrayValue;
+
+    for (size_t i = 0; i < subfolders.size(); i++)
+    {
+      v[SERIALIZATION_KEY_SUBFOLDERS].append(Orthanc::SystemToolbox::PathToUtf8(subfolders[i].filename()));
+    }
+
+    OrthancPlugins::WriteFastJson(serialized, v);
+  }
+
+  static bool UnserializeFolder(int64_t& mtimeNs,
+                                std::vector<std::string>& subfolders,
+                                const std::string& serialized)
+  {
+    Json::Value v;
+    OrthancPlugins::ReadJson(v, serialized);
+
+    if (v.type() != Json::objectValue ||
+        v[SERIALIZATION_KEY_VERSION].asInt() != 1 ||
+        !v[SERIALIZATION_KEY_SUBFOLDERS].isArray())
+    {
+      return false;
+    }
+
+    mtimeNs = v[SERIALIZATION_KEY_TIME].asInt64();
+
+    subfolders.clear();
+    for (Json::ArrayIndex i = 0; i < v[SERIALIZATION_KEY_SUBFOLDERS].size(); i++)
+    {
+      subfolders.push_back(v[SERIALIZATION_KEY_SUBFOLDERS][i].asString());
+    }
+
+    return true;
+  }
+
+
   FoldersIndexer::FoldersIndexer(const std::list<std::string>& folders, 
                                  unsigned int intervalInSeconds, 
                                  unsigned int throttleDelayMs,
@@ -121,13 +185,24 @@ namespace OrthancPlugins
                                  bool takeOwnership,
                                  bool enableVerboseLogs) :
     intervalInSeconds_(intervalInSeconds),
-    throttleDelayMs_(throttleDelayMs),
+    throttle_(throttleDelayMs),
     parsedExtensions_(parsedExentions),
     skippedExtensions_(skippedExentions),
     takeOwnership_(takeOwnership),
     enableVerboseLogs_(enableVerboseLogs),
+    fullRescanIntervalSeconds_(0),
+    walkerThreads_(1),
+    maxWalkerThreadsPerFolder_(0),
+    skipUnchangedFolders_(false),
+    fullVerificationPasses_(1),
+    passesCount_(0),
+    verifyFolders_(true),
     isRunning_(false),
-    kvsIndexedPaths_(KVS_ID_INDEXER_PATH)
+    kvsIndexedPaths_(KVS_ID_INDEXER_PATH),
+    snapshot_(new IndexSnapshot(IndexSnapshot::Mode_None)),
+    kvsIndexedFolders_(KVS_ID_INDEXER_FOLDER),
+    listedFoldersCount_(0),
+    skippedFoldersCount_(0)
   {
     for (std::list<std::string>::const_iterator it = folders.begin(); it != folders.end(); ++it)
     {
@@ -140,6 +215,40 @@ namespace OrthancPlugins
     }
   }
   
+  void FoldersIndexer::SetEventsMode(unsigned int fullRescanIntervalSeconds)
+  {
+    fullRescanIntervalSeconds_ = std::max(1u, fullRescanIntervalSeconds);
+  }
+
+  void FoldersIndexer::SetWalkerThreads(unsigned int threadsCount,
+                                        unsigned int maxThreadsPerFolder)
+  {
+    walkerThreads_ = std::max(1u, threadsCount);
+    maxWalkerThreadsPerFolder_ = maxThreadsPerFolder;
+  }
+
+  void FoldersIndexer::SetSkipUnchangedFolders(unsigned int fullVerificationPasses)
+  {
+    skipUnchangedFolders_ = true;
+    fullVerificationPasses_ = std::max(1u, fullVerificationPasses);
+  }
+
+  void FoldersIndexer::SetInMemoryIndex(IndexSnapshot::Mode mode)
+  {
+    snapshot_.reset(new IndexSnapshot(mode));
+  }
+
+  void FoldersIndexer::GetStatistics(Json::Value& target)
+  {
+    target = Json::objectValue;
+    target["InMemoryIndexEntries"] = static_cast<Json::UInt64>(snapshot_->GetCount());
+    target["InMemoryIndexMemoryBytes"] = static_cast<Json::UInt64>(snapshot_->GetMemoryUsage());
+
+    boost::mutex::scoped_lock lock(foldersMutex_);
+    target["ListedFolders"] = static_cast<Json::UInt64>(listedFoldersCount_);
+    target["SkippedUnchangedFolders"] = static_cast<Json::UInt64>(skippedFoldersCount_);
+  }
+
   FoldersIndexer::~FoldersIndexer()
   {
     Stop();
@@ -167,118 +276,323 @@ namespace OrthancPlugins
     }
   }
 
-  void FoldersIndexer::WorkerThread()
+  bool FoldersIndexer::IsIndexedExtension(const fs::path& path) const
   {
-    while (isRunning_)
+    if (parsedExtensions_.size() > 0 || skippedExtensions_.size() > 0)
     {
-      std::stack<boost::filesystem::path> pathStack;
+      std::string extension = path.extension().string();
+      if (parsedExtensions_.size() > 0 && std::find(parsedExtensions_.begin(), parsedExtensions_.end(), extension) == parsedExtensions_.end())
+      {
+        return false;
+      }
 
-      for (std::list<fs::path>::const_iterator it = folders_.begin();
-          it != folders_.end(); ++it)
+      if (skippedExtensions_.size() > 0 && std::find(skippedExtensions_.begin(), skippedExtensions_.end(), extension) != skippedExtensions_.end())
       {
-        pathStack.push(*it);
+        return false;
       }
+    }
+
+    return true;
+  }
+
+  bool FoldersIndexer::IsCandidate(const fs::path& path) const
+  {
+    return IsIndexedExtension(path);
+  }
 
-      while (!pathStack.empty())
+  void FoldersIndexer::VisitFile(const DirectoryWalker::FileEntry& file)
+  {
+    try
+    {
+      if (enableVerboseLogs_)
       {
-        if (!isRunning_)
-        {
-          return;
-        }
-        
-        boost::filesystem::path d = pathStack.top();
-        pathStack.pop();
+        LOG(INFO) << "FoldersIndexer is processing the file '" << Orthanc::SystemToolbox::PathToUtf8(file.path_) << "'";
+      }
 
-        boost::filesystem::directory_iterator current;
+      if (file.hasStatus_)
+      {
+        // the walker has already read the status of the file (the index stores the time in seconds)
+        ProcessFile(file.path_, static_cast<std::time_t>(file.mtimeNs_ / 1000000000ll), file.size_);
+      }
+      else
+      {
+        ProcessFile(file.path_);
+      }
       
-        try
-        {
-          current = boost::filesystem::directory_iterator(d);
-        }
-        catch (boost::filesystem::filesystem_error&)
+      throttle_.Sleep();
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Indexer: " << e.What();
+
+      // the folder must be enumerated again by the next scan, to retry this file
+      boost::mutex::scoped_lock lock(foldersMutex_);
+      failedFolders_.insert(Orthanc::SystemToolbox::PathToUtf8(file.path_.parent_path()));
+    }
+    catch (boost::filesystem::filesystem_error&)
+    {
+      // the file has disappeared since the folder was enumerated
+    }
+  }
+
+  bool FoldersIndexer::LookupUnchangedFolder(std::vector<fs::path>& subfolders,
+                                             const fs::path& folder,
+                                             int64_t mtimeNs)
+  {
+    if (!skipUnchangedFolders_ ||
+        verifyFolders_)
+    {
+      return false;
+    }
+
+    const std::string strFolder = Orthanc::SystemToolbox::PathToUtf8(folder);
+
+    std::string serialized;
+    int64_t recordedTime;
+    std::vector<std::string> names;
+
+    if (!kvsIndexedFolders_.GetValue(serialized, strFolder) ||
+        !UnserializeFolder(recordedTime, names, serialized) ||
+        recordedTime != mtimeNs)
+    {
+      return false;
+    }
+
+    // no entry has been added, removed or renamed in this folder since it has been recorded
+    for (size_t i = 0; i < names.size(); i++)
+    {
+      subfolders.push_back(folder / Orthanc::SystemToolbox::PathFromUtf8(names[i]));
+    }
+
+    boost::mutex::scoped_lock lock(foldersMutex_);
+    unchangedFolders_.push_back(IndexSnapshot::HashFolder(strFolder));
+    skippedFoldersCount_++;
+
+    return true;
+  }
+
+  void FoldersIndexer::VisitFolder(const fs::path& folder,
+                                   size_t root,
+                                   int64_t mtimeNs,
+                                   const std::vector<fs::path>& subfolders)
+  {
+    if (!skipUnchangedFolders_)
+    {
+      return;
+    }
+
+    boost::mutex::scoped_lock lock(foldersMutex_);
+    listedFoldersCount_++;
+
+    // like git's "racy" files: a folder that has just been modified might be modified again
+    // without changing its time, it will be recorded by a next scan
+    if (mtimeNs / 1000000000ll >= static_cast<int64_t>(time(NULL)) - RACY_FOLDER_SECONDS)
+    {
+      return;
+    }
+
+    PendingFolder& pending = pendingFolders_[Orthanc::SystemToolbox::PathToUtf8(folder)];
+    pending.root_ = root;
+    SerializeFolder(pending.serialized_, mtimeNs, subfolders);
+  }
+
+  void FoldersIndexer::CommitFolders(const std::vector<bool>& complete)
+  {
+    std::map<std::string, PendingFolder> pending;
+    std::set<std::string> failed;
+
+    {
+      boost::mutex::scoped_lock lock(foldersMutex_);
+      pending.swap(pendingFolders_);
+      failed.swap(failedFolders_);
+    }
+
+    for (std::map<std::string, PendingFolder>::const_iterator it = pending.begin(); it != pending.end(); ++it)
+    {
+      // the files of a folder are only known to be indexed if the walk of its root has completed
+      if (it->second.root_ >= complete.size() ||
+          !complete[it->second.root_] ||
+          failed.find(it->first) != failed.end())
+      {
+        continue;
+      }
+
+      std::string previous;
+      if (kvsIndexedFolders_.GetValue(previous, it->first))
+      {
+        if (previous == it->second.serialized_)
         {
-          LOG(WARNING) << "Indexer cannot read directory: " << Orthanc::SystemToolbox::PathToUtf8(d);
           continue;
         }
 
-        const boost::filesystem::directory_iterator end;
-      
-        while (current != end)
+        // forget the subfolders that have been removed
+        int64_t previousTime, currentTime;
+        std::vector<std::string> previousNames, currentNames;
+
+        if (UnserializeFolder(previousTime, previousNames, previous) &&
+            UnserializeFolder(currentTime, currentNames, it->second.serialized_))
         {
-          try
+          std::set<std::string> current(currentNames.begin(), currentNames.end());
+
+          for (size_t i = 0; i < previousNames.size(); i++)
           {
-            const boost::filesystem::file_status status = boost::filesystem::status(current->path());
-            
-            switch (status.type())
+            if (current.find(previousNames[i]) == current.end())
             {
-              case boost::filesystem::regular_file:
-              case boost::filesystem::reparse_file:
-                try
-                {
-                  // check extensions
-                  if (parsedExtensions_.size() > 0 || skippedExtensions_.size() > 0)
-                  {
-                    std::string extension = boost::filesystem::path(current->path()).extension().string();
-                    if (parsedExtensions_.size() > 0 && std::find(parsedExtensions_.begin(), parsedExtensions_.end(), extension) == parsedExtensions_.end())
-                    {
-                      ++current;
-                      continue;
-                    }
-
-                    if (skippedExtensions_.size() > 0 && std::find(skippedExtensions_.begin(), skippedExtensions_.end(), extension) != skippedExtensions_.end())
-                    {
-                      ++current;
-                      continue;
-                    }
-                  }
-
-                  if (enableVerboseLogs_)
-                  {
-                    LOG(INFO) << "FoldersIndexer is processing the file '" << Orthanc::SystemToolbox::PathToUtf8(current->path()) << "'";
-                  }
-
-                  ProcessFile(current->path());
-                  
-                  if (throttleDelayMs_ > 0)
-                  {
-                    boost::this_thread::sleep(boost::posix_time::milliseconds(throttleDelayMs_));
-                  }
-                }
-                catch (Orthanc::OrthancException& e)
-                {
-                  LOG(ERROR) << "Indexer: " << e.What();
-                }              
-                break;
-            
-              case boost::filesystem::directory_file:
-                if (enableVerboseLogs_)
-                {
-                  LOG(INFO) << "FoldersIndexer will process the folder '" << Orthanc::SystemToolbox::PathToUtf8(current->path()) << "'";
-                }
-
-                pathStack.push(current->path());
-                break;
-            
-              default:
-                break;
+              RemoveFolderRecord(Orthanc::SystemToolbox::PathToUtf8(
+                                   Orthanc::SystemToolbox::PathFromUtf8(it->first) / Orthanc::SystemToolbox::PathFromUtf8(previousNames[i])));
             }
           }
-          catch (boost::filesystem::filesystem_error&)
-          {
-          }
+        }
+      }
+
+      kvsIndexedFolders_.Store(it->first, it->second.serialized_);
+    }
+  }
+
+  void FoldersIndexer::RemoveFolderRecord(const std::string& folder)
+  {
+    std::string serialized;
+    if (kvsIndexedFolders_.GetValue(serialized, folder))
+    {
+      int64_t mtimeNs;
+      std::vector<std::string> names;
 
-          ++current;
+      if (UnserializeFolder(mtimeNs, names, serialized))
+      {
+        for (size_t i = 0; i < names.size(); i++)
+        {
+          RemoveFolderRecord(Orthanc::SystemToolbox::PathToUtf8(
+                               Orthanc::SystemToolbox::PathFromUtf8(folder) / Orthanc::SystemToolbox::PathFromUtf8(names[i])));
         }
       }
 
+      kvsIndexedFolders_.DeleteKey(folder);
+    }
+  }
+
+  void FoldersIndexer::ScanFolders(std::vector<bool>& complete,
+                                   const std::list<fs::path>& folders)
+  {
+    // the folders are enumerated by the walker threads, the files are processed one at a time by this thread
+    DirectoryWalker walker(walkerThreads_, maxWalkerThreadsPerFolder_);
+    walker.SetVerbose(enableVerboseLogs_);
+    walker.SetTrackFolders(skipUnchangedFolders_);
+
+    {
+      boost::mutex::scoped_lock lock(foldersMutex_);
+      pendingFolders_.clear();
+      failedFolders_.clear();
+    }
+
+    std::vector<fs::path> roots(folders.begin(), folders.end());
+    walker.Walk(complete, roots, *this, isRunning_);
+
+    if (skipUnchangedFolders_)
+    {
       try
       {
-        LookupDeletedFiles();
+        CommitFolders(complete);
       }
       catch (Orthanc::OrthancException& e)
       {
-        LOG(ERROR) << e.What();
+        LOG(ERROR) << "Indexer: the scanned folders could not be recorded: " << e.What();
       }
+    }
+  }
+
+  void FoldersIndexer::FullScan()
+  {
+    if (snapshot_->GetMode() != IndexSnapshot::Mode_None &&
+        !snapshot_->IsLoaded())
+    {
+      try
+      {
+        LoadSnapshot();
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Indexer: the in-memory index could not be loaded: " << e.What();
+      }
+    }
+
+    if (skipUnchangedFolders_)
+    {
+      verifyFolders_ = (passesCount_ % fullVerificationPasses_ == 0);
+      passesCount_++;
+
+      boost::mutex::scoped_lock lock(foldersMutex_);
+      unchangedFolders_.clear();
+      listedFoldersCount_ = 0;
+      skippedFoldersCount_ = 0;
+    }
+
+    // with the in-memory index, the deleted files are the ones that are not seen by the scan
+    const bool sweep = snapshot_->StartPass();
+
+    std::vector<bool> complete;
+    ScanFolders(complete, folders_);
+
+    if (!isRunning_)
+    {
+      return;
+    }
+
+    if (skipUnchangedFolders_)
+    {
+      boost::mutex::scoped_lock lock(foldersMutex_);
+      LOG(INFO) << "Indexer: " << listedFoldersCount_ << " folders have been enumerated, "
+                << skippedFoldersCount_ << " unchanged folders have been skipped"
+                << (verifyFolders_ ? " (full verification)" : "");
+    }
+
+    try
+    {
+      if (sweep)
+      {
+        SweepUnseenFiles(complete);
+      }
+      else
+      {
+        LookupDeletedFiles(std::set<std::string>());
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << e.What();
+    }
+  }
+
+  void FoldersIndexer::WorkerThread()
+  {
+    if (fullRescanIntervalSeconds_ > 0)
+    {
+      if (!FolderWatcher::IsSupported())
+      {
+        LOG(WARNING) << "Indexer: the events mode is not supported on this platform, the folders are scanned every " << intervalInSeconds_ << " seconds";
+      }
+      else
+      {
+        try
+        {
+          WatchFolders();
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Indexer: " << e.What();
+        }
+
+        if (!isRunning_)
+        {
+          return;
+        }
+
+        LOG(WARNING) << "Indexer: the folders could not be watched, they are scanned every " << intervalInSeconds_ << " seconds";
+      }
+    }
+
+    while (isRunning_)
+    {
+      FullScan();
       
       for (unsigned int i = 0; i < intervalInSeconds_ * 10; i++)
       {
@@ -292,18 +606,215 @@ namespace OrthancPlugins
     }
   }
 
+  void FoldersIndexer::WatchFolders()
+  {
+    FolderWatcher watcher;
+
+    // the watches are installed before the initial scan, so that no file is missed in-between
+    for (std::list<fs::path>::const_iterator it = folders_.begin(); it != folders_.end(); ++it)
+    {
+      if (!watcher.AddTree(*it))
+      {
+        return;
+      }
+    }
+
+    LOG(WARNING) << "Indexer: watching " << watcher.GetWatchesCount() << " folders, a full scan is done every " << fullRescanIntervalSeconds_ << " seconds";
+
+    // the events keep being received while this thread is scanning the folders
+    FolderEventsQueue queue(watcher, MAX_QUEUED_EVENTS, MAX_DROPPED_FOLDERS);
+
+    bool needsFullScan = true;
+    time_t lastFullScan = 0;
+
+    while (isRunning_)
+    {
+      const time_t now = time(NULL);
+
+      // after lost events, the folders are not scanned more often than in the polling mode
+      if ((needsFullScan && now - lastFullScan >= static_cast<time_t>(intervalInSeconds_)) ||
+          now - lastFullScan >= static_cast<time_t>(fullRescanIntervalSeconds_))
+      {
+        needsFullScan = false;
+        lastFullScan = time(NULL);
+        FullScan();
+      }
+
+      std::vector<FolderWatcher::Event> events;
+      std::list<fs::path> droppedFolders;
+
+      switch (queue.WaitEvents(events, droppedFolders, 100 /* to check isRunning_ */))
+      {
+        case FolderEventsQueue::Status_WatcherStopped:
+          return;
+
+        case FolderEventsQueue::Status_EventsLost:
+          LOG(WARNING) << "Indexer: some file events have been lost, the folders will be scanned again";
+          needsFullScan = true;
+          break;
+
+        default:
+          break;
+      }
+
+      // the folders whose indexed files must be checked, since they might have been deleted
+      std::set<std::string> removedFolders;
+
+      if (!droppedFolders.empty() &&
+          !needsFullScan &&
+          isRunning_)
+      {
+        LOG(WARNING) << "Indexer: too many file events were pending, " << droppedFolders.size() << " folders will be scanned again";
+
+        std::list<fs::path> existingFolders;
+        for (std::list<fs::path>::const_iterator it = droppedFolders.begin(); it != droppedFolders.end(); ++it)
+        {
+          removedFolders.insert(Orthanc::SystemToolbox::PathToUtf8(*it));
+
+          boost::system::error_code ec;
+          if (fs::is_directory(*it, ec) && !ec)
+          {
+            existingFolders.push_back(*it);
+          }
+        }
+
+        // their files might have been rewritten without changing the modification time of the folders
+        const bool verifyFolders = verifyFolders_;
+        verifyFolders_ = true;
+
+        try
+        {
+          std::vector<bool> complete;
+          ScanFolders(complete, existingFolders);
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Indexer: " << e.What();
+        }
+
+        verifyFolders_ = verifyFolders;
+      }
+
+      for (size_t i = 0; i < events.size() && isRunning_; i++)
+      {
+        if (events[i].type_ == FolderWatcher::EventType_FolderRemoved)
+        {
+          // its files are abandoned at once, after the other events of this batch
+          LOG(INFO) << "Indexer: a folder has been moved away: " << Orthanc::SystemToolbox::PathToUtf8(events[i].path_);
+          removedFolders.insert(Orthanc::SystemToolbox::PathToUtf8(events[i].path_));
+          continue;
+        }
+
+        try
+        {
+          ProcessEvent(events[i]);
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Indexer: " << e.What();
+        }
+        catch (boost::filesystem::filesystem_error&)
+        {
+          // the file has disappeared in the meantime, its deletion has been notified as well
+        }
+      }
+
+      if (!removedFolders.empty() &&
+          isRunning_)
+      {
+        try
+        {
+          LookupDeletedFiles(removedFolders);
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Indexer: " << e.What();
+        }
+      }
+    }
+  }
+
+  void FoldersIndexer::ProcessEvent(const FolderWatcher::Event& event)
+  {
+    switch (event.type_)
+    {
+      case FolderWatcher::EventType_FileWritten:
+        if (IsIndexedExtension(event.path_) &&
+            Orthanc::SystemToolbox::IsRegularFile(event.path_))
+        {
+          if (enableVerboseLogs_)
+          {
+            LOG(INFO) << "FoldersIndexer is processing the file '" << Orthanc::SystemToolbox::PathToUtf8(event.path_) << "'";
+          }
+
+          ProcessFile(event.path_);
+          throttle_.Sleep();
+        }
+        break;
+
+      case FolderWatcher::EventType_FileRemoved:
+        if (!Orthanc::SystemToolbox::IsRegularFile(event.path_))
+        {
+          ProcessDeletedFile(Orthanc::SystemToolbox::PathToUtf8(event.path_));
+        }
+        break;
+
+      case FolderWatcher::EventType_NewFolder:
+      {
+        // the files might have been written in the folder before it was watched
+        std::list<fs::path> folder;
+        folder.push_back(event.path_);
+
+        std::vector<bool> complete;
+        ScanFolders(complete, folder);
+        break;
+      }
+
+      case FolderWatcher::EventType_FolderRemoved:
+        // handled by WatchFolders(), that checks the indexed files of all the removed folders at once
+        break;
+
+      default:
+        break;
+    }
+  }
+
   void FoldersIndexer::ProcessFile(const fs::path& path)
   {
-    std::time_t lastWriteTime = boost::filesystem::last_write_time(path);
-    uintmax_t fileSize = boost::filesystem::file_size(path);
+    ProcessFile(path, boost::filesystem::last_write_time(path), boost::filesystem::file_size(path));
+  }
 
+  void FoldersIndexer::ProcessFile(const fs::path& path,
+                                   std::time_t lastWriteTime,
+                                   uintmax_t fileSize)
+  {
     std::string serialized;
     std::string strPath = Orthanc::SystemToolbox::PathToUtf8(path);
 
-    if (kvsIndexedPaths_.GetValue(serialized, strPath))
+    IndexSnapshot::Record record;
+    IndexSnapshot::Lookup lookup = snapshot_->Find(record, strPath, true /* seen by this pass */);
+
+    // The snapshot is only kept up-to-date by this Orthanc: a file that it reports as absent might
+    // have been indexed by another Orthanc sharing the same DB.  This is confirmed by the key-value
+    // store before adopting the file (the adoption is much more costly anyway).
+    if (lookup != IndexSnapshot::Lookup_Present &&
+        kvsIndexedPaths_.GetValue(serialized, strPath))
     {
-      // this is not a new file but it might have been modified
       IndexedPath indexedPath = IndexedPath::CreateFromSerializedString(serialized);
+      indexedPath.ToRecord(record);
+
+      if (lookup == IndexSnapshot::Lookup_Absent)
+      {
+        snapshot_->Store(strPath, record);
+      }
+
+      lookup = IndexSnapshot::Lookup_Present;
+    }
+
+    if (lookup == IndexSnapshot::Lookup_Present)
+    {
+      // this is not a new file but it might have been modified
+      IndexedPath indexedPath(record);
       
       if (indexedPath.HasChanged(lastWriteTime, fileSize))
       {
@@ -315,6 +826,7 @@ namespace OrthancPlugins
         }
 
         kvsIndexedPaths_.DeleteKey(strPath);
+        snapshot_->Remove(strPath);
       }
       else
       {
@@ -341,9 +853,81 @@ namespace OrthancPlugins
     newIndexedPath.ToString(newIndexedPathSerialized);
 
     kvsIndexedPaths_.Store(strPath, newIndexedPathSerialized);
+
+    newIndexedPath.ToRecord(record);
+    snapshot_->Store(strPath, record);
+  }
+
+  void FoldersIndexer::LoadSnapshot()
+  {
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    snapshot_->BeginLoading();
+
+    try
+    {
+      std::unique_ptr<OrthancPlugins::KeyValueStore::Iterator> iterator(kvsIndexedPaths_.CreateIterator());
+
+      while (iterator->Next())
+      {
+        if (!isRunning_)
+        {
+          snapshot_->CancelLoading();
+          return;
+        }
+
+        std::string serialized;
+        iterator->GetValue(serialized);
+
+        IndexSnapshot::Record record;
+        IndexedPath::CreateFromSerializedString(serialized).ToRecord(record);
+        snapshot_->AddLoaded(iterator->GetKey(), record);
+      }
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      snapshot_->CancelLoading();
+      throw;
+    }
+
+    snapshot_->EndLoading();
+
+    LOG(WARNING) << "Indexer: loaded " << snapshot_->GetCount() << " indexed files in memory ("
+                 << snapshot_->GetMemoryUsage() / (1024 * 1024) << " MB) in "
+                 << (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds() << " ms";
   }
 
-  void FoldersIndexer::LookupDeletedFiles()
+  static bool IsInFolder(const std::string& path,
+                         const std::string& folder)
+  {
+    if (folder.empty() ||
+        path.size() <= folder.size() ||
+        path.compare(0, folder.size(), folder) != 0)
+    {
+      return false;
+    }
+
+    const char last = folder[folder.size() - 1];
+    const char next = path[folder.size()];
+    return (last == '/' || last == '\\' || next == '/' || next == '\\');
+  }
+
+  // Whether the path is in one of the folders or in one of their subfolders
+  static bool IsInFolders(const std::string& path,
+                          const std::set<std::string>& folders)
+  {
+    for (size_t pos = path.find_first_of("/\\", 1); pos != std::string::npos; pos = path.find_first_of("/\\", pos + 1))
+    {
+      if (folders.find(path.substr(0, pos)) != folders.end())
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void FoldersIndexer::LookupDeletedFiles(const std::set<std::string>& folders)
   {
     std::unique_ptr<OrthancPlugins::KeyValueStore::Iterator> iterator(kvsIndexedPaths_.CreateIterator());
 
@@ -356,6 +940,12 @@ namespace OrthancPlugins
 
       const std::string strPath = iterator->GetKey();
 
+      if (!folders.empty() &&
+          !IsInFolders(strPath, folders))
+      {
+        continue;
+      }
+
       if (enableVerboseLogs_)
       {
         LOG(INFO) << "FoldersIndexer is checking if previously indexed file is still there '" << strPath << "'";
@@ -367,44 +957,159 @@ namespace OrthancPlugins
         std::string serialized;
         iterator->GetValue(serialized);
 
-        IndexedPath indexedPath = IndexedPath::CreateFromSerializedString(serialized);
+        ProcessDeletedFile(strPath, serialized);
+      }
 
-        if (indexedPath.IsDicom() && !indexedPath.HasBeenDeletedByOrthanc())
-        {
-          LOG(INFO) << "Indexer: a DICOM file has been deleted, abandoning it: " << strPath;
-          AbandonFile(strPath);
-        }
-        else
+      throttle_.Sleep();
+    }
+  }
+
+  void FoldersIndexer::SweepUnseenFiles(const std::vector<bool>& complete)
+  {
+    // the files of the unchanged folders are still there
+    std::vector<uint64_t> unchangedFolders;
+
+    {
+      boost::mutex::scoped_lock lock(foldersMutex_);
+      unchangedFolders = unchangedFolders_;
+    }
+
+    std::sort(unchangedFolders.begin(), unchangedFolders.end());
+
+    std::vector<uint64_t> unseen;
+    snapshot_->ListUnseen(unseen, unchangedFolders);
+
+    if (unseen.empty())
+    {
+      return;  // all the indexed files are still there: no need to browse the key-value store
+    }
+
+    std::vector<std::string> completeFolders;
+    size_t i = 0;
+    for (std::list<fs::path>::const_iterator it = folders_.begin(); it != folders_.end(); ++it, i++)
+    {
+      if (i < complete.size() && complete[i])
+      {
+        completeFolders.push_back(Orthanc::SystemToolbox::PathToUtf8(*it));
+      }
+    }
+
+    LOG(INFO) << "Indexer: " << unseen.size() << " indexed files have not been seen by the last scan";
+
+    std::unique_ptr<OrthancPlugins::KeyValueStore::Iterator> iterator(kvsIndexedPaths_.CreateIterator());
+
+    while (iterator->Next() && isRunning_)
+    {
+      const std::string strPath = iterator->GetKey();
+
+      if (!std::binary_search(unseen.begin(), unseen.end(), IndexSnapshot::HashPath(strPath)))
+      {
+        continue;  // seen by the scan
+      }
+
+      const fs::path path = Orthanc::SystemToolbox::PathFromUtf8(strPath);
+
+      bool isUnderCompleteFolder = false;
+      for (size_t j = 0; j < completeFolders.size() && !isUnderCompleteFolder; j++)
+      {
+        isUnderCompleteFolder = IsInFolder(strPath, completeFolders[j]);
+      }
+
+      bool isDeleted;
+      if (isUnderCompleteFolder &&
+          IsIndexedExtension(path))
+      {
+        // the scan would have seen the file if it was still there
+        isDeleted = true;
+      }
+      else
+      {
+        // the file is in a folder that could not be scanned completely, out of the indexed
+        // folders or has an extension that is not indexed anymore
+        if (enableVerboseLogs_)
         {
-          LOG(INFO) << "Indexer: a file has been deleted, removing it from the index: " << strPath;
+          LOG(INFO) << "FoldersIndexer is checking if previously indexed file is still there '" << strPath << "'";
         }
 
-        kvsIndexedPaths_.DeleteKey(strPath);
+        isDeleted = !Orthanc::SystemToolbox::IsRegularFile(path);
       }
 
-      if (throttleDelayMs_ > 0)
+      if (isDeleted)
       {
-        boost::this_thread::sleep(boost::posix_time::milliseconds(throttleDelayMs_));
+        std::string serialized;
+        iterator->GetValue(serialized);
+
+        ProcessDeletedFile(strPath, serialized);
+        throttle_.Sleep();
       }
     }
   }
 
+  void FoldersIndexer::ProcessDeletedFile(const std::string& strPath,
+                                          const std::string& serialized)
+  {
+    IndexedPath indexedPath = IndexedPath::CreateFromSerializedString(serialized);
+
+    if (indexedPath.IsDicom() && !indexedPath.HasBeenDeletedByOrthanc())
+    {
+      LOG(INFO) << "Indexer: a DICOM file has been deleted, abandoning it: " << strPath;
+      AbandonFile(strPath);
+    }
+    else
+    {
+      LOG(INFO) << "Indexer: a file has been deleted, removing it from the index: " << strPath;
+    }
+
+    kvsIndexedPaths_.DeleteKey(strPath);
+    snapshot_->Remove(strPath);
+  }
+
+  void FoldersIndexer::ProcessDeletedFile(const std::string& strPath)
+  {
+    IndexSnapshot::Record record;
+    if (snapshot_->Find(record, strPath, false) == IndexSnapshot::Lookup_Absent)
+    {
+      return;
+    }
+
+    std::string serialized;
+    if (kvsIndexedPaths_.GetValue(serialized, strPath))
+    {
+      ProcessDeletedFile(strPath, serialized);
+    }
+  }
+
   bool FoldersIndexer::IsFileIndexed(const std::string& path)
   {
-    std::string serializedNotUsed;
-    return kvsIndexedPaths_.GetValue(serializedNotUsed, path);
+    IndexSnapshot::Record record;
+    if (snapshot_->Find(record, path, false) == IndexSnapshot::Lookup_Present)
+    {
+      return true;
+    }
+    else
+    {
+      // the file might have been indexed by another Orthanc sharing the same DB
+      std::string serializedNotUsed;
+      return kvsIndexedPaths_.GetValue(serializedNotUsed, path);
+    }
   }
 
   void FoldersIndexer::MarkAsDeletedByOrthanc(const std::string& path)
   {
+    // only called for the adopted files: the snapshot is not used, since another Orthanc sharing the
+    // same DB might have indexed the file
     std::string serialized;
     if (kvsIndexedPaths_.GetValue(serialized, path))
     {
+      IndexSnapshot::Record record;
       IndexedPath ip = IndexedPath::CreateFromSerializedString(serialized);
       ip.MarkAsDeletedByOrthanc();
       
       ip.ToString(serialized);
       kvsIndexedPaths_.Store(path, serialized);
+
+      ip.ToRecord(record);
+      snapshot_->Store(path, record);
     }
   }
 
@@ -23,10 +23,16 @@
 #pragma once
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "AdaptiveThrottle.h"
+#include "DirectoryWalker.h"
+#include "FolderWatcher.h"
+#include "IndexSnapshot.h"
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
 #include <list>
+#include <map>
+#include <set>
 #include <string.h>
 
 namespace fs = boost::filesystem;
@@ -34,25 +40,81 @@ namespace fs = boost::filesystem;
 namespace OrthancPlugins
 {
 
-  class FoldersIndexer
+  class FoldersIndexer : public DirectoryWalker::IVisitor
   {
     std::list<fs::path>       folders_;
     unsigned int              intervalInSeconds_;
-    unsigned int              throttleDelayMs_;
+    AdaptiveThrottle          throttle_;
     std::list<std::string>    parsedExtensions_;
     std::list<std::string>    skippedExtensions_;
     bool                      takeOwnership_;
     bool                      enableVerboseLogs_;
+    unsigned int              fullRescanIntervalSeconds_;  // 0 if the events mode is disabled
+    unsigned int              walkerThreads_;
+    unsigned int              maxWalkerThreadsPerFolder_;  // 0 for no limit
+    bool                      skipUnchangedFolders_;
+    unsigned int              fullVerificationPasses_;
+    unsigned int              passesCount_;
+    bool                      verifyFolders_;              // true during a full verification pass
     
-    bool                      isRunning_;
+    volatile bool             isRunning_;
     boost::thread             thread_;
     OrthancPlugins::KeyValueStore kvsIndexedPaths_;
+    std::unique_ptr<IndexSnapshot> snapshot_;
+    OrthancPlugins::KeyValueStore kvsIndexedFolders_;
+
+    struct PendingFolder
+    {
+      size_t       root_;
+      std::string  serialized_;
+    };
+
+    // the folders are looked up and visited by the walker threads
+    boost::mutex              foldersMutex_;
+    std::vector<uint64_t>     unchangedFolders_;   // hashes of the folders skipped since the start of the pass
+    std::map<std::string, PendingFolder>  pendingFolders_;  // recorded once their files have been processed
+    std::set<std::string>     failedFolders_;      // folders with a file that could not be processed
+    uint64_t                  listedFoldersCount_;
+    uint64_t                  skippedFoldersCount_;
+
+    bool IsIndexedExtension(const fs::path& path) const;
+
+    // "complete" tells, for each folder, whether it has been enumerated completely
+    void ScanFolders(std::vector<bool>& complete,
+                     const std::list<fs::path>& folders);
+
+    void FullScan();
+
+    void WatchFolders();
+
+    void ProcessEvent(const FolderWatcher::Event& event);
 
     void ProcessFile(const fs::path& path);
 
+    void ProcessFile(const fs::path& path,
+                     std::time_t lastWriteTime,
+                     uintmax_t fileSize);
+
+    void ProcessDeletedFile(const std::string& strPath,
+                            const std::string& serialized);
+
+    // Does nothing if the file has not been indexed
+    void ProcessDeletedFile(const std::string& strPath);
+
     void ProcessDeletedFiles();
 
-    void LookupDeletedFiles();
+    // Only the files of the given folders (and of their subfolders) are checked, if "folders" is not empty
+    void LookupDeletedFiles(const std::set<std::string>& folders);
+
+    // The indexed files that have not been seen by the last scan of a complete folder have been
+    // deleted (requires the "Full" in-memory index)
+    void SweepUnseenFiles(const std::vector<bool>& complete);
+
+    void LoadSnapshot();
+
+    void CommitFolders(const std::vector<bool>& complete);
+
+    void RemoveFolderRecord(const std::string& folder);
 
   public:
     FoldersIndexer(const std::list<std::string>& folders, 
@@ -65,6 +127,26 @@ namespace OrthancPlugins
 
     ~FoldersIndexer();
 
+    // Instead of scanning the folders every "Interval" seconds, the files are processed as soon as
+    // they are written or deleted (Linux only) and the folders are only scanned in full every
+    // "fullRescanIntervalSeconds" as a safety net
+    void SetEventsMode(unsigned int fullRescanIntervalSeconds);
+
+    // The number of threads that enumerate the folders (the files are always adopted one at a time)
+    // and the maximum number of these threads that can enumerate the same indexed folder at once
+    void SetWalkerThreads(unsigned int threadsCount,
+                          unsigned int maxThreadsPerFolder);
+
+    // The folders whose modification time has not changed since their last scan are not enumerated
+    // again (only their subfolders are walked), except every "fullVerificationPasses" scans
+    void SetSkipUnchangedFolders(unsigned int fullVerificationPasses);
+
+    // Keeps a copy of the index in memory, so that the unchanged files are skipped without
+    // querying the Orthanc DB (only safe if no other Orthanc indexes the same folders)
+    void SetInMemoryIndex(IndexSnapshot::Mode mode);
+
+    void GetStatistics(Json::Value& target);
+
     void Start();
 
     void Stop();
@@ -74,6 +156,19 @@ namespace OrthancPlugins
     bool IsFileIndexed(const std::string& path);
 
     void MarkAsDeletedByOrthanc(const std::string& path);
+
+    virtual bool IsCandidate(const fs::path& path) const ORTHANC_OVERRIDE;
+
+    virtual void VisitFile(const DirectoryWalker::FileEntry& file) ORTHANC_OVERRIDE;
+
+    virtual bool LookupUnchangedFolder(std::vector<fs::path>& subfolders,
+                                       const fs::path& folder,
+                                       int64_t mtimeNs) ORTHANC_OVERRIDE;
+
+    virtual void VisitFolder(const fs::path& folder,
+                             size_t root,
+                             int64_t mtimeNs,
+                             const std::vector<fs::path>& subfolders) ORTHANC_OVERRIDE;
   };
 
 }
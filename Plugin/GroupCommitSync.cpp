@@ -0,0 +1,205 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "GroupCommitSync.h"
+
+#include <Compatibility.h>
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <map>
+
+#if defined(__linux__)
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <string.h>
+#  include <unistd.h>
+#endif
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+  typedef std::map<std::string, GroupCommitSync*>  Syncers;
+
+  static boost::mutex syncersMutex_;
+  static Syncers syncers_;
+
+
+  GroupCommitSync::GroupCommitSync(const fs::path& rootPath) :
+    rootFd_(-1),
+    isFlushing_(false),
+    epochsCount_(0),
+    filesCount_(0),
+    maxEpochSize_(0),
+    totalWaitUs_(0),
+    maxWaitUs_(0)
+  {
+#if defined(__linux__)
+    rootFd_ = open(rootPath.string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd_ < 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                      "Unable to open the storage root for group commit: " + rootPath.string());
+    }
+#else
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+#endif
+  }
+
+
+  GroupCommitSync::~GroupCommitSync()
+  {
+#if defined(__linux__)
+    if (rootFd_ >= 0)
+    {
+      close(rootFd_);
+    }
+#endif
+  }
+
+
+  bool GroupCommitSync::Flush()
+  {
+#if defined(__linux__)
+    if (syncfs(rootFd_) == 0)
+    {
+      return true;
+    }
+
+    LOG(ERROR) << "AdvancedStorage - syncfs() failed during group commit: " << strerror(errno);
+#endif
+
+    return false;
+  }
+
+
+  void GroupCommitSync::WaitDurable()
+  {
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (pendingEpoch_.get() == NULL)
+    {
+      pendingEpoch_.reset(new Epoch);
+      pendingEpoch_->isDone_ = false;
+      pendingEpoch_->isSuccess_ = false;
+      pendingEpoch_->size_ = 0;
+    }
+
+    boost::shared_ptr<Epoch> epoch = pendingEpoch_;
+    epoch->size_++;
+
+    while (!epoch->isDone_)
+    {
+      if (isFlushing_)
+      {
+        // the ongoing flush may have started before our file was written: wait for the next one
+        epochDone_.wait(lock);
+      }
+      else
+      {
+        // we are the leader of the pending epoch: close it and flush it, the writers
+        // arriving in the meantime will gather in a new epoch
+        isFlushing_ = true;
+        pendingEpoch_.reset();
+
+        lock.unlock();
+        const bool success = Flush();
+        lock.lock();
+
+        epoch->isDone_ = true;
+        epoch->isSuccess_ = success;
+        isFlushing_ = false;
+
+        epochsCount_++;
+        filesCount_ += epoch->size_;
+        maxEpochSize_ = std::max(maxEpochSize_, epoch->size_);
+
+        epochDone_.notify_all();
+      }
+    }
+
+    const uint64_t waitUs = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+    totalWaitUs_ += waitUs;
+    maxWaitUs_ = std::max(maxWaitUs_, waitUs);
+
+    if (!epoch->isSuccess_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Unable to sync the storage area");
+    }
+  }
+
+
+  void GroupCommitSync::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["Epochs"] = static_cast<Json::UInt64>(epochsCount_);
+    target["Files"] = static_cast<Json::UInt64>(filesCount_);
+    target["AverageEpochSize"] = (epochsCount_ == 0 ? 0.0 : static_cast<double>(filesCount_) / static_cast<double>(epochsCount_));
+    target["MaxEpochSize"] = static_cast<Json::UInt64>(maxEpochSize_);
+    target["AverageWaitMs"] = (filesCount_ == 0 ? 0.0 : static_cast<double>(totalWaitUs_) / static_cast<double>(filesCount_) / 1000.0);
+    target["MaxWaitMs"] = static_cast<double>(maxWaitUs_) / 1000.0;
+  }
+
+
+  bool GroupCommitSync::IsSupported()
+  {
+#if defined(__linux__)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+
+  GroupCommitSync& GroupCommitSync::GetForStorage(const fs::path& rootPath)
+  {
+    const std::string root = rootPath.string();
+
+    boost::mutex::scoped_lock lock(syncersMutex_);
+
+    Syncers::iterator found = syncers_.find(root);
+    if (found == syncers_.end())
+    {
+      // syncers are never deleted: there is one per storage and they live as long as the plugin
+      found = syncers_.insert(std::make_pair(root, new GroupCommitSync(rootPath))).first;
+    }
+
+    return *found->second;
+  }
+
+
+  void GroupCommitSync::GetAllStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(syncersMutex_);
+
+    target = Json::objectValue;
+
+    for (Syncers::const_iterator it = syncers_.begin(); it != syncers_.end(); ++it)
+    {
+      it->second->GetStatistics(target[it->first]);
+    }
+  }
+}
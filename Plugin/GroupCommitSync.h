@@ -0,0 +1,79 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <stdint.h>
+
+
+namespace OrthancPlugins
+{
+  // Group commit of the writes in a storage: instead of one fsync per file, the writers that
+  // are waiting at the same time join a "sync epoch" and a single syncfs() of the file system
+  // (that also persists the new directory entries) makes all of them durable at once.
+  // While an epoch is being flushed, the new writers gather in the next epoch.
+  class GroupCommitSync : public boost::noncopyable
+  {
+    struct Epoch
+    {
+      bool    isDone_;
+      bool    isSuccess_;
+      size_t  size_;
+    };
+
+    int                         rootFd_;
+    boost::mutex                mutex_;
+    boost::condition_variable   epochDone_;
+    boost::shared_ptr<Epoch>    pendingEpoch_;  // the epoch new writers join
+    bool                        isFlushing_;
+
+    // statistics
+    uint64_t                    epochsCount_;
+    uint64_t                    filesCount_;
+    size_t                      maxEpochSize_;
+    uint64_t                    totalWaitUs_;
+    uint64_t                    maxWaitUs_;
+
+    bool Flush();
+
+  public:
+    explicit GroupCommitSync(const boost::filesystem::path& rootPath);
+
+    ~GroupCommitSync();
+
+    // Blocks until all the files written (but not fsynced) in this storage before the call are durable.
+    // Throws ErrorCode_CannotWriteFile if the file system could not be synced.
+    void WaitDurable();
+
+    void GetStatistics(Json::Value& target);
+
+    // syncfs() is only available on Linux
+    static bool IsSupported();
+
+    static GroupCommitSync& GetForStorage(const boost::filesystem::path& rootPath);
+
+    static void GetAllStatistics(Json::Value& target);
+  };
+}
@@ -22,6 +22,8 @@
 
 #include "Helpers.h"
 #include "PathOwner.h"
+#include "DirectoriesPruner.h"
+#include "FileDescriptorsCache.h"
 
 #include <SystemToolbox.h>
 #include <Toolbox.h>
@@ -61,22 +63,9 @@ namespace OrthancPlugins
   }
 
   void RemoveEmptyParentDirectories(const fs::path& path)
-  {  
-    // Remove the empty parent directories, (ignoring the error code if these directories are not empty)
-    try
-    {
-      fs::path parent = path.parent_path();
-
-      while (!CustomData::IsARootPath(parent))
-      {
-        fs::remove(parent);
-        parent = parent.parent_path();
-      }
-    }
-    catch (...)
-    {
-      // Ignore the error
-    }
+  {
+    // The empty parent directories are removed later, in the background
+    DirectoriesPruner::Schedule(path.parent_path());
   }
 
   void AdoptFile(std::string& instanceId,
@@ -87,6 +76,9 @@ namespace OrthancPlugins
   {
     fs::path path = Orthanc::SystemToolbox::PathFromUtf8(strPath);
     CustomData cd = CustomData::CreateForAdoption(path, takeOwnership);
+
+    // the file might have been replaced at the same path since it was last read
+    FileDescriptorsCache::Invalidate(path);
     
     std::string customDataString;
     cd.ToString(customDataString);
@@ -138,6 +130,9 @@ namespace OrthancPlugins
 
   void AbandonFile(const std::string& strPath)
   {
+    // an abandoned file is usually modified or replaced by an external tool
+    FileDescriptorsCache::Invalidate(Orthanc::SystemToolbox::PathFromUtf8(strPath));
+
     // find attachment uuid from path -> lookup in DB the Key-Value Store provided by Orthanc
     std::string serializedPathOwner;
 
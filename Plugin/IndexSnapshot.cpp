@@ -0,0 +1,545 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "IndexSnapshot.h"
+
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <string.h>
+
+
+namespace OrthancPlugins
+{
+  static const size_t MIN_SLOTS = 1024;                // a power of 2
+  static const uint32_t FLAG_IS_DICOM = 0x01;
+  static const uint32_t FLAG_DELETED_BY_ORTHANC = 0x02;
+  static const size_t BLOOM_BITS_PER_ENTRY = 10;       // ~1% of false positives with 7 hashes
+  static const unsigned int BLOOM_HASHES = 7;
+  static const size_t BLOOM_MIN_BITS = 1 << 20;
+
+
+  uint64_t IndexSnapshot::HashPath(const std::string& path)
+  {
+    // FNV-1a followed by the finalizer of splitmix64 to spread the bits
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < path.size(); i++)
+    {
+      hash ^= static_cast<uint8_t>(path[i]);
+      hash *= 1099511628211ull;
+    }
+
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    hash = hash ^ (hash >> 31);
+
+    return (hash == 0 ? 1 : hash);  // 0 denotes the empty slots
+  }
+
+
+  static bool IsSeparator(char c)
+  {
+    return (c == '/' || c == '\\');
+  }
+
+
+  uint64_t IndexSnapshot::HashFolder(const std::string& folder)
+  {
+    size_t length = folder.size();
+    while (length > 0 &&
+           IsSeparator(folder[length - 1]))
+    {
+      length--;
+    }
+
+    return HashPath(folder.substr(0, length));
+  }
+
+
+  static uint64_t HashParentFolder(const std::string& path)
+  {
+    size_t length = path.size();
+    while (length > 0 &&
+           !IsSeparator(path[length - 1]))
+    {
+      length--;
+    }
+
+    return IndexSnapshot::HashFolder(path.substr(0, length));
+  }
+
+
+  IndexSnapshot::Mode IndexSnapshot::ParseMode(const std::string& value)
+  {
+    if (value == "None")
+    {
+      return Mode_None;
+    }
+    else if (value == "Full")
+    {
+      return Mode_Full;
+    }
+    else if (value == "BloomFilter")
+    {
+      return Mode_BloomFilter;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Invalid in-memory index mode: " + value + " (allowed values are \"None\", \"Full\" and \"BloomFilter\")");
+    }
+  }
+
+
+  size_t IndexSnapshot::Table::FindSlot(uint64_t hash) const
+  {
+    // linear probing, slots_.size() is a power of 2 and the table is never full
+    const size_t mask = slots_.size() - 1;
+    size_t i = static_cast<size_t>(hash) & mask;
+
+    while (slots_[i].hash_ != 0 &&
+           slots_[i].hash_ != hash)
+    {
+      i = (i + 1) & mask;
+    }
+
+    return i;
+  }
+
+
+  void IndexSnapshot::Table::Grow()
+  {
+    std::vector<Slot> previous;
+    previous.swap(slots_);
+
+    Slot empty;
+    memset(&empty, 0, sizeof(empty));
+    slots_.resize(previous.empty() ? MIN_SLOTS : previous.size() * 2, empty);
+
+    for (size_t i = 0; i < previous.size(); i++)
+    {
+      if (previous[i].hash_ != 0)
+      {
+        slots_[FindSlot(previous[i].hash_)] = previous[i];
+      }
+    }
+  }
+
+
+  IndexSnapshot::Slot* IndexSnapshot::Table::Find(uint64_t hash)
+  {
+    if (slots_.empty())
+    {
+      return NULL;
+    }
+
+    Slot& slot = slots_[FindSlot(hash)];
+    return (slot.hash_ == 0 ? NULL : &slot);
+  }
+
+
+  void IndexSnapshot::Table::Store(const Slot& slot,
+                                   bool overwrite)
+  {
+    // load factor of at most 0.75
+    if ((count_ + 1) * 4 > slots_.size() * 3)
+    {
+      Grow();
+    }
+
+    Slot& target = slots_[FindSlot(slot.hash_)];
+
+    if (target.hash_ == 0)
+    {
+      target = slot;
+      count_++;
+    }
+    else if (overwrite)
+    {
+      const uint32_t generation = target.generation_;
+      target = slot;
+      target.generation_ = generation;
+    }
+  }
+
+
+  void IndexSnapshot::Table::Remove(uint64_t hash)
+  {
+    if (slots_.empty())
+    {
+      return;
+    }
+
+    const size_t mask = slots_.size() - 1;
+    size_t i = FindSlot(hash);
+
+    if (slots_[i].hash_ == 0)
+    {
+      return;
+    }
+
+    // backward shift deletion: move back the following entries of the cluster that would not be
+    // found anymore because of the hole
+    for (size_t j = (i + 1) & mask; slots_[j].hash_ != 0; j = (j + 1) & mask)
+    {
+      const size_t home = static_cast<size_t>(slots_[j].hash_) & mask;
+
+      // is "home" cyclically outside of ]i, j] ?
+      if ((j > i && (home <= i || home > j)) ||
+          (j < i && (home <= i && home > j)))
+      {
+        slots_[i] = slots_[j];
+        i = j;
+      }
+    }
+
+    memset(&slots_[i], 0, sizeof(Slot));
+    count_--;
+  }
+
+
+  void IndexSnapshot::Table::ListUnseen(std::vector<uint64_t>& hashes,
+                                        uint32_t generation,
+                                        const std::vector<uint64_t>& seenFolders)
+  {
+    for (size_t i = 0; i < slots_.size(); i++)
+    {
+      if (slots_[i].hash_ != 0 &&
+          slots_[i].generation_ != generation)
+      {
+        if (std::binary_search(seenFolders.begin(), seenFolders.end(), slots_[i].folder_))
+        {
+          slots_[i].generation_ = generation;
+        }
+        else
+        {
+          hashes.push_back(slots_[i].hash_);
+        }
+      }
+    }
+  }
+
+
+  void IndexSnapshot::Table::Swap(Table& other)
+  {
+    slots_.swap(other.slots_);
+    std::swap(count_, other.count_);
+  }
+
+
+  void IndexSnapshot::BloomFilter::Reset(size_t expectedCount)
+  {
+    size_t bits = BLOOM_MIN_BITS;
+    while (bits < expectedCount * BLOOM_BITS_PER_ENTRY)
+    {
+      bits *= 2;
+    }
+
+    bits_.assign(bits / 64, 0);
+    mask_ = bits - 1;
+    capacity_ = bits / BLOOM_BITS_PER_ENTRY;
+    count_ = 0;
+  }
+
+
+  void IndexSnapshot::BloomFilter::Add(uint64_t hash)
+  {
+    // double hashing: the i-th hash is h1 + i * h2
+    const uint64_t h1 = hash & 0xffffffffull;
+    const uint64_t h2 = (hash >> 32) | 1;
+
+    for (unsigned int i = 0; i < BLOOM_HASHES; i++)
+    {
+      const uint64_t bit = (h1 + i * h2) & mask_;
+      bits_[bit / 64] |= (static_cast<uint64_t>(1) << (bit % 64));
+    }
+
+    count_++;
+  }
+
+
+  bool IndexSnapshot::BloomFilter::MightContain(uint64_t hash) const
+  {
+    if (bits_.empty())
+    {
+      return true;
+    }
+
+    const uint64_t h1 = hash & 0xffffffffull;
+    const uint64_t h2 = (hash >> 32) | 1;
+
+    for (unsigned int i = 0; i < BLOOM_HASHES; i++)
+    {
+      const uint64_t bit = (h1 + i * h2) & mask_;
+      if ((bits_[bit / 64] & (static_cast<uint64_t>(1) << (bit % 64))) == 0)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  void IndexSnapshot::BloomFilter::Swap(BloomFilter& other)
+  {
+    bits_.swap(other.bits_);
+    std::swap(mask_, other.mask_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(count_, other.count_);
+  }
+
+
+  IndexSnapshot::Slot IndexSnapshot::CreateSlot(const std::string& path,
+                                                const Record& record)
+  {
+    Slot slot;
+    slot.hash_ = HashPath(path);
+    slot.folder_ = HashParentFolder(path);
+    slot.size_ = record.size_;
+    slot.time_ = record.time_;
+    slot.flags_ = ((record.isDicom_ ? FLAG_IS_DICOM : 0) |
+                   (record.hasBeenDeletedByOrthanc_ ? FLAG_DELETED_BY_ORTHANC : 0));
+    slot.generation_ = 0;  // set once the mutex is locked
+    return slot;
+  }
+
+
+  IndexSnapshot::IndexSnapshot(Mode mode) :
+    mode_(mode),
+    isLoaded_(false),
+    generation_(0),
+    isLoading_(false)
+  {
+  }
+
+
+  bool IndexSnapshot::IsLoaded()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return isLoaded_ && !(mode_ == Mode_BloomFilter && bloom_.IsFull());
+  }
+
+
+  IndexSnapshot::Lookup IndexSnapshot::Find(Record& record,
+                                            const std::string& path,
+                                            bool markAsSeen)
+  {
+    if (mode_ == Mode_None)
+    {
+      return Lookup_Unknown;
+    }
+
+    const uint64_t hash = HashPath(path);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!isLoaded_)
+    {
+      return Lookup_Unknown;
+    }
+    else if (mode_ == Mode_Full)
+    {
+      Slot* slot = table_.Find(hash);
+      if (slot == NULL)
+      {
+        return Lookup_Absent;
+      }
+
+      if (markAsSeen)
+      {
+        slot->generation_ = generation_;
+      }
+
+      record.time_ = slot->time_;
+      record.size_ = slot->size_;
+      record.isDicom_ = ((slot->flags_ & FLAG_IS_DICOM) != 0);
+      record.hasBeenDeletedByOrthanc_ = ((slot->flags_ & FLAG_DELETED_BY_ORTHANC) != 0);
+      return Lookup_Present;
+    }
+    else
+    {
+      return (bloom_.MightContain(hash) ? Lookup_Unknown : Lookup_Absent);
+    }
+  }
+
+
+  void IndexSnapshot::Store(const std::string& path,
+                            const Record& record)
+  {
+    if (mode_ == Mode_None)
+    {
+      return;
+    }
+
+    Slot slot = CreateSlot(path, record);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (mode_ == Mode_Full)
+    {
+      slot.generation_ = generation_;
+      table_.Store(slot, true);
+
+      if (isLoading_)
+      {
+        loadingTable_.Store(slot, true);
+      }
+    }
+    else
+    {
+      bloom_.Add(slot.hash_);
+
+      if (isLoading_)
+      {
+        loadingHashes_.push_back(slot.hash_);
+      }
+    }
+  }
+
+
+  void IndexSnapshot::Remove(const std::string& path)
+  {
+    // a bloom filter can not forget a file: this only costs a query to the key-value store
+    if (mode_ == Mode_Full)
+    {
+      const uint64_t hash = HashPath(path);
+
+      boost::mutex::scoped_lock lock(mutex_);
+      table_.Remove(hash);
+
+      if (isLoading_)
+      {
+        loadingTable_.Remove(hash);
+      }
+    }
+  }
+
+
+  void IndexSnapshot::BeginLoading()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    isLoading_ = true;
+    Table().Swap(loadingTable_);
+    std::vector<uint64_t>().swap(loadingHashes_);
+  }
+
+
+  void IndexSnapshot::AddLoaded(const std::string& path,
+                                const Record& record)
+  {
+    Slot slot = CreateSlot(path, record);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (mode_ == Mode_Full)
+    {
+      slot.generation_ = generation_;
+      loadingTable_.Store(slot, false /* the files stored in the meantime are more recent */);
+    }
+    else if (mode_ == Mode_BloomFilter)
+    {
+      loadingHashes_.push_back(slot.hash_);
+    }
+  }
+
+
+  void IndexSnapshot::EndLoading()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (mode_ == Mode_Full)
+    {
+      table_.Swap(loadingTable_);
+    }
+    else if (mode_ == Mode_BloomFilter)
+    {
+      BloomFilter bloom;
+      bloom.Reset(loadingHashes_.size());
+
+      for (size_t i = 0; i < loadingHashes_.size(); i++)
+      {
+        bloom.Add(loadingHashes_[i]);
+      }
+
+      bloom_.Swap(bloom);
+    }
+
+    isLoaded_ = true;
+    isLoading_ = false;
+    Table().Swap(loadingTable_);
+    std::vector<uint64_t>().swap(loadingHashes_);
+  }
+
+
+  void IndexSnapshot::CancelLoading()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    isLoading_ = false;
+    Table().Swap(loadingTable_);
+    std::vector<uint64_t>().swap(loadingHashes_);
+  }
+
+
+  bool IndexSnapshot::StartPass()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (mode_ == Mode_Full &&
+        isLoaded_)
+    {
+      generation_++;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void IndexSnapshot::ListUnseen(std::vector<uint64_t>& hashes,
+                                 const std::vector<uint64_t>& seenFolders)
+  {
+    hashes.clear();
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      table_.ListUnseen(hashes, generation_, seenFolders);
+    }
+
+    std::sort(hashes.begin(), hashes.end());
+  }
+
+
+  size_t IndexSnapshot::GetCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return (mode_ == Mode_BloomFilter ? bloom_.GetCount() : table_.GetCount());
+  }
+
+
+  size_t IndexSnapshot::GetMemoryUsage()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return table_.GetMemoryUsage() + bloom_.GetMemoryUsage();
+  }
+}
@@ -0,0 +1,225 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // An in-memory copy of the "advst-indexer-path" key-value store, so that the indexer only
+  // accesses the Orthanc DB for the files that are new or have changed.  The paths are not
+  // stored: the entries are identified by a 64-bit hash of the path (a file is only considered
+  // unchanged if its hash, time and size all match).  The snapshot is reloaded from the key-value
+  // store before the first scan and is then kept up-to-date by the indexer (a bloom filter is
+  // loaded again once it contains more files than it has been sized for).  The files indexed by
+  // another Orthanc sharing the same DB are not added: "Lookup_Absent" must be confirmed by the
+  // key-value store before adopting a file.
+  class IndexSnapshot : public boost::noncopyable
+  {
+  public:
+    enum Mode
+    {
+      Mode_None,         // the key-value store is queried for each file
+      Mode_Full,         // hash, folder, time, size and flags of each indexed file (40 bytes per file)
+      Mode_BloomFilter   // the key-value store is only queried for the files that might be indexed (~10 bits per file)
+    };
+
+    enum Lookup
+    {
+      Lookup_Absent,     // the file is not indexed
+      Lookup_Present,    // the file is indexed, "record" is filled
+      Lookup_Unknown     // the key-value store must be queried
+    };
+
+    struct Record
+    {
+      int64_t   time_;
+      uint64_t  size_;
+      bool      isDicom_;
+      bool      hasBeenDeletedByOrthanc_;
+    };
+
+  private:
+    struct Slot
+    {
+      uint64_t  hash_;     // 0 for an empty slot
+      uint64_t  folder_;   // hash of the parent folder
+      uint64_t  size_;
+      int64_t   time_;
+      uint32_t  flags_;
+      uint32_t  generation_;  // the last pass that has seen the file
+    };
+
+    class Table
+    {
+    private:
+      std::vector<Slot>  slots_;
+      size_t             count_;
+
+      size_t FindSlot(uint64_t hash) const;
+
+      void Grow();
+
+    public:
+      Table() :
+        count_(0)
+      {
+      }
+
+      Slot* Find(uint64_t hash);
+
+      // The generation of an existing entry is kept
+      void Store(const Slot& slot,
+                 bool overwrite);
+
+      void Remove(uint64_t hash);
+
+      size_t GetCount() const
+      {
+        return count_;
+      }
+
+      size_t GetMemoryUsage() const
+      {
+        return slots_.size() * sizeof(Slot);
+      }
+
+      void ListUnseen(std::vector<uint64_t>& hashes,
+                      uint32_t generation,
+                      const std::vector<uint64_t>& seenFolders);
+
+      void Swap(Table& other);
+    };
+
+    class BloomFilter
+    {
+    private:
+      std::vector<uint64_t>  bits_;
+      uint64_t               mask_;
+
+      size_t                 capacity_;
+      size_t                 count_;
+
+    public:
+      BloomFilter() :
+        mask_(0),
+        capacity_(0),
+        count_(0)
+      {
+      }
+
+      // beyond its capacity, the rate of false positives increases quickly
+      bool IsFull() const
+      {
+        return count_ > capacity_;
+      }
+
+      void Reset(size_t expectedCount);
+
+      void Add(uint64_t hash);
+
+      bool MightContain(uint64_t hash) const;
+
+      size_t GetCount() const
+      {
+        return count_;
+      }
+
+      size_t GetMemoryUsage() const
+      {
+        return bits_.size() * sizeof(uint64_t);
+      }
+
+      void Swap(BloomFilter& other);
+    };
+
+    Mode                   mode_;
+    boost::mutex           mutex_;
+    bool                   isLoaded_;
+    uint32_t               generation_;
+    Table                  table_;
+    BloomFilter            bloom_;
+
+    bool                   isLoading_;
+    Table                  loadingTable_;
+    std::vector<uint64_t>  loadingHashes_;
+
+    static Slot CreateSlot(const std::string& path,
+                           const Record& record);
+
+  public:
+    explicit IndexSnapshot(Mode mode);
+
+    Mode GetMode() const
+    {
+      return mode_;
+    }
+
+    bool IsLoaded();
+
+    // "markAsSeen" records that the file has been seen by the current pass (only in "Full" mode)
+    Lookup Find(Record& record,
+                const std::string& path,
+                bool markAsSeen);
+
+    void Store(const std::string& path,
+               const Record& record);
+
+    void Remove(const std::string& path);
+
+    // The indexer iterates over the key-value store between BeginLoading() and EndLoading().  The
+    // files that are stored in the meantime are not overwritten by the (older) loaded values.
+    void BeginLoading();
+
+    void AddLoaded(const std::string& path,
+                   const Record& record);
+
+    void EndLoading();
+
+    void CancelLoading();
+
+    // Starts a new pass over the indexed folders.  Returns false if the files that are not seen
+    // by this pass can not be listed at its end (i.e. if not in "Full" mode or not loaded).
+    bool StartPass();
+
+    // The sorted hashes of the files that have not been seen since the start of the current pass.
+    // The files of the "seenFolders" (sorted hashes of folders that have not changed) are marked
+    // as seen.
+    void ListUnseen(std::vector<uint64_t>& hashes,
+                    const std::vector<uint64_t>& seenFolders);
+
+    size_t GetCount();
+
+    size_t GetMemoryUsage();
+
+    static uint64_t HashPath(const std::string& path);
+
+    // The trailing separators are ignored
+    static uint64_t HashFolder(const std::string& folder);
+
+    static Mode ParseMode(const std::string& value);
+  };
+}
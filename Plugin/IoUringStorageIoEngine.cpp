@@ -0,0 +1,545 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "IoUringStorageIoEngine.h"
+
+#include "AtomicFileWriter.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <liburing.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if !defined(RENAME_NOREPLACE)
+#  define RENAME_NOREPLACE (1 << 0)
+#endif
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+  static const unsigned int QUEUE_DEPTH = 64;
+  static const size_t MAX_CHUNK_SIZE = 1024 * 1024 * 1024;  // the length of a read/write SQE is 32-bit
+  static const unsigned int FILE_SLOT = 0;  // a ring is used by one callback at a time => one direct descriptor
+
+
+  class IoUringStorageIoEngine::Ring : public boost::noncopyable
+  {
+    struct io_uring  ring_;
+    unsigned int     count_;
+
+  public:
+    Ring() :
+      count_(0)
+    {
+      int r = io_uring_queue_init(QUEUE_DEPTH, &ring_, 0);
+      if (r < 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                        "Unable to initialize io_uring: " + std::string(strerror(-r)));
+      }
+
+      r = io_uring_register_files_sparse(&ring_, 1);
+      if (r < 0)
+      {
+        io_uring_queue_exit(&ring_);
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                        "Unable to register the io_uring direct descriptors: " + std::string(strerror(-r)));
+      }
+    }
+
+    ~Ring()
+    {
+      io_uring_queue_exit(&ring_);
+    }
+
+    bool IsSupportedOperation(int operation)
+    {
+      struct io_uring_probe* probe = io_uring_get_probe_ring(&ring_);
+      if (probe == NULL)
+      {
+        return false;
+      }
+
+      const bool supported = io_uring_opcode_supported(probe, operation);
+      io_uring_free_probe(probe);
+      return supported;
+    }
+
+    struct io_uring_sqe* Next()
+    {
+      struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+      if (sqe == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "The io_uring submission queue is full");
+      }
+
+      return sqe;
+    }
+
+    // must be called after the io_uring_prep_*() function that resets the flags
+    void Commit(struct io_uring_sqe* sqe,
+                unsigned int flags)
+    {
+      io_uring_sqe_set_flags(sqe, flags);
+      sqe->user_data = count_++;
+    }
+
+    // Submits the committed SQEs and waits for all of them: results[i] is the result of the i-th SQE
+    void Run(std::vector<int>& results)
+    {
+      const unsigned int count = count_;
+      count_ = 0;
+
+      results.assign(count, -ECANCELED);
+
+      int r = io_uring_submit(&ring_);
+      if (r != static_cast<int>(count))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to submit to io_uring");
+      }
+
+      for (unsigned int i = 0; i < count; i++)
+      {
+        struct io_uring_cqe* cqe = NULL;
+
+        do
+        {
+          r = io_uring_wait_cqe(&ring_, &cqe);
+        }
+        while (r == -EINTR);
+
+        if (r < 0)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to wait for io_uring: " + std::string(strerror(-r)));
+        }
+
+        if (cqe->user_data < count)
+        {
+          results[cqe->user_data] = cqe->res;
+        }
+
+        io_uring_cqe_seen(&ring_, cqe);
+      }
+    }
+  };
+
+
+  // Borrows a ring from the pool (or creates a new one if all of them are in use).  A ring
+  // that failed at the io_uring level is destroyed instead of being returned to the pool.
+  // If no ring is available (the maximum number of rings is reached or a new ring can not be
+  // set up, e.g. because of the memlock limit), the caller must use the default engine.
+  class IoUringStorageIoEngine::RingLease : public boost::noncopyable
+  {
+    IoUringStorageIoEngine&  engine_;
+    Ring*                    ring_;
+    bool                     isBroken_;
+
+  public:
+    explicit RingLease(IoUringStorageIoEngine& engine) :
+      engine_(engine),
+      ring_(NULL),
+      isBroken_(false)
+    {
+      {
+        boost::mutex::scoped_lock lock(engine_.mutex_);
+
+        if (!engine_.availableRings_.empty())
+        {
+          ring_ = engine_.availableRings_.back();
+          engine_.availableRings_.pop_back();
+          return;
+        }
+        else if (engine_.ringsCount_ >= engine_.maxRings_)
+        {
+          return;
+        }
+
+        engine_.ringsCount_++;  // reserved before the (slow) setup of the ring
+      }
+
+      try
+      {
+        ring_ = new Ring;
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(WARNING) << "Cannot create a new io_uring, using the default I/O engine: " << e.What();
+
+        boost::mutex::scoped_lock lock(engine_.mutex_);
+        engine_.ringsCount_--;
+      }
+    }
+
+    bool IsValid() const
+    {
+      return ring_ != NULL;
+    }
+
+    ~RingLease()
+    {
+      if (ring_ == NULL)
+      {
+        return;
+      }
+
+      boost::mutex::scoped_lock lock(engine_.mutex_);
+
+      if (isBroken_)
+      {
+        delete ring_;
+        engine_.ringsCount_--;
+      }
+      else
+      {
+        engine_.availableRings_.push_back(ring_);
+      }
+    }
+
+    Ring& GetRing()
+    {
+      return *ring_;
+    }
+
+    // Returns false if the submission or the completion has failed at the io_uring level: the
+    // caller must then use the default engine.  The errors of the file operations themselves
+    // (e.g. ENOENT) are reported in "results".
+    bool Run(std::vector<int>& results)
+    {
+      try
+      {
+        ring_->Run(results);
+        return true;
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(WARNING) << "io_uring failure, using the default I/O engine: " << e.What();
+        isBroken_ = true;
+        return false;
+      }
+    }
+
+    // Releases the direct descriptor if the close_direct of a chain has been canceled
+    void CloseFile()
+    {
+      struct io_uring_sqe* sqe = ring_->Next();
+      io_uring_prep_close_direct(sqe, FILE_SLOT);
+      ring_->Commit(sqe, 0);
+
+      std::vector<int> results;
+      Run(results);  // if the ring has failed, it is destroyed with its direct descriptor
+    }
+  };
+
+
+  IoUringStorageIoEngine::IoUringStorageIoEngine(unsigned int maxRings) :
+    maxRings_(std::max(1u, maxRings)),
+    ringsCount_(0)
+  {
+    std::unique_ptr<Ring> ring(new Ring);
+
+    static const int REQUIRED_OPERATIONS[] = {
+      IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC,
+      IORING_OP_CLOSE, IORING_OP_RENAMEAT, IORING_OP_UNLINKAT, IORING_OP_STATX
+    };
+
+    for (size_t i = 0; i < sizeof(REQUIRED_OPERATIONS) / sizeof(int); i++)
+    {
+      if (!ring->IsSupportedOperation(REQUIRED_OPERATIONS[i]))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                        "The kernel does not support all the io_uring operations used by the plugin");
+      }
+    }
+
+    // the direct descriptors (Linux >= 5.15) can not be probed: try to open and close the root directory
+    struct io_uring_sqe* sqe = ring->Next();
+    io_uring_prep_openat_direct(sqe, AT_FDCWD, "/", O_RDONLY | O_DIRECTORY, 0, FILE_SLOT);
+    ring->Commit(sqe, IOSQE_IO_LINK);
+
+    sqe = ring->Next();
+    io_uring_prep_close_direct(sqe, FILE_SLOT);
+    ring->Commit(sqe, 0);
+
+    std::vector<int> results;
+    ring->Run(results);
+
+    if (results[0] < 0 || results[1] < 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                      "The kernel does not support the io_uring direct descriptors");
+    }
+
+    availableRings_.push_back(ring.release());
+    ringsCount_ = 1;
+  }
+
+
+  IoUringStorageIoEngine::~IoUringStorageIoEngine()
+  {
+    for (size_t i = 0; i < availableRings_.size(); i++)
+    {
+      delete availableRings_[i];
+    }
+  }
+
+
+  bool IoUringStorageIoEngine::WriteNewFile(const fs::path& path,
+                                            const void* content,
+                                            size_t size,
+                                            bool fsync,
+                                            const WritePolicy& policy)
+  {
+    // open + writes + fsync + close + rename
+    const size_t chunks = (size + MAX_CHUNK_SIZE - 1) / MAX_CHUNK_SIZE;
+    if (chunks + 4 > QUEUE_DEPTH ||
+        !policy.IsDefault())  // the cache policies and the pre-allocation are only implemented by the default engine
+    {
+      return fallback_.WriteNewFile(path, content, size, fsync, policy);
+    }
+
+    // io_uring has no linkat() of an O_TMPFILE direct descriptor: write a temporary file and
+    // publish it with renameat2(RENAME_NOREPLACE) at the end of the chain
+    const std::string target = path.string();
+    const std::string temporary = (path.parent_path() /
+                                   ("." + path.filename().string() + "." + Orthanc::Toolbox::GenerateUuid() + ".tmp")).string();
+
+    std::vector<int> results;
+    bool isRingFailure = false;
+
+    {
+      RingLease lease(*this);
+      if (!lease.IsValid())
+      {
+        return fallback_.WriteNewFile(path, content, size, fsync, policy);
+      }
+
+      Ring& ring = lease.GetRing();
+
+      struct io_uring_sqe* sqe = ring.Next();
+      io_uring_prep_openat_direct(sqe, AT_FDCWD, temporary.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0666, FILE_SLOT);
+      ring.Commit(sqe, IOSQE_IO_LINK);
+
+      for (size_t i = 0; i < chunks; i++)
+      {
+        const size_t offset = i * MAX_CHUNK_SIZE;
+        sqe = ring.Next();
+        io_uring_prep_write(sqe, FILE_SLOT, reinterpret_cast<const char*>(content) + offset,
+                            static_cast<unsigned int>(std::min(MAX_CHUNK_SIZE, size - offset)), offset);
+        ring.Commit(sqe, IOSQE_IO_LINK | IOSQE_FIXED_FILE);
+      }
+
+      if (fsync)
+      {
+        sqe = ring.Next();
+        io_uring_prep_fsync(sqe, FILE_SLOT, 0);
+        ring.Commit(sqe, IOSQE_IO_LINK | IOSQE_FIXED_FILE);
+      }
+
+      sqe = ring.Next();
+      io_uring_prep_close_direct(sqe, FILE_SLOT);
+      ring.Commit(sqe, IOSQE_IO_LINK);
+
+      sqe = ring.Next();
+      io_uring_prep_renameat(sqe, AT_FDCWD, temporary.c_str(), AT_FDCWD, target.c_str(), RENAME_NOREPLACE);
+      ring.Commit(sqe, 0);
+
+      if (!lease.Run(results))
+      {
+        isRingFailure = true;
+      }
+      else if (results.back() == 0)
+      {
+        if (fsync)
+        {
+          // the new directory entry must be durable as well
+          AtomicFileWriter::SyncParentDirectory(path);
+        }
+
+        return true;
+      }
+      else if (results[0] < 0)
+      {
+        if (results[0] == -ENOENT || results[0] == -ENOTDIR || results[0] == -EACCES || results[0] == -ENOSPC)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                          "Unable to write file " + target + ": " + std::string(strerror(-results[0])));
+        }
+      }
+      else if (results[results.size() - 2] != 0)
+      {
+        lease.CloseFile();  // a write or the fsync has failed: the close_direct has been canceled
+      }
+    }
+
+    if (isRingFailure)
+    {
+      // the chain may have been partially executed: the temporary file is unique to this call
+      unlink(temporary.c_str());
+      return fallback_.WriteNewFile(path, content, size, fsync, policy);
+    }
+
+    if (results[0] >= 0)
+    {
+      unlink(temporary.c_str());
+    }
+
+    if (results.back() == -EEXIST)
+    {
+      return false;
+    }
+
+    // e.g. a short write, or RENAME_NOREPLACE not supported by the file system
+    return fallback_.WriteNewFile(path, content, size, fsync, policy);
+  }
+
+
+  uint64_t IoUringStorageIoEngine::ReadRange(void* target,
+                                             uint64_t size,
+                                             const fs::path& path,
+                                             uint64_t start,
+                                             bool mappable)
+  {
+    // statx + open + reads + close
+    const uint64_t chunks = (size + MAX_CHUNK_SIZE - 1) / MAX_CHUNK_SIZE;
+    if (chunks + 3 > QUEUE_DEPTH)
+    {
+      return fallback_.ReadRange(target, size, path, start, mappable);
+    }
+
+    const std::string source = path.string();
+
+    static const size_t OPEN = 1;  // index of the result of the open (after the statx)
+
+    std::vector<int> results;
+    bool isRingFailure = false;
+    struct statx info;
+
+    {
+      RingLease lease(*this);
+      if (!lease.IsValid())
+      {
+        return fallback_.ReadRange(target, size, path, start, mappable);
+      }
+
+      Ring& ring = lease.GetRing();
+
+      // the size of the file is reported to the caller, in the same submission as the reads (not linked to them)
+      struct io_uring_sqe* sqe = ring.Next();
+      io_uring_prep_statx(sqe, AT_FDCWD, source.c_str(), 0, STATX_SIZE, &info);
+      ring.Commit(sqe, 0);
+
+      sqe = ring.Next();
+      io_uring_prep_openat_direct(sqe, AT_FDCWD, source.c_str(), O_RDONLY, 0, FILE_SLOT);
+      ring.Commit(sqe, IOSQE_IO_LINK);
+
+      for (uint64_t i = 0; i < chunks; i++)
+      {
+        const uint64_t offset = i * MAX_CHUNK_SIZE;
+        sqe = ring.Next();
+        io_uring_prep_read(sqe, FILE_SLOT, reinterpret_cast<char*>(target) + offset,
+                           static_cast<unsigned int>(std::min(static_cast<uint64_t>(MAX_CHUNK_SIZE), size - offset)), start + offset);
+        ring.Commit(sqe, IOSQE_IO_LINK | IOSQE_FIXED_FILE);
+      }
+
+      sqe = ring.Next();
+      io_uring_prep_close_direct(sqe, FILE_SLOT);
+      ring.Commit(sqe, 0);
+
+      if (!lease.Run(results))
+      {
+        isRingFailure = true;
+      }
+      else if (results[OPEN] >= 0 && results.back() != 0)
+      {
+        lease.CloseFile();  // a read has failed or was short: the close_direct has been canceled
+      }
+    }
+
+    if (isRingFailure)
+    {
+      return fallback_.ReadRange(target, size, path, start, mappable);
+    }
+
+    if (results[OPEN] == -ENOENT ||
+        results[OPEN] == -ENOTDIR)
+    {
+      LOG(ERROR) << "The path does not point to a regular file: " << path;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile);
+    }
+
+    if (results.back() != 0)
+    {
+      // e.g. a directory, or a range beyond the end of the file: let the default engine handle it as before
+      return fallback_.ReadRange(target, size, path, start, mappable);
+    }
+    else if (results[0] != 0)
+    {
+      // unlikely, since the file has just been read: the caller only uses the size to decide about caching
+      LOG(INFO) << "Unable to get the size of a file with io_uring: " << strerror(-results[0]);
+      return 0;
+    }
+    else
+    {
+      return info.stx_size;
+    }
+  }
+
+
+  void IoUringStorageIoEngine::RemoveFile(const fs::path& path)
+  {
+    const std::string s = path.string();
+
+    std::vector<int> results;
+
+    {
+      RingLease lease(*this);
+      if (!lease.IsValid())
+      {
+        fallback_.RemoveFile(path);
+        return;
+      }
+
+      Ring& ring = lease.GetRing();
+
+      struct io_uring_sqe* sqe = ring.Next();
+      io_uring_prep_unlinkat(sqe, AT_FDCWD, s.c_str(), 0);
+      ring.Commit(sqe, 0);
+
+      if (!lease.Run(results))
+      {
+        results.assign(1, -ECANCELED);
+      }
+    }
+
+    if (results[0] != 0 &&
+        results[0] != -ENOENT)
+    {
+      fallback_.RemoveFile(path);
+    }
+  }
+}
@@ -0,0 +1,80 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#if !defined(ORTHANC_ENABLE_IO_URING)
+#  error The macro ORTHANC_ENABLE_IO_URING must be defined
+#endif
+
+#if ORTHANC_ENABLE_IO_URING != 1
+#  error io_uring support is disabled
+#endif
+
+#include "StorageIoEngine.h"
+
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // Submits the open/write/fsync/close/rename (resp. open/read/close) chain of each callback
+  // as linked SQEs on an io_uring, using a direct descriptor so that the whole chain goes
+  // through a single io_uring_enter().  The rings are not thread-safe: each callback
+  // borrows one from a pool.  Any unexpected error falls back to the default engine.  With
+  // "fsync", the directory is synced once the file has been renamed to its final path.
+  class IoUringStorageIoEngine : public IStorageIoEngine
+  {
+    class Ring;
+    class RingLease;
+
+    boost::mutex            mutex_;
+    std::vector<Ring*>      availableRings_;
+    unsigned int            maxRings_;
+    unsigned int            ringsCount_;      // available or in use
+    DefaultStorageIoEngine  fallback_;
+
+  public:
+    // Throws ErrorCode_NotImplemented if io_uring (or the required operations) are not available.
+    // Beyond "maxRings" concurrent callbacks, the default engine is used.
+    explicit IoUringStorageIoEngine(unsigned int maxRings);
+
+    virtual ~IoUringStorageIoEngine();
+
+    virtual const char* GetName() const ORTHANC_OVERRIDE
+    {
+      return "IoUring";
+    }
+
+    virtual bool WriteNewFile(const boost::filesystem::path& path,
+                              const void* content,
+                              size_t size,
+                              bool fsync,
+                              const WritePolicy& policy) ORTHANC_OVERRIDE;
+
+    virtual uint64_t ReadRange(void* target,
+                               uint64_t size,
+                               const boost::filesystem::path& path,
+                               uint64_t start,
+                               bool mappable) ORTHANC_OVERRIDE;
+
+    virtual void RemoveFile(const boost::filesystem::path& path) ORTHANC_OVERRIDE;
+  };
+}
@@ -0,0 +1,135 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "LogsVerbosity.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <SystemToolbox.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+
+namespace OrthancPlugins
+{
+  static const unsigned int REFRESH_INTERVAL_SECONDS = 10;
+
+  static boost::atomic<bool> isVerbose_(true);
+  static boost::mutex mutex_;
+  static boost::condition_variable stopped_;
+  static bool isRunning_ = false;
+  static boost::thread thread_;
+
+
+  static bool IsVerboseLevel(const std::string& level)
+  {
+    return level == "verbose" || level == "trace";
+  }
+
+
+  bool LogsVerbosity::IsVerbose()
+  {
+    return isVerbose_.load(boost::memory_order_relaxed);
+  }
+
+
+  void LogsVerbosity::Refresh()
+  {
+    // the category of the plugins exists since Orthanc 1.9.0, fallback to the global log level
+    std::string level;
+    if (RestApiGetString(level, "/tools/log-level-plugins", false) ||
+        RestApiGetString(level, "/tools/log-level", false))
+    {
+      isVerbose_.store(IsVerboseLevel(level), boost::memory_order_relaxed);
+    }
+    else
+    {
+      isVerbose_.store(true, boost::memory_order_relaxed);
+    }
+  }
+
+
+  static void Worker()
+  {
+    OrthancPluginSetCurrentThreadName(OrthancPlugins::GetGlobalContext(), "LOGS-LEVEL");
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (;;)
+    {
+      stopped_.timed_wait(lock, boost::posix_time::seconds(REFRESH_INTERVAL_SECONDS));
+
+      if (!isRunning_)
+      {
+        return;
+      }
+
+      lock.unlock();
+      LogsVerbosity::Refresh();
+      lock.lock();
+    }
+  }
+
+
+  void LogsVerbosity::Start()
+  {
+    // the storage callbacks see the log level as soon as Orthanc has started
+    Refresh();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!isRunning_)
+    {
+      isRunning_ = true;
+      thread_ = boost::thread(Worker);
+    }
+  }
+
+
+  void LogsVerbosity::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isRunning_ = false;
+      stopped_.notify_all();
+    }
+
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+
+    isVerbose_.store(true, boost::memory_order_relaxed);
+  }
+
+
+  std::ostream& operator<<(std::ostream& stream,
+                           const PathForLogs& path)
+  {
+    if (path.deidentify_)
+    {
+      return stream << "*** POTENTIAL PHI ***";
+    }
+    else
+    {
+      return stream << Orthanc::SystemToolbox::PathToUtf8(path.path_);
+    }
+  }
+}
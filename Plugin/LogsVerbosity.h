@@ -0,0 +1,62 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <ostream>
+
+
+namespace OrthancPlugins
+{
+  // The plugin SDK does not tell whether the INFO logs are displayed by the Orthanc core: the
+  // log level of the plugins is polled from the REST API in the background, so that the storage
+  // callbacks can skip the formatting of their INFO logs when they would be dropped anyway.
+  class LogsVerbosity
+  {
+  public:
+    // Until the first poll, the INFO logs are assumed to be enabled
+    static bool IsVerbose();
+
+    static void Refresh();
+
+    static void Start();
+
+    static void Stop();
+  };
+
+
+  // Inserts a path in a log, converted to UTF-8 only when the log is actually formatted
+  class PathForLogs
+  {
+    const boost::filesystem::path&  path_;
+    bool                            deidentify_;
+
+  public:
+    PathForLogs(const boost::filesystem::path& path,
+                bool deidentify) :
+      path_(path),
+      deidentify_(deidentify)
+    {
+    }
+
+    friend std::ostream& operator<<(std::ostream& stream,
+                                    const PathForLogs& path);
+  };
+}
@@ -18,9 +18,12 @@
  **/
 
 #include "MoveStorageJob.h"
+#include "AttachmentsCache.h"
 #include "Logging.h"
 #include "Constants.h"
 #include "Helpers.h"
+#include "DirectoriesCache.h"
+#include "FileDescriptorsCache.h"
 #include <SystemToolbox.h>
 
 namespace fs = boost::filesystem;
@@ -106,25 +109,24 @@ namespace OrthancPlugins
       }
 
       // Make sure the folders hierarchy exists
-      if (fs::exists(newPath.parent_path()))
+      try
       {
-        if (!fs::is_directory(newPath.parent_path()))
+        DirectoriesCache::CreateParentDirectory(newCustomData.GetRootPath(), newPath);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        if (e.GetErrorCode() == Orthanc::ErrorCode_DirectoryOverFile)
         {
           errorDetails_= std::string("Unable to move attachment ") + currentCustomData.GetUuid() + " because the target directory already exists as a file: " + Orthanc::SystemToolbox::PathToUtf8(newPath.parent_path());
-          UpdateContent();
-          LOG(ERROR) << errorDetails_;
-          return false;
         }
-      }
-      else
-      {
-        if (!fs::create_directories(newPath.parent_path()))
+        else
         {
           errorDetails_= std::string("Unable to move attachment ") + currentCustomData.GetUuid() + " unable to create the target directory:: " + Orthanc::SystemToolbox::PathToUtf8(newPath.parent_path());
-          UpdateContent();
-          LOG(ERROR) << errorDetails_;
-          return false;
         }
+
+        UpdateContent();
+        LOG(ERROR) << errorDetails_;
+        return false;
       }
 
       // Copy the file
@@ -149,6 +151,9 @@ namespace OrthancPlugins
       }
       else
       {
+        // the target directory might have been removed behind our back, don't trust the cache for the next attempt
+        DirectoriesCache::Invalidate(newPath.parent_path());
+
         errorDetails_= std::string("Unable to move attachment ") + currentCustomData.GetUuid() + ": " + e.what();
         UpdateContent();
         LOG(ERROR) << errorDetails_;
@@ -163,12 +168,16 @@ namespace OrthancPlugins
       UpdateContent();
       LOG(ERROR) << errorDetails_;
 
+      FileDescriptorsCache::Invalidate(newPath);
       fs::remove(newPath);
       RemoveEmptyParentDirectories(newPath);
       return false;
     }
 
-    // Delete the original file and its parent folders if they are empty now
+    AttachmentsCache::Invalidate(currentCustomData.GetUuid());
+
+    // Delete the original file (its parent folders are removed later if they are empty now)
+    FileDescriptorsCache::Invalidate(currentPath);
     fs::remove(currentPath);
     RemoveEmptyParentDirectories(currentPath);
     
@@ -28,10 +28,228 @@
 #include "PathGenerator.h"
 #include "Helpers.h"
 
+#include <string.h>
+
 namespace OrthancPlugins
 {
-	static std::string namingScheme_;
-	std::string PathGenerator::otherAttachmentsPrefix_;
+  namespace
+  {
+    enum TokenType
+    {
+      TokenType_Literal,
+      TokenType_StringTag,
+      TokenType_IntegerTag,
+      TokenType_SplitDateTag,
+      TokenType_OrthancId,
+      TokenType_Uuid,
+      TokenType_Extension
+    };
+
+    struct Keyword
+    {
+      const char*            keyword_;
+      TokenType              type_;
+      const char*            tagName_;
+      const char*            defaultValue_;
+      size_t                 padding_;     // for integer tags
+      Orthanc::ResourceType  level_;       // for Orthanc IDs
+      size_t                 from_;        // for Orthanc IDs
+      size_t                 length_;      // for Orthanc IDs, 0 means the whole ID
+    };
+
+    // A naming scheme is compiled once into a list of folders, each folder being a list of tokens.
+    // A token is either a literal text (keyword_ == NULL) or a reference to one of the KEYWORDS below.
+    struct Token
+    {
+      const Keyword*      keyword_;
+      std::string         literal_;
+      Orthanc::DicomTag   tag_;       // for DICOM tags keywords
+
+      Token() :
+        keyword_(NULL),
+        tag_(0, 0)
+      {
+      }
+    };
+
+    struct NamedTag
+    {
+      const char*        name_;
+      Orthanc::DicomTag  tag_;
+    };
+
+    typedef std::vector<Token>  CompiledFolder;
+  }
+
+  static const Keyword KEYWORDS[] =
+  {
+    { "{split(StudyDate)}",           TokenType_SplitDateTag, "StudyDate",         "NO_STUDY_DATE",          0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{split(PatientBirthDate)}",    TokenType_SplitDateTag, "PatientBirthDate",  "NO_PATIENT_BIRTH_DATE",  0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{PatientID}",                  TokenType_StringTag,    "PatientID",         "NO_PATIENT_ID",          0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{PatientBirthDate}",           TokenType_StringTag,    "PatientBirthDate",  "NO_PATIENT_BIRTH_DATE",  0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{PatientName}",                TokenType_StringTag,    "PatientName",       "NO_PATIENT_NAME",        0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{PatientSex}",                 TokenType_StringTag,    "PatientSex",        "NO_PATIENT_SEX",         0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{StudyInstanceUID}",           TokenType_StringTag,    "StudyInstanceUID",  "NO_STUDY_INSTANCE_UID",  0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{StudyDate}",                  TokenType_StringTag,    "StudyDate",         "NO_STUDY_DATE",          0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{StudyID}",                    TokenType_StringTag,    "StudyID",           "NO_STUDY_ID",            0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{StudyDescription}",           TokenType_StringTag,    "StudyDescription",  "NO_STUDY_DESCRIPTION",   0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{AccessionNumber}",            TokenType_StringTag,    "AccessionNumber",   "NO_ACCESSION_NUMBER",    0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{SeriesInstanceUID}",          TokenType_StringTag,    "SeriesInstanceUID", "NO_SERIES_INSTANCE_UID", 0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{SeriesDate}",                 TokenType_StringTag,    "SeriesDate",        "NO_SERIES_DATE",         0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{SeriesDescription}",          TokenType_StringTag,    "SeriesDescription", "NO_SERIES_DESCRIPTION",  0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{SOPInstanceUID}",             TokenType_StringTag,    "SOPInstanceUID",    "NO_SOP_INSTANCE_UID",    0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{InstitutionName}",            TokenType_StringTag,    "InstitutionName",   "NO_INSTITUTION_NAME",    0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{SeriesNumber}",               TokenType_IntegerTag,   "SeriesNumber",      "NO_SERIES_NUMBER",       0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{InstanceNumber}",             TokenType_IntegerTag,   "InstanceNumber",    "NO_INSTANCE_NUMBER",     0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{pad4(SeriesNumber)}",         TokenType_IntegerTag,   "SeriesNumber",      "NO_SERIES_NUMBER",       4, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{pad4(InstanceNumber)}",       TokenType_IntegerTag,   "InstanceNumber",    "NO_INSTANCE_NUMBER",     4, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{pad6(SeriesNumber)}",         TokenType_IntegerTag,   "SeriesNumber",      "NO_SERIES_NUMBER",       6, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{pad6(InstanceNumber)}",       TokenType_IntegerTag,   "InstanceNumber",    "NO_INSTANCE_NUMBER",     6, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{pad8(SeriesNumber)}",         TokenType_IntegerTag,   "SeriesNumber",      "NO_SERIES_NUMBER",       8, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{pad8(InstanceNumber)}",       TokenType_IntegerTag,   "InstanceNumber",    "NO_INSTANCE_NUMBER",     8, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{OrthancPatientID}",           TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Patient,  0, 0 },
+    { "{OrthancStudyID}",             TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Study,    0, 0 },
+    { "{OrthancSeriesID}",            TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Series,   0, 0 },
+    { "{OrthancInstanceID}",          TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{01(OrthancPatientID)}",       TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Patient,  0, 2 },
+    { "{01(OrthancStudyID)}",         TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Study,    0, 2 },
+    { "{01(OrthancSeriesID)}",        TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Series,   0, 2 },
+    { "{01(OrthancInstanceID)}",      TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Instance, 0, 2 },
+    { "{23(OrthancPatientID)}",       TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Patient,  2, 2 },
+    { "{23(OrthancStudyID)}",         TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Study,    2, 2 },
+    { "{23(OrthancSeriesID)}",        TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Series,   2, 2 },
+    { "{23(OrthancInstanceID)}",      TokenType_OrthancId,    NULL,                NULL,                     0, Orthanc::ResourceType_Instance, 2, 2 },
+    { "{UUID}",                       TokenType_Uuid,         NULL,                NULL,                     0, Orthanc::ResourceType_Instance, 0, 0 },
+    { "{.ext}",                       TokenType_Extension,    NULL,                NULL,                     0, Orthanc::ResourceType_Instance, 0, 0 }
+  };
+
+  static const size_t KEYWORDS_COUNT = sizeof(KEYWORDS) / sizeof(Keyword);
+
+  static const NamedTag TAGS[] =
+  {
+    { "PatientID",         Orthanc::DicomTag(0x0010, 0x0020) },
+    { "PatientName",       Orthanc::DicomTag(0x0010, 0x0010) },
+    { "PatientBirthDate",  Orthanc::DicomTag(0x0010, 0x0030) },
+    { "PatientSex",        Orthanc::DicomTag(0x0010, 0x0040) },
+    { "StudyInstanceUID",  Orthanc::DicomTag(0x0020, 0x000d) },
+    { "StudyDate",         Orthanc::DicomTag(0x0008, 0x0020) },
+    { "StudyID",           Orthanc::DicomTag(0x0020, 0x0010) },
+    { "StudyDescription",  Orthanc::DicomTag(0x0008, 0x1030) },
+    { "AccessionNumber",   Orthanc::DicomTag(0x0008, 0x0050) },
+    { "SeriesInstanceUID", Orthanc::DicomTag(0x0020, 0x000e) },
+    { "SeriesDate",        Orthanc::DicomTag(0x0008, 0x0021) },
+    { "SeriesDescription", Orthanc::DicomTag(0x0008, 0x103e) },
+    { "SeriesNumber",      Orthanc::DicomTag(0x0020, 0x0011) },
+    { "SOPInstanceUID",    Orthanc::DicomTag(0x0008, 0x0018) },
+    { "InstanceNumber",    Orthanc::DicomTag(0x0020, 0x0013) },
+    { "InstitutionName",   Orthanc::DicomTag(0x0008, 0x0080) }
+  };
+
+  static const size_t TAGS_COUNT = sizeof(TAGS) / sizeof(NamedTag);
+
+  // the tags that are required to compute the Orthanc IDs
+  static const Orthanc::DicomTag TAG_PATIENT_ID(0x0010, 0x0020);
+  static const Orthanc::DicomTag TAG_STUDY_INSTANCE_UID(0x0020, 0x000d);
+  static const Orthanc::DicomTag TAG_SERIES_INSTANCE_UID(0x0020, 0x000e);
+  static const Orthanc::DicomTag TAG_SOP_INSTANCE_UID(0x0008, 0x0018);
+
+  static std::string namingScheme_;
+  static std::vector<CompiledFolder> compiledNamingScheme_;
+  static std::set<Orthanc::DicomTag> referencedTags_;
+  std::string PathGenerator::otherAttachmentsPrefix_;
+
+
+  static const Keyword* LookupKeyword(const std::string& folderName, size_t position)
+  {
+    for (size_t i = 0; i < KEYWORDS_COUNT; i++)
+    {
+      const size_t length = strlen(KEYWORDS[i].keyword_);
+      if (folderName.compare(position, length, KEYWORDS[i].keyword_) == 0)
+      {
+        return &KEYWORDS[i];
+      }
+    }
+
+    return NULL;
+  }
+
+  static const Orthanc::DicomTag& GetTagFromName(const char* name)
+  {
+    for (size_t i = 0; i < TAGS_COUNT; i++)
+    {
+      if (strcmp(TAGS[i].name_, name) == 0)
+      {
+        return TAGS[i].tag_;
+      }
+    }
+
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  static void CompileNamingScheme(std::vector<CompiledFolder>& target,
+                                  std::set<Orthanc::DicomTag>& referencedTags,
+                                  const std::string& namingScheme)
+  {
+    target.clear();
+    referencedTags.clear();
+
+    std::vector<std::string> folderNames;
+    Orthanc::Toolbox::SplitString(folderNames, namingScheme, '/');
+
+    for (std::vector<std::string>::const_iterator it = folderNames.begin(); it != folderNames.end(); ++it)
+    {
+      CompiledFolder folder;
+      Token literal;
+
+      size_t position = 0;
+      while (position < it->size())
+      {
+        const Keyword* keyword = ((*it)[position] == '{' ? LookupKeyword(*it, position) : NULL);
+
+        if (keyword != NULL)
+        {
+          if (!literal.literal_.empty())
+          {
+            folder.push_back(literal);
+            literal.literal_.clear();
+          }
+
+          Token token;
+          token.keyword_ = keyword;
+
+          if (keyword->tagName_ != NULL)
+          {
+            token.tag_ = GetTagFromName(keyword->tagName_);
+            referencedTags.insert(token.tag_);
+          }
+          else if (keyword->type_ == TokenType_OrthancId)
+          {
+            referencedTags.insert(TAG_PATIENT_ID);
+            referencedTags.insert(TAG_STUDY_INSTANCE_UID);
+            referencedTags.insert(TAG_SERIES_INSTANCE_UID);
+            referencedTags.insert(TAG_SOP_INSTANCE_UID);
+          }
+
+          folder.push_back(token);
+
+          position += strlen(keyword->keyword_);
+        }
+        else
+        {
+          // unknown keywords are kept as is in the path, like any other text
+          literal.literal_ += (*it)[position];
+          position++;
+        }
+      }
+
+      if (!literal.literal_.empty())
+      {
+        folder.push_back(literal);
+      }
+
+      target.push_back(folder);
+    }
+  }
 
   void PathGenerator::SetOtherAttachmentsPrefix(const std::string& prefix)
   {
@@ -41,9 +259,13 @@ namespace OrthancPlugins
 	void PathGenerator::SetNamingScheme(const std::string& namingScheme, bool isOverwriteInstances)
 	{
 		namingScheme_ = namingScheme;
+    compiledNamingScheme_.clear();
+    referencedTags_.clear();
 
 		if (namingScheme_ != "OrthancDefault")
 		{
+      CompileNamingScheme(compiledNamingScheme_, referencedTags_, namingScheme_);
+
 			// when using a custom scheme, to avoid collisions, you must include, at least the attachment UUID
 			// or each of the DICOM IDs or the orthancInstanceID
 			if (!isOverwriteInstances)
@@ -76,123 +298,98 @@ namespace OrthancPlugins
 		return namingScheme_ == "OrthancDefault";
 	}
 
-	std::string GetSplitDateDicomTagToPath(const Json::Value& tags, const char* tagName, const char* defaultValue = NULL)
-	{
-		if (tags.isMember(tagName) && tags[tagName].asString().size() == 8)
-		{
-			std::string date = tags[tagName].asString();
-			return date.substr(0, 4) + "/" + date.substr(4, 2) + "/" + date.substr(6, 2);
-		}
-		else if (defaultValue != NULL)
-		{
-			return defaultValue;
-		}
+  const std::set<Orthanc::DicomTag>& PathGenerator::GetReferencedTags()
+  {
+    return referencedTags_;
+  }
 
-		return "";
-	}
+  static void AppendStringTag(std::string& target, const DicomTagsValues& tags, const Token& token)
+  {
+    DicomTagsValues::const_iterator found = tags.find(token.tag_);
 
-	std::string GetStringDicomTagForPath(const Json::Value& tags, const std::string& tagName, const char* defaultValue = NULL)
-	{
-		if (tags.isMember(tagName) && tags[tagName].isString() && tags[tagName].asString().size() > 0)
-		{
-			return tags[tagName].asString();
-		}
-		else if (defaultValue != NULL)
-		{
-			return defaultValue;
-		}
-		
-		return "";
-	}
+    if (found != tags.end() && !found->second.empty())
+    {
+      target += found->second;
+    }
+    else
+    {
+      target += token.keyword_->defaultValue_;
+    }
+  }
 
-	std::string GetIntDicomTagForPath(const Json::Value& tags, const std::string& tagName, const char* defaultValue = NULL, size_t padding = 0)
-	{
-		if (tags.isMember(tagName))
-		{
-			std::string value;
-			if (tags[tagName].isInt())
-			{
-				value = boost::lexical_cast<std::string>(tags[tagName].asInt());
-			}
-			else if (tags[tagName].isString())
-			{
-				value = tags[tagName].asString();
-			}
+  static void AppendIntegerTag(std::string& target, const DicomTagsValues& tags, const Token& token)
+  {
+    DicomTagsValues::const_iterator found = tags.find(token.tag_);
 
-			if (padding > 0 && padding > value.size())
-			{
-				value = std::string(padding - value.size(), '0') + value;
-			}
-			return value;
-		}
-		else if (defaultValue != NULL)
-		{
-			return defaultValue;
-		}
-		
-		return "";
-	}
+    if (found == tags.end())
+    {
+      target += token.keyword_->defaultValue_;
+    }
+    else
+    {
+      if (token.keyword_->padding_ > found->second.size())
+      {
+        target.append(token.keyword_->padding_ - found->second.size(), '0');
+      }
 
-	void ReplaceTagKeyword(std::string& folderName, const std::string& keyword, const Json::Value& tags, const char* defaultValue, const char* tagKey = NULL)
-	{
-		if (folderName.find(keyword) != std::string::npos)
-		{
-			std::string key = keyword.substr(1, keyword.size() -2);
-			if (tagKey != NULL)
-			{
-				key = tagKey;
-			}
-			boost::replace_all(folderName, keyword, GetStringDicomTagForPath(tags, key, defaultValue));
-		}
-	}
+      target += found->second;
+    }
+  }
 
-	void ReplaceIntTagKeyword(std::string& folderName, const std::string& keyword, const Json::Value& tags, const char* defaultValue, size_t padding, const char* tagKey = NULL)
-	{
-		if (folderName.find(keyword) != std::string::npos)
-		{
-			std::string key = keyword.substr(1, keyword.size() -2);
-			if (tagKey != NULL)
-			{
-				key = tagKey;
-			}
-			boost::replace_all(folderName, keyword, GetIntDicomTagForPath(tags, key, defaultValue, padding));
-		}
-	}
+  static void AppendSplitDateTag(std::string& target, const DicomTagsValues& tags, const Token& token)
+  {
+    DicomTagsValues::const_iterator found = tags.find(token.tag_);
 
+    if (found != tags.end() && found->second.size() == 8)
+    {
+      target.append(found->second, 0, 4);
+      target += '/';
+      target.append(found->second, 4, 2);
+      target += '/';
+      target.append(found->second, 6, 2);
+    }
+    else
+    {
+      target += token.keyword_->defaultValue_;
+    }
+  }
 
-	void ReplaceOrthancID(std::string& folderName, const std::string& keyword, const std::string& id, size_t from, size_t length)
-	{
-		if (length == 0)
-		{
-			boost::replace_all(folderName, keyword, id);
-		}
-		else
-		{
-			boost::replace_all(folderName, keyword, id.substr(from, length));
-		}
-	}
+  static const std::string& GetTagValue(const DicomTagsValues& tags, const Orthanc::DicomTag& tag)
+  {
+    static const std::string EMPTY;
 
+    DicomTagsValues::const_iterator found = tags.find(tag);
+    return (found == tags.end() ? EMPTY : found->second);
+  }
 
-	void AddIntDicomTagToPath(boost::filesystem::path& path, const Json::Value& tags, const char* tagName, size_t zeroPaddingWidth = 0, const char* defaultValue = NULL)
-	{
-		if (tags.isMember(tagName) && tags[tagName].isString() && tags[tagName].asString().size() > 0)
-		{
-			std::string tagValue = tags[tagName].asString();
-			if (zeroPaddingWidth > 0 && tagValue.size() < zeroPaddingWidth)
-			{
-				std::string padding(zeroPaddingWidth - tagValue.size(), '0');
-				path /= padding + tagValue; 
-			}
-			else
-			{
-				path /= tagValue;
-			}
-		}
-		else if (defaultValue != NULL)
-		{
-			path /= defaultValue;
-		}
-	}
+  static void AppendSubstring(std::string& target, const std::string& id, const Keyword& keyword)
+  {
+    if (keyword.length_ == 0)
+    {
+      target += id;
+    }
+    else
+    {
+      target.append(id, keyword.from_, keyword.length_);
+    }
+  }
+
+  static const std::string& GetOrthancId(Orthanc::DicomInstanceHasher& hasher, Orthanc::ResourceType level)
+  {
+    switch (level)
+    {
+      case Orthanc::ResourceType_Patient:
+        return hasher.HashPatient();
+      case Orthanc::ResourceType_Study:
+        return hasher.HashStudy();
+      case Orthanc::ResourceType_Series:
+        return hasher.HashSeries();
+      case Orthanc::ResourceType_Instance:
+        return hasher.HashInstance();
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
 
 	std::string GetExtension(OrthancPluginContentType type, bool isCompressed)
 	{
@@ -220,92 +417,36 @@ namespace OrthancPlugins
 
 	boost::filesystem::path PathGenerator::GetRelativePathFromTags(const Json::Value& tags, const char* uuid, OrthancPluginContentType type, bool isCompressed)
 	{
-		boost::filesystem::path path;
-
 		if (!tags.isNull())
-		{ 
-      // If, at some point, we enable saving other attachments using tags, we must re-think the duplicate files avoidance scheme:
-      // E.g: using the 4 DICOM IDs or the OrthancInstanceID in the path is not sufficient anymore to avoid duplicates.
-      if (type != OrthancPluginContentType_Dicom)
+		{
+      // keep only the tags that are referenced by the naming scheme
+      DicomTagsValues values;
+
+      for (std::set<Orthanc::DicomTag>::const_iterator it = referencedTags_.begin(); it != referencedTags_.end(); ++it)
       {
-    		return GetLegacyRelativePath(uuid);
+        for (size_t i = 0; i < TAGS_COUNT; i++)
+        {
+          if (TAGS[i].tag_ == *it && tags.isMember(TAGS[i].name_))
+          {
+            const Json::Value& value = tags[TAGS[i].name_];
+
+            if (value.isInt())
+            {
+              values[*it] = boost::lexical_cast<std::string>(value.asInt());
+            }
+            else if (value.isString())
+            {
+              values[*it] = value.asString();
+            }
+            else
+            {
+              values[*it] = "";
+            }
+          }
+        }
       }
 
-			std::vector<std::string> folderNames;
-			Orthanc::Toolbox::SplitString(folderNames, namingScheme_, '/');
-
-			for (std::vector<std::string>::const_iterator it = folderNames.begin(); it != folderNames.end(); ++it)
-			{
-				std::string folderName = *it;
-				
-				if (folderName.find("{split(StudyDate)}") != std::string::npos)
-				{
-					boost::replace_all(folderName, "{split(StudyDate)}", GetSplitDateDicomTagToPath(tags, "StudyDate", "NO_STUDY_DATE"));
-				}
-
-				if (folderName.find("{split(PatientBirthDate)}") != std::string::npos)
-				{
-					boost::replace_all(folderName, "{split(PatientBirthDate)}", GetSplitDateDicomTagToPath(tags, "PatientBirthDate", "NO_PATIENT_BIRTH_DATE"));
-				}
-
-				ReplaceTagKeyword(folderName, "{PatientID}", tags, "NO_PATIENT_ID");
-				ReplaceTagKeyword(folderName, "{PatientBirthDate}", tags, "NO_PATIENT_BIRTH_DATE");
-				ReplaceTagKeyword(folderName, "{PatientName}", tags, "NO_PATIENT_NAME");
-				ReplaceTagKeyword(folderName, "{PatientSex}", tags, "NO_PATIENT_SEX");
-				ReplaceTagKeyword(folderName, "{StudyInstanceUID}", tags, "NO_STUDY_INSTANCE_UID");
-				ReplaceTagKeyword(folderName, "{StudyDate}", tags, "NO_STUDY_DATE");
-				ReplaceTagKeyword(folderName, "{StudyID}", tags, "NO_STUDY_ID");
-				ReplaceTagKeyword(folderName, "{StudyDescription}", tags, "NO_STUDY_DESCRIPTION");
-				ReplaceTagKeyword(folderName, "{AccessionNumber}", tags, "NO_ACCESSION_NUMBER");
-				ReplaceTagKeyword(folderName, "{SeriesInstanceUID}", tags, "NO_SERIES_INSTANCE_UID");
-				ReplaceTagKeyword(folderName, "{SeriesDate}", tags, "NO_SERIES_DATE");
-				ReplaceTagKeyword(folderName, "{SeriesDescription}", tags, "NO_SERIES_DESCRIPTION");
-				ReplaceTagKeyword(folderName, "{SOPInstanceUID}", tags, "NO_SOP_INSTANCE_UID");
-				ReplaceTagKeyword(folderName, "{InstitutionName}", tags, "NO_INSTITUTION_NAME");
-				ReplaceIntTagKeyword(folderName, "{SeriesNumber}", tags, "NO_SERIES_NUMBER", 0);
-				ReplaceIntTagKeyword(folderName, "{InstanceNumber}", tags, "NO_INSTANCE_NUMBER", 0);
-				ReplaceIntTagKeyword(folderName, "{pad4(SeriesNumber)}", tags, "NO_SERIES_NUMBER", 4, "SeriesNumber");
-				ReplaceIntTagKeyword(folderName, "{pad4(InstanceNumber)}", tags, "NO_INSTANCE_NUMBER", 4, "InstanceNumber");
-				ReplaceIntTagKeyword(folderName, "{pad6(SeriesNumber)}", tags, "NO_SERIES_NUMBER", 6, "SeriesNumber");
-				ReplaceIntTagKeyword(folderName, "{pad6(InstanceNumber)}", tags, "NO_INSTANCE_NUMBER", 6, "InstanceNumber");
-				ReplaceIntTagKeyword(folderName, "{pad8(SeriesNumber)}", tags, "NO_SERIES_NUMBER", 8, "SeriesNumber");
-				ReplaceIntTagKeyword(folderName, "{pad8(InstanceNumber)}", tags, "NO_INSTANCE_NUMBER", 8, "InstanceNumber");
-
-				Orthanc::DicomInstanceHasher hasher(tags["PatientID"].asString(), tags["StudyInstanceUID"].asString(), tags["SeriesInstanceUID"].asString(), tags["SOPInstanceUID"].asString());
-				std::string orthancPatientId = hasher.HashPatient();
-				std::string orthancStudyId = hasher.HashStudy();
-				std::string orthancSeriesId = hasher.HashSeries();
-				std::string orthancInstanceId = hasher.HashInstance();
-
-				ReplaceOrthancID(folderName, "{OrthancPatientID}", orthancPatientId, 0, 0);
-				ReplaceOrthancID(folderName, "{OrthancStudyID}", orthancStudyId, 0, 0);
-				ReplaceOrthancID(folderName, "{OrthancSeriesID}", orthancSeriesId, 0, 0);
-				ReplaceOrthancID(folderName, "{OrthancInstanceID}", orthancInstanceId, 0, 0);
-
-				ReplaceOrthancID(folderName, "{01(OrthancPatientID)}", orthancPatientId, 0, 2);
-				ReplaceOrthancID(folderName, "{01(OrthancStudyID)}", orthancStudyId, 0, 2);
-				ReplaceOrthancID(folderName, "{01(OrthancSeriesID)}", orthancSeriesId, 0, 2);
-				ReplaceOrthancID(folderName, "{01(OrthancInstanceID)}", orthancInstanceId, 0, 2);
-
-				ReplaceOrthancID(folderName, "{23(OrthancPatientID)}", orthancPatientId, 2, 2);
-				ReplaceOrthancID(folderName, "{23(OrthancStudyID)}", orthancStudyId, 2, 2);
-				ReplaceOrthancID(folderName, "{23(OrthancSeriesID)}", orthancSeriesId, 2, 2);
-				ReplaceOrthancID(folderName, "{23(OrthancInstanceID)}", orthancInstanceId, 2, 2);
-
-				if (folderName.find("{UUID}") != std::string::npos)
-				{
-					boost::replace_all(folderName, "{UUID}", uuid);
-				}
-
-				if (folderName.find("{.ext}") != std::string::npos)
-				{
-					boost::replace_all(folderName, "{.ext}", GetExtension(type, isCompressed));
-				}
-
-				path /= Orthanc::SystemToolbox::PathFromUtf8(folderName);
-			}
-
-			return path;
+      return GetRelativePathFromTags(values, uuid, type, isCompressed);
 		}
     else if (type != OrthancPluginContentType_Dicom && !otherAttachmentsPrefix_.empty())
     {
@@ -316,6 +457,80 @@ namespace OrthancPlugins
 	}
 
 
+  boost::filesystem::path PathGenerator::GetRelativePathFromTags(const DicomTagsValues& tags, const char* uuid, OrthancPluginContentType type, bool isCompressed)
+  {
+    // If, at some point, we enable saving other attachments using tags, we must re-think the duplicate files avoidance scheme:
+    // E.g: using the 4 DICOM IDs or the OrthancInstanceID in the path is not sufficient anymore to avoid duplicates.
+    if (type != OrthancPluginContentType_Dicom)
+    {
+      return GetLegacyRelativePath(uuid);
+    }
+
+    // the Orthanc IDs are only computed (4 SHA-1) if the naming scheme refers to one of them
+    std::unique_ptr<Orthanc::DicomInstanceHasher> hasher;
+    const std::string uuidStr(uuid);
+    boost::filesystem::path path;
+    std::string folderName;
+
+    for (std::vector<CompiledFolder>::const_iterator folder = compiledNamingScheme_.begin(); folder != compiledNamingScheme_.end(); ++folder)
+    {
+      folderName.clear();
+
+      for (CompiledFolder::const_iterator token = folder->begin(); token != folder->end(); ++token)
+      {
+        if (token->keyword_ == NULL)
+        {
+          folderName += token->literal_;
+          continue;
+        }
+
+        const Keyword& keyword = *token->keyword_;
+
+        switch (keyword.type_)
+        {
+          case TokenType_StringTag:
+            AppendStringTag(folderName, tags, *token);
+            break;
+
+          case TokenType_IntegerTag:
+            AppendIntegerTag(folderName, tags, *token);
+            break;
+
+          case TokenType_SplitDateTag:
+            AppendSplitDateTag(folderName, tags, *token);
+            break;
+
+          case TokenType_OrthancId:
+            if (hasher.get() == NULL)
+            {
+              hasher.reset(new Orthanc::DicomInstanceHasher(GetTagValue(tags, TAG_PATIENT_ID),
+                                                            GetTagValue(tags, TAG_STUDY_INSTANCE_UID),
+                                                            GetTagValue(tags, TAG_SERIES_INSTANCE_UID),
+                                                            GetTagValue(tags, TAG_SOP_INSTANCE_UID)));
+            }
+            AppendSubstring(folderName, GetOrthancId(*hasher, keyword.level_), keyword);
+            break;
+
+          case TokenType_Uuid:
+            folderName += uuidStr;
+            break;
+
+          case TokenType_Extension:
+            folderName += GetExtension(type, isCompressed);
+            break;
+
+          default:
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+      }
+
+      path /= Orthanc::SystemToolbox::PathFromUtf8(folderName);
+    }
+
+    return path;
+  }
+
+
 	boost::filesystem::path PathGenerator::GetLegacyRelativePath(const std::string& uuid)
 	{
 		if (!Orthanc::Toolbox::IsUuid(uuid))
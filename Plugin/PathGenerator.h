@@ -20,6 +20,7 @@
 #pragma once
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "DicomTagsExtractor.h"
 
 #include <boost/filesystem.hpp>
 
@@ -37,7 +38,14 @@ namespace OrthancPlugins
 
     static bool IsDefaultNamingScheme();
 
+    // The DICOM tags that must be provided to GetRelativePathFromTags()
+    static const std::set<Orthanc::DicomTag>& GetReferencedTags();
+
+    // "tags" is the simplified JSON of the instance or a null value if the instance is not known
     static boost::filesystem::path GetRelativePathFromTags(const Json::Value& tags, const char* uuid, OrthancPluginContentType type, bool isCompressed);
+
+    static boost::filesystem::path GetRelativePathFromTags(const DicomTagsValues& tags, const char* uuid, OrthancPluginContentType type, bool isCompressed);
+
     static boost::filesystem::path GetLegacyRelativePath(const std::string& uuid);
   };
   
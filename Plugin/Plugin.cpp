@@ -30,6 +30,8 @@
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
+#include "AdaptiveThrottle.h"
+#include "AttachmentsCache.h"
 #include "CustomData.h"
 #include "PathGenerator.h"
 #include "PathOwner.h"
@@ -38,6 +40,19 @@
 #include "Helpers.h"
 #include "FoldersIndexer.h"
 #include "DelayedFilesDeleter.h"
+#include "DicomTagsExtractor.h"
+#include "DirectoriesCache.h"
+#include "DirectoriesPruner.h"
+#include "FileDescriptorsCache.h"
+#include "LogsVerbosity.h"
+#include "GroupCommitSync.h"
+#include "SequentialReadahead.h"
+#include "StorageIoEngine.h"
+#include "TrashFilesDeleter.h"
+
+#if ORTHANC_ENABLE_IO_URING == 1
+#  include "IoUringStorageIoEngine.h"
+#endif
 
 #include <Compatibility.h>
 #include <OrthancException.h>
@@ -67,6 +82,7 @@
 namespace fs = boost::filesystem;
 
 bool fsyncOnWrite_ = true;
+bool groupCommit_ = false;  // fsync a whole batch of files at once instead of each file
 bool overwriteInstances_ = false;
 bool deidentifyLogs_ = true;
 size_t legacyPathLength = 39; // ex "/00/f7/00f7fd8b-47bd8c3a-ff917804-d180cdbc-40cf9527"
@@ -82,14 +98,29 @@ static const char* const READ_ONLY = "ReadOnly";
 static const char* const CONFIG_SYNC_STORAGE_AREA = "SyncStorageArea";
 static const char* const CONFIG_OVERWRITE_INSTANCES = "OverwriteInstances";
 static const char* const CONFIG_DE_IDENTIFY_LOGS = "DeidentifyLogs";
+static const char* const CONFIG_HTTP_THREADS_COUNT = "HttpThreadsCount";
 static const char* const CONFIG_STORAGE_DIRECTORY = "StorageDirectory";
 static const char* const CONFIG_ENABLE = "Enable";
 static const char* const CONFIG_NAMING_SCHEME = "NamingScheme";
 static const char* const CONFIG_MAX_PATH_LENGTH = "MaxPathLength";
+static const char* const CONFIG_CUSTOM_DATA_FORMAT = "CustomDataFormat";
 static const char* const CONFIG_OTHER_ATTACHMENTS_PREFIX = "OtherAttachmentsPrefix";
+static const char* const CONFIG_DIRECTORIES_CACHE_SIZE = "DirectoriesCacheSize";
+static const char* const CONFIG_FILE_DESCRIPTORS_CACHE_SIZE = "FileDescriptorsCacheSize";
+static const char* const CONFIG_MMAP_THRESHOLD_MB = "MmapThresholdMB";
+static const char* const CONFIG_MMAP_CACHE_SIZE = "MmapCacheSize";
+static const char* const CONFIG_ATTACHMENTS_CACHE_SIZE_MB = "AttachmentsCacheSizeMB";
+static const char* const CONFIG_ATTACHMENTS_CACHE_MAX_ENTRY_SIZE_KB = "AttachmentsCacheMaxEntrySizeKB";
+static const char* const CONFIG_SYNC_MODE = "SyncMode";
+static const char* const CONFIG_IO_ENGINE = "IoEngine";
 static const char* const CONFIG_MULTIPLE_STORAGES = "MultipleStorages";
 static const char* const CONFIG_MULTIPLE_STORAGES_STORAGES = "Storages";
 static const char* const CONFIG_MULTIPLE_STORAGES_CURRENT_WRITE_STORAGE = "CurrentWriteStorage";
+static const char* const CONFIG_MULTIPLE_STORAGES_PATH = "Path";
+static const char* const CONFIG_WRITE_CACHE_POLICY = "WriteCachePolicy";
+static const char* const CONFIG_PREALLOCATE = "Preallocate";
+static const char* const CONFIG_READAHEAD_FILES = "ReadaheadFiles";
+static const char* const CONFIG_READAHEAD_BUDGET_MB = "ReadaheadBudgetMB";
 static const char* const CONFIG_INDEXER = "Indexer";
 static const char* const CONFIG_INDEXER_ENABLE = "Enable";
 static const char* const CONFIG_INDEXER_FOLDERS = "Folders";
@@ -99,13 +130,38 @@ static const char* const CONFIG_INDEXER_PARSED_EXTENSIONS = "ParsedExtensions";
 static const char* const CONFIG_INDEXER_SKIPPED_EXTENSIONS = "SkippedExtensions";
 static const char* const CONFIG_INDEXER_TAKE_OWNERSHIP = "TakeOwnership";
 static const char* const CONFIG_INDEXER_ENABLE_VERBOSE_LOGS = "EnableVerboseLogs";
+static const char* const CONFIG_INDEXER_MODE = "Mode";
+static const char* const CONFIG_INDEXER_FULL_RESCAN_INTERVAL = "FullRescanInterval";
+static const char* const CONFIG_INDEXER_WALKER_THREADS = "WalkerThreads";
+static const char* const CONFIG_INDEXER_MAX_WALKER_THREADS_PER_FOLDER = "MaxWalkerThreadsPerFolder";
+static const char* const CONFIG_INDEXER_IN_MEMORY_INDEX = "InMemoryIndex";
+static const char* const CONFIG_INDEXER_SKIP_UNCHANGED_FOLDERS = "SkipUnchangedFolders";
+static const char* const CONFIG_INDEXER_FULL_VERIFICATION_PASSES = "FullVerificationPasses";
 static const char* const CONFIG_DELAYED_DELETION = "DelayedDeletion";
 static const char* const CONFIG_DELAYED_DELETION_ENABLE = "Enable";
 static const char* const CONFIG_DELAYED_DELETION_THROTTLE_DELAY_MS = "ThrottleDelayMs";
+static const char* const CONFIG_DELAYED_DELETION_THREADS = "Threads";
+static const char* const CONFIG_DELAYED_DELETION_MODE = "Mode";
+static const char* const CONFIG_ADAPTIVE_THROTTLING = "AdaptiveThrottling";
+static const char* const CONFIG_ADAPTIVE_THROTTLING_ENABLE = "Enable";
+static const char* const CONFIG_ADAPTIVE_THROTTLING_TARGET_LATENCY_MS = "TargetLatencyMs";
+static const char* const CONFIG_ADAPTIVE_THROTTLING_MIN_DELAY_MS = "MinDelayMs";
+static const char* const CONFIG_ADAPTIVE_THROTTLING_MAX_DELAY_MS = "MaxDelayMs";
+static const char* const CONFIG_ADAPTIVE_THROTTLING_TIME_WINDOWS = "TimeWindows";
+static const char* const CONFIG_ADAPTIVE_THROTTLING_FROM = "From";
+static const char* const CONFIG_ADAPTIVE_THROTTLING_TO = "To";
 
 static const char* const PLUGIN_STATUS_DELAYED_DELETION_ACTIVE = "DelayedDeletionIsActive";
 static const char* const PLUGIN_STATUS_DELAYED_DELETION_PENDING_FILES = "FilesPendingDeletion";
+static const char* const PLUGIN_STATUS_DELAYED_DELETION = "DelayedDeletion";
 static const char* const PLUGIN_STATUS_INDEXER_ACTIVE = "IndexerIsActive";
+static const char* const PLUGIN_STATUS_INDEXER = "Indexer";
+static const char* const PLUGIN_STATUS_GROUP_COMMIT = "GroupCommit";
+static const char* const PLUGIN_STATUS_IO_ENGINE = "IoEngine";
+static const char* const PLUGIN_STATUS_READAHEAD = "Readahead";
+static const char* const PLUGIN_STATUS_ATTACHMENTS_CACHE = "AttachmentsCache";
+static const char* const PLUGIN_STATUS_PENDING_EMPTY_DIRECTORIES = "EmptyDirectoriesPendingRemoval";
+static const char* const PLUGIN_STATUS_FOREGROUND_LATENCY = "ForegroundLatency";
 
 bool isReadOnly_ = false;
 bool hasKeyValueStoresSupport_ = false;
@@ -114,6 +170,32 @@ bool hasQueuesSupport_ = false;
 boost::mutex mutex_;
 std::unique_ptr<FoldersIndexer> foldersIndexer_;
 std::unique_ptr<DelayedFilesDeleter> delayedFilesDeleter_;
+std::unique_ptr<TrashFilesDeleter> trashFilesDeleter_;  // only set at startup and reset at finalization -> no need for mutex_
+std::unique_ptr<IStorageIoEngine> ioEngine_(new DefaultStorageIoEngine);
+SequentialReadahead readahead_;
+
+
+static WriteCachePolicy ParseWriteCachePolicy(const std::string& value)
+{
+  if (value == "Buffered")
+  {
+    return WriteCachePolicy_Buffered;
+  }
+  else if (value == "DontNeed")
+  {
+    return WriteCachePolicy_DontNeed;
+  }
+  else if (value == "Direct")
+  {
+    return WriteCachePolicy_Direct;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    std::string("Invalid value for \"") + CONFIG_WRITE_CACHE_POLICY + "\": " + value +
+                                    " (allowed values are \"Buffered\", \"DontNeed\" and \"Direct\")");
+  }
+}
 
 
 OrthancPluginErrorCode StorageCreate(OrthancPluginMemoryBuffer* customData,
@@ -130,7 +212,10 @@ OrthancPluginErrorCode StorageCreate(OrthancPluginMemoryBuffer* customData,
   Orthanc::Toolbox::ElapsedTimer timer;
 #endif
 
-  LOG(INFO) << "Advanced Storage - creating attachment \"" << uuid << "\" of type " << static_cast<int>(type);
+  if (LogsVerbosity::IsVerbose())
+  {
+    LOG(INFO) << "Advanced Storage - creating attachment \"" << uuid << "\" of type " << static_cast<int>(type);
+  }
 
   try
   {
@@ -139,21 +224,67 @@ OrthancPluginErrorCode StorageCreate(OrthancPluginMemoryBuffer* customData,
     boost::filesystem::path relativePath;
     if (!PathGenerator::IsDefaultNamingScheme())
     {
-      Json::Value tags;
-
-      if (dicomInstance != NULL)
+      if (dicomInstance != NULL && type == OrthancPluginContentType_Dicom)
       {
         OrthancPlugins::DicomInstance dicom(dicomInstance);
-        dicom.GetSimplifiedJson(tags);
-      }
+        DicomTagsValues tags;
+
+        // read only the tags that are used in the NamingScheme instead of converting the whole dataset into JSON
+        if (DicomTagsExtractor::ExtractTags(tags, dicom.GetBuffer(), dicom.GetSize(), PathGenerator::GetReferencedTags()))
+        {
+          relativePath = PathGenerator::GetRelativePathFromTags(tags, uuid, type, isCompressed);
+        }
+        else
+        {
+          Json::Value simplifiedTags;
+          dicom.GetSimplifiedJson(simplifiedTags);
 
-      relativePath = PathGenerator::GetRelativePathFromTags(tags, uuid, type, isCompressed);
+          relativePath = PathGenerator::GetRelativePathFromTags(simplifiedTags, uuid, type, isCompressed);
+        }
+      }
+      else if (dicomInstance != NULL)
+      {
+        // the other attachments of an instance are stored with the legacy path -> no need to read the tags
+        relativePath = PathGenerator::GetRelativePathFromTags(DicomTagsValues(), uuid, type, isCompressed);
+      }
+      else
+      {
+        relativePath = PathGenerator::GetRelativePathFromTags(Json::Value(), uuid, type, isCompressed);
+      }
     }
     
     CustomData cd = CustomData::CreateForWriting(uuid, relativePath);
 
     boost::filesystem::path absolutePath = cd.GetAbsolutePath(); //ForWriting()
-    if (fs::exists(absolutePath))
+
+    std::string seriliazedCustomDataString;
+    cd.ToString(seriliazedCustomDataString);
+
+    const boost::filesystem::path rootPath = cd.GetRootPath();
+    const bool isKnownDirectory = DirectoriesCache::CreateParentDirectory(rootPath, absolutePath);
+
+    const bool fsyncEachFile = fsyncOnWrite_ && !groupCommit_;
+
+    bool isCreated;
+
+    try
+    {
+      isCreated = ioEngine_->WriteNewFile(absolutePath, content, size, fsyncEachFile, cd.GetWritePolicy());
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      if (!isKnownDirectory)
+      {
+        throw;
+      }
+
+      // the cached directory might have been removed in the meantime (e.g. by another Orthanc sharing the storage)
+      DirectoriesCache::Invalidate(absolutePath.parent_path());
+      DirectoriesCache::CreateParentDirectory(rootPath, absolutePath);
+      isCreated = ioEngine_->WriteNewFile(absolutePath, content, size, fsyncEachFile, cd.GetWritePolicy());
+    }
+
+    if (!isCreated)
     {
       // Extremely unlikely case if uuid is included in the path: This Uuid has already been created
       // in the past.
@@ -162,36 +293,41 @@ OrthancPluginErrorCode StorageCreate(OrthancPluginMemoryBuffer* customData,
       // TODO for the future: handle duplicates path (e.g: there's no uuid in the path and we are uploading the same file again)
     }
 
-    std::string seriliazedCustomDataString;
-    cd.ToString(seriliazedCustomDataString);
-
-    if (fs::exists(absolutePath.parent_path()))
+    if (fsyncOnWrite_ && groupCommit_)
     {
-      if (!fs::is_directory(absolutePath.parent_path()))
+      try
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryOverFile);
+        GroupCommitSync::GetForStorage(rootPath).WaitDurable();
       }
-    }
-    else
-    {
-      if (!fs::create_directories(absolutePath.parent_path()))
+      catch (Orthanc::OrthancException&)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_FileStorageCannotWrite);
+        // the file is not durable: don't let Orthanc reference it
+        Orthanc::SystemToolbox::RemoveFile(absolutePath);
+        throw;
       }
     }
 
-    Orthanc::SystemToolbox::WriteFile(content, size, absolutePath, fsyncOnWrite_);
+    // a file might have existed at this path before (e.g. removed by another Orthanc sharing the storage)
+    FileDescriptorsCache::Invalidate(absolutePath);
+
+    // write-through: the small attachments (e.g. DicomUntilPixelData) are read soon after they are written
+    AttachmentsCache::Add(uuid, type, content, size);
 
     OrthancPluginCreateMemoryBuffer(OrthancPlugins::GetGlobalContext(), customData, seriliazedCustomDataString.size());
     memcpy(customData->data, seriliazedCustomDataString.data(), seriliazedCustomDataString.size());
 
 
-    std::string pathForLogs = Orthanc::SystemToolbox::PathToUtf8(absolutePath);
-    if (deidentifyLogs_ && !PathGenerator::IsDefaultNamingScheme())
+    if (AdaptiveThrottle::IsAdaptiveMode())
+    {
+      ForegroundLatency::Record(cd.GetStorageNumber(), timer.GetElapsedMicroseconds());
+    }
+
+    if (LogsVerbosity::IsVerbose())
     {
-      pathForLogs = "*** POTENTIAL PHI ***";
+      LOG(INFO) << "Advanced Storage - Created attachment \"" << uuid << "\" - path = "
+                << PathForLogs(absolutePath, deidentifyLogs_ && !PathGenerator::IsDefaultNamingScheme())
+                << " (" << timer.GetHumanTransferSpeed(true, size) << ")";
     }
-    LOG(INFO) << "Advanced Storage - Created attachment \"" << uuid << "\" - path = " << pathForLogs << " (" << timer.GetHumanTransferSpeed(true, size) << ")";
 
     return OrthancPluginErrorCode_Success;
   }
@@ -222,44 +358,58 @@ OrthancPluginErrorCode StorageReadRange(OrthancPluginMemoryBuffer64* target,
   CustomData cd = CustomData::FromString(uuid, customData, customDataSize);
   boost::filesystem::path path = cd.GetAbsolutePath();
 
-  std::string pathForLogs = Orthanc::SystemToolbox::PathToUtf8(path);
-  if (deidentifyLogs_) // we never know how the path was generated -> always deidentify
+  // we never know how the path was generated -> always deidentify
+  const bool isVerbose = LogsVerbosity::IsVerbose();
+  if (isVerbose)
   {
-    pathForLogs = "*** POTENTIAL PHI ***";
-  }
-
-  LOG(INFO) << "Advanced Storage - Reading range of attachment \"" << uuid << "\" of type " << static_cast<int>(type) << " (path = " << pathForLogs << ")";
-
-  if (!Orthanc::SystemToolbox::IsRegularFile(path))
-  {
-    LOG(ERROR) << "The path does not point to a regular file: " << path;
-    return OrthancPluginErrorCode_InexistentFile;
+    LOG(INFO) << "Advanced Storage - Reading range of attachment \"" << uuid << "\" of type " << static_cast<int>(type) << " (path = " << PathForLogs(path, deidentifyLogs_) << ")";
   }
 
   try
   {
-    fs::ifstream f;
-    f.open(path, std::ifstream::in | std::ifstream::binary);
-    if (!f.good())
+    if (AttachmentsCache::ReadRange(target->data, target->size, uuid, type, rangeStart))
     {
-      LOG(ERROR) << "The path does not point to a regular file: " << path;
-      return OrthancPluginErrorCode_InexistentFile;
+      if (isVerbose)
+      {
+        LOG(INFO) << "Advanced Storage - Read attachment \"" << uuid << "\" from the cache";
+      }
+
+      return OrthancPluginErrorCode_Success;
     }
 
-    f.seekg(rangeStart, std::ios::beg);
+    readahead_.NotifyRead(cd.GetRootPath(), path);
 
     // The ReadRange uses a target that has already been allocated by orthanc
-    f.read(reinterpret_cast<char*>(target->data), target->size);
+    // only map the files that the plugin owns: the adopted files might be truncated by another tool
+    const uint64_t fileSize = ioEngine_->ReadRange(target->data, target->size, path, rangeStart, cd.IsOwner() && cd.IsRelativePath());
 
-    f.close();
+    if (AdaptiveThrottle::IsAdaptiveMode())
+    {
+      ForegroundLatency::Record(cd.GetStorageNumber(), timer.GetElapsedMicroseconds());
+    }
+
+    // only cache the whole attachments
+    if (rangeStart == 0 &&
+        fileSize == target->size &&
+        AttachmentsCache::IsCacheable(type, target->size))
+    {
+      AttachmentsCache::Add(uuid, type, target->data, target->size);
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
   }
   catch (...)
   {
-    LOG(ERROR) << "Unexpected error while reading: " << path;
+    LOG(ERROR) << "Unexpected error while reading: " << PathForLogs(path, deidentifyLogs_);
     return OrthancPluginErrorCode_StorageAreaPlugin;
   }
 
-  LOG(INFO) << "Advanced Storage - Read attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
+  if (isVerbose)
+  {
+    LOG(INFO) << "Advanced Storage - Read attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
+  }
 
   return OrthancPluginErrorCode_Success;
 }
@@ -270,19 +420,25 @@ OrthancPluginErrorCode StorageRemove(const char* uuid,
                                      const void* customData,
                                      uint32_t customDataSize) ORTHANC_NOEXCEPT
 {
+  AttachmentsCache::Invalidate(uuid);
+
   CustomData cd = CustomData::FromString(uuid, customData, customDataSize);
   boost::filesystem::path path = cd.GetAbsolutePath();
-  std::string pathUtf8Str = Orthanc::SystemToolbox::PathToUtf8(path);
 
-  std::string pathForLogs = Orthanc::SystemToolbox::PathToUtf8(path);
-  if (deidentifyLogs_) // we never know how the path was generated -> always deidentify
-  {
-    pathForLogs = "*** POTENTIAL PHI ***";
-  }
+  // we never know how the path was generated -> always deidentify
+  const bool isVerbose = LogsVerbosity::IsVerbose();
 
   if (!cd.IsOwner())
   {
-    LOG(INFO) << "NOT deleting attachment \"" << uuid << "\" of type " << static_cast<int>(type) << " (path = " << pathForLogs << ") since the file has been adopted.";
+    if (isVerbose)
+    {
+      LOG(INFO) << "NOT deleting attachment \"" << uuid << "\" of type " << static_cast<int>(type) << " (path = " << PathForLogs(path, deidentifyLogs_) << ") since the file has been adopted.";
+    }
+
+    // the file is not deleted, but it might be modified or replaced at the same path once abandoned
+    FileDescriptorsCache::Invalidate(path);
+
+    const std::string pathUtf8Str = Orthanc::SystemToolbox::PathToUtf8(path);
 
     // remove it from the adopted paths
     MarkAdoptedFileAsDeleted(pathUtf8Str);
@@ -297,6 +453,8 @@ OrthancPluginErrorCode StorageRemove(const char* uuid,
   {
     if (!cd.IsRelativePath()) // the file has been adopted and is now owned by Orthanc
     {
+      const std::string pathUtf8Str = Orthanc::SystemToolbox::PathToUtf8(path);
+
       // remove it from the adopted paths
       MarkAdoptedFileAsDeleted(pathUtf8Str);
 
@@ -313,22 +471,44 @@ OrthancPluginErrorCode StorageRemove(const char* uuid,
 
     try
     {
+      // the file must not be read through a cached descriptor anymore, whether it is deleted now or later
+      FileDescriptorsCache::Invalidate(path);
+
+      if (trashFilesDeleter_.get() != NULL &&
+          trashFilesDeleter_->MoveToTrash(path, cd.GetRootPath(), uuid))
+      {
+        if (isVerbose)
+        {
+          LOG(INFO) << "Moved attachment \"" << uuid << "\" of type " << static_cast<int>(type) << " to the trash (path = " << PathForLogs(path, deidentifyLogs_) << ")";
+        }
+
+        RemoveEmptyParentDirectories(path);
+        return OrthancPluginErrorCode_Success;
+      }
+
       {
         boost::mutex::scoped_lock lock(mutex_); // because we modify/access foldersIndexer and/or delayedDeletion pointer
 
         if (delayedFilesDeleter_.get() != NULL)
         {
-          LOG(INFO) << "Scheduling later deletion of attachment \"" << uuid << "\" of type " << static_cast<int>(type) << " (path = " << pathForLogs << ")";
-          delayedFilesDeleter_->ScheduleFileDeletion(pathUtf8Str);
+          if (isVerbose)
+          {
+            LOG(INFO) << "Scheduling later deletion of attachment \"" << uuid << "\" of type " << static_cast<int>(type) << " (path = " << PathForLogs(path, deidentifyLogs_) << ")";
+          }
+
+          delayedFilesDeleter_->ScheduleFileDeletion(Orthanc::SystemToolbox::PathToUtf8(path));
           return OrthancPluginErrorCode_Success;
         }
       }
 
-      LOG(INFO) << "Deleting attachment \"" << uuid << "\" of type " << static_cast<int>(type) << " (path = " << pathForLogs << ")";
+      if (isVerbose)
+      {
+        LOG(INFO) << "Deleting attachment \"" << uuid << "\" of type " << static_cast<int>(type) << " (path = " << PathForLogs(path, deidentifyLogs_) << ")";
+      }
 
-      fs::remove(path);
+      ioEngine_->RemoveFile(path);
 
-      // Remove the empty parent directories, (ignoring the error code if these directories are not empty)
+      // The parent directories are removed in the background, if they are empty
       RemoveEmptyParentDirectories(path);
     }
     catch (...)
@@ -365,6 +545,15 @@ static OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeTyp
     {
       case OrthancPluginChangeType_OrthancStarted:
       {
+        LogsVerbosity::Start();
+        DirectoriesPruner::Start();
+
+        if (trashFilesDeleter_.get() != NULL)
+        {
+          LOG(INFO) << "Starting Trash Files Deleter";
+          trashFilesDeleter_->Start();
+        }
+
         Json::Value system;
         if (OrthancPlugins::RestApiGet(system, "/system", false))
         {
@@ -435,6 +624,15 @@ static OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeTyp
           delayedFilesDeleter_->Stop();
           delayedFilesDeleter_.reset(NULL);
         }
+
+        if (trashFilesDeleter_.get() != NULL)
+        {
+          trashFilesDeleter_->Stop();
+        }
+
+        DirectoriesPruner::Stop();  // after the deleter, that schedules directories
+        readahead_.Stop();
+        LogsVerbosity::Stop();
       }; break;
       default:
         break;
@@ -714,14 +912,47 @@ extern "C"
     {
       boost::mutex::scoped_lock lock(mutex_); // because we modify/access foldersIndexer and delayedDeletion pointer
 
-      status[PLUGIN_STATUS_DELAYED_DELETION_ACTIVE] = delayedFilesDeleter_.get() != NULL;
+      status[PLUGIN_STATUS_DELAYED_DELETION_ACTIVE] = (delayedFilesDeleter_.get() != NULL || trashFilesDeleter_.get() != NULL);
       status[PLUGIN_STATUS_INDEXER_ACTIVE] = foldersIndexer_.get() != NULL;
+
+      if (foldersIndexer_.get() != NULL)
+      {
+        foldersIndexer_->GetStatistics(status[PLUGIN_STATUS_INDEXER]);
+      }
       
       if (delayedFilesDeleter_.get() != NULL)
       {
-        status[PLUGIN_STATUS_DELAYED_DELETION_PENDING_FILES] = Json::UInt64(delayedFilesDeleter_->GetPendingDeletionFilesCount());
+        delayedFilesDeleter_->GetStatistics(status[PLUGIN_STATUS_DELAYED_DELETION]);
+        status[PLUGIN_STATUS_DELAYED_DELETION_PENDING_FILES] = status[PLUGIN_STATUS_DELAYED_DELETION]["PendingFiles"];
+      }
+      else if (trashFilesDeleter_.get() != NULL)
+      {
+        trashFilesDeleter_->GetStatistics(status[PLUGIN_STATUS_DELAYED_DELETION]);
       }
     }
+
+    status[PLUGIN_STATUS_IO_ENGINE] = ioEngine_->GetName();
+    status[PLUGIN_STATUS_PENDING_EMPTY_DIRECTORIES] = static_cast<Json::UInt64>(DirectoriesPruner::GetPendingDirectoriesCount());
+
+    if (groupCommit_)
+    {
+      GroupCommitSync::GetAllStatistics(status[PLUGIN_STATUS_GROUP_COMMIT]);
+    }
+
+    if (readahead_.IsEnabled())
+    {
+      readahead_.GetStatistics(status[PLUGIN_STATUS_READAHEAD]);
+    }
+
+    if (AttachmentsCache::IsEnabled())
+    {
+      AttachmentsCache::GetStatistics(status[PLUGIN_STATUS_ATTACHMENTS_CACHE]);
+    }
+
+    if (AdaptiveThrottle::IsAdaptiveMode())
+    {
+      ForegroundLatency::GetStatistics(status[PLUGIN_STATUS_FOREGROUND_LATENCY]);
+    }
     
     OrthancPlugins::AnswerJson(status, output);
   }
@@ -823,6 +1054,108 @@ extern "C"
         LOG(WARNING) << "Maximum path length: " << maxPathLength;
         CustomData::SetMaxPathLength(maxPathLength);
 
+        std::string customDataFormat = advancedStorageConfiguration.GetStringValue(CONFIG_CUSTOM_DATA_FORMAT, "Json");
+        if (customDataFormat == "Binary")
+        {
+          LOG(WARNING) << "AdvancedStorage - The custom data of the new attachments are stored in the binary format";
+          CustomData::SetSerializationFormat(CustomDataFormat_Binary);
+        }
+        else if (customDataFormat == "Json")
+        {
+          CustomData::SetSerializationFormat(CustomDataFormat_Json);
+        }
+        else
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          std::string("Invalid value for \"") + CONFIG_CUSTOM_DATA_FORMAT + "\": " + customDataFormat + " (allowed values are \"Json\" and \"Binary\")");
+        }
+
+        size_t directoriesCacheSize = advancedStorageConfiguration.GetUnsignedIntegerValue(CONFIG_DIRECTORIES_CACHE_SIZE, 10000);
+        LOG(WARNING) << "Directories cache size: " << directoriesCacheSize;
+        DirectoriesCache::SetMaxSize(directoriesCacheSize);
+
+        size_t fileDescriptorsCacheSize = advancedStorageConfiguration.GetUnsignedIntegerValue(CONFIG_FILE_DESCRIPTORS_CACHE_SIZE, 256);
+        LOG(WARNING) << "File descriptors cache size: " << fileDescriptorsCacheSize;
+        FileDescriptorsCache::SetMaxSize(fileDescriptorsCacheSize);
+
+        unsigned int mmapThresholdMB = advancedStorageConfiguration.GetUnsignedIntegerValue(CONFIG_MMAP_THRESHOLD_MB, 0);
+        size_t mmapCacheSize = advancedStorageConfiguration.GetUnsignedIntegerValue(CONFIG_MMAP_CACHE_SIZE, 64);
+        if (mmapThresholdMB > 0)
+        {
+          if (fileDescriptorsCacheSize == 0)
+          {
+            LOG(WARNING) << "AdvancedStorage - \"" << CONFIG_MMAP_THRESHOLD_MB << "\" is ignored since \"" << CONFIG_FILE_DESCRIPTORS_CACHE_SIZE << "\" is 0";
+          }
+          else
+          {
+            LOG(WARNING) << "AdvancedStorage - The files of at least " << mmapThresholdMB << " MB are mapped in memory (at most " << mmapCacheSize << " files)";
+          }
+        }
+        FileDescriptorsCache::SetMapping(static_cast<uint64_t>(mmapThresholdMB) * 1024 * 1024, mmapCacheSize);
+
+        unsigned int attachmentsCacheSizeMB = advancedStorageConfiguration.GetUnsignedIntegerValue(CONFIG_ATTACHMENTS_CACHE_SIZE_MB, 0);
+        unsigned int attachmentsCacheMaxEntrySizeKB = advancedStorageConfiguration.GetUnsignedIntegerValue(CONFIG_ATTACHMENTS_CACHE_MAX_ENTRY_SIZE_KB, 256);
+        if (attachmentsCacheSizeMB > 0)
+        {
+          LOG(WARNING) << "AdvancedStorage - Attachments cache size: " << attachmentsCacheSizeMB << " MB (attachments of at most " << attachmentsCacheMaxEntrySizeKB << " KB)";
+        }
+        AttachmentsCache::SetMaxSize(static_cast<uint64_t>(attachmentsCacheSizeMB) * 1024 * 1024, static_cast<size_t>(attachmentsCacheMaxEntrySizeKB) * 1024);
+
+        std::string syncMode = advancedStorageConfiguration.GetStringValue(CONFIG_SYNC_MODE, "PerFile");
+        if (syncMode == "GroupCommit")
+        {
+          if (!fsyncOnWrite_)
+          {
+            LOG(WARNING) << "AdvancedStorage - \"" << CONFIG_SYNC_MODE << "\" is ignored since \"" << CONFIG_SYNC_STORAGE_AREA << "\" is false";
+          }
+          else if (!GroupCommitSync::IsSupported())
+          {
+            LOG(WARNING) << "AdvancedStorage - Group commit is not supported on this platform, each file will be synced individually";
+          }
+          else
+          {
+            groupCommit_ = true;
+            LOG(WARNING) << "AdvancedStorage - The files will be synced to disk by group commit";
+          }
+        }
+        else if (syncMode != "PerFile")
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          std::string("Invalid value for \"") + CONFIG_SYNC_MODE + "\": " + syncMode + " (allowed values are \"PerFile\" and \"GroupCommit\")");
+        }
+
+        std::string ioEngine = advancedStorageConfiguration.GetStringValue(CONFIG_IO_ENGINE, "Default");
+        if (ioEngine == "IoUring")
+        {
+#if ORTHANC_ENABLE_IO_URING == 1
+          try
+          {
+            // one ring per HTTP thread, the other concurrent callbacks use the default engine
+            ioEngine_.reset(new IoUringStorageIoEngine(orthancConfiguration.GetUnsignedIntegerValue(CONFIG_HTTP_THREADS_COUNT, 50)));
+            LOG(WARNING) << "AdvancedStorage - Using the io_uring I/O engine";
+          }
+          catch (Orthanc::OrthancException& e)
+          {
+            LOG(WARNING) << "AdvancedStorage - The io_uring I/O engine is not available, using the default I/O engine: " << e.What();
+          }
+#else
+          LOG(WARNING) << "AdvancedStorage - The plugin has been built without io_uring support, using the default I/O engine";
+#endif
+        }
+        else if (ioEngine != "Default")
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          std::string("Invalid value for \"") + CONFIG_IO_ENGINE + "\": " + ioEngine + " (allowed values are \"Default\" and \"IoUring\")");
+        }
+
+        const WritePolicy defaultWritePolicy(ParseWriteCachePolicy(advancedStorageConfiguration.GetStringValue(CONFIG_WRITE_CACHE_POLICY, "Buffered")),
+                                             advancedStorageConfiguration.GetBooleanValue(CONFIG_PREALLOCATE, false));
+        CustomData::SetDefaultWritePolicy(defaultWritePolicy);
+
+        const unsigned int defaultReadaheadFiles = advancedStorageConfiguration.GetUnsignedIntegerValue(CONFIG_READAHEAD_FILES, 0);
+        const unsigned int defaultReadaheadBudgetMB = advancedStorageConfiguration.GetUnsignedIntegerValue(CONFIG_READAHEAD_BUDGET_MB, 256);
+        readahead_.SetStoragePolicy(CustomData::GetOrthancCoreRootPath(), defaultReadaheadFiles, static_cast<uint64_t>(defaultReadaheadBudgetMB) * 1024 * 1024);
+
         if (pluginJson.isMember(CONFIG_MULTIPLE_STORAGES))
         {
           // multipleStoragesEnabled_ = true;
@@ -835,14 +1168,75 @@ extern "C"
 
             for (Json::Value::Members::const_iterator it = storageIds.begin(); it != storageIds.end(); ++it)
             {
-              if (!storagesJson[*it].isString())
+              const Json::Value& storageJson = storagesJson[*it];
+
+              if (storageJson.isString())
+              {
+                CustomData::SetStorageRootPath(*it, storageJson.asString(), defaultWritePolicy);
+                readahead_.SetStoragePolicy(CustomData::GetStorageRootPath(*it), defaultReadaheadFiles, static_cast<uint64_t>(defaultReadaheadBudgetMB) * 1024 * 1024);
+              }
+              else if (storageJson.isObject() &&
+                       storageJson.isMember(CONFIG_MULTIPLE_STORAGES_PATH) &&
+                       storageJson[CONFIG_MULTIPLE_STORAGES_PATH].isString())
+              {
+                WriteCachePolicy cachePolicy = defaultWritePolicy.GetCachePolicy();
+                bool preallocate = defaultWritePolicy.IsPreallocate();
+
+                if (storageJson.isMember(CONFIG_WRITE_CACHE_POLICY))
+                {
+                  if (!storageJson[CONFIG_WRITE_CACHE_POLICY].isString())
+                  {
+                    LOG(ERROR) << "Storage " << CONFIG_WRITE_CACHE_POLICY << " is not a string " << *it;
+                    return -1;
+                  }
+
+                  cachePolicy = ParseWriteCachePolicy(storageJson[CONFIG_WRITE_CACHE_POLICY].asString());
+                }
+
+                if (storageJson.isMember(CONFIG_PREALLOCATE))
+                {
+                  if (!storageJson[CONFIG_PREALLOCATE].isBool())
+                  {
+                    LOG(ERROR) << "Storage " << CONFIG_PREALLOCATE << " is not a boolean " << *it;
+                    return -1;
+                  }
+
+                  preallocate = storageJson[CONFIG_PREALLOCATE].asBool();
+                }
+
+                unsigned int readaheadFiles = defaultReadaheadFiles;
+                unsigned int readaheadBudgetMB = defaultReadaheadBudgetMB;
+
+                if (storageJson.isMember(CONFIG_READAHEAD_FILES))
+                {
+                  if (!storageJson[CONFIG_READAHEAD_FILES].isUInt())
+                  {
+                    LOG(ERROR) << "Storage " << CONFIG_READAHEAD_FILES << " is not a positive integer " << *it;
+                    return -1;
+                  }
+
+                  readaheadFiles = storageJson[CONFIG_READAHEAD_FILES].asUInt();
+                }
+
+                if (storageJson.isMember(CONFIG_READAHEAD_BUDGET_MB))
+                {
+                  if (!storageJson[CONFIG_READAHEAD_BUDGET_MB].isUInt())
+                  {
+                    LOG(ERROR) << "Storage " << CONFIG_READAHEAD_BUDGET_MB << " is not a positive integer " << *it;
+                    return -1;
+                  }
+
+                  readaheadBudgetMB = storageJson[CONFIG_READAHEAD_BUDGET_MB].asUInt();
+                }
+
+                CustomData::SetStorageRootPath(*it, storageJson[CONFIG_MULTIPLE_STORAGES_PATH].asString(), WritePolicy(cachePolicy, preallocate));
+                readahead_.SetStoragePolicy(CustomData::GetStorageRootPath(*it), readaheadFiles, static_cast<uint64_t>(readaheadBudgetMB) * 1024 * 1024);
+              }
+              else
               {
                 LOG(ERROR) << "Storage path is not a string " << *it;
                 return -1;
               }
-              fs::path storagePath = storagesJson[*it].asString();
-
-              CustomData::SetStorageRootPath(*it, storagesJson[*it].asString());
             }
 
             if (multipleStoragesJson.isMember(CONFIG_MULTIPLE_STORAGES_CURRENT_WRITE_STORAGE) && multipleStoragesJson[CONFIG_MULTIPLE_STORAGES_CURRENT_WRITE_STORAGE].isString())
@@ -863,6 +1257,57 @@ extern "C"
           }
         }
 
+        if (advancedStorageConfiguration.IsSection(CONFIG_ADAPTIVE_THROTTLING))
+        {
+          OrthancPlugins::OrthancConfiguration throttlingConfig;
+          advancedStorageConfiguration.GetSection(throttlingConfig, CONFIG_ADAPTIVE_THROTTLING);
+
+          if (throttlingConfig.GetBooleanValue(CONFIG_ADAPTIVE_THROTTLING_ENABLE, false))
+          {
+            unsigned int targetLatencyMs = throttlingConfig.GetUnsignedIntegerValue(CONFIG_ADAPTIVE_THROTTLING_TARGET_LATENCY_MS, 100);
+            unsigned int minDelayMs = throttlingConfig.GetUnsignedIntegerValue(CONFIG_ADAPTIVE_THROTTLING_MIN_DELAY_MS, 0);
+            unsigned int maxDelayMs = throttlingConfig.GetUnsignedIntegerValue(CONFIG_ADAPTIVE_THROTTLING_MAX_DELAY_MS, 1000);
+
+            std::vector<AdaptiveThrottle::TimeWindow> windows;
+
+            const Json::Value& windowsJson = throttlingConfig.GetJson()[CONFIG_ADAPTIVE_THROTTLING_TIME_WINDOWS];
+            if (windowsJson.isArray())
+            {
+              for (Json::ArrayIndex i = 0; i < windowsJson.size(); i++)
+              {
+                const Json::Value& windowJson = windowsJson[i];
+
+                if (!windowJson.isObject() ||
+                    !windowJson.isMember(CONFIG_ADAPTIVE_THROTTLING_FROM) ||
+                    !windowJson.isMember(CONFIG_ADAPTIVE_THROTTLING_TO) ||
+                    !windowJson[CONFIG_ADAPTIVE_THROTTLING_FROM].isString() ||
+                    !windowJson[CONFIG_ADAPTIVE_THROTTLING_TO].isString())
+                {
+                  LOG(ERROR) << "Each entry of \"" << CONFIG_ADAPTIVE_THROTTLING_TIME_WINDOWS << "\" must define \"" << CONFIG_ADAPTIVE_THROTTLING_FROM << "\" and \"" << CONFIG_ADAPTIVE_THROTTLING_TO << "\"";
+                  return -1;
+                }
+
+                AdaptiveThrottle::TimeWindow window;
+                window.fromMinute_ = AdaptiveThrottle::ParseTimeOfDay(windowJson[CONFIG_ADAPTIVE_THROTTLING_FROM].asString());
+                window.toMinute_ = AdaptiveThrottle::ParseTimeOfDay(windowJson[CONFIG_ADAPTIVE_THROTTLING_TO].asString());
+                window.targetLatencyMs_ = windowJson.get(CONFIG_ADAPTIVE_THROTTLING_TARGET_LATENCY_MS, targetLatencyMs).asUInt();
+                window.minDelayMs_ = windowJson.get(CONFIG_ADAPTIVE_THROTTLING_MIN_DELAY_MS, minDelayMs).asUInt();
+                window.maxDelayMs_ = std::max(window.minDelayMs_, windowJson.get(CONFIG_ADAPTIVE_THROTTLING_MAX_DELAY_MS, maxDelayMs).asUInt());
+                windows.push_back(window);
+              }
+            }
+            else if (!windowsJson.isNull())
+            {
+              LOG(ERROR) << "\"" << CONFIG_ADAPTIVE_THROTTLING_TIME_WINDOWS << "\" must be an array";
+              return -1;
+            }
+
+            LOG(WARNING) << "AdvancedStorage - The indexer and the delayed deletion are throttled to keep the p99 of the storage latency below "
+                         << targetLatencyMs << " ms (" << windows.size() << " time windows)";
+            AdaptiveThrottle::EnableAdaptiveMode(targetLatencyMs, minDelayMs, maxDelayMs, windows);
+          }
+        }
+
         if (advancedStorageConfiguration.IsSection(CONFIG_INDEXER))
         {
           OrthancPlugins::OrthancConfiguration indexerConfig;
@@ -877,6 +1322,19 @@ extern "C"
           unsigned int throttleDelayMs = indexerConfig.GetUnsignedIntegerValue(CONFIG_INDEXER_THROTTLE_DELAY_MS, 0 /* 0 ms seconds by default */);
           bool takeOwnership = indexerConfig.GetBooleanValue(CONFIG_INDEXER_TAKE_OWNERSHIP, false);
           bool enableVerboseLogs = indexerConfig.GetBooleanValue(CONFIG_INDEXER_ENABLE_VERBOSE_LOGS, false);
+          std::string indexerMode = indexerConfig.GetStringValue(CONFIG_INDEXER_MODE, "Polling");
+          unsigned int fullRescanIntervalSeconds = indexerConfig.GetUnsignedIntegerValue(CONFIG_INDEXER_FULL_RESCAN_INTERVAL, 86400 /* once a day by default */);
+          unsigned int walkerThreads = indexerConfig.GetUnsignedIntegerValue(CONFIG_INDEXER_WALKER_THREADS, 1);
+          unsigned int maxWalkerThreadsPerFolder = indexerConfig.GetUnsignedIntegerValue(CONFIG_INDEXER_MAX_WALKER_THREADS_PER_FOLDER, 0 /* no limit */);
+          IndexSnapshot::Mode inMemoryIndex = IndexSnapshot::ParseMode(indexerConfig.GetStringValue(CONFIG_INDEXER_IN_MEMORY_INDEX, "None"));
+          bool skipUnchangedFolders = indexerConfig.GetBooleanValue(CONFIG_INDEXER_SKIP_UNCHANGED_FOLDERS, false);
+          unsigned int fullVerificationPasses = indexerConfig.GetUnsignedIntegerValue(CONFIG_INDEXER_FULL_VERIFICATION_PASSES, 10);
+
+            if (indexerMode != "Polling" && indexerMode != "Events")
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                              std::string("Invalid value for \"") + CONFIG_INDEXER_MODE + "\": " + indexerMode + " (allowed values are \"Polling\" and \"Events\")");
+            }
 
             if (!indexerConfig.LookupListOfStrings(indexedFolders, CONFIG_INDEXER_FOLDERS, true) ||
                 indexedFolders.empty())
@@ -899,6 +1357,19 @@ extern "C"
     
           boost::mutex::scoped_lock lock(mutex_); // because we modify/access foldersIndexer and delayedDeletion pointer
           foldersIndexer_.reset(new FoldersIndexer(indexedFolders, indexerIntervalSeconds, throttleDelayMs, parsedExtensions, skippedExtensions, takeOwnership, enableVerboseLogs));
+
+          foldersIndexer_->SetWalkerThreads(walkerThreads, maxWalkerThreadsPerFolder);
+          foldersIndexer_->SetInMemoryIndex(inMemoryIndex);
+
+          if (skipUnchangedFolders)
+          {
+            foldersIndexer_->SetSkipUnchangedFolders(fullVerificationPasses);
+          }
+
+          if (indexerMode == "Events")
+          {
+            foldersIndexer_->SetEventsMode(fullRescanIntervalSeconds);
+          }
         }
         else
         {
@@ -914,11 +1385,26 @@ extern "C"
           if (delayedDeletionConfig.GetBooleanValue(CONFIG_DELAYED_DELETION_ENABLE, false))
           {
             unsigned int throttleDelayMs = delayedDeletionConfig.GetUnsignedIntegerValue(CONFIG_DELAYED_DELETION_THROTTLE_DELAY_MS, 0 /* 0 ms seconds by default */);
+            unsigned int threadsCount = delayedDeletionConfig.GetUnsignedIntegerValue(CONFIG_DELAYED_DELETION_THREADS, 1);
+            const std::string mode = delayedDeletionConfig.GetStringValue(CONFIG_DELAYED_DELETION_MODE, "Queue");
 
-            LOG(WARNING) << "creating DelayedDeleter";
-    
-            boost::mutex::scoped_lock lock(mutex_); // because we modify/access foldersIndexer and delayedDeletion pointer
-            delayedFilesDeleter_.reset(new DelayedFilesDeleter(throttleDelayMs));
+            if (mode == "Trash")
+            {
+              LOG(WARNING) << "creating TrashDeleter (" << threadsCount << " threads)";
+              trashFilesDeleter_.reset(new TrashFilesDeleter(throttleDelayMs, threadsCount));
+            }
+            else if (mode == "Queue")
+            {
+              LOG(WARNING) << "creating DelayedDeleter (" << threadsCount << " threads)";
+
+              boost::mutex::scoped_lock lock(mutex_); // because we modify/access foldersIndexer and delayedDeletion pointer
+              delayedFilesDeleter_.reset(new DelayedFilesDeleter(throttleDelayMs, threadsCount));
+            }
+            else
+            {
+              LOG(ERROR) << "Invalid value for " << CONFIG_DELAYED_DELETION_MODE << ": \"" << mode << "\" (must be \"Queue\" or \"Trash\")";
+              return -1;
+            }
           }
           else
           {
@@ -926,6 +1412,19 @@ extern "C"
           }
         }
 
+        if (readahead_.IsEnabled())
+        {
+          if (SequentialReadahead::IsSupported())
+          {
+            LOG(WARNING) << "AdvancedStorage - The files that are read sequentially in a folder are read ahead";
+            readahead_.Start();
+          }
+          else
+          {
+            LOG(WARNING) << "AdvancedStorage - \"" << CONFIG_READAHEAD_FILES << "\" is ignored since the readahead is not supported on this platform";
+          }
+        }
+
         OrthancPluginRegisterStorageArea3(context, StorageCreate, StorageReadRange, StorageRemove);
 
         OrthancPlugins::RegisterRestCallback<GetAttachmentInfo>("/(studies|series|instances|patients)/([^/]+)/attachments/(.*)/info", true);
@@ -951,6 +1450,17 @@ extern "C"
   ORTHANC_PLUGINS_API void OrthancPluginFinalize()
   {
     LOG(WARNING) << "AdvancedStorage plugin is finalizing";
+    if (trashFilesDeleter_.get() != NULL)
+    {
+      trashFilesDeleter_->Stop();
+      trashFilesDeleter_.reset(NULL);
+    }
+
+    DirectoriesPruner::Stop();
+    readahead_.Stop();
+    DirectoriesCache::Clear();
+    FileDescriptorsCache::Clear();
+    LogsVerbosity::Stop();
   }
 
 
@@ -0,0 +1,472 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "SequentialReadahead.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Compatibility.h>
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+
+#if defined(__linux__)
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+  static const size_t MAX_DIRECTORIES = 1024;              // the directories whose access pattern is tracked
+  static const size_t MAX_PENDING_JOBS = 64;
+  static const unsigned int SEQUENTIAL_READS_THRESHOLD = 2;  // consecutive moves in the same direction
+  static const time_t PREFETCH_EXPIRATION_SECONDS = 60;     // a prefetched file that is not read by then is considered as evicted
+  static const time_t LISTING_VALIDITY_SECONDS = 10;
+
+
+  SequentialReadahead::SequentialReadahead() :
+    isRunning_(false)
+  {
+  }
+
+
+  SequentialReadahead::~SequentialReadahead()
+  {
+    Stop();
+
+    for (Storages::iterator it = storages_.begin(); it != storages_.end(); ++it)
+    {
+      delete it->second;
+    }
+  }
+
+
+  void SequentialReadahead::SetStoragePolicy(const fs::path& rootPath,
+                                             unsigned int files,
+                                             uint64_t budgetBytes)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const std::string root = rootPath.string();
+
+    Storages::iterator found = storages_.find(root);
+    if (found != storages_.end())
+    {
+      delete found->second;
+      storages_.erase(found);
+    }
+
+    if (files > 0 && budgetBytes > 0)
+    {
+      std::unique_ptr<Storage> storage(new Storage);
+      storage->files_ = files;
+      storage->budget_ = budgetBytes;
+      storage->pendingBytes_ = 0;
+      storage->hits_ = 0;
+      storage->misses_ = 0;
+      storage->prefetchedFiles_ = 0;
+      storage->prefetchedBytes_ = 0;
+      storage->skippedFiles_ = 0;
+
+      storages_[root] = storage.release();
+    }
+  }
+
+
+  bool SequentialReadahead::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return !storages_.empty();
+  }
+
+
+  void SequentialReadahead::Worker(SequentialReadahead* that)
+  {
+    OrthancPluginSetCurrentThreadName(OrthancPlugins::GetGlobalContext(), "READAHEAD");
+
+    that->WorkerThread();
+  }
+
+
+  void SequentialReadahead::Start()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!isRunning_)
+    {
+      isRunning_ = true;
+      thread_ = boost::thread(Worker, this);
+    }
+  }
+
+
+  void SequentialReadahead::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isRunning_ = false;
+      jobAvailable_.notify_all();
+    }
+
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+  }
+
+
+  void SequentialReadahead::NotifyRead(const fs::path& rootPath,
+                                       const fs::path& path)
+  {
+    if (rootPath.empty())
+    {
+      return;
+    }
+
+    const std::string root = rootPath.string();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Storages::iterator storage = storages_.find(root);
+    if (storage == storages_.end() ||
+        !isRunning_)
+    {
+      return;
+    }
+
+    const std::string absolutePath = path.string();
+    const std::string directory = path.parent_path().string();
+    const std::string file = path.filename().string();
+
+    bool isHit = false;
+
+    std::map<std::string, Prefetched>::iterator prefetched = storage->second->prefetched_.find(absolutePath);
+    if (prefetched != storage->second->prefetched_.end())
+    {
+      isHit = true;
+      storage->second->hits_++;
+      storage->second->pendingBytes_ -= prefetched->second.size_;
+      storage->second->prefetched_.erase(prefetched);
+    }
+
+    std::map<std::string, Directory>::iterator found = directories_.find(directory);
+
+    if (found == directories_.end())
+    {
+      Directory d;
+      d.lastFile_ = file;
+      d.direction_ = 0;
+      d.sequentialReads_ = 0;
+      directories_[directory] = d;
+      directoriesOrder_.Add(directory);
+
+      while (directoriesOrder_.GetSize() > MAX_DIRECTORIES)
+      {
+        directories_.erase(directoriesOrder_.RemoveOldest());
+      }
+
+      return;
+    }
+
+    directoriesOrder_.MakeMostRecent(directory);
+
+    Directory& d = found->second;
+
+    if (d.lastFile_ == file)
+    {
+      return;  // another range of the same file
+    }
+
+    const int direction = (file > d.lastFile_ ? 1 : -1);
+    if (direction == d.direction_)
+    {
+      d.sequentialReads_++;
+    }
+    else
+    {
+      d.direction_ = direction;
+      d.sequentialReads_ = 1;
+    }
+
+    d.lastFile_ = file;
+
+    if (d.sequentialReads_ >= SEQUENTIAL_READS_THRESHOLD)
+    {
+      if (!isHit)
+      {
+        storage->second->misses_++;
+      }
+
+      Job job;
+      job.root_ = root;
+      job.directory_ = path.parent_path();
+      job.file_ = file;
+      job.direction_ = direction;
+
+      if (jobs_.size() >= MAX_PENDING_JOBS)
+      {
+        jobs_.pop_front();  // the readahead is late: the oldest requests are the least useful
+      }
+
+      jobs_.push_back(job);
+      jobAvailable_.notify_one();
+    }
+  }
+
+
+  void SequentialReadahead::ExpirePrefetchedFiles(Storage& storage,
+                                                  time_t now)
+  {
+    std::map<std::string, Prefetched>::iterator it = storage.prefetched_.begin();
+
+    while (it != storage.prefetched_.end())
+    {
+      if (now - it->second.time_ >= PREFETCH_EXPIRATION_SECONDS)
+      {
+        storage.pendingBytes_ -= it->second.size_;
+        storage.prefetched_.erase(it++);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+
+
+  void SequentialReadahead::Prefetch(const Job& job,
+                                     const std::vector<std::string>& sortedFiles)
+  {
+#if defined(__linux__)
+    std::vector<std::string> candidates;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Storages::iterator storage = storages_.find(job.root_);
+      if (storage == storages_.end())
+      {
+        return;
+      }
+
+      ExpirePrefetchedFiles(*storage->second, time(NULL));
+
+      if (job.direction_ > 0)
+      {
+        std::vector<std::string>::const_iterator it = std::upper_bound(sortedFiles.begin(), sortedFiles.end(), job.file_);
+        for (; it != sortedFiles.end() && candidates.size() < storage->second->files_; ++it)
+        {
+          candidates.push_back(*it);
+        }
+      }
+      else
+      {
+        std::vector<std::string>::const_iterator it = std::lower_bound(sortedFiles.begin(), sortedFiles.end(), job.file_);
+        while (it != sortedFiles.begin() && candidates.size() < storage->second->files_)
+        {
+          --it;
+          candidates.push_back(*it);
+        }
+      }
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+      const std::string path = (job.directory_ / candidates[i]).string();
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        Storages::iterator storage = storages_.find(job.root_);
+        if (!isRunning_ ||
+            storage == storages_.end())
+        {
+          return;
+        }
+
+        if (storage->second->prefetched_.find(path) != storage->second->prefetched_.end())
+        {
+          continue;  // already in the window
+        }
+      }
+
+      int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+      if (fd < 0 && errno == EPERM)
+      {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);  // O_NOATIME is only allowed to the owner of the file
+      }
+
+      if (fd < 0)
+      {
+        continue;  // e.g. removed in the meantime
+      }
+
+      struct stat info;
+      if (fstat(fd, &info) == 0 &&
+          S_ISREG(info.st_mode))
+      {
+        const uint64_t size = static_cast<uint64_t>(info.st_size);
+        bool accepted = false;
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          Storages::iterator storage = storages_.find(job.root_);
+          if (storage != storages_.end())
+          {
+            if (storage->second->pendingBytes_ + size <= storage->second->budget_)
+            {
+              Prefetched p;
+              p.size_ = size;
+              p.time_ = time(NULL);
+              storage->second->prefetched_[path] = p;
+              storage->second->pendingBytes_ += size;
+              storage->second->prefetchedFiles_++;
+              storage->second->prefetchedBytes_ += size;
+              accepted = true;
+            }
+            else
+            {
+              storage->second->skippedFiles_++;
+            }
+          }
+        }
+
+        if (accepted)
+        {
+          // asynchronous: this starts the reads and returns
+          posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        }
+        else
+        {
+          close(fd);
+          return;  // the budget is exhausted, the farthest files are the least useful
+        }
+      }
+
+      close(fd);
+    }
+#endif
+  }
+
+
+  void SequentialReadahead::WorkerThread()
+  {
+    // the sorted content of the last directory, to avoid listing it again for the next files of the same series
+    std::string listedDirectory;
+    std::vector<std::string> listedFiles;
+    time_t listingTime = 0;
+
+    for (;;)
+    {
+      Job job;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        while (isRunning_ && jobs_.empty())
+        {
+          jobAvailable_.wait(lock);
+        }
+
+        if (!isRunning_)
+        {
+          return;
+        }
+
+        job = jobs_.front();
+        jobs_.pop_front();
+      }
+
+      const std::string directory = job.directory_.string();
+      const time_t now = time(NULL);
+
+      if (directory != listedDirectory ||
+          now - listingTime >= LISTING_VALIDITY_SECONDS)
+      {
+        listedDirectory = directory;
+        listedFiles.clear();
+        listingTime = now;
+
+        try
+        {
+          for (fs::directory_iterator it(job.directory_); it != fs::directory_iterator(); ++it)
+          {
+            listedFiles.push_back(it->path().filename().string());
+          }
+        }
+        catch (fs::filesystem_error&)
+        {
+          listedFiles.clear();  // e.g. removed in the meantime
+        }
+
+        std::sort(listedFiles.begin(), listedFiles.end());
+      }
+
+      try
+      {
+        Prefetch(job, listedFiles);
+      }
+      catch (...)
+      {
+        // the readahead is only a hint
+      }
+    }
+  }
+
+
+  void SequentialReadahead::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+
+    for (Storages::const_iterator it = storages_.begin(); it != storages_.end(); ++it)
+    {
+      const Storage& storage = *it->second;
+
+      Json::Value& s = target[it->first];
+      s["Hits"] = static_cast<Json::UInt64>(storage.hits_);
+      s["Misses"] = static_cast<Json::UInt64>(storage.misses_);
+      s["HitRatio"] = (storage.hits_ + storage.misses_ == 0 ? 0.0 :
+                       static_cast<double>(storage.hits_) / static_cast<double>(storage.hits_ + storage.misses_));
+      s["PrefetchedFiles"] = static_cast<Json::UInt64>(storage.prefetchedFiles_);
+      s["PrefetchedMB"] = static_cast<double>(storage.prefetchedBytes_) / (1024.0 * 1024.0);
+      s["SkippedFiles"] = static_cast<Json::UInt64>(storage.skippedFiles_);
+      s["PendingMB"] = static_cast<double>(storage.pendingBytes_) / (1024.0 * 1024.0);
+      s["BudgetMB"] = static_cast<double>(storage.budget_) / (1024.0 * 1024.0);
+    }
+  }
+
+
+  bool SequentialReadahead::IsSupported()
+  {
+#if defined(__linux__)
+    return true;
+#else
+    return false;
+#endif
+  }
+}
@@ -0,0 +1,126 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <Cache/LeastRecentlyUsedIndex.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <json/value.h>
+
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <time.h>
+
+
+namespace OrthancPlugins
+{
+  // Detects the files of a directory that are read one after the other (e.g. a viewer scrolling
+  // through a series stored in one folder by the NamingScheme) and asks the kernel to read the
+  // next files of the directory in the background (posix_fadvise(WILLNEED)), so that they are in
+  // the page cache when Orthanc reads them.  The bytes that have been prefetched but not read yet
+  // are bounded per storage.  Linux only.
+  class SequentialReadahead : public boost::noncopyable
+  {
+    struct Prefetched
+    {
+      uint64_t  size_;
+      time_t    time_;
+    };
+
+    struct Storage
+    {
+      unsigned int                       files_;
+      uint64_t                           budget_;
+      uint64_t                           pendingBytes_;
+      std::map<std::string, Prefetched>  prefetched_;  // by absolute path
+
+      // statistics
+      uint64_t                           hits_;
+      uint64_t                           misses_;
+      uint64_t                           prefetchedFiles_;
+      uint64_t                           prefetchedBytes_;
+      uint64_t                           skippedFiles_;  // because of the budget
+    };
+
+    struct Directory
+    {
+      std::string   lastFile_;
+      int           direction_;
+      unsigned int  sequentialReads_;
+    };
+
+    struct Job
+    {
+      std::string              root_;
+      boost::filesystem::path  directory_;
+      std::string              file_;
+      int                      direction_;
+    };
+
+    typedef std::map<std::string, Storage*>  Storages;
+
+    boost::mutex                                 mutex_;
+    boost::condition_variable                    jobAvailable_;
+    Storages                                     storages_;  // by root path
+    std::map<std::string, Directory>             directories_;
+    Orthanc::LeastRecentlyUsedIndex<std::string> directoriesOrder_;
+    std::deque<Job>                              jobs_;
+    bool                                         isRunning_;
+    boost::thread                                thread_;
+
+    void ExpirePrefetchedFiles(Storage& storage,
+                               time_t now);
+
+    void Prefetch(const Job& job,
+                  const std::vector<std::string>& sortedFiles);
+
+    void WorkerThread();
+
+    static void Worker(SequentialReadahead* that);
+
+  public:
+    SequentialReadahead();
+
+    ~SequentialReadahead();
+
+    // "files" is the number of files that are read ahead (0 disables the readahead in this storage)
+    void SetStoragePolicy(const boost::filesystem::path& rootPath,
+                          unsigned int files,
+                          uint64_t budgetBytes);
+
+    bool IsEnabled();
+
+    void Start();
+
+    void Stop();
+
+    // To be called before reading a file of the storage (an empty root means an adopted file)
+    void NotifyRead(const boost::filesystem::path& rootPath,
+                    const boost::filesystem::path& path);
+
+    void GetStatistics(Json::Value& target);
+
+    // posix_fadvise() is only used on Linux
+    static bool IsSupported();
+  };
+}
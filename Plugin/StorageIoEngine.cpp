@@ -0,0 +1,156 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StorageIoEngine.h"
+#include "AtomicFileWriter.h"
+#include "FileDescriptorsCache.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/filesystem/fstream.hpp>
+
+#if !defined(_WIN32)
+#  include <errno.h>
+#  include <string.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+  bool DefaultStorageIoEngine::WriteNewFile(const fs::path& path,
+                                            const void* content,
+                                            size_t size,
+                                            bool fsync,
+                                            const WritePolicy& policy)
+  {
+    return AtomicFileWriter::WriteNewFile(path, content, size, fsync, policy);
+  }
+
+
+  uint64_t DefaultStorageIoEngine::ReadRange(void* target,
+                                             uint64_t size,
+                                             const fs::path& path,
+                                             uint64_t start,
+                                             bool mappable)
+  {
+#if !defined(_WIN32)
+    // the descriptor is kept open across the reads of the same file, so that a warm read is a single pread()
+    FileDescriptorsCache::Accessor file(path, mappable);
+
+    if (start + size > file.GetFileSize())
+    {
+      FileDescriptorsCache::Invalidate(path);
+      LOG(ERROR) << "Trying to read beyond the end of the file: " << path;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_StorageAreaPlugin);
+    }
+
+    if (mappable &&
+        file.GetMapping() != NULL &&
+        size < file.GetFileSize())
+    {
+      // a range of a large mapped file (e.g. a frame of a whole-slide image): start reading all its pages
+      // at once, since the mapping is advised as random (the whole files are still read with pread())
+      static const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+      const uint64_t pageStart = start - start % pageSize;
+      madvise(const_cast<uint8_t*>(file.GetMapping()) + pageStart, static_cast<size_t>(start + size - pageStart), MADV_WILLNEED);
+
+      memcpy(target, file.GetMapping() + start, static_cast<size_t>(size));
+      return file.GetFileSize();
+    }
+
+    char* position = reinterpret_cast<char*>(target);
+    uint64_t remaining = size;
+    uint64_t offset = start;
+
+    while (remaining > 0)
+    {
+      ssize_t count = pread(file.GetDescriptor(), position, static_cast<size_t>(remaining), static_cast<off_t>(offset));
+
+      if (count < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      else if (count <= 0)
+      {
+        // the file has been truncated behind our back, don't trust the cached descriptor for the next attempt
+        FileDescriptorsCache::Invalidate(path);
+
+        LOG(ERROR) << "Unexpected error while reading: " << path;
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_StorageAreaPlugin);
+      }
+
+      position += count;
+      offset += static_cast<uint64_t>(count);
+      remaining -= static_cast<uint64_t>(count);
+    }
+
+    return file.GetFileSize();
+#else
+    if (!Orthanc::SystemToolbox::IsRegularFile(path))
+    {
+      LOG(ERROR) << "The path does not point to a regular file: " << path;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile);
+    }
+
+    try
+    {
+      fs::ifstream f;
+      f.open(path, std::ifstream::in | std::ifstream::binary);
+      if (!f.good())
+      {
+        LOG(ERROR) << "The path does not point to a regular file: " << path;
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile);
+      }
+
+      f.seekg(0, std::ios::end);
+      const uint64_t fileSize = static_cast<uint64_t>(f.tellg());
+
+      f.seekg(start, std::ios::beg);
+
+      // The ReadRange uses a target that has already been allocated by orthanc
+      f.read(reinterpret_cast<char*>(target), size);
+
+      f.close();
+
+      return fileSize;
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      throw;
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "Unexpected error while reading: " << path;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_StorageAreaPlugin);
+    }
+#endif
+  }
+
+
+  void DefaultStorageIoEngine::RemoveFile(const fs::path& path)
+  {
+    fs::remove(path);
+  }
+}
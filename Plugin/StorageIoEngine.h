@@ -0,0 +1,89 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "WritePolicy.h"
+
+#include <Compatibility.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+
+
+namespace OrthancPlugins
+{
+  // The file system operations performed by the storage area callbacks
+  class IStorageIoEngine : public boost::noncopyable
+  {
+  public:
+    virtual ~IStorageIoEngine()
+    {
+    }
+
+    virtual const char* GetName() const = 0;
+
+    // Returns false (and writes nothing) if the path already exists.
+    // Throws ErrorCode_CannotWriteFile on I/O errors (including a missing parent directory).
+    virtual bool WriteNewFile(const boost::filesystem::path& path,
+                              const void* content,
+                              size_t size,
+                              bool fsync,
+                              const WritePolicy& policy) = 0;
+
+    // Fills the whole target buffer with the content of the file starting at "start".
+    // "mappable" is false if the file is not owned by the plugin (cf. FileDescriptorsCache).
+    // Returns the size of the whole file (0 if unknown), so that the caller does not need another stat().
+    // Throws ErrorCode_InexistentFile or ErrorCode_StorageAreaPlugin.
+    virtual uint64_t ReadRange(void* target,
+                               uint64_t size,
+                               const boost::filesystem::path& path,
+                               uint64_t start,
+                               bool mappable) = 0;
+
+    // A missing file is not an error
+    virtual void RemoveFile(const boost::filesystem::path& path) = 0;
+  };
+
+
+  // Blocking system calls, this is the historical behavior of the plugin
+  class DefaultStorageIoEngine : public IStorageIoEngine
+  {
+  public:
+    virtual const char* GetName() const ORTHANC_OVERRIDE
+    {
+      return "Default";
+    }
+
+    virtual bool WriteNewFile(const boost::filesystem::path& path,
+                              const void* content,
+                              size_t size,
+                              bool fsync,
+                              const WritePolicy& policy) ORTHANC_OVERRIDE;
+
+    virtual uint64_t ReadRange(void* target,
+                               uint64_t size,
+                               const boost::filesystem::path& path,
+                               uint64_t start,
+                               bool mappable) ORTHANC_OVERRIDE;
+
+    virtual void RemoveFile(const boost::filesystem::path& path) ORTHANC_OVERRIDE;
+  };
+}
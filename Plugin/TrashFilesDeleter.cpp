@@ -0,0 +1,296 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "TrashFilesDeleter.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "CustomData.h"
+
+#include <Logging.h>
+#include <SystemToolbox.h>
+
+#include <boost/lexical_cast.hpp>
+#include <time.h>
+
+
+namespace fs = boost::filesystem;
+
+namespace OrthancPlugins
+{
+  static const char* TRASH_FOLDER = ".trash";
+  static const time_t EPOCH_SECONDS = 60;
+  static const uint64_t CLOSED_EPOCH_MARGIN = 2;   // an epoch is only reaped once no file can be moved into it anymore
+  static const unsigned int REAPING_INTERVAL_SECONDS = 10;
+
+
+  static uint64_t GetCurrentEpoch()
+  {
+    return static_cast<uint64_t>(time(NULL) / EPOCH_SECONDS);
+  }
+
+
+  fs::path TrashFilesDeleter::GetTrashFolder(const fs::path& rootPath)
+  {
+    return rootPath / TRASH_FOLDER;
+  }
+
+
+  TrashFilesDeleter::TrashFilesDeleter(unsigned int throttleDelayMs,
+                                       unsigned int threadsCount) :
+    throttle_(throttleDelayMs),
+    threadsCount_(std::max(1u, threadsCount)),
+    isRunning_(false),
+    trashedFiles_(0),
+    deletedFiles_(0),
+    failedMoves_(0),
+    pendingEpochs_(0)
+  {
+  }
+
+
+  TrashFilesDeleter::~TrashFilesDeleter()
+  {
+    Stop();
+  }
+
+
+  static void TrashFilesDeleterReaperThread(TrashFilesDeleter* deleter)
+  {
+    OrthancPluginSetCurrentThreadName(OrthancPlugins::GetGlobalContext(), "TRASH-REAPER");
+
+    deleter->ReaperThread();
+  }
+
+
+  void TrashFilesDeleter::Start()
+  {
+    isRunning_ = true;
+    reaperThread_ = boost::thread(TrashFilesDeleterReaperThread, this);
+  }
+
+
+  void TrashFilesDeleter::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isRunning_ = false;
+      stopped_.notify_all();
+    }
+
+    if (reaperThread_.joinable())
+    {
+      reaperThread_.join();
+    }
+  }
+
+
+  bool TrashFilesDeleter::MoveToTrash(const fs::path& path,
+                                      const fs::path& rootPath,
+                                      const std::string& uuid)
+  {
+    if (rootPath.empty())
+    {
+      return false;  // an adopted file, outside of the storages
+    }
+
+    const uint64_t epoch = GetCurrentEpoch();
+    const fs::path epochFolder = GetTrashFolder(rootPath) / boost::lexical_cast<std::string>(epoch);
+
+    boost::system::error_code ec;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      // the epoch folder is only created once per epoch and per storage
+      std::map<fs::path, uint64_t>::iterator found = createdEpochs_.find(rootPath);
+      if (found == createdEpochs_.end() ||
+          found->second != epoch)
+      {
+        fs::create_directories(epochFolder, ec);
+        if (ec)
+        {
+          failedMoves_++;
+          return false;
+        }
+
+        createdEpochs_[rootPath] = epoch;
+      }
+    }
+
+    // the attachment UUID is unique, the files in the trash never collide
+    fs::rename(path, epochFolder / uuid, ec);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (ec)
+    {
+      failedMoves_++;
+      return false;
+    }
+    else
+    {
+      trashedFiles_++;
+      return true;
+    }
+  }
+
+
+  void TrashFilesDeleter::ReaperWorker(const std::vector<fs::path>* entries,
+                                       boost::atomic<size_t>* next,
+                                       size_t storageNumber)
+  {
+    for (;;)
+    {
+      const size_t index = next->fetch_add(1);
+
+      if (!isRunning_ ||
+          index >= entries->size())
+      {
+        return;
+      }
+
+      boost::system::error_code ec;
+      const uint64_t count = fs::remove_all((*entries)[index], ec);
+
+      if (ec)
+      {
+        LOG(WARNING) << "Advanced Storage - Could not remove a file from the trash: " << ec.message();
+      }
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        deletedFiles_ += count;
+      }
+
+      throttle_.Sleep(storageNumber);
+    }
+  }
+
+
+  void TrashFilesDeleter::ReapEpoch(const fs::path& epochFolder)
+  {
+    std::vector<fs::path> entries;
+
+    boost::system::error_code ec;
+    for (fs::directory_iterator it(epochFolder, ec), end; !ec && it != end; it.increment(ec))
+    {
+      entries.push_back(it->path());
+    }
+
+    boost::atomic<size_t> next(0);
+
+    // the deletions are only slowed down by the foreground calls on the storage of this trash
+    const size_t storageNumber = CustomData::FindStorageNumber(epochFolder);
+
+    if (threadsCount_ == 1 ||
+        entries.size() <= 1)
+    {
+      ReaperWorker(&entries, &next, storageNumber);
+    }
+    else
+    {
+      boost::thread_group workers;
+
+      for (unsigned int i = 0; i < threadsCount_; i++)
+      {
+        workers.create_thread(boost::bind(&TrashFilesDeleter::ReaperWorker, this, &entries, &next, storageNumber));
+      }
+
+      workers.join_all();
+    }
+
+    if (isRunning_)
+    {
+      fs::remove(epochFolder, ec);  // fails if a file could not be removed, it will be tried again
+    }
+  }
+
+
+  void TrashFilesDeleter::ReapClosedEpochs()
+  {
+    std::vector<fs::path> roots;
+    CustomData::GetAllRootPaths(roots);
+
+    const uint64_t currentEpoch = GetCurrentEpoch();
+    std::vector<fs::path> closedEpochs;
+    size_t pendingEpochs = 0;
+
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+      const fs::path trashFolder = GetTrashFolder(roots[i]);
+
+      boost::system::error_code ec;
+      for (fs::directory_iterator it(trashFolder, ec), end; !ec && it != end; it.increment(ec))
+      {
+        uint64_t epoch;
+        if (!boost::conversion::try_lexical_convert(it->path().filename().string(), epoch))
+        {
+          continue;  // not created by the plugin
+        }
+
+        pendingEpochs++;
+
+        if (epoch + CLOSED_EPOCH_MARGIN <= currentEpoch)
+        {
+          closedEpochs.push_back(it->path());
+        }
+      }
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      pendingEpochs_ = pendingEpochs;
+    }
+
+    for (size_t i = 0; i < closedEpochs.size() && isRunning_; i++)
+    {
+      LOG(INFO) << "Advanced Storage - Emptying the trash folder " << Orthanc::SystemToolbox::PathToUtf8(closedEpochs[i]);
+      ReapEpoch(closedEpochs[i]);
+    }
+  }
+
+
+  void TrashFilesDeleter::ReaperThread()
+  {
+    while (isRunning_)
+    {
+      ReapClosedEpochs();
+
+      boost::mutex::scoped_lock lock(mutex_);
+      if (isRunning_)
+      {
+        stopped_.timed_wait(lock, boost::posix_time::seconds(REAPING_INTERVAL_SECONDS));
+      }
+    }
+  }
+
+
+  void TrashFilesDeleter::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["Threads"] = threadsCount_;
+    target["ThrottleDelayMs"] = throttle_.GetCurrentDelayMs();
+    target["TrashedFiles"] = static_cast<Json::UInt64>(trashedFiles_);
+    target["DeletedFiles"] = static_cast<Json::UInt64>(deletedFiles_);
+    target["FailedMoves"] = static_cast<Json::UInt64>(failedMoves_);
+    target["TrashEpochs"] = static_cast<Json::UInt64>(pendingEpochs_);
+  }
+}
@@ -0,0 +1,88 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "AdaptiveThrottle.h"
+
+#include <boost/atomic.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <json/value.h>
+
+#include <map>
+#include <stdint.h>
+
+
+namespace OrthancPlugins
+{
+  // The "Trash" mode of the delayed deletion: the deleted files are renamed into the
+  // "<storage root>/.trash/<epoch>/" folder (a single rename on the same filesystem, without any
+  // access to the Orthanc DB) and a reaper thread removes the trash folders of the previous
+  // epochs.  Since the trash is on disk, the reaping simply resumes after a restart.
+  class TrashFilesDeleter : public boost::noncopyable
+  {
+    AdaptiveThrottle                    throttle_;
+    unsigned int                        threadsCount_;
+
+    volatile bool                       isRunning_;
+    boost::thread                       reaperThread_;
+
+    boost::mutex                        mutex_;
+    boost::condition_variable           stopped_;
+    std::map<boost::filesystem::path, uint64_t>  createdEpochs_;  // the last epoch folder created in each storage
+
+    // statistics, protected by mutex_
+    uint64_t                            trashedFiles_;
+    uint64_t                            deletedFiles_;
+    uint64_t                            failedMoves_;
+    size_t                              pendingEpochs_;
+
+    void ReapEpoch(const boost::filesystem::path& epochFolder);
+
+    void ReapClosedEpochs();
+
+  public:
+    TrashFilesDeleter(unsigned int throttleDelayMs,
+                      unsigned int threadsCount);
+
+    ~TrashFilesDeleter();
+
+    void Start();
+
+    void Stop();
+
+    void ReaperThread();
+
+    void ReaperWorker(const std::vector<boost::filesystem::path>* entries,
+                      boost::atomic<size_t>* next,
+                      size_t storageNumber);
+
+    // Returns false if the file could not be moved to the trash of its storage (e.g. a file outside of
+    // the storages or on another filesystem): it must then be deleted immediately.
+    bool MoveToTrash(const boost::filesystem::path& path,
+                     const boost::filesystem::path& rootPath,
+                     const std::string& uuid);
+
+    void GetStatistics(Json::Value& target);
+
+    static boost::filesystem::path GetTrashFolder(const boost::filesystem::path& rootPath);
+  };
+}
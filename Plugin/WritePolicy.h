@@ -0,0 +1,69 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+
+namespace OrthancPlugins
+{
+  enum WriteCachePolicy
+  {
+    WriteCachePolicy_Buffered,  // the written files stay in the page cache (historical behavior)
+    WriteCachePolicy_DontNeed,  // the pages of the written files are dropped once they are on disk
+    WriteCachePolicy_Direct     // O_DIRECT: the written files never go through the page cache
+  };
+
+
+  // How the files of a storage are written (the cache policies are only implemented on Linux)
+  class WritePolicy
+  {
+    WriteCachePolicy  cachePolicy_;
+    bool              preallocate_;
+
+  public:
+    WritePolicy() :
+      cachePolicy_(WriteCachePolicy_Buffered),
+      preallocate_(false)
+    {
+    }
+
+    WritePolicy(WriteCachePolicy cachePolicy,
+                bool preallocate) :
+      cachePolicy_(cachePolicy),
+      preallocate_(preallocate)
+    {
+    }
+
+    WriteCachePolicy GetCachePolicy() const
+    {
+      return cachePolicy_;
+    }
+
+    // fallocate() the final size of the file before writing it, to get a contiguous allocation
+    bool IsPreallocate() const
+    {
+      return preallocate_;
+    }
+
+    bool IsDefault() const
+    {
+      return cachePolicy_ == WriteCachePolicy_Buffered && !preallocate_;
+    }
+  };
+}
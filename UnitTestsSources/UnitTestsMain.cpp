@@ -0,0 +1,239 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../Plugin/CustomData.h"
+#include "../Plugin/IndexSnapshot.h"
+
+#include <OrthancException.h>
+
+#include <gtest/gtest.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+using namespace OrthancPlugins;
+
+
+static void CheckRoundTrip(bool isOwner,
+                           const std::string& path,
+                           const std::string& storageId)
+{
+  std::string encoded;
+  SerializedCustomData::Encode(encoded, isOwner, path, storageId);
+
+  SerializedCustomData decoded;
+  ASSERT_TRUE(decoded.Decode(encoded.c_str(), encoded.size()));
+  ASSERT_EQ(isOwner, decoded.isOwner_);
+  ASSERT_EQ(path, std::string(decoded.path_ == NULL ? "" : decoded.path_, decoded.pathSize_));
+  ASSERT_EQ(storageId, std::string(decoded.storageId_ == NULL ? "" : decoded.storageId_, decoded.storageIdSize_));
+}
+
+
+TEST(SerializedCustomData, RoundTrip)
+{
+  CheckRoundTrip(true, "", "");
+  CheckRoundTrip(false, "", "");
+  CheckRoundTrip(true, "a/b/c.dcm", "");
+  CheckRoundTrip(false, "/mnt/adopted/d\xc3\xa9j\xc3\xa0.dcm", "");
+  CheckRoundTrip(true, "a/b/c.dcm", "1");
+  CheckRoundTrip(true, "a/b/c.dcm", "42");
+  CheckRoundTrip(true, "a/b/c.dcm", "18446744073709551615");  // too long to be stored as an integer
+  CheckRoundTrip(true, "a/b/c.dcm", "007");                   // not canonical, stored as a string
+  CheckRoundTrip(true, "a/b/c.dcm", "-1");
+  CheckRoundTrip(false, "", "secondary");
+}
+
+
+TEST(SerializedCustomData, TextSafe)
+{
+  // the storage id "0" and the lengths >= 128 must not produce a NUL byte or an invalid UTF-8 sequence
+  const std::string longPath(5000, 'x');
+  const std::string longStorageId(200, 's');
+
+  CheckRoundTrip(true, "a/b/c.dcm", "0");
+  CheckRoundTrip(false, longPath, "0");
+  CheckRoundTrip(true, longPath, longStorageId);
+  CheckRoundTrip(true, std::string(127, 'x'), "31");
+  CheckRoundTrip(true, std::string(128, 'x'), "32");
+  CheckRoundTrip(true, std::string(1024, 'x'), "1023");
+  CheckRoundTrip(true, "a/b/c.dcm", "9999999999999999999");
+
+  std::string encoded;
+  SerializedCustomData::Encode(encoded, false, longPath, "0");
+
+  for (size_t i = 0; i < encoded.size(); i++)
+  {
+    ASSERT_GE(encoded[i], 0x20);
+    ASSERT_LT(encoded[i], 0x7f);
+  }
+
+  SerializedCustomData::Encode(encoded, true, longPath, longStorageId);
+  ASSERT_EQ(std::string::npos, encoded.find('\0'));
+}
+
+
+TEST(SerializedCustomData, NotBinary)
+{
+  SerializedCustomData decoded;
+  ASSERT_FALSE(decoded.Decode("", 0));
+
+  const std::string json = "{\"v\":1,\"o\":true,\"p\":\"a/b/c.dcm\"}";
+  ASSERT_FALSE(decoded.Decode(json.c_str(), json.size()));
+}
+
+
+TEST(SerializedCustomData, Corrupted)
+{
+  std::string encoded;
+  SerializedCustomData::Encode(encoded, true, "a/b/c.dcm", "secondary");
+
+  SerializedCustomData decoded;
+
+  for (size_t size = 1; size < encoded.size(); size++)
+  {
+    ASSERT_THROW(decoded.Decode(encoded.c_str(), size), Orthanc::OrthancException);
+  }
+
+  std::string trailing = encoded + "x";
+  ASSERT_THROW(decoded.Decode(trailing.c_str(), trailing.size()), Orthanc::OrthancException);
+}
+
+
+static IndexSnapshot::Record CreateRecord(size_t i)
+{
+  IndexSnapshot::Record record;
+  record.time_ = static_cast<int64_t>(1000000 + i);
+  record.size_ = static_cast<uint64_t>(i * 7);
+  record.isDicom_ = (i % 3 != 0);
+  record.hasBeenDeletedByOrthanc_ = (i % 5 == 0);
+  return record;
+}
+
+
+static std::string GetPath(size_t i)
+{
+  return "/mnt/indexed/" + boost::lexical_cast<std::string>(i % 97) + "/" + boost::lexical_cast<std::string>(i) + ".dcm";
+}
+
+
+TEST(IndexSnapshot, StoreAndRemove)
+{
+  IndexSnapshot snapshot(IndexSnapshot::Mode_Full);
+
+  IndexSnapshot::Record record;
+  ASSERT_EQ(IndexSnapshot::Lookup_Unknown, snapshot.Find(record, GetPath(0), false));
+
+  snapshot.BeginLoading();
+  snapshot.EndLoading();
+  ASSERT_TRUE(snapshot.IsLoaded());
+
+  // enough entries to grow the table several times
+  static const size_t COUNT = 20000;
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    snapshot.Store(GetPath(i), CreateRecord(i));
+  }
+
+  ASSERT_EQ(COUNT, snapshot.GetCount());
+
+  // removing the entries shifts the colliding ones backwards: they must all remain reachable
+  for (size_t i = 0; i < COUNT; i += 3)
+  {
+    snapshot.Remove(GetPath(i));
+  }
+
+  snapshot.Remove("/mnt/indexed/nope.dcm");
+
+  size_t count = 0;
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    if (i % 3 == 0)
+    {
+      ASSERT_EQ(IndexSnapshot::Lookup_Absent, snapshot.Find(record, GetPath(i), false));
+    }
+    else
+    {
+      count++;
+
+      ASSERT_EQ(IndexSnapshot::Lookup_Present, snapshot.Find(record, GetPath(i), false));
+
+      const IndexSnapshot::Record expected = CreateRecord(i);
+      ASSERT_EQ(expected.time_, record.time_);
+      ASSERT_EQ(expected.size_, record.size_);
+      ASSERT_EQ(expected.isDicom_, record.isDicom_);
+      ASSERT_EQ(expected.hasBeenDeletedByOrthanc_, record.hasBeenDeletedByOrthanc_);
+    }
+  }
+
+  ASSERT_EQ(count, snapshot.GetCount());
+
+  // the removed entries can be stored again
+  for (size_t i = 0; i < COUNT; i += 3)
+  {
+    snapshot.Store(GetPath(i), CreateRecord(i + 1));
+  }
+
+  ASSERT_EQ(COUNT, snapshot.GetCount());
+  ASSERT_EQ(IndexSnapshot::Lookup_Present, snapshot.Find(record, GetPath(3), false));
+  ASSERT_EQ(CreateRecord(4).time_, record.time_);
+}
+
+
+TEST(IndexSnapshot, BloomFilter)
+{
+  IndexSnapshot snapshot(IndexSnapshot::Mode_BloomFilter);
+
+  static const size_t COUNT = 10000;
+
+  snapshot.BeginLoading();
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    snapshot.AddLoaded(GetPath(i), CreateRecord(i));
+  }
+  snapshot.EndLoading();
+
+  // no false negative: the indexed files are always looked up in the key-value store
+  IndexSnapshot::Record record;
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    ASSERT_EQ(IndexSnapshot::Lookup_Unknown, snapshot.Find(record, GetPath(i), false));
+  }
+
+  size_t falsePositives = 0;
+  for (size_t i = COUNT; i < 2 * COUNT; i++)
+  {
+    if (snapshot.Find(record, GetPath(i), false) == IndexSnapshot::Lookup_Unknown)
+    {
+      falsePositives++;
+    }
+  }
+
+  // about 1% with 10 bits per entry
+  ASSERT_LT(falsePositives, COUNT / 20);
+}
+
+
+int main(int argc, char **argv)
+{
+  // no plugin context: the logs of the plugin are discarded
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}